@@ -0,0 +1,40 @@
+#pragma once
+#include "EncoderAPI.h"
+#include <chrono>
+
+namespace DX12VideoEncoding
+{
+
+struct DeviceSchedulerConfiguration
+{
+    uint32_t encodeQueueCount{ 1 };
+    uint32_t copyQueueCount{ 1 };
+
+    // Limit of command lists passed to one ExecuteCommandLists() call.
+    uint32_t maxCommandListsPerSubmission{ 16 };
+
+    // Time to collect command lists from other sessions before the submission, 0 - submit immediately.
+    std::chrono::microseconds batchingInterval{ 0 };
+};
+
+// Shares a small set of command queues of the device between many encoder sessions.
+// Command lists of the sessions are submitted in batches, sessions with higher priority get
+// a proportionally larger share of each batch. Fences of all queues are waited by one thread.
+class IDeviceScheduler
+{
+public:
+    struct Statistics
+    {
+        uint64_t submittedCommandLists{};
+        uint64_t executeCalls{};
+    };
+
+    virtual ~IDeviceScheduler() = default;
+    virtual Statistics GetStatistics() const = 0;
+};
+
+std::shared_ptr<IDeviceScheduler> CreateDeviceScheduler(
+    const Microsoft::WRL::ComPtr<ID3D12Device>& device,
+    const DeviceSchedulerConfiguration& config);
+
+}
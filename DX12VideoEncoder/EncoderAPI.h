@@ -1,32 +1,144 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <memory>
+#include <string>
+#include <chrono>
 #include <d3d12.h>
 #include <wrl.h>
 
 namespace DX12VideoEncoding
 {
 
+enum class PixelFormat : uint32_t
+{
+    NV12 = 0,
+    YUV420P,   // 3 planes, limited range
+    YUVJ420P,  // 3 planes, full range, it is compressed to limited range
+    YUV422P,
+    P010,      // 2 planes, 16 bits per sample with the value in the high 10 bits
+    BGRA,      // Converted with BT.601 limited range matrix
+    YUV420P10, // 3 planes, 16 bits per sample with the value in the low 10 bits
+};
+
+constexpr int64_t NoTimestamp = INT64_MIN;
+
+struct FramePlane
+{
+    const uint8_t* data{};
+    size_t pitch{};
+    uint32_t height{}; // rows
+};
+
+enum class FrameOwnership : uint32_t
+{
+    Shared = 0, // Planes stay valid while the encoder holds a reference to the frame
+    Borrowed,   // Planes are valid only during PushFrame(), the encoder copies them
+};
+
+// Area of the frame encoded with QP changed by deltaQP, negative values spend more bits on it.
+struct RegionOfInterest
+{
+    uint32_t left{};
+    uint32_t top{};
+    uint32_t width{};
+    uint32_t height{};
+    int32_t deltaQP{};
+};
+
+// Native layout of the producer frame, it's converted to the encoder input format while uploading.
+struct FrameDescriptor
+{
+    PixelFormat format{ PixelFormat::NV12 };
+    uint32_t width{};
+    uint32_t height{};
+    uint32_t planeCount{};
+    FramePlane planes[3]{};
+    FrameOwnership ownership{ FrameOwnership::Shared };
+
+    // Presentation timestamp in EncoderConfiguration::timeBase units, frames without it follow the previous one.
+    int64_t timestamp{ NoTimestamp };
+
+    // When the frame was produced, for the latency reported with the encoded frame. Default - PushFrame() call time.
+    std::chrono::steady_clock::time_point captureTime{};
+
+    // Used if EncoderConfiguration::enableRegionsOfInterest is set, valid as long as the planes.
+    // Overlapping regions take the delta of the last one.
+    const RegionOfInterest* regionsOfInterest{};
+    uint32_t regionOfInterestCount{};
+};
+
+// Mapped planes of the encoder input buffer.
+struct FrameUploadBuffer
+{
+    DXGI_FORMAT format{ DXGI_FORMAT_NV12 };
+    uint8_t* y{};
+    size_t linesizeY{};
+    uint8_t* uv{};
+    size_t linesizeUV{};
+};
+
 class IRawFrameData
 {
 public:
     virtual ~IRawFrameData() = default;
-    virtual void* GetY() const = 0;
-    virtual void* GetUV() const = 0;
-    virtual size_t GetLinesizeY() const = 0;
-    virtual size_t GetLinesizeUV() const = 0;
-    virtual uint32_t GetWidth() const = 0;
-    virtual uint32_t GetHeight() const = 0;
+    virtual FrameDescriptor GetDescriptor() const = 0;
+
+    // Lets the frame write itself straight into the encoder input buffer instead of being converted
+    // from the descriptor planes, returns false if the frame has no own way to write itself.
+    virtual bool WriteTo(const FrameUploadBuffer& /*destination*/) const { return false; }
 };
 
 using RawFrameData = std::shared_ptr<IRawFrameData>;
 
+// Slice NAL unit in EncodedFrame::encodedData, starting with its start code.
+struct EncodedSlice
+{
+    size_t offset{};
+    size_t size{};
+};
+
+// Steps of the frame from the capture to the bitstream read back by WaitForEncodedFrame().
+struct FrameLatency
+{
+    std::chrono::microseconds queueing{};  // From the capture to the start of encoding: lookahead, reordering, batching
+    std::chrono::microseconds encoding{};  // From the start of encoding to the encoded data read back
+    std::chrono::microseconds total{};
+};
+
+// UUID of the user_data_unregistered SEI written before each frame if EncoderConfiguration::enableTimingSEI is set.
+// The payload following it holds big-endian 64-bit EncodedFrame::pictureOrderCountNumber, the capture time and
+// the start of encoding, both in microseconds since the Unix epoch.
+constexpr uint8_t TimingSEIUuid[16] = {
+    0x6b, 0x1f, 0x5e, 0x2a, 0x93, 0xc4, 0x4d, 0x57, 0xa0, 0x3e, 0x81, 0xd2, 0x7c, 0x45, 0xf9, 0x16 };
+
 struct EncodedFrame
 {
     std::vector<uint8_t> encodedData;
     uint64_t pictureOrderCountNumber = 0;
     uint64_t decodingOrderNumber = 0;
+    // Timestamps in EncoderConfiguration::timeBase units. The decoding ones are the presentation ones
+    // delayed by the reordering depth, the first frames of a stream with B-frames get them below the first pts.
+    int64_t timestamp = 0;
+    int64_t decodingTimestamp = 0;
     bool isKeyFrame = false;
+    // Decoding can start at the frame, the picture is complete after the recovery point SEI frame count.
+    bool isRecoveryPoint = false;
+    // Slices in coding order, the bytes before the first one are parameter sets.
+    // With temporal layers each slice starts with its prefix NAL unit.
+    std::vector<EncodedSlice> slices;
+    // Frames of the higher layers can be dropped, see EncoderConfiguration::temporalLayerCount.
+    uint32_t temporalLayerIndex = 0;
+    FrameLatency latency;
+};
+
+// Totals since the encoder creation or the last reset.
+struct EncoderStatistics
+{
+    uint64_t encodedFrameCount = 0;
+    uint64_t encodedBytes = 0;
+    std::chrono::microseconds averageLatency{};
+    std::chrono::microseconds maxLatency{};
 };
 
 class IEncoder
@@ -38,6 +150,54 @@ public:
     virtual bool WaitForEncodedFrame(EncodedFrame& encodedFrame) = 0;
     virtual void Flush() = 0;
     virtual void Terminate() = 0;
+    virtual EncoderStatistics GetStatistics() const = 0;
+
+    // Loss recovery for real-time streaming, e.g. on PLI or NACK of the receiver.
+    // The next pushed frame is encoded as an IDR frame.
+    virtual void RequestKeyFrame() = 0;
+    // Frames of the EncodedFrame::pictureOrderCountNumber range are lost, the next P-frame references only
+    // an intact older frame, or becomes an IDR frame if there is none in the DPB.
+    virtual void InvalidateReferences(uint64_t firstPictureOrderCountNumber, uint64_t lastPictureOrderCountNumber) = 0;
+    // Keeps a started reference frame, e.g. one acknowledged by the receiver, as long-term reference: it stays in
+    // the DPB after the sliding window passes it and recovers InvalidateReferences() without an IDR frame.
+    // The marking is written by the next reference frame, the oldest long-term frame is replaced if all are used.
+    // Returns false if long-term references are disabled or the frame is not a short-term reference anymore.
+    virtual bool MarkLongTermReference(uint64_t pictureOrderCountNumber) = 0;
+};
+
+class IDeviceScheduler;
+class WorkerPool;
+
+enum class H264Profile : uint32_t
+{
+    Auto = 0, // The highest profile supported by the device.
+    Main,
+    High,
+    High10, // Requires P010 input
+};
+
+enum class SliceMode : uint32_t
+{
+    FullFrame = 0,
+    MacroblockRows, // EncoderConfiguration::sliceSize rows of macroblocks per slice
+    Bytes,          // Slices are ended before exceeding EncoderConfiguration::sliceSize bytes
+};
+
+// Signalled in VUI for players, frames are not converted. Codes of ITU-T H.273, which FFmpeg AVColorPrimaries,
+// AVColorTransferCharacteristic and AVColorSpace use too. 2 - unspecified.
+struct ColorDescription
+{
+    uint8_t primaries{ 2 };
+    uint8_t transferCharacteristics{ 2 };
+    uint8_t matrixCoefficients{ 2 };
+    bool fullRange{ false }; // Only for NV12 and P010 input, other YUV formats are compressed to limited range
+};
+
+enum class EncodingPass : uint32_t
+{
+    Single = 0,
+    First,  // Records statistics of the frames to EncoderConfiguration::passStatisticsFile
+    Second, // Adapts QP to the statistics recorded by the first pass over the same input and configuration
 };
 
 struct EncoderConfiguration
@@ -45,16 +205,116 @@ struct EncoderConfiguration
     uint32_t width{};
     uint32_t height{};
 
+    // NV12 or P010, 10-bit input is encoded in High10 profile.
+    DXGI_FORMAT inputFormat{ DXGI_FORMAT_NV12 };
+
     struct {
         uint32_t numerator;
         uint32_t denominator;
     } fps;
 
+    // Units of the frame timestamps, 0/0 - frame durations, i.e. 1/fps.
+    struct {
+        uint32_t numerator;
+        uint32_t denominator;
+    } timeBase{};
+
+    // Pixel aspect ratio signalled in VUI, 0:0 - unspecified.
+    struct {
+        uint32_t width;
+        uint32_t height;
+    } sampleAspectRatio{};
+    ColorDescription colorDescription;
+
     uint32_t keyFrameInterval{}; // 0 - infinite GOP
     uint32_t bFramesCount{}; // amount of B-frames between I/P frames
+    // GOPs after the first one start with I-frames keeping the DPB, so B-frames before them in display order
+    // reference both GOPs, which saves bits at every GOP boundary. Decoding can start at the I-frames marked with
+    // recovery point SEI, skipping their leading B-frames. Scene cuts and key frame requests start closed GOPs.
+    bool enableOpenGop{ false };
     uint32_t maxReferenceFrameCount{};
+    // Long-term reference frames kept in the DPB on top of maxReferenceFrameCount short-term ones, see
+    // IEncoder::MarkLongTermReference(). Limited by the device, not used with B-frames.
+    uint32_t maxLongTermReferenceFrameCount{};
+
+    // Temporal scalability, 1 - 3 layers (L1T1 - L1T3): the frame rate halves with each dropped upper layer.
+    // Frames reference only the lower or the same layer, the top layer is not referenced. Each slice is preceded by
+    // an SVC prefix NAL unit with its temporal_id, so a forwarding server can drop layers without parsing slices.
+    // Requires no B-frames and maxReferenceFrameCount of at least temporalLayerCount - 1.
+    uint32_t temporalLayerCount{ 1 };
+
+    // Gradual decoder refresh to avoid bitrate spikes of IDR frames, used with keyFrameInterval 0 it leaves
+    // the first frame the only IDR one. Each frame intra codes the next band of macroblock rows, a wave of
+    // intraRefreshPeriod frames refreshes the whole picture. Waves run back to back from each IDR frame and start
+    // with a recovery point SEI. Requires no B-frames and temporal layers, ignored if the device doesn't support it.
+    uint32_t intraRefreshPeriod{};
+
+    // Scene cuts found by comparing luma of consecutive frames are encoded as IDR frames starting a new GOP.
+    bool enableSceneCutDetection{ false };
+    // Number of B-frames between I/P frames is chosen from 0 to bFramesCount by motion estimated on
+    // the next bFramesCount + 1 frames, which are held before encoding. Fewer B-frames are used with high motion.
+    bool enableAdaptiveBFrames{ false };
+
+    // Frames recorded into one GPU submission, larger batches reduce submission overhead for offline encoding
+    // at the cost of latency. Up to twice this amount of frames can be started before waiting for encoded ones:
+    // the next batch is recorded while the previous one is encoded.
+    uint32_t framesPerSubmission{ 1 };
+
+    // Interactive streaming: frames are encoded in the input order without B-frames and batching, parameter sets
+    // are written only before IDR frames. Set by ApplyLowLatencyPreset(), other options must not contradict it.
+    bool lowLatency{ false };
+
+    // In-band timing to measure the latency on the receiver side: each frame is preceded by a user_data_unregistered
+    // SEI with TimingSEIUuid and a picture timing SEI with the presentation timestamp.
+    // Buffering period SEI is not written, constant QP streams have no HRD parameters it would refer to.
+    bool enableTimingSEI{ false };
+
+    H264Profile profile{ H264Profile::Auto };
+
+    // Coding tools are enabled only if the device supports them for the selected profile.
+    bool enableCabac{ true };
+    bool enableAdaptive8x8Transform{ true }; // High profile only
+    bool enableDirectModes{ true }; // Spatial direct prediction is preferred over temporal one
+
+    // Slices bound the packet sizes and the damage of lost packets, at the cost of compression.
+    // Frames are encoded as one slice if the device doesn't support the mode.
+    SliceMode sliceMode{ SliceMode::FullFrame };
+    uint32_t sliceSize{};
+
+    // Constant QP rate control: QP of I-frames, P- and B-frames get the offsets added. QPs are clamped to 0 - 51.
+    uint32_t qp{ 30 };
+    int32_t pFrameQPOffset{};
+    int32_t bFrameQPOffset{};
+    // QP of each frame follows its complexity relative to the neighbour frames: complex frames mask distortion
+    // and get higher QP, simple ones get lower QP. Applied only if the device supports rate control changes.
+    bool enableAdaptiveQP{ false };
+    // Frames held back after PushFrame() before they are queued for encoding, so QP of each started frame is compared
+    // with the analysis of that many future frames in addition to the B-frames waiting for their reference.
+    // Works with and without B-frames, up to 12 future frames are compared. Key frame requests apply to the next
+    // pushed frame, so they are started the same number of frames later. Not allowed in the low-latency mode.
+    uint32_t lookaheadDepth{};
+    EncodingPass encodingPass{ EncodingPass::Single };
+    std::wstring passStatisticsFile{};
+
+    // Per-block QP offsets, applied only if the device supports delta QP maps. Adaptive quantization lowers QP
+    // of flat blocks and raises it in detailed ones by luma variance, regions of interest of the frames are added on top.
+    bool enableAdaptiveQuantization{ false };
+    bool enableRegionsOfInterest{ false };
+
+    // File to persist device capabilities between runs, empty - keep them in memory only.
+    std::wstring capabilityCacheFile{};
+
+    // Command queues shared with other sessions on the device, by default the encoder creates own queues.
+    std::shared_ptr<IDeviceScheduler> scheduler{};
+    uint32_t schedulingPriority{}; // Higher priority gets larger share of the shared queues
+
+    // Threads copying frames to the upload buffers, by default frames are copied on the calling thread.
+    std::shared_ptr<WorkerPool> workerPool{};
 };
 
+// Configures the low-latency mode keeping the rest of the configuration.
+void ApplyLowLatencyPreset(EncoderConfiguration& config);
+
 std::unique_ptr<IEncoder> CreateH264Encoder(
     const Microsoft::WRL::ComPtr<ID3D12Device>& device,
     const EncoderConfiguration&);
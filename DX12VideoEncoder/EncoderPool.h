@@ -0,0 +1,111 @@
+#pragma once
+#include "EncoderAPI.h"
+#include <list>
+#include <mutex>
+
+namespace DX12VideoEncoding
+{
+
+// Keeps idle encoder sessions to reuse them by the following jobs with compatible configuration,
+// instead of creating all DX12 objects and resources from scratch.
+class EncoderPool
+{
+public:
+    // Creates and resets actual sessions, can be replaced by a fake one to check the pool logic.
+    class IBackend
+    {
+    public:
+        virtual ~IBackend() = default;
+        virtual std::unique_ptr<IEncoder> CreateEncoder(const EncoderConfiguration& config) = 0;
+        // Brings the session to the initial state with new configuration having the same key.
+        virtual void ResetEncoder(IEncoder& encoder, const EncoderConfiguration& config) = 0;
+        // Estimated size of GPU memory allocated by the session.
+        virtual uint64_t GetMemoryUsage(const IEncoder& encoder) const = 0;
+    };
+
+    // Sessions can be reused only if their resources and DX12 encoder objects match.
+    struct Key
+    {
+        uint32_t width{};
+        uint32_t height{};
+        DXGI_FORMAT format{ DXGI_FORMAT_NV12 };
+        H264Profile profile{ H264Profile::Auto };
+        uint32_t maxReferenceFrameCount{};
+        uint32_t maxLongTermReferenceFrameCount{};
+        uint32_t framesPerSubmission{};
+        bool enableCabac{};
+        bool enableAdaptive8x8Transform{};
+        bool useDirectModes{};
+        const IDeviceScheduler* scheduler{};
+
+        static Key FromConfiguration(const EncoderConfiguration& config);
+
+        auto operator<=>(const Key&) const = default;
+    };
+
+    struct Statistics
+    {
+        uint64_t reusedSessions{};
+        uint64_t createdSessions{};
+        uint64_t evictedSessions{};
+    };
+
+    // Returns the session to the pool when the encoder is destroyed.
+    class Releaser
+    {
+    public:
+        Releaser() = default;
+        Releaser(EncoderPool* pool, const Key& key, uint64_t memoryUsage);
+        void operator()(IEncoder* encoder) const;
+
+    private:
+        EncoderPool* m_pool{};
+        Key m_key;
+        uint64_t m_memoryUsage{};
+    };
+
+    // The pool should outlive all acquired encoders.
+    using PooledEncoder = std::unique_ptr<IEncoder, Releaser>;
+
+    // Idle sessions are evicted in the least recently used order while memory used by all sessions exceeds the budget.
+    EncoderPool(std::unique_ptr<IBackend> backend, uint64_t memoryBudget);
+    ~EncoderPool();
+
+    EncoderPool(const EncoderPool&) = delete;
+    EncoderPool& operator=(const EncoderPool&) = delete;
+
+    PooledEncoder Acquire(const EncoderConfiguration& config);
+
+    // Destroys all idle sessions.
+    void Clear();
+
+    size_t GetIdleSessionCount() const;
+    uint64_t GetMemoryUsage() const;
+    Statistics GetStatistics() const;
+
+private:
+    void Release(const Key& key, std::unique_ptr<IEncoder> encoder, uint64_t memoryUsage);
+    void EvictOverBudget(std::list<std::unique_ptr<IEncoder>>& evicted);
+
+private:
+    struct IdleSession
+    {
+        Key key;
+        std::unique_ptr<IEncoder> encoder;
+        uint64_t memoryUsage{};
+    };
+
+    const std::unique_ptr<IBackend> m_backend;
+    const uint64_t m_memoryBudget;
+
+    mutable std::mutex m_mutex;
+    std::list<IdleSession> m_idleSessions; // The most recently used first.
+    uint64_t m_idleMemoryUsage = 0;
+    uint64_t m_activeMemoryUsage = 0;
+    Statistics m_statistics;
+};
+
+std::unique_ptr<EncoderPool::IBackend> CreateH264EncoderPoolBackend(
+    const Microsoft::WRL::ComPtr<ID3D12Device>& device);
+
+}
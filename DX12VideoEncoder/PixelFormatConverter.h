@@ -0,0 +1,30 @@
+#pragma once
+#include "EncoderAPI.h"
+
+namespace DX12VideoEncoding
+{
+
+class WorkerPool;
+
+uint32_t GetPlaneCount(PixelFormat format);
+// Bytes of one row of the plane, the chroma planes are half width for all subsampled formats.
+size_t GetPlaneRowSize(PixelFormat format, uint32_t plane, uint32_t width);
+// Rows of the plane, the chroma planes are half height for 4:2:0 formats.
+uint32_t GetPlaneHeight(PixelFormat format, uint32_t plane, uint32_t height);
+
+// NV12 destination accepts all 8-bit formats and P010 (rounded to 8 bits),
+// P010 destination accepts 10-bit formats only.
+bool IsConversionSupported(PixelFormat sourceFormat, DXGI_FORMAT destinationFormat);
+
+enum class ConversionKernels : uint32_t
+{
+    Best = 0, // AVX2 or NEON if available
+    Scalar,   // Reference for the SIMD ones, they produce exactly the same result
+};
+
+// Converts the frame to the destination format, rows are split between the pool threads when the pool is given.
+// Destination planes may point to mapped GPU memory.
+void ConvertImage(const FrameDescriptor& source, const FrameUploadBuffer& destination, WorkerPool* workerPool = nullptr,
+    ConversionKernels kernelSet = ConversionKernels::Best);
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace DX12VideoEncoding
+{
+
+class WorkerPool;
+
+// Copies rows of an image plane. Destination can be write-combined memory of an upload heap,
+// it's written with non-temporal stores bypassing the cache. Planes with equal pitches are copied
+// as one block. Rows are split between the pool threads when the pool is given.
+void CopyPlane(const uint8_t* source, size_t sourcePitch,
+    uint8_t* destination, size_t destinationPitch,
+    size_t rowSize, uint32_t rowCount, WorkerPool* workerPool = nullptr);
+
+}
@@ -6,6 +6,9 @@ namespace DX12VideoEncoding {
 void ThrowIfFailed(HRESULT hr);
 void ThrowIfFalse(bool condition);
 
+// Size of GPU memory occupied by the resource.
+UINT64 GetAllocationSize(ID3D12Device* device, ID3D12Resource* resource);
+
 enum class LogLevel : int
 {
     E_ERROR = 0,
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DX12VideoEncoding
+{
+
+// Threads splitting CPU work of frames (pixel conversion, upload) into parallel tasks.
+// One pool can be shared by many encoder sessions, their jobs are processed in order of arrival.
+class WorkerPool
+{
+public:
+    using TTask = std::function<void(uint32_t taskIndex)>;
+
+    // 0 - a thread per logical processor except the calling one.
+    explicit WorkerPool(uint32_t threadCount = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+    // Runs task(0) ... task(taskCount - 1) on the pool threads and the calling thread,
+    // returns when all of them are finished. Rethrows the first exception thrown by the tasks.
+    void ParallelFor(uint32_t taskCount, const TTask& task);
+
+private:
+    struct Job
+    {
+        const TTask* task{};
+        uint32_t taskCount{};
+        std::atomic<uint32_t> nextTask{};
+        std::atomic<uint32_t> finishedTasks{};
+        std::exception_ptr error;
+    };
+
+    void ThreadProc();
+    // Returns false when there are no tasks left in the job.
+    bool RunNextTask(Job& job);
+
+private:
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobAdded;
+    std::condition_variable m_jobFinished;
+    std::deque<std::shared_ptr<Job>> m_jobs;
+    bool m_stopping = false;
+};
+
+}
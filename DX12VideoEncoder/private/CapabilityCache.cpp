@@ -0,0 +1,230 @@
+#include "pch.h"
+#include "CapabilityCache.h"
+#include "Utils.h"
+#include "QPController.h"
+
+
+namespace DX12VideoEncoding {
+
+using Microsoft::WRL::ComPtr;
+
+namespace {
+
+constexpr uint32_t CacheFileMagic = 0x43433344; // "D3CC"
+// Increment on any change of EncoderCapabilities or of the key derivation.
+constexpr uint32_t CacheFileVersion = 4;
+
+struct CacheFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entrySize;
+    uint32_t entryCount;
+};
+
+struct CacheFileEntry
+{
+    CapabilityCache::Key key;
+    EncoderCapabilities capabilities;
+};
+
+class Fnv1aHash
+{
+public:
+    template <typename T>
+    void Add(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+        for (size_t i = 0; i < sizeof(T); ++i)
+        {
+            m_hash ^= bytes[i];
+            m_hash *= 0x100000001B3ull;
+        }
+    }
+
+    uint64_t Get() const { return m_hash; }
+
+private:
+    uint64_t m_hash = 0xCBF29CE484222325ull;
+};
+
+uint64_t ToUint64(LUID luid)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(luid.HighPart)) << 32) | luid.LowPart;
+}
+
+}
+
+CapabilityCache& CapabilityCache::Instance()
+{
+    static CapabilityCache instance;
+    return instance;
+}
+
+CapabilityCache::Key CapabilityCache::MakeKey(ID3D12Device* device,
+    const EncoderConfiguration& config,
+    DXGI_FORMAT inputFormat)
+{
+    // All inputs of the capability queries are hashed, including the CQP values of the support query.
+    Fnv1aHash hash;
+    hash.Add(config.width);
+    hash.Add(config.height);
+    hash.Add(config.fps.numerator);
+    hash.Add(config.fps.denominator);
+    hash.Add(config.keyFrameInterval);
+    hash.Add(config.bFramesCount);
+    hash.Add(config.enableOpenGop);
+    hash.Add(config.maxReferenceFrameCount);
+    hash.Add(config.maxLongTermReferenceFrameCount);
+    hash.Add(config.profile);
+    hash.Add(config.enableCabac);
+    hash.Add(config.enableAdaptive8x8Transform);
+    hash.Add(config.enableDirectModes);
+    hash.Add(config.sliceMode);
+    hash.Add(config.intraRefreshPeriod > 0);
+    hash.Add(QPController::GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME));
+    hash.Add(QPController::GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME));
+    hash.Add(QPController::GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME));
+    hash.Add(inputFormat);
+
+    Key key;
+    key.adapterLuid = ToUint64(device->GetAdapterLuid());
+    key.driverVersion = GetDriverVersion(device);
+    key.configurationHash = hash.Get();
+    return key;
+}
+
+std::optional<EncoderCapabilities> CapabilityCache::Find(const Key& key)
+{
+    std::lock_guard lock(m_mutex);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void CapabilityCache::Insert(const Key& key, const EncoderCapabilities& capabilities)
+{
+    std::lock_guard lock(m_mutex);
+    m_entries[key] = capabilities;
+}
+
+void CapabilityCache::LoadFromFile(const std::wstring& path)
+{
+    std::lock_guard lock(m_mutex);
+    if (!m_loadedFiles.insert(path).second)
+    {
+        return;
+    }
+
+    std::ifstream file(std::filesystem::path(path), std::ios::binary);
+    if (!file)
+    {
+        // No cache yet.
+        return;
+    }
+
+    CacheFileHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != CacheFileMagic || header.version != CacheFileVersion
+        || header.entrySize != sizeof(CacheFileEntry))
+    {
+        LogMessage(LogLevel::E_WARNING, "Capability cache file is invalid or outdated, ignoring it");
+        return;
+    }
+
+    std::vector<CacheFileEntry> entries(header.entryCount);
+    file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(CacheFileEntry));
+    if (!file)
+    {
+        LogMessage(LogLevel::E_WARNING, "Capability cache file is truncated, ignoring it");
+        return;
+    }
+
+    for (const auto& entry : entries)
+    {
+        // Entries probed in the current process take precedence.
+        m_entries.emplace(entry.key, entry.capabilities);
+    }
+
+    LogMessage(LogLevel::E_DEBUG, "Loaded " + std::to_string(entries.size()) + " capability cache entries");
+}
+
+void CapabilityCache::SaveToFile(const std::wstring& path)
+{
+    std::lock_guard lock(m_mutex);
+
+    std::vector<CacheFileEntry> entries;
+    entries.reserve(m_entries.size());
+    for (const auto& [key, capabilities] : m_entries)
+    {
+        entries.push_back({ key, capabilities });
+    }
+
+    CacheFileHeader header{};
+    header.magic = CacheFileMagic;
+    header.version = CacheFileVersion;
+    header.entrySize = sizeof(CacheFileEntry);
+    header.entryCount = static_cast<uint32_t>(entries.size());
+
+    // Write to a temporary file first, so a concurrently started process never reads a partial cache.
+    const std::filesystem::path filePath(path);
+    std::filesystem::path tempPath = filePath;
+    tempPath += L".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(CacheFileEntry));
+        if (!file)
+        {
+            LogMessage(LogLevel::E_WARNING, "Failed to write capability cache file");
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, filePath, error);
+    if (error)
+    {
+        LogMessage(LogLevel::E_WARNING, "Failed to replace capability cache file: " + error.message());
+        std::filesystem::remove(tempPath, error);
+    }
+}
+
+uint64_t CapabilityCache::GetDriverVersion(ID3D12Device* device)
+{
+    const uint64_t luid = ToUint64(device->GetAdapterLuid());
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = m_driverVersions.find(luid);
+        if (it != m_driverVersions.end())
+        {
+            return it->second;
+        }
+    }
+
+    // The driver version is a part of the key, so entries become stale after a driver update.
+    uint64_t driverVersion = 0;
+    ComPtr<IDXGIFactory4> factory;
+    ComPtr<IDXGIAdapter> adapter;
+    LARGE_INTEGER umdVersion{};
+    if (SUCCEEDED(CreateDXGIFactory1(IID_PPV_ARGS(&factory)))
+        && SUCCEEDED(factory->EnumAdapterByLuid(device->GetAdapterLuid(), IID_PPV_ARGS(&adapter)))
+        && SUCCEEDED(adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umdVersion)))
+    {
+        driverVersion = static_cast<uint64_t>(umdVersion.QuadPart);
+    }
+    else
+    {
+        LogMessage(LogLevel::E_WARNING, "Failed to query the driver version");
+    }
+
+    std::lock_guard lock(m_mutex);
+    m_driverVersions[luid] = driverVersion;
+    return driverVersion;
+}
+
+}
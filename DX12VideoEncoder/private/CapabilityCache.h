@@ -0,0 +1,63 @@
+#pragma once
+#include "EncoderAPI.h"
+
+namespace DX12VideoEncoding
+{
+
+// Results of the device capability queries needed to create an encoder session.
+// The structure is persisted to the cache file as is, so it has to stay trivially copyable.
+struct EncoderCapabilities
+{
+    D3D12_VIDEO_ENCODER_PROFILE_H264 profile;
+    D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264 codecConfiguration;
+    D3D12_VIDEO_ENCODER_LEVELS_H264 maxLevel;
+    UINT maxLongTermReferences;
+    D3D12_VIDEO_ENCODER_SUPPORT_FLAGS supportFlags;
+    D3D12_FEATURE_DATA_VIDEO_ENCODER_RESOLUTION_SUPPORT_LIMITS resolutionLimits;
+    D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE subregionMode; // Full frame if the requested one is not supported
+    D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE intraRefreshMode; // None if not requested or not supported
+    UINT compressedBitstreamBufferAccessAlignment;
+    UINT encoderMetadataBufferAccessAlignment;
+    UINT maxEncoderOutputMetadataBufferSize;
+};
+
+static_assert(std::is_trivially_copyable_v<EncoderCapabilities>);
+
+// Process wide cache of encoder capabilities, so creating a session with already seen configuration
+// doesn't need to query the driver again. Optionally the cache is persisted to a file between runs.
+class CapabilityCache
+{
+public:
+    struct Key
+    {
+        uint64_t adapterLuid{};
+        uint64_t driverVersion{};
+        uint64_t configurationHash{};
+
+        auto operator<=>(const Key&) const = default;
+    };
+
+    static CapabilityCache& Instance();
+
+    Key MakeKey(ID3D12Device* device, const EncoderConfiguration& config, DXGI_FORMAT inputFormat);
+
+    std::optional<EncoderCapabilities> Find(const Key& key);
+    void Insert(const Key& key, const EncoderCapabilities& capabilities);
+
+    // Loading is done once per file, invalid or outdated files are ignored.
+    void LoadFromFile(const std::wstring& path);
+    void SaveToFile(const std::wstring& path);
+
+private:
+    CapabilityCache() = default;
+
+    uint64_t GetDriverVersion(ID3D12Device* device);
+
+private:
+    std::mutex m_mutex;
+    std::map<Key, EncoderCapabilities> m_entries;
+    std::map<uint64_t, uint64_t> m_driverVersions;
+    std::set<std::wstring> m_loadedFiles;
+};
+
+}
@@ -0,0 +1,78 @@
+#include "pch.h"
+#include "CommandSubmitter.h"
+#include "Utils.h"
+
+
+namespace DX12VideoEncoding {
+
+bool WaitForEventOrTermination(HANDLE event, HANDLE terminateEvent)
+{
+    HANDLE events[] = { event, terminateEvent };
+    const DWORD eventCount = terminateEvent != nullptr ? 2 : 1;
+    DWORD result = WaitForMultipleObjects(eventCount, events, FALSE, INFINITE);
+    if (result == WAIT_OBJECT_0)
+    {
+        return true;
+    }
+    else if (result == WAIT_OBJECT_0 + 1)
+    {
+        // Terminated
+        return false;
+    }
+    else
+        throw std::runtime_error("WaitForMultipleObjects() failed: " + std::to_string(GetLastError()));
+}
+
+DedicatedCommandQueue::DedicatedCommandQueue(const ComPtr<ID3D12Device>& device, D3D12_COMMAND_LIST_TYPE type)
+{
+    D3D12_COMMAND_QUEUE_DESC commandQueueDesc = { type };
+    ThrowIfFailed(device->CreateCommandQueue(
+        &commandQueueDesc,
+        IID_PPV_ARGS(&m_commandQueue)));
+
+    ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence)));
+    m_completedEvent.Attach(CreateEvent(NULL, FALSE, FALSE, nullptr));
+}
+
+DedicatedCommandQueue::~DedicatedCommandQueue()
+{
+    // Command lists and resources are released by the owner right after this.
+    if (m_lastSubmission)
+    {
+        WaitForCompletion(m_lastSubmission, nullptr);
+    }
+}
+
+SubmissionHandle DedicatedCommandQueue::Submit(const std::vector<ID3D12CommandList*>& commandLists,
+    const std::vector<SubmissionHandle>& dependencies)
+{
+    for (const auto& dependency : dependencies)
+    {
+        assert(dependency->IsSubmitted());
+        ThrowIfFailed(m_commandQueue->Wait(dependency->fence, dependency->fenceValue));
+    }
+
+    m_commandQueue->ExecuteCommandLists(static_cast<UINT>(commandLists.size()), commandLists.data());
+    ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), ++m_fenceValue));
+
+    auto submission = std::make_shared<Submission>();
+    submission->fence = m_fence.Get();
+    submission->fenceValue = m_fenceValue;
+    submission->isSubmitted.store(true, std::memory_order_release);
+    m_lastSubmission = submission;
+    return submission;
+}
+
+bool DedicatedCommandQueue::WaitForCompletion(const SubmissionHandle& submission, HANDLE terminateEvent)
+{
+    if (submission->IsCompleted())
+    {
+        return true;
+    }
+
+    // Wait for the fence to be set from GPU.
+    ThrowIfFailed(submission->fence->SetEventOnCompletion(submission->fenceValue, m_completedEvent.Get()));
+    return WaitForEventOrTermination(m_completedEvent.Get(), terminateEvent);
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+namespace DX12VideoEncoding
+{
+
+using Microsoft::WRL::ComPtr;
+
+// GPU work submitted by ICommandSubmitter. Fence point is assigned when the work is actually
+// passed to a command queue, that can be done later than Submit() call.
+struct Submission
+{
+    bool IsSubmitted() const { return isSubmitted.load(std::memory_order_acquire); }
+    bool IsCompleted() const { return IsSubmitted() && (fence->GetCompletedValue() >= fenceValue); }
+
+    ID3D12Fence* fence{};
+    UINT64 fenceValue{};
+    std::atomic<bool> isSubmitted{ false };
+};
+
+using SubmissionHandle = std::shared_ptr<Submission>;
+
+class ICommandSubmitter
+{
+public:
+    virtual ~ICommandSubmitter() = default;
+
+    // Executes closed command lists after GPU completes the dependencies.
+    // Command lists should not be reset until the submission is completed.
+    virtual SubmissionHandle Submit(const std::vector<ID3D12CommandList*>& commandLists,
+        const std::vector<SubmissionHandle>& dependencies) = 0;
+
+    // Returns false if terminateEvent is signaled before the submission is completed.
+    virtual bool WaitForCompletion(const SubmissionHandle& submission, HANDLE terminateEvent = nullptr) = 0;
+};
+
+// Own command queue for each submitter, the work is executed immediately.
+class DedicatedCommandQueue : public ICommandSubmitter
+{
+public:
+    DedicatedCommandQueue(const ComPtr<ID3D12Device>& device, D3D12_COMMAND_LIST_TYPE type);
+    ~DedicatedCommandQueue();
+
+    SubmissionHandle Submit(const std::vector<ID3D12CommandList*>& commandLists,
+        const std::vector<SubmissionHandle>& dependencies) override;
+    bool WaitForCompletion(const SubmissionHandle& submission, HANDLE terminateEvent) override;
+
+private:
+    ComPtr<ID3D12CommandQueue> m_commandQueue;
+    ComPtr<ID3D12Fence> m_fence;
+    UINT64 m_fenceValue = 0;
+    SubmissionHandle m_lastSubmission;
+    Microsoft::WRL::Wrappers::Event m_completedEvent;
+};
+
+// Waits for the event or the terminate event, returns false in the latter case.
+bool WaitForEventOrTermination(HANDLE event, HANDLE terminateEvent);
+
+}
@@ -0,0 +1,68 @@
+#include "pch.h"
+#include "CopiedFrameData.h"
+#include "PixelFormatConverter.h"
+#include "PlaneCopy.h"
+#include "Utils.h"
+
+
+namespace DX12VideoEncoding {
+
+namespace {
+
+class CopiedFrameData : public IRawFrameData
+{
+public:
+    explicit CopiedFrameData(const FrameDescriptor& source)
+        : m_descriptor(source)
+    {
+        ThrowIfFalse(source.planeCount >= GetPlaneCount(source.format));
+
+        m_descriptor.planeCount = GetPlaneCount(source.format);
+        m_descriptor.ownership = FrameOwnership::Shared;
+
+        size_t offsets[3] = {};
+        size_t totalSize = 0;
+        for (uint32_t plane = 0; plane < m_descriptor.planeCount; ++plane)
+        {
+            FramePlane& copiedPlane = m_descriptor.planes[plane];
+            copiedPlane.pitch = GetPlaneRowSize(source.format, plane, source.width);
+            copiedPlane.height = GetPlaneHeight(source.format, plane, source.height);
+            ThrowIfFalse(source.planes[plane].height >= copiedPlane.height);
+
+            offsets[plane] = totalSize;
+            totalSize += copiedPlane.pitch * copiedPlane.height;
+        }
+
+        m_data.resize(totalSize);
+        for (uint32_t plane = 0; plane < m_descriptor.planeCount; ++plane)
+        {
+            FramePlane& copiedPlane = m_descriptor.planes[plane];
+            CopyPlane(source.planes[plane].data, source.planes[plane].pitch,
+                m_data.data() + offsets[plane], copiedPlane.pitch,
+                copiedPlane.pitch, copiedPlane.height);
+            copiedPlane.data = m_data.data() + offsets[plane];
+        }
+
+        m_regionsOfInterest.assign(source.regionsOfInterest, source.regionsOfInterest + source.regionOfInterestCount);
+        m_descriptor.regionsOfInterest = m_regionsOfInterest.data();
+    }
+
+    FrameDescriptor GetDescriptor() const override
+    {
+        return m_descriptor;
+    }
+
+private:
+    FrameDescriptor m_descriptor;
+    std::vector<uint8_t> m_data;
+    std::vector<RegionOfInterest> m_regionsOfInterest;
+};
+
+}
+
+RawFrameData CopyFrameData(const FrameDescriptor& descriptor)
+{
+    return std::make_shared<CopiedFrameData>(descriptor);
+}
+
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "EncoderAPI.h"
+
+namespace DX12VideoEncoding
+{
+
+// Copies planes of a frame borrowed by the producer, the copy has tightly packed rows.
+RawFrameData CopyFrameData(const FrameDescriptor& descriptor);
+
+}
@@ -0,0 +1,44 @@
+#include "pch.h"
+#include "CpuFeatures.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+
+namespace DX12VideoEncoding {
+
+#if defined(_M_X64) || defined(_M_IX86)
+
+namespace {
+
+bool DetectAvx2()
+{
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // AVX registers should be enabled by OS.
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+}
+
+bool IsAvx2Supported()
+{
+    static const bool supported = DetectAvx2();
+    return supported;
+}
+
+#endif
+
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace DX12VideoEncoding
+{
+
+#if defined(_M_X64) || defined(_M_IX86)
+// AVX2 is supported by the CPU and its registers are enabled by OS, the result is cached.
+bool IsAvx2Supported();
+#endif
+
+}
@@ -1,29 +1,14 @@
 #include "pch.h"
 #include "EncoderH264.h"
+#include "CopiedFrameData.h"
 #include "EncoderH264DX12.h"
+#include "SharedQueuesScheduler.h"
 
 namespace DX12VideoEncoding
 {
 
 namespace {
 
-std::string GetFrameTypeName(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType)
-{
-    switch (frameType)
-    {
-    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME:
-        return "IDR";
-    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME:
-        return "I";
-    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME:
-        return "P";
-    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME:
-        return "B";
-    default:
-        return "Unknown";
-    }
-}
-
 template <typename T>
 std::string VectorNumbersToString(const std::vector<T>& numbers)
 {
@@ -37,146 +22,314 @@ std::string VectorNumbersToString(const std::vector<T>& numbers)
     return result;
 }
 
+std::unique_ptr<ICommandSubmitter> CreateCommandSubmitter(const ComPtr<ID3D12Device>& device,
+    const EncoderConfiguration& configuration, D3D12_COMMAND_LIST_TYPE type)
+{
+    if (configuration.scheduler == nullptr)
+    {
+        return std::make_unique<DedicatedCommandQueue>(device, type);
+    }
+
+    // Only schedulers of CreateDeviceScheduler() can share their queues.
+    auto* scheduler = dynamic_cast<SharedQueuesScheduler*>(configuration.scheduler.get());
+    ThrowIfFalse(scheduler != nullptr);
+    ThrowIfFalse(scheduler->GetDevice() == device.Get());
+    return scheduler->CreateSubmitter(type, configuration.schedulingPriority);
+}
+
+int64_t GetFrameDuration(const EncoderConfiguration& configuration)
+{
+    if (configuration.timeBase.numerator == 0 || configuration.timeBase.denominator == 0)
+        return 1;
+
+    ThrowIfFalse(configuration.fps.numerator != 0);
+    const uint64_t numerator = uint64_t(configuration.timeBase.denominator) * configuration.fps.denominator;
+    const uint64_t denominator = uint64_t(configuration.timeBase.numerator) * configuration.fps.numerator;
+    return (std::max)(static_cast<int64_t>((numerator + denominator / 2) / denominator), int64_t(1));
+}
+
+void ValidateLowLatencyConfiguration(const EncoderConfiguration& configuration)
+{
+    if (!configuration.lowLatency)
+        return;
+
+    if (configuration.bFramesCount > 0)
+        throw std::runtime_error("B-frames are not allowed in the low-latency mode");
+    if (configuration.framesPerSubmission > 1)
+        throw std::runtime_error("Batched submissions are not allowed in the low-latency mode");
+    if (configuration.lookaheadDepth > 0)
+        throw std::runtime_error("Lookahead is not allowed in the low-latency mode");
+}
+
+void ValidateTemporalLayerConfiguration(const EncoderConfiguration& configuration)
+{
+    if (configuration.temporalLayerCount > 3)
+        throw std::runtime_error("Up to 3 temporal layers are supported");
+    if (configuration.temporalLayerCount <= 1)
+        return;
+
+    if (configuration.bFramesCount > 0)
+        throw std::runtime_error("B-frames are not allowed with temporal layers");
+    // The last frame of each lower layer stays in the DPB.
+    if (configuration.maxReferenceFrameCount + 1 < configuration.temporalLayerCount)
+        throw std::runtime_error("Not enough reference frames for the temporal layers");
+}
+
+void ValidateIntraRefreshConfiguration(const EncoderConfiguration& configuration)
+{
+    if (configuration.intraRefreshPeriod == 0)
+        return;
+
+    // Intra coded rows of non-reference frames wouldn't refresh the following frames.
+    if (configuration.bFramesCount > 0)
+        throw std::runtime_error("B-frames are not allowed with intra refresh");
+    if (configuration.temporalLayerCount > 1)
+        throw std::runtime_error("Temporal layers are not allowed with intra refresh");
+    // Refresh waves already give the recovery points.
+    if (configuration.enableOpenGop)
+        throw std::runtime_error("Open GOPs are not allowed with intra refresh");
+}
+
+std::chrono::microseconds ToMicroseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+// Receivers compare the timing SEI with their own clocks, so the steady clock is converted to the system one.
+uint64_t ToUnixTimeMicroseconds(std::chrono::steady_clock::time_point time)
+{
+    const auto age = std::chrono::steady_clock::now() - time;
+    const auto systemTime = std::chrono::system_clock::now()
+        - std::chrono::duration_cast<std::chrono::system_clock::duration>(age);
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(systemTime.time_since_epoch()).count());
+}
+
+// value * multiplier / divisor rounded down, saturated if it doesn't fit 64 bits. The product is kept in 128 bits,
+// so timestamps of time bases with large numerators don't overflow before the division.
+uint64_t MultiplyDivide(uint64_t value, uint64_t multiplier, uint32_t divisor)
+{
+    assert(divisor != 0);
+    constexpr uint64_t LowMask = 0xFFFFFFFF;
+    const uint64_t low = (value & LowMask) * (multiplier & LowMask);
+    const uint64_t middleLow = (value >> 32) * (multiplier & LowMask);
+    const uint64_t middleHigh = (value & LowMask) * (multiplier >> 32);
+    const uint64_t middle = (low >> 32) + (middleLow & LowMask) + (middleHigh & LowMask);
+    const uint64_t high = (value >> 32) * (multiplier >> 32) + (middleLow >> 32) + (middleHigh >> 32) + (middle >> 32);
+    // 32-bit digits of the product, the most significant first.
+    const uint64_t digits[4] = { high >> 32, high & LowMask, middle & LowMask, low & LowMask };
+
+    // Long division by a 32-bit divisor: the remainder is below it, so each partial dividend fits 64 bits.
+    uint64_t quotient = 0;
+    uint64_t remainder = 0;
+    for (uint64_t digit : digits)
+    {
+        if (quotient > LowMask)
+            return UINT64_MAX;
+        const uint64_t dividend = (remainder << 32) | digit;
+        quotient = (quotient << 32) | (dividend / divisor);
+        remainder = dividend % divisor;
+    }
+    return quotient;
+}
+
+}
+
+void ApplyLowLatencyPreset(EncoderConfiguration& config)
+{
+    config.lowLatency = true;
+    config.bFramesCount = 0;
+    config.enableAdaptiveBFrames = false;
+    config.framesPerSubmission = 1;
+    config.lookaheadDepth = 0;
 }
 
 std::unique_ptr<IEncoder> CreateH264Encoder(
     const ComPtr<ID3D12Device>& device, const EncoderConfiguration& configuration)
 {
+    ThrowIfFalse(configuration.inputFormat == DXGI_FORMAT_NV12 || configuration.inputFormat == DXGI_FORMAT_P010);
+    ValidateLowLatencyConfiguration(configuration);
+    ValidateTemporalLayerConfiguration(configuration);
+    ValidateIntraRefreshConfiguration(configuration);
+
+    // Input textures of the frames in the submission batches in flight share the copy queue.
+    std::shared_ptr<ICommandSubmitter> copySubmitter =
+        CreateCommandSubmitter(device, configuration, D3D12_COMMAND_LIST_TYPE_COPY);
+    std::vector<std::unique_ptr<InputFrameResources>> inputFrameResources;
+    const uint32_t inputFrameCount =
+        EncoderH264DX12::SubmissionsInFlight * (std::max)(configuration.framesPerSubmission, 1u);
+    for (uint32_t i = 0; i < inputFrameCount; ++i)
+    {
+        inputFrameResources.push_back(std::make_unique<InputFrameResources>(device,
+            copySubmitter, configuration.workerPool, configuration.inputFormat,
+            configuration.width, configuration.height));
+    }
+
     return std::make_unique<EncoderH264>(
-        std::make_unique<EncoderH264DX12>(device, configuration, DXGI_FORMAT_NV12),
-        std::make_unique<InputFrameResources>(device, DXGI_FORMAT_NV12, configuration.width, configuration.height),
-        configuration.keyFrameInterval, configuration.bFramesCount, configuration.maxReferenceFrameCount);
+        std::make_unique<EncoderH264DX12>(device,
+            CreateCommandSubmitter(device, configuration, D3D12_COMMAND_LIST_TYPE_VIDEO_ENCODE),
+            configuration, configuration.inputFormat),
+        std::move(inputFrameResources),
+        configuration);
 }
 
 EncoderH264::EncoderH264(
     std::unique_ptr<EncoderH264DX12> encoder,
-    std::unique_ptr<InputFrameResources> inputFrameResources,
-    uint32_t keyFrameInterval,
-    uint32_t bFramesCount,
-    uint32_t maxReferenceFrameCount)
+    std::vector<std::unique_ptr<InputFrameResources>> inputFrameResources,
+    const EncoderConfiguration& config)
     : m_inputFrameResources(std::move(inputFrameResources))
     , m_encoder(std::move(encoder))
-    , m_keyFrameInterval(keyFrameInterval)
-    , m_bFramesCount(bFramesCount)
-    , m_maxReferenceFrameCount(maxReferenceFrameCount)
+    , m_maxReferenceFrameCount(config.maxReferenceFrameCount)
 {
-    m_termintateEvent.Attach(CreateEvent(NULL, TRUE, FALSE, TEXT("terminateEvent")));
+    ApplyConfiguration(config);
+    // Unnamed, so terminating one encoder of the pool doesn't abort the other sessions waiting for their frames.
+    m_termintateEvent.Attach(CreateEvent(NULL, TRUE, FALSE, nullptr));
 }
 
-void EncoderH264::PushFrame(const RawFrameData& frameData)
+void EncoderH264::ApplyConfiguration(const EncoderConfiguration& config)
+{
+    m_bFramesCount = config.bFramesCount;
+    m_frameDuration = GetFrameDuration(config);
+    m_timingSEI = config.enableTimingSEI;
+    const bool hasTimeBase = config.timeBase.numerator != 0 && config.timeBase.denominator != 0;
+    m_timeBaseNumerator = hasTimeBase ? config.timeBase.numerator : config.fps.denominator;
+    m_timeBaseDenominator = (std::max)(hasTimeBase ? config.timeBase.denominator : config.fps.numerator, 1u);
+    m_temporalLayerCount = (std::max)(config.temporalLayerCount, 1u);
+    m_intraRefreshPeriod = m_encoder->GetIntraRefreshPeriod();
+
+    m_sceneCutDetection = config.enableSceneCutDetection;
+    m_adaptiveBFrames = config.enableAdaptiveBFrames && config.bFramesCount > 0;
+    m_qpController = std::make_unique<QPController>(config);
+    m_gopScheduler = GopScheduler(config);
+    if (config.lookaheadDepth > 0 && !m_qpController->IsAdaptive())
+    {
+        LogMessage(LogLevel::E_WARNING, "Lookahead is used by adaptive QP only, it just delays the frames\n");
+    }
+    m_frameAnalyzer = m_sceneCutDetection || m_adaptiveBFrames || m_qpController->IsAdaptive()
+        ? std::make_unique<FrameAnalyzer>()
+        : nullptr;
+
+    m_picturePlanner = PicturePlanner(m_maxReferenceFrameCount, m_encoder->GetMaxLongTermReferenceFrameCount());
+
+    const uint32_t qpMapRegionSize = m_encoder->GetQPMapRegionSize();
+    m_qpMapBuilder = qpMapRegionSize > 0
+        ? std::make_unique<QPMapBuilder>(config.width, config.height, qpMapRegionSize,
+            config.enableAdaptiveQuantization, config.enableRegionsOfInterest)
+        : nullptr;
+}
+
+void EncoderH264::PushFrame(const RawFrameData& rawFrameData)
 {
     // Check that there is no running encoding.
     assert(!m_currentFrame.has_value());
 
-    auto frameType = GetFrameType(m_currentFrameOrderNumber);
-    if (frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
-    {
-        m_encodedReferenceFrameOrderNumberList.clear();
-        m_lastIdrNumber = m_currentFrameOrderNumber;
-        if (m_currentFrameOrderNumber != 0)
-            ++m_idrPicId;
-    }
+    // The frame can wait for reordering, so the borrowed planes are copied right away.
+    const RawFrameData frameData = rawFrameData->GetDescriptor().ownership == FrameOwnership::Borrowed
+        ? CopyFrameData(rawFrameData->GetDescriptor())
+        : rawFrameData;
+
+    auto captureTime = frameData->GetDescriptor().captureTime;
+    if (captureTime == std::chrono::steady_clock::time_point{})
+        captureTime = std::chrono::steady_clock::now();
+
+    int64_t timestamp = frameData->GetDescriptor().timestamp;
+    if (timestamp == NoTimestamp)
+        timestamp = m_nextTimestamp;
+    m_nextTimestamp = timestamp + m_frameDuration;
+    m_presentationTimestamps.push_back(timestamp);
+
+    const FrameStatistics statistics = m_frameAnalyzer != nullptr
+        ? m_frameAnalyzer->Analyze(frameData->GetDescriptor())
+        : FrameStatistics{};
+    const bool sceneCut = m_sceneCutDetection && FrameAnalyzer::IsSceneCut(statistics);
 
     auto rawFrame = RawFrame{
         .frameData = frameData,
-        .frameType = frameType,
-        .frameOrderNumber = static_cast<uint32_t>(m_currentFrameOrderNumber),
-        .idrPicId = m_idrPicId,
-    };
-
-    while (true)
-    {
-        if (rawFrame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
-        {
-            assert(m_reorderingFrameBuffer.empty());
-            rawFrame.useAsReference = true;
-            m_currentFrame = rawFrame;
-        }
-        else if (rawFrame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
-        {
-            auto futureRefFrameNumber = GetNextReferenceFrameNumber(rawFrame.frameOrderNumber);
-            auto nextIdrFrameNumber = GetNextIDRFrameNumber(rawFrame.frameOrderNumber);
-            if (futureRefFrameNumber >= nextIdrFrameNumber)
-            {
-                // No P frame in the end of GOP, treat this frame as P frame.
-                LogMessage(LogLevel::E_DEBUG, "Queue P frame " + std::to_string(rawFrame.frameOrderNumber)
-                    + " instead of B frame because of GOP end\n");
-                rawFrame.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
-                continue;
-            }
-            else
-            {
-                LogMessage(LogLevel::E_DEBUG, "Queue B frame " + std::to_string(rawFrame.frameOrderNumber)
-                    + "\n");
-
-                // Don't use referenced B frames.
-                rawFrame.useAsReference = false;
-
-                rawFrame.futureReferenceFrameOrderNumber = futureRefFrameNumber;
-                m_reorderingFrameBuffer.push_back(std::move(rawFrame));
-
-                m_currentFrame.reset();
-            }
-        }
-        else if (rawFrame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME)
-        {
-            rawFrame.useAsReference = true;
-            m_currentFrame = rawFrame;
-        }
-
-        break;
+        .timestamp = timestamp,
+        .captureTime = captureTime,
+        .frameOrderNumber = m_currentFrameOrderNumber,
     };
-
+    m_qpController->AddFrame(m_currentFrameOrderNumber, statistics);
     ++m_currentFrameOrderNumber;
+
+    m_gopScheduler.Push(std::move(rawFrame), sceneCut, FrameAnalyzer::IsHighMotion(statistics));
 }
 
 bool EncoderH264::StartEncodingPushedFrame()
 {
+    // Encoded data of the started frames should be read to free input textures.
+    ThrowIfFalse(m_encodingFrames.size() < m_inputFrameResources.size());
+
     // Returns false when need more frames to encode.
+    m_currentFrame = m_gopScheduler.Pop();
     if (!m_currentFrame.has_value())
+        return false;
+
+    m_currentFrame->temporalLayerIndex = GetTemporalLayerIndex(*m_currentFrame);
+    if (m_temporalLayerCount > 1)
     {
-        m_currentFrame = GetNextFrameToEncode();
-        if (!m_currentFrame.has_value())
-            return false;
+        // The top layer is not referenced, so dropping it doesn't break the lower ones.
+        m_currentFrame->useAsReference = m_currentFrame->temporalLayerIndex + 1 < m_temporalLayerCount;
     }
 
-    std::vector<uint32_t> l0List;
-    std::vector<uint32_t> l1List;
-
-    if ((*m_currentFrame).frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME)
+    PicturePlanner::Picture picture = m_picturePlanner.Start(*m_currentFrame, m_gopScheduler.HasReorderedFrames());
+    if (picture.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME
+        && m_currentFrame->frameType != D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
     {
-        // Using only 1 past reference frame, and it should be previous encoded frame.
-        assert(!m_encodedReferenceFrameOrderNumberList.empty());
-        auto pastFrameOrderNumber = *m_encodedReferenceFrameOrderNumberList.rbegin() - m_lastIdrNumber;
-        l0List.push_back(static_cast<uint32_t>(pastFrameOrderNumber));
+        // All references are lost, the next pushed frames count their GOP from this one.
+        m_gopScheduler.RestartGop(m_currentFrame->frameOrderNumber);
     }
-    else if ((*m_currentFrame).frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
+    if (picture.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME || picture.restartPictureNumbering)
     {
-        // Using only 1 past and 1 future reference frame.
-        assert(m_encodedReferenceFrameOrderNumberList.size() >= 2);
-        size_t lastIdx = m_encodedReferenceFrameOrderNumberList.size() - 1;
-
-        auto pastFrameOrderNumber = m_encodedReferenceFrameOrderNumberList[lastIdx - 1] - m_lastIdrNumber;
-        l0List.push_back(static_cast<uint32_t>(pastFrameOrderNumber));
-
-        auto futureFrameOrderNumber = m_encodedReferenceFrameOrderNumberList[lastIdx] - m_lastIdrNumber;
-        l1List.push_back(static_cast<uint32_t>(futureFrameOrderNumber));
+        m_gopScheduler.SetPictureNumberingStart(m_picturePlanner.GetPictureNumberingStart());
+    }
+    m_currentFrame->frameType = picture.frameType;
+    m_currentFrame->useAsReference = picture.useAsReference;
+    m_currentFrame->temporalLayerIndex = picture.temporalLayerIndex;
+    m_currentFrame->idrPicId = picture.idrPicId;
+
+    // Refresh waves run back to back from the IDR frame, decoding can start at the first frame of each wave.
+    std::optional<UINT> intraRefreshFrameIndex;
+    std::optional<UINT> recoveryFrameCount;
+    if (m_intraRefreshPeriod > 0 && m_currentFrame->frameType != D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
+    {
+        intraRefreshFrameIndex = static_cast<UINT>(
+            (m_currentFrame->frameOrderNumber - m_picturePlanner.GetLastIdrNumber() - 1) % m_intraRefreshPeriod);
+        if (*intraRefreshFrameIndex == 0)
+            recoveryFrameCount = m_intraRefreshPeriod - 1;
+    }
+    else if (m_currentFrame->frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME && m_currentFrame->useAsReference)
+    {
+        // I-frame of an open GOP or replacing a P-frame which references are lost, the frames following it
+        // in display order are decoded correctly from it. Non-reference I-frames only replace B-frames.
+        recoveryFrameCount = 0;
     }
-
 
     EncoderH264DX12::InputFrame inputFrame = {
         .frameType = (*m_currentFrame).frameType,
-        .pictureOrderCountNumber = static_cast<UINT>((*m_currentFrame).frameOrderNumber - m_lastIdrNumber),
-        .decodingOrderNumber = static_cast<UINT>(m_currentDecodingOrderNumber - m_lastIdrNumber),
-        .idrPicId = (*m_currentFrame).idrPicId,
-        .l0List = std::move(l0List),
-        .l1List = std::move(l1List),
+        .pictureOrderCountNumber = picture.pictureOrderCountNumber,
+        .decodingOrderNumber = picture.decodingOrderNumber,
+        .idrPicId = picture.idrPicId,
+        .l0List = std::move(picture.l0List),
+        .l1List = std::move(picture.l1List),
         .useAsReference = (*m_currentFrame).useAsReference,
+        .qp = m_qpController->GetFrameQP((*m_currentFrame).frameOrderNumber, (*m_currentFrame).frameType),
+        .temporalLayerIndex = (*m_currentFrame).temporalLayerIndex,
+        .intraRefreshFrameIndex = intraRefreshFrameIndex,
+        .recoveryFrameCount = recoveryFrameCount,
+        .longTermReference = picture.longTermReference,
+        .restartPictureNumbering = picture.restartPictureNumbering,
     };
+    if (m_qpMapBuilder)
+    {
+        inputFrame.deltaQPMap = m_qpMapBuilder->Build((*m_currentFrame).frameData->GetDescriptor());
+    }
 
     LogMessage(LogLevel::E_INFO, "Encoding frame: type " + GetFrameTypeName(inputFrame.frameType)
         + ", pic order " + std::to_string(inputFrame.pictureOrderCountNumber)
-        + ", dec order " + std::to_string(inputFrame.decodingOrderNumber));
+        + ", dec order " + std::to_string(inputFrame.decodingOrderNumber)
+        + ", QP " + std::to_string(inputFrame.qp)
+        + (m_temporalLayerCount > 1 ? ", layer " + std::to_string(inputFrame.temporalLayerIndex) : ""));
 
     if (!inputFrame.l0List.empty())
     {
@@ -188,63 +341,80 @@ bool EncoderH264::StartEncodingPushedFrame()
     }
     if (inputFrame.frameType != D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
     {
-        LogMessage(LogLevel::E_DEBUG, "POC of referenece frames in DPB: " + VectorNumbersToString(m_encodedReferenceFrameOrderNumberList));
+        LogMessage(LogLevel::E_DEBUG, "POC of referenece frames in DPB: "
+            + VectorNumbersToString(m_picturePlanner.GetReferenceFrames().GetFrameOrderNumbers()));
     }
     LogMessage(LogLevel::E_INFO, "\n");
 
-    m_inputFrameResources->SetFrameData((*m_currentFrame).frameData);
-    m_inputFrameResources->UploadTexture();
-    m_encoder->SendFrame(inputFrame, *m_inputFrameResources.get());
+    const auto encodingStartTime = std::chrono::steady_clock::now();
+    if (m_timingSEI)
+    {
+        // The clock timestamp can't go below zero, the first frames of a stream may have negative timestamps.
+        const uint64_t timestamp = static_cast<uint64_t>((std::max)(m_currentFrame->timestamp, int64_t{ 0 }));
+        inputFrame.timing = EncoderH264DX12::FrameTiming{
+            .frameNumber = m_currentFrame->frameOrderNumber,
+            .captureTime = ToUnixTimeMicroseconds(m_currentFrame->captureTime),
+            .encodingStartTime = ToUnixTimeMicroseconds(encodingStartTime),
+            .presentationTime = MultiplyDivide(timestamp, m_timeBaseNumerator * 1000000, m_timeBaseDenominator),
+        };
+    }
+
+    const size_t inputSlot = m_nextInputSlot;
+    m_nextInputSlot = (m_nextInputSlot + 1) % m_inputFrameResources.size();
+    auto& inputFrameResources = *m_inputFrameResources[inputSlot];
+    inputFrameResources.SetFrameData((*m_currentFrame).frameData);
+    inputFrameResources.UploadTexture();
+    m_encoder->SendFrame(inputFrame, inputFrameResources);
+
+    m_encodingFrames.push_back(EncodingFrame{ *m_currentFrame, m_currentDecodingOrderNumber,
+        GetNextDecodingTimestamp(), inputSlot, inputFrame.qp, encodingStartTime, recoveryFrameCount.has_value() });
+    ++m_currentDecodingOrderNumber;
+    m_currentFrame.reset();
 
     return true;
 }
 
 bool EncoderH264::WaitForEncodedFrame(EncodedFrame& encodedFrame)
 {
-    assert(m_currentFrame.has_value());
+    assert(!m_encodingFrames.empty());
 
-    if (!m_encoder->WaitForEncodedData(m_termintateEvent, encodedFrame.encodedData))
+    if (!m_encoder->WaitForEncodedData(m_termintateEvent, encodedFrame.encodedData, encodedFrame.slices))
         return false;
 
-    encodedFrame.pictureOrderCountNumber = m_currentFrame->frameOrderNumber;
-    encodedFrame.decodingOrderNumber = m_currentDecodingOrderNumber;
-    encodedFrame.isKeyFrame = m_currentFrame->frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME
-        || m_currentFrame->frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME;
-
-    if (m_currentFrame->useAsReference)
-    {
-        m_encodedReferenceFrameOrderNumberList.push_back(m_currentFrame->frameOrderNumber);
-
-        // Keep only last reference frames. Although count of reference frames should be received from the DPB.
-        if (m_encodedReferenceFrameOrderNumberList.size() > m_maxReferenceFrameCount)
-            m_encodedReferenceFrameOrderNumberList.erase(m_encodedReferenceFrameOrderNumberList.begin());
-    }
-
-    ++m_currentDecodingOrderNumber;
+    const EncodingFrame& encodingFrame = m_encodingFrames.front();
+    encodedFrame.pictureOrderCountNumber = encodingFrame.frame.frameOrderNumber;
+    encodedFrame.decodingOrderNumber = encodingFrame.decodingOrderNumber;
+    encodedFrame.timestamp = encodingFrame.frame.timestamp;
+    encodedFrame.decodingTimestamp = encodingFrame.decodingTimestamp;
+    encodedFrame.isKeyFrame = encodingFrame.frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME
+        || encodingFrame.frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME;
+    encodedFrame.isRecoveryPoint = encodingFrame.isRecoveryPoint;
+    encodedFrame.temporalLayerIndex = encodingFrame.frame.temporalLayerIndex;
+
+    m_qpController->OnFrameEncoded(encodingFrame.frame.frameOrderNumber, encodingFrame.frame.frameType,
+        encodingFrame.qp, encodedFrame.encodedData.size());
+
+    // The encoded data is available as soon as the GPU signals the frame, so reading it back ends the latency.
+    const auto encodedTime = std::chrono::steady_clock::now();
+    encodedFrame.latency = FrameLatency{
+        .queueing = ToMicroseconds(encodingFrame.startTime - encodingFrame.frame.captureTime),
+        .encoding = ToMicroseconds(encodedTime - encodingFrame.startTime),
+        .total = ToMicroseconds(encodedTime - encodingFrame.frame.captureTime),
+    };
+    ++m_statistics.encodedFrameCount;
+    m_statistics.encodedBytes += encodedFrame.encodedData.size();
+    m_statistics.maxLatency = (std::max)(m_statistics.maxLatency, encodedFrame.latency.total);
+    m_totalLatency += encodedFrame.latency.total;
 
-    m_inputFrameResources->ResetCommands();
-    m_currentFrame.reset();
+    m_inputFrameResources[encodingFrame.inputSlot]->ResetCommands();
+    m_encodingFrames.pop_front();
 
     return true;
 }
 
 void EncoderH264::Flush()
 {
-    if (!m_reorderingFrameBuffer.empty())
-    {
-        // Change buffered B frames to P frames and push the current IDR frame.
-        for (size_t i = 0; i < m_reorderingFrameBuffer.size(); ++i)
-        {
-            auto& frame = m_reorderingFrameBuffer[i];
-            if (frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
-            {
-                frame.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
-                frame.useAsReference = true;
-            }
-            else
-                assert(false && "Only B frames should be in the reordering buffer.");
-        }
-    }
+    m_gopScheduler.Flush();
 }
 
 void EncoderH264::Terminate()
@@ -252,61 +422,107 @@ void EncoderH264::Terminate()
     SetEvent(m_termintateEvent.Get());
 }
 
-std::optional<EncoderH264::RawFrame> EncoderH264::GetNextFrameToEncode()
+void EncoderH264::Reset(const EncoderConfiguration& config)
 {
-    if (m_reorderingFrameBuffer.empty())
-        return {};
-
-    auto bufferedFrame = m_reorderingFrameBuffer.front();
-    if (bufferedFrame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
+    ThrowIfFalse(config.maxReferenceFrameCount == m_maxReferenceFrameCount);
+    ValidateLowLatencyConfiguration(config);
+    ValidateTemporalLayerConfiguration(config);
+    ValidateIntraRefreshConfiguration(config);
+
+    // Waits for the interrupted encoding if any.
+    m_encoder->Reset(config);
+    for (auto& inputFrameResources : m_inputFrameResources)
     {
-        // Check if all future reference frames are already encoded.
+        inputFrameResources->Reset();
+        inputFrameResources->SetWorkerPool(config.workerPool);
+    }
+    m_nextInputSlot = 0;
+    ResetEvent(m_termintateEvent.Get());
 
-        if (m_encodedReferenceFrameOrderNumberList.empty())
-            return {};
+    ApplyConfiguration(config);
 
-        auto lastEncodedReferenceFrameOrderNumber = m_encodedReferenceFrameOrderNumberList.back();
-        if (lastEncodedReferenceFrameOrderNumber < bufferedFrame.futureReferenceFrameOrderNumber)
-            return {};
-    }
+    m_currentFrameOrderNumber = 0;
+    m_currentDecodingOrderNumber = 0;
+    m_nextTimestamp = 0;
+    m_presentationTimestamps.clear();
+    m_currentFrame.reset();
+    m_encodingFrames.clear();
+    m_statistics = {};
+    m_totalLatency = {};
+}
 
-    RawFrame frame = bufferedFrame;
-    m_reorderingFrameBuffer.erase(m_reorderingFrameBuffer.begin());
-    return frame;
+EncoderStatistics EncoderH264::GetStatistics() const
+{
+    EncoderStatistics statistics = m_statistics;
+    if (statistics.encodedFrameCount > 0)
+        statistics.averageLatency = m_totalLatency / statistics.encodedFrameCount;
+    return statistics;
 }
 
-D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 EncoderH264::GetFrameType(uint64_t pictureOrderCountNumber)
+void EncoderH264::RequestKeyFrame()
 {
-    bool firstFrame = pictureOrderCountNumber == 0;
-    if (firstFrame ||
-        (m_keyFrameInterval > 0 && (pictureOrderCountNumber % m_keyFrameInterval == 0)))
-    {
-        return D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
-    }
+    m_gopScheduler.RequestKeyFrame();
+}
 
-    const auto gopStart = m_keyFrameInterval == 0 ? 0
-        : (pictureOrderCountNumber / m_keyFrameInterval) * m_keyFrameInterval;
+void EncoderH264::InvalidateReferences(uint64_t firstPictureOrderCountNumber, uint64_t lastPictureOrderCountNumber)
+{
+    ThrowIfFalse(firstPictureOrderCountNumber <= lastPictureOrderCountNumber);
 
-    if (((pictureOrderCountNumber - gopStart) % (m_bFramesCount + 1)) == 0)
-        return D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+    m_picturePlanner.InvalidateReferences(firstPictureOrderCountNumber, lastPictureOrderCountNumber);
+    const auto lastValidReference = m_picturePlanner.GetReferenceFrames().GetLastValid();
+    LogMessage(LogLevel::E_DEBUG, "References " + std::to_string(firstPictureOrderCountNumber) + " - "
+        + std::to_string(lastPictureOrderCountNumber) + " invalidated, last intact reference: "
+        + (lastValidReference ? std::to_string(*lastValidReference) : "none") + "\n");
+}
 
-    return D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME;
+bool EncoderH264::MarkLongTermReference(uint64_t pictureOrderCountNumber)
+{
+    return m_picturePlanner.MarkLongTermReference(pictureOrderCountNumber);
 }
 
-uint64_t EncoderH264::GetNextReferenceFrameNumber(uint64_t pictureOrderCountNumber)
+uint64_t EncoderH264::GetMemoryUsage() const
 {
-    const auto gopStart = m_keyFrameInterval == 0 ? 0
-        : (pictureOrderCountNumber / m_keyFrameInterval) * m_keyFrameInterval;
+    uint64_t memoryUsage = m_encoder->GetMemoryUsage();
+    for (const auto& inputFrameResources : m_inputFrameResources)
+    {
+        memoryUsage += inputFrameResources->GetMemoryUsage();
+    }
+    return memoryUsage;
+}
 
-    const auto pFrameInterval = m_bFramesCount + 1;
-    return ((pictureOrderCountNumber - gopStart) / pFrameInterval) * pFrameInterval + pFrameInterval + gopStart;
+uint32_t EncoderH264::GetTemporalLayerIndex(const RawFrame& frame) const
+{
+    if (frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME
+        || frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME)
+        return 0;
+
+    // Dyadic pattern counted from the IDR frame: L1T2 - 0 1 0 1..., L1T3 - 0 2 1 2 0 2 1 2...
+    const uint64_t position = frame.frameOrderNumber - m_picturePlanner.GetLastIdrNumber();
+    uint32_t temporalLayerIndex = m_temporalLayerCount - 1;
+    for (uint64_t period = 2; temporalLayerIndex > 0 && position % period == 0; period *= 2)
+    {
+        --temporalLayerIndex;
+    }
+    return temporalLayerIndex;
 }
 
-uint64_t EncoderH264::GetNextIDRFrameNumber(uint64_t pictureOrderCountNumber)
+int64_t EncoderH264::GetNextDecodingTimestamp()
 {
-    if (m_keyFrameInterval == 0)
-        return (std::numeric_limits<uint64_t>::max)();
-    return (pictureOrderCountNumber / m_keyFrameInterval + 1) * m_keyFrameInterval;
+    // B-frames are decoded one frame after their presentation at most, as they reference only the closest
+    // P-frames, so decoding timestamps lag the presentation ones by one frame.
+    const uint64_t reorderDelay = m_bFramesCount > 0 ? 1 : 0;
+    if (m_currentDecodingOrderNumber < reorderDelay)
+    {
+        assert(!m_presentationTimestamps.empty());
+        return m_presentationTimestamps.front()
+            - static_cast<int64_t>(reorderDelay - m_currentDecodingOrderNumber) * m_frameDuration;
+    }
+
+    // All frames decoded before the current one are pushed, so the timestamp is there.
+    assert(!m_presentationTimestamps.empty());
+    const int64_t decodingTimestamp = m_presentationTimestamps.front();
+    m_presentationTimestamps.pop_front();
+    return decodingTimestamp;
 }
 
 }
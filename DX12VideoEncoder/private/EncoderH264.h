@@ -1,7 +1,12 @@
 #pragma once
 
 #include "EncoderAPI.h"
+#include "FrameAnalyzer.h"
+#include "GopScheduler.h"
+#include "QPController.h"
+#include "QPMapBuilder.h"
 #include "InputFrameResources.h"
+#include "PicturePlanner.h"
 #include "Utils.h"
 #include "ReferenceFramesManager.h"
 
@@ -15,52 +20,82 @@ class EncoderH264 : public IEncoder
 public:
     EncoderH264(
         std::unique_ptr<EncoderH264DX12> encoder,
-        std::unique_ptr<InputFrameResources> inputFrameResources,
-        uint32_t keyFrameInterval,
-        uint32_t bFramesCount,
-        uint32_t maxReferenceFrameCount);
+        std::vector<std::unique_ptr<InputFrameResources>> inputFrameResources,
+        const EncoderConfiguration& config);
 
     void PushFrame(const RawFrameData& frameData) override;
     bool StartEncodingPushedFrame() override;
     bool WaitForEncodedFrame(EncodedFrame& encodedFrame) override;
     void Flush() override;
     void Terminate() override;
+    EncoderStatistics GetStatistics() const override;
+    void RequestKeyFrame() override;
+    void InvalidateReferences(uint64_t firstPictureOrderCountNumber, uint64_t lastPictureOrderCountNumber) override;
+    bool MarkLongTermReference(uint64_t pictureOrderCountNumber) override;
+
+    // Starts a new sequence with the same resolution, format, profile and DPB size, keeping allocated resources.
+    void Reset(const EncoderConfiguration& config);
+    uint64_t GetMemoryUsage() const;
 
 private:
 
-    struct RawFrame
+    using RawFrame = GopScheduler::Frame;
+
+    // Started frame which encoded data is not read yet.
+    struct EncodingFrame
     {
-        RawFrameData frameData;
-        D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType{ D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME };
-        uint64_t frameOrderNumber{};
-        uint32_t idrPicId{};
-        uint64_t futureReferenceFrameOrderNumber{}; // Only valid for B-frames
-        bool useAsReference{ false };
+        RawFrame frame;
+        uint64_t decodingOrderNumber{};
+        int64_t decodingTimestamp{};
+        size_t inputSlot{};
+        uint32_t qp{};
+        std::chrono::steady_clock::time_point startTime{};
+        bool isRecoveryPoint{ false };
     };
 
-    std::optional<RawFrame> GetNextFrameToEncode();
-    D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 GetFrameType(uint64_t pictureOrderCountNumber);
-    uint64_t GetNextReferenceFrameNumber(uint64_t pictureOrderCountNumber);
-    uint64_t GetNextIDRFrameNumber(uint64_t pictureOrderCountNumber);
+    void ApplyConfiguration(const EncoderConfiguration& config);
+    uint32_t GetTemporalLayerIndex(const RawFrame& frame) const;
+    int64_t GetNextDecodingTimestamp();
 
 private:
 
+    // One input texture per frame of a submission batch, released after the encoder.
+    std::vector<std::unique_ptr<InputFrameResources>> m_inputFrameResources;
+    size_t m_nextInputSlot = 0;
+
     std::unique_ptr<EncoderH264DX12> m_encoder;
     Microsoft::WRL::Wrappers::Event m_termintateEvent;
 
-    const uint32_t m_keyFrameInterval; // 0 - inifinite GOP
-    const uint32_t m_bFramesCount;
+    uint32_t m_bFramesCount;
     const uint32_t m_maxReferenceFrameCount;
+    uint32_t m_temporalLayerCount = 1;
+    uint32_t m_intraRefreshPeriod = 0; // 0 - no intra refresh waves
 
     uint64_t m_currentFrameOrderNumber = 0;
     uint64_t m_currentDecodingOrderNumber = 0;
-    uint64_t m_lastIdrNumber = 0;
-    uint32_t m_idrPicId = 0;
-    std::vector<uint64_t> m_encodedReferenceFrameOrderNumberList;
-    std::unique_ptr<InputFrameResources> m_inputFrameResources;
+    PicturePlanner m_picturePlanner;
+
+    int64_t m_frameDuration; // in time base units
+    bool m_timingSEI = false;
+    // Seconds per time base unit for the picture timing SEI.
+    uint64_t m_timeBaseNumerator = 1;
+    uint32_t m_timeBaseDenominator = 1;
+    int64_t m_nextTimestamp = 0;
+    // Presentation timestamps of the pushed frames in display order, the oldest ones are taken as decoding timestamps.
+    std::deque<int64_t> m_presentationTimestamps;
+
+    bool m_sceneCutDetection = false;
+    bool m_adaptiveBFrames = false;
+    std::unique_ptr<FrameAnalyzer> m_frameAnalyzer; // Only if scene cut detection, adaptive B-frames or QP are enabled
+    GopScheduler m_gopScheduler;
+    std::unique_ptr<QPController> m_qpController;
+    std::unique_ptr<QPMapBuilder> m_qpMapBuilder; // Only if the device supports requested QP maps
 
     std::optional<RawFrame> m_currentFrame;
-    std::vector<RawFrame> m_reorderingFrameBuffer;
+    std::deque<EncodingFrame> m_encodingFrames;
+
+    EncoderStatistics m_statistics;
+    std::chrono::microseconds m_totalLatency{}; // Of the frames counted in m_statistics
 };
 
 } // namespace DX12VideoEncoding
@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "EncoderH264DX12.h"
 #include "Utils.h"
+#include "CapabilityCache.h"
+#include "QPController.h"
 #include "gallium/d3d12_video_encoder_bitstream_builder_h264.h"
 
 
@@ -78,6 +80,21 @@ void ThrowEncoderSupportError(D3D12_VIDEO_ENCODER_VALIDATION_FLAGS validationFla
     throw std::runtime_error(error);
 }
 
+std::string GetProfileName(D3D12_VIDEO_ENCODER_PROFILE_H264 profile)
+{
+    switch (profile)
+    {
+    case D3D12_VIDEO_ENCODER_PROFILE_H264_MAIN:
+        return "Main";
+    case D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH:
+        return "High";
+    case D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH_10:
+        return "High10";
+    default:
+        return "Unknown";
+    }
+}
+
 D3D12_BOX H264FrameCroppingBox(D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC resolution)
 {
     const UINT mbWidth = (resolution.Width + 15) / 16;
@@ -91,88 +108,382 @@ D3D12_BOX H264FrameCroppingBox(D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC resol
     return frameCropping;
 }
 
+D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE GetSubregionLayoutMode(SliceMode sliceMode)
+{
+    switch (sliceMode)
+    {
+    case SliceMode::MacroblockRows:
+        return D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_UNIFORM_PARTITIONING_ROWS_PER_SUBREGION;
+    case SliceMode::Bytes:
+        return D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_BYTES_PER_SUBREGION;
+    default:
+        return D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME;
+    }
+}
+
+// sar_width and sar_height of VUI are 16-bit, larger ratios are approximated.
+DXGI_RATIONAL ReduceSampleAspectRatio(uint32_t width, uint32_t height)
+{
+    if (width == 0 || height == 0)
+        return {};
+
+    const uint32_t divisor = std::gcd(width, height);
+    width /= divisor;
+    height /= divisor;
+    const uint32_t scale = ((std::max)(width, height) + 0xfffe) / 0xffff;
+    return { (std::max)(width / scale, 1u), (std::max)(height / scale, 1u) };
+}
+
+// Index of the sample aspect ratio in Table E-1, Extended_SAR if it's not there.
+uint32_t GetAspectRatioIdc(DXGI_RATIONAL sampleAspectRatio)
+{
+    static constexpr std::array<std::pair<UINT, UINT>, 16> PredefinedRatios = { {
+        { 1, 1 }, { 12, 11 }, { 10, 11 }, { 16, 11 }, { 40, 33 }, { 24, 11 }, { 20, 11 }, { 32, 11 },
+        { 80, 33 }, { 18, 11 }, { 15, 11 }, { 64, 33 }, { 160, 99 }, { 4, 3 }, { 3, 2 }, { 2, 1 } } };
+
+    auto it = std::find(PredefinedRatios.begin(), PredefinedRatios.end(),
+        std::make_pair(sampleAspectRatio.Numerator, sampleAspectRatio.Denominator));
+    return it != PredefinedRatios.end() ? static_cast<uint32_t>(std::distance(PredefinedRatios.begin(), it)) + 1 : 255;
+}
+
+// Header byte of the NAL unit following its start code.
+uint8_t GetNalUnitHeader(const uint8_t* nalUnit, size_t size)
+{
+    size_t i = 0;
+    while (i < size && nalUnit[i] == 0)
+    {
+        ++i;
+    }
+    ThrowIfFalse(i >= 2 && i + 1 < size && nalUnit[i] == 1);
+    return nalUnit[i + 1];
+}
+
 }
 
 EncoderH264DX12::EncoderH264DX12(const ComPtr<ID3D12Device> &device,
+    std::unique_ptr<ICommandSubmitter> encodeSubmitter,
     const EncoderConfiguration& config,
     DXGI_FORMAT inputFormat)
     : m_device(device)
     , m_maxReferenceFrameCount(config.maxReferenceFrameCount)
+    , m_requestedLongTermReferenceFrameCount(config.maxLongTermReferenceFrameCount)
+    , m_framesPerSubmission((std::max)(config.framesPerSubmission, 1u))
     , m_inputFormat(inputFormat)
     , m_bitstreamBuilder(std::make_unique<d3d12_video_bitstream_builder_h264>())
+    , m_encodeSubmitter(std::move(encodeSubmitter))
 {
     ThrowIfFailed(m_device->QueryInterface(IID_PPV_ARGS(&m_videoDevice)));
-    m_encodeCompletedEvent.Attach(CreateEvent(NULL, FALSE, FALSE, TEXT("encodeCompletedEvent")));
     Configure(config);
 }
 
 EncoderH264DX12::~EncoderH264DX12() = default;
 
 void EncoderH264DX12::Configure(const EncoderConfiguration& config)
+{
+    ConfigureSequence(config);
+    CreateVideoEncoder();
+
+    m_referenceFramesManager = std::make_unique<ReferenceFramesManager>(
+        m_device, m_resolutionDesc, m_inputFormat, m_maxReferenceFrameCount, m_maxLongTermReferenceFrameCount,
+        HasInterFrames());
+    m_referenceFramesManager->SetMaxFrameNum(GetMaxFrameNum());
+
+    CreateOutputBufferResource();
+    CreateEncodeCommand();
+}
+
+void EncoderH264DX12::Reset(const EncoderConfiguration& config)
+{
+    // Only the sequence parameters can be changed, the encoder objects and resources are reused.
+    ThrowIfFalse((config.width == m_resolutionDesc.Width) && (config.height == m_resolutionDesc.Height)
+        && (config.maxReferenceFrameCount == m_maxReferenceFrameCount)
+        && (config.maxLongTermReferenceFrameCount == m_requestedLongTermReferenceFrameCount));
+
+    // Drop the recorded commands and wait for the frames which encoded data was not read.
+    if (!m_isCommandListClosed)
+    {
+        ThrowIfFailed(m_encodeCommandList->Close());
+        m_isCommandListClosed = true;
+    }
+    WaitForSubmissions();
+    BeginRecording();
+    m_sentFrames.clear();
+    m_recordedDependencies.clear();
+    m_nextOutputSlot = 0;
+
+    const auto previousProfile = m_h264Profile;
+    const auto previousCodecConfig = m_codecH264Config;
+    const auto previousResolvedMetadataBufferSize = m_resolvedMetadataBufferSize;
+    ConfigureSequence(config);
+    ThrowIfFalse((previousProfile == m_h264Profile)
+        && (memcmp(&previousCodecConfig, &m_codecH264Config, sizeof(m_codecH264Config)) == 0));
+
+    // Another slice configuration may need room for metadata of more slices.
+    if (m_resolvedMetadataBufferSize != previousResolvedMetadataBufferSize)
+    {
+        CreateOutputBufferResource();
+    }
+
+    if ((m_referenceFramesManager->HasInterFrames() == HasInterFrames())
+        && (m_referenceFramesManager->GetMaxLongTermReferenceFrameCount() == m_maxLongTermReferenceFrameCount))
+    {
+        m_referenceFramesManager->Reset();
+    }
+    else
+    {
+        m_referenceFramesManager = std::make_unique<ReferenceFramesManager>(
+            m_device, m_resolutionDesc, m_inputFormat, m_maxReferenceFrameCount, m_maxLongTermReferenceFrameCount,
+            HasInterFrames());
+    }
+    m_referenceFramesManager->SetMaxFrameNum(GetMaxFrameNum());
+
+    m_bitstreamBuilder = std::make_unique<d3d12_video_bitstream_builder_h264>();
+    m_isFirstFrame = true;
+    m_currentFrame = {};
+}
+
+uint64_t EncoderH264DX12::GetMemoryUsage() const
+{
+    // Memory of the encoder heap is internal to the driver and not counted.
+    uint64_t memoryUsage = m_referenceFramesManager->GetMemoryUsage();
+    for (const auto& slot : m_outputSlots)
+    {
+        memoryUsage += GetAllocationSize(m_device.Get(), slot.resolvedMetadataBuffer.Get())
+            + GetAllocationSize(m_device.Get(), slot.metadataOutputBuffer.Get())
+            + GetAllocationSize(m_device.Get(), slot.outputBitstreamBuffer.Get());
+    }
+    return memoryUsage;
+}
+
+bool EncoderH264DX12::HasInterFrames() const
+{
+    return (m_h264GopStructure.PPicturePeriod > 0) &&
+        ((m_h264GopStructure.GOPLength == 0) || (m_h264GopStructure.PPicturePeriod < m_h264GopStructure.GOPLength));
+}
+
+void EncoderH264DX12::ConfigureSequence(const EncoderConfiguration& config)
 {
     m_resolutionDesc.Width = config.width;
     m_resolutionDesc.Height = config.height;
     m_frameCropping = H264FrameCroppingBox(m_resolutionDesc);
     m_targetFramerate.Numerator = config.fps.numerator;
     m_targetFramerate.Denominator = config.fps.denominator;
+    m_sampleAspectRatio = ReduceSampleAspectRatio(config.sampleAspectRatio.width, config.sampleAspectRatio.height);
+    m_colorDescription = config.colorDescription;
 
-    m_h264GopStructure = ConfigureGOPStructure(config.keyFrameInterval, config.bFramesCount);
+    m_h264GopStructure = ConfigureGOPStructure(config.keyFrameInterval, config.bFramesCount,
+        config.enableOpenGop);
     m_gopStructure.pH264GroupOfPictures = &m_h264GopStructure;
     m_gopStructure.DataSize = sizeof(m_h264GopStructure);
+    m_lowLatency = config.lowLatency;
+    m_timingSEI = config.enableTimingSEI;
+    if (m_timingSEI && (config.fps.numerator == 0 || config.fps.denominator == 0))
+        throw std::runtime_error("Timing SEI requires the frame rate");
+    m_temporalLayerCount = (std::max)(config.temporalLayerCount, 1u);
 
     m_profileDesc.pH264Profile = &m_h264Profile;
     m_profileDesc.DataSize = sizeof(m_h264Profile);
-
     m_codecConfiguration.pH264Config = &m_codecH264Config;
     m_codecConfiguration.DataSize = sizeof(m_codecH264Config);
 
     m_rateControl.Mode = D3D12_VIDEO_ENCODER_RATE_CONTROL_MODE_CQP;
     m_rateControlCQP = D3D12_VIDEO_ENCODER_RATE_CONTROL_CQP{
-        .ConstantQP_FullIntracodedFrame = 30,
-        .ConstantQP_InterPredictedFrame_PrevRefOnly = 30,
-        .ConstantQP_InterPredictedFrame_BiDirectionalRef = 30,
+        .ConstantQP_FullIntracodedFrame =
+            QPController::GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME),
+        .ConstantQP_InterPredictedFrame_PrevRefOnly =
+            QPController::GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME),
+        .ConstantQP_InterPredictedFrame_BiDirectionalRef =
+            QPController::GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME),
     };
     m_rateControl.ConfigParams.DataSize = sizeof(m_rateControlCQP);
     m_rateControl.ConfigParams.pConfiguration_CQP = &m_rateControlCQP;
     m_rateControl.Flags = D3D12_VIDEO_ENCODER_RATE_CONTROL_FLAG_NONE;
     m_rateControl.TargetFrameRate = m_targetFramerate;
 
+    const EncoderCapabilities capabilities = GetCapabilities(config);
+    m_h264Profile = capabilities.profile;
+    m_codecH264Config = capabilities.codecConfiguration;
+    m_maxSupportedLevel = capabilities.maxLevel;
 
+    // Long-term references are used only by P-frames, so that default lists of B-frames stay valid.
+    m_maxLongTermReferenceFrameCount = config.bFramesCount > 0 ? 0
+        : (std::min)(config.maxLongTermReferenceFrameCount, capabilities.maxLongTermReferences);
+    if (m_maxLongTermReferenceFrameCount < config.maxLongTermReferenceFrameCount)
+    {
+        LogMessage(LogLevel::E_WARNING, "Long-term references are limited to "
+            + std::to_string(m_maxLongTermReferenceFrameCount) + (config.bFramesCount > 0 ? " with B-frames" : " by the device"));
+    }
+
+    m_isRateControlReconfigurationSupported =
+        (capabilities.supportFlags & D3D12_VIDEO_ENCODER_SUPPORT_FLAG_RATE_CONTROL_RECONFIGURATION_AVAILABLE) != 0;
+    if ((config.enableAdaptiveQP || config.encodingPass == EncodingPass::Second) && !m_isRateControlReconfigurationSupported)
+    {
+        LogMessage(LogLevel::E_WARNING, "Rate control reconfiguration is not supported, QP of the frame types is constant");
+    }
+
+    // Every frame gets a map once delta QP is enabled, maps of frames without offsets are zero.
+    const bool isQPMapRequested = config.enableAdaptiveQuantization || config.enableRegionsOfInterest;
+    const UINT qpMapRegionSize = capabilities.resolutionLimits.QPMapRegionPixelsSize;
+    const bool isQPMapSupported =
+        (capabilities.supportFlags & D3D12_VIDEO_ENCODER_SUPPORT_FLAG_RATE_CONTROL_DELTA_QP_AVAILABLE) != 0
+        && qpMapRegionSize > 0 && qpMapRegionSize % 16 == 0; // Whole macroblocks
+    m_qpMapRegionSize = isQPMapRequested && isQPMapSupported ? qpMapRegionSize : 0;
+    if (m_qpMapRegionSize > 0)
+    {
+        m_rateControl.Flags |= D3D12_VIDEO_ENCODER_RATE_CONTROL_FLAG_ENABLE_DELTA_QP;
+    }
+    else if (isQPMapRequested)
+    {
+        LogMessage(LogLevel::E_WARNING,
+            "Delta QP maps are not supported, adaptive quantization and regions of interest are disabled");
+    }
+
+    m_intraRefreshMode = capabilities.intraRefreshMode;
+    m_intraRefreshPeriod = m_intraRefreshMode != D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_NONE ? config.intraRefreshPeriod : 0;
+    if (config.intraRefreshPeriod > 0 && m_intraRefreshPeriod == 0)
+    {
+        LogMessage(LogLevel::E_WARNING, "Intra refresh is not supported, the picture is refreshed by IDR frames only");
+    }
+
+    m_resourceRequirements.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
+    m_resourceRequirements.Profile = m_profileDesc;
+    m_resourceRequirements.InputFormat = m_inputFormat;
+    m_resourceRequirements.PictureTargetResolution = m_resolutionDesc;
+    m_resourceRequirements.IsSupported = TRUE;
+    m_resourceRequirements.CompressedBitstreamBufferAccessAlignment = capabilities.compressedBitstreamBufferAccessAlignment;
+    m_resourceRequirements.EncoderMetadataBufferAccessAlignment = capabilities.encoderMetadataBufferAccessAlignment;
+    m_resourceRequirements.MaxEncoderOutputMetadataBufferSize = capabilities.maxEncoderOutputMetadataBufferSize;
+
+    ConfigureSlices(config, capabilities);
+
+    // Metadata of the frame is followed by metadata of each written slice.
+    m_resolvedMetadataBufferSize = D3DX12Align<UINT64>(
+        sizeof(D3D12_VIDEO_ENCODER_OUTPUT_METADATA)
+            + m_maxSliceCount * sizeof(D3D12_VIDEO_ENCODER_FRAME_SUBREGION_METADATA),
+        m_resourceRequirements.EncoderMetadataBufferAccessAlignment);
+}
+
+void EncoderH264DX12::ConfigureSlices(const EncoderConfiguration& config, const EncoderCapabilities& capabilities)
+{
+    m_subregionMode = capabilities.subregionMode;
+    m_sliceLayout = {};
+    m_maxSliceCount = 1;
+    if (config.sliceMode != SliceMode::FullFrame
+        && m_subregionMode == D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME)
+    {
+        LogMessage(LogLevel::E_WARNING, "Slice mode is not supported, frames are encoded as one slice");
+    }
+    if (m_subregionMode == D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME)
+        return;
+
+    if (config.sliceSize == 0)
+        throw std::runtime_error("Slice size is not set");
+
+    const UINT maxSliceCount = (std::max)(capabilities.resolutionLimits.MaxSubregionsNumber, 1u);
+    if (m_subregionMode == D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_UNIFORM_PARTITIONING_ROWS_PER_SUBREGION)
+    {
+        // Slices are made taller if the device can't write as many of them.
+        const UINT macroblockRows = (m_resolutionDesc.Height + 15) / 16;
+        const UINT rowsPerSlice = (std::max)(config.sliceSize, (macroblockRows + maxSliceCount - 1) / maxSliceCount);
+        m_sliceLayout.NumberOfRowsPerSlice = rowsPerSlice;
+        m_maxSliceCount = (macroblockRows + rowsPerSlice - 1) / rowsPerSlice;
+    }
+    else
+    {
+        m_sliceLayout.MaxBytesPerSlice = config.sliceSize;
+        m_maxSliceCount = maxSliceCount;
+    }
+}
+
+void EncoderH264DX12::CreateVideoEncoder()
+{
+    D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC resolutionDescList[] = { m_resolutionDesc };
+
+    D3D12_VIDEO_ENCODER_DESC encoderDesc = {};
+    encoderDesc.EncodeCodec = D3D12_VIDEO_ENCODER_CODEC_H264;
+    encoderDesc.EncodeProfile = m_profileDesc;
+    encoderDesc.InputFormat = m_inputFormat;
+    encoderDesc.CodecConfiguration = m_codecConfiguration;
+
+    ThrowIfFailed(m_videoDevice->CreateVideoEncoder(&encoderDesc, IID_PPV_ARGS(&m_videoEncoder)));
+
+
+    D3D12_VIDEO_ENCODER_HEAP_DESC encoderHeapDesc = {};
+    encoderHeapDesc.Flags = D3D12_VIDEO_ENCODER_HEAP_FLAG_NONE;
+    encoderHeapDesc.EncodeCodec = encoderDesc.EncodeCodec;
+    encoderHeapDesc.EncodeProfile = encoderDesc.EncodeProfile;
+    encoderHeapDesc.EncodeLevel.pH264LevelSetting = &m_maxSupportedLevel;
+    encoderHeapDesc.EncodeLevel.DataSize = sizeof(m_maxSupportedLevel);
+    encoderHeapDesc.ResolutionsListCount = _countof(resolutionDescList);
+    encoderHeapDesc.pResolutionList = resolutionDescList;
+
+    ThrowIfFailed(m_videoDevice->CreateVideoEncoderHeap(&encoderHeapDesc, IID_PPV_ARGS(&m_videoEncoderHeap)));
+}
+
+EncoderCapabilities EncoderH264DX12::GetCapabilities(const EncoderConfiguration& config)
+{
+    auto& cache = CapabilityCache::Instance();
+    if (!config.capabilityCacheFile.empty())
+    {
+        cache.LoadFromFile(config.capabilityCacheFile);
+    }
+
+    const CapabilityCache::Key key = cache.MakeKey(m_device.Get(), config, m_inputFormat);
+    if (auto capabilities = cache.Find(key))
+    {
+        LogMessage(LogLevel::E_INFO, "Using cached capabilities, H264 profile: " + GetProfileName(capabilities->profile));
+        return *capabilities;
+    }
+
+    const EncoderCapabilities capabilities = QueryCapabilities(config);
+    cache.Insert(key, capabilities);
+    if (!config.capabilityCacheFile.empty())
+    {
+        cache.SaveToFile(config.capabilityCacheFile);
+    }
+    return capabilities;
+}
+
+EncoderCapabilities EncoderH264DX12::QueryCapabilities(const EncoderConfiguration& config)
+{
+    EncoderCapabilities capabilities{};
+
+    m_h264Profile = NegotiateProfile(config.profile);
+    m_codecH264Config = ConfigureCodecH264(config);
+    capabilities.profile = m_h264Profile;
+    capabilities.codecConfiguration = m_codecH264Config;
+
+
+    D3D12_VIDEO_ENCODER_LEVELS_H264 minLevel = {};
     D3D12_FEATURE_DATA_VIDEO_ENCODER_PROFILE_LEVEL profileLevel = {};
     profileLevel.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
     profileLevel.Profile = m_profileDesc;
-    D3D12_VIDEO_ENCODER_LEVELS_H264 minLevelH264 = {};
-    D3D12_VIDEO_ENCODER_LEVELS_H264 maxLevelH264 = {};
-    D3D12_VIDEO_ENCODER_LEVEL_SETTING minLevel = {};
-    minLevel.pH264LevelSetting = &minLevelH264;
-    minLevel.DataSize = sizeof(minLevelH264);
-    D3D12_VIDEO_ENCODER_LEVEL_SETTING maxLevel = {};
-    maxLevel.pH264LevelSetting = &maxLevelH264;
-    maxLevel.DataSize = sizeof(maxLevelH264);
-    profileLevel.MinSupportedLevel = minLevel;
-    profileLevel.MaxSupportedLevel = maxLevel;
+    profileLevel.MinSupportedLevel.pH264LevelSetting = &minLevel;
+    profileLevel.MinSupportedLevel.DataSize = sizeof(minLevel);
+    profileLevel.MaxSupportedLevel.pH264LevelSetting = &capabilities.maxLevel;
+    profileLevel.MaxSupportedLevel.DataSize = sizeof(capabilities.maxLevel);
     ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_PROFILE_LEVEL,
         &profileLevel, sizeof(profileLevel)));
     ThrowIfFalse(profileLevel.IsSupported == TRUE);
 
 
-    D3D12_VIDEO_ENCODER_CODEC_PICTURE_CONTROL_SUPPORT_H264 h264PictureControl = {};
+    D3D12_VIDEO_ENCODER_CODEC_PICTURE_CONTROL_SUPPORT_H264 pictureControlSupport = {};
     D3D12_FEATURE_DATA_VIDEO_ENCODER_CODEC_PICTURE_CONTROL_SUPPORT capPictureControlData = {};
     capPictureControlData.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
-    capPictureControlData.Profile.pH264Profile = &m_h264Profile;
-    capPictureControlData.Profile.DataSize = sizeof(m_h264Profile);
-    capPictureControlData.PictureSupport.pH264Support = &h264PictureControl;
-    capPictureControlData.PictureSupport.DataSize = sizeof(h264PictureControl);
+    capPictureControlData.Profile = m_profileDesc;
+    capPictureControlData.PictureSupport.pH264Support = &pictureControlSupport;
+    capPictureControlData.PictureSupport.DataSize = sizeof(pictureControlSupport);
     ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_CODEC_PICTURE_CONTROL_SUPPORT,
         &capPictureControlData,
         sizeof(capPictureControlData)));
 
     ThrowIfFalse(capPictureControlData.IsSupported == TRUE);
+    capabilities.maxLongTermReferences = pictureControlSupport.MaxLongTermReferences;
 
 
     D3D12_FEATURE_DATA_VIDEO_ENCODER_INPUT_FORMAT inputFormat = {};
     inputFormat.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
-    inputFormat.Profile = profileLevel.Profile;
+    inputFormat.Profile = m_profileDesc;
     inputFormat.Format = m_inputFormat;
     ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_INPUT_FORMAT,
         &inputFormat, sizeof(inputFormat)));
@@ -180,33 +491,72 @@ void EncoderH264DX12::Configure(const EncoderConfiguration& config)
     ThrowIfFalse(inputFormat.IsSupported == TRUE);
 
 
-    m_resourceRequirements.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
-    m_resourceRequirements.Profile = inputFormat.Profile;
-    m_resourceRequirements.InputFormat = inputFormat.Format;
-    m_resourceRequirements.PictureTargetResolution = m_resolutionDesc;
+    D3D12_FEATURE_DATA_VIDEO_ENCODER_RESOURCE_REQUIREMENTS resourceRequirements = {};
+    resourceRequirements.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
+    resourceRequirements.Profile = m_profileDesc;
+    resourceRequirements.InputFormat = m_inputFormat;
+    resourceRequirements.PictureTargetResolution = m_resolutionDesc;
     ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_RESOURCE_REQUIREMENTS,
-        &m_resourceRequirements, sizeof(m_resourceRequirements)));
+        &resourceRequirements, sizeof(resourceRequirements)));
 
-    ThrowIfFalse(m_resourceRequirements.IsSupported == TRUE);
+    ThrowIfFalse(resourceRequirements.IsSupported == TRUE);
 
-    m_resolvedMetadataBufferSize = D3DX12Align<UINT64>(
-        sizeof(D3D12_VIDEO_ENCODER_OUTPUT_METADATA) + sizeof(D3D12_VIDEO_ENCODER_FRAME_SUBREGION_METADATA),
-        m_resourceRequirements.EncoderMetadataBufferAccessAlignment);
+    capabilities.compressedBitstreamBufferAccessAlignment = resourceRequirements.CompressedBitstreamBufferAccessAlignment;
+    capabilities.encoderMetadataBufferAccessAlignment = resourceRequirements.EncoderMetadataBufferAccessAlignment;
+    capabilities.maxEncoderOutputMetadataBufferSize = resourceRequirements.MaxEncoderOutputMetadataBufferSize;
+
+
+    capabilities.subregionMode = GetSubregionLayoutMode(config.sliceMode);
+    if (capabilities.subregionMode != D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME)
+    {
+        D3D12_FEATURE_DATA_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE subregionMode = {};
+        subregionMode.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
+        subregionMode.Profile = m_profileDesc;
+        subregionMode.Level.pH264LevelSetting = &capabilities.maxLevel;
+        subregionMode.Level.DataSize = sizeof(capabilities.maxLevel);
+        subregionMode.SubregionMode = capabilities.subregionMode;
+        ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE,
+            &subregionMode, sizeof(subregionMode)));
+
+        if (subregionMode.IsSupported != TRUE)
+        {
+            capabilities.subregionMode = D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME;
+        }
+    }
+
+
+    capabilities.intraRefreshMode = D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_NONE;
+    if (config.intraRefreshPeriod > 0)
+    {
+        D3D12_FEATURE_DATA_VIDEO_ENCODER_INTRA_REFRESH_MODE intraRefreshMode = {};
+        intraRefreshMode.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
+        intraRefreshMode.Profile = m_profileDesc;
+        intraRefreshMode.Level.pH264LevelSetting = &capabilities.maxLevel;
+        intraRefreshMode.Level.DataSize = sizeof(capabilities.maxLevel);
+        intraRefreshMode.IntraRefreshMode = D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_ROW_BASED;
+        ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_INTRA_REFRESH_MODE,
+            &intraRefreshMode, sizeof(intraRefreshMode)));
+
+        if (intraRefreshMode.IsSupported == TRUE)
+        {
+            capabilities.intraRefreshMode = D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_ROW_BASED;
+        }
+    }
 
 
     D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC resolutionDescList[] = { m_resolutionDesc };
 
     D3D12_FEATURE_DATA_VIDEO_ENCODER_SUPPORT encoderSupport = {};
     encoderSupport.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
-    encoderSupport.InputFormat = inputFormat.Format;
+    encoderSupport.InputFormat = m_inputFormat;
     encoderSupport.CodecConfiguration = m_codecConfiguration;
     encoderSupport.CodecGopSequence = m_gopStructure;
     encoderSupport.RateControl = m_rateControl;
-    encoderSupport.IntraRefresh = D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_NONE;
-    encoderSupport.SubregionFrameEncoding = D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME;
-    encoderSupport.ResolutionsListCount = _countof(resolutionDescList);;
+    encoderSupport.IntraRefresh = capabilities.intraRefreshMode;
+    encoderSupport.SubregionFrameEncoding = capabilities.subregionMode;
+    encoderSupport.ResolutionsListCount = _countof(resolutionDescList);
     encoderSupport.pResolutionList = resolutionDescList;
-    encoderSupport.MaxReferenceFramesInDPB = m_maxReferenceFrameCount;
+    encoderSupport.MaxReferenceFramesInDPB = m_maxReferenceFrameCount + m_requestedLongTermReferenceFrameCount;
 
     D3D12_VIDEO_ENCODER_LEVELS_H264 receivedLevel = {};
     encoderSupport.SuggestedLevel.DataSize = sizeof(receivedLevel);
@@ -216,8 +566,7 @@ void EncoderH264DX12::Configure(const EncoderConfiguration& config)
     encoderSupport.SuggestedProfile.DataSize = sizeof(receivedProfile);
     encoderSupport.SuggestedProfile.pH264Profile = &receivedProfile;
 
-    std::vector<D3D12_FEATURE_DATA_VIDEO_ENCODER_RESOLUTION_SUPPORT_LIMITS> resolutionLimits{ encoderSupport.ResolutionsListCount };
-    encoderSupport.pResolutionDependentSupport = resolutionLimits.data();
+    encoderSupport.pResolutionDependentSupport = &capabilities.resolutionLimits;
 
     ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_SUPPORT,
         &encoderSupport, sizeof(encoderSupport)));
@@ -226,50 +575,147 @@ void EncoderH264DX12::Configure(const EncoderConfiguration& config)
     {
         ThrowEncoderSupportError(encoderSupport.ValidationFlags);
     }
+    capabilities.supportFlags = encoderSupport.SupportFlags;
 
+    return capabilities;
+}
 
-    D3D12_VIDEO_ENCODER_DESC encoderDesc = {};
-    encoderDesc.EncodeCodec = D3D12_VIDEO_ENCODER_CODEC_H264;
-    encoderDesc.EncodeProfile = profileLevel.Profile;
-    encoderDesc.InputFormat = m_inputFormat;
-    encoderDesc.CodecConfiguration = m_codecConfiguration;
+D3D12_VIDEO_ENCODER_PROFILE_H264 EncoderH264DX12::NegotiateProfile(H264Profile requestedProfile)
+{
+    std::vector<D3D12_VIDEO_ENCODER_PROFILE_H264> candidates;
+    switch (requestedProfile)
+    {
+    case H264Profile::Main:
+        candidates = { D3D12_VIDEO_ENCODER_PROFILE_H264_MAIN };
+        break;
+    case H264Profile::High:
+        candidates = { D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH };
+        break;
+    case H264Profile::High10:
+        candidates = { D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH_10 };
+        break;
+    case H264Profile::Auto:
+    default:
+        if (m_inputFormat == DXGI_FORMAT_P010)
+        {
+            // 10-bit samples are allowed only in High10 profile.
+            candidates = { D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH_10 };
+        }
+        else
+        {
+            // High profile allows 8x8 transform on top of Main profile tools.
+            candidates = { D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH, D3D12_VIDEO_ENCODER_PROFILE_H264_MAIN };
+        }
+        break;
+    }
 
-    ThrowIfFailed(m_videoDevice->CreateVideoEncoder(&encoderDesc, IID_PPV_ARGS(&m_videoEncoder)));
+    for (auto candidate : candidates)
+    {
+        if (IsProfileSupported(candidate))
+        {
+            LogMessage(LogLevel::E_INFO, "Selected H264 profile: " + GetProfileName(candidate));
+            return candidate;
+        }
+    }
 
+    throw std::runtime_error("Requested H264 profile is not supported");
+}
 
-    D3D12_VIDEO_ENCODER_HEAP_DESC encoderHeapDesc = {};
-    encoderHeapDesc.Flags = D3D12_VIDEO_ENCODER_HEAP_FLAG_NONE;
-    encoderHeapDesc.EncodeCodec = encoderDesc.EncodeCodec;
-    encoderHeapDesc.EncodeProfile = encoderDesc.EncodeProfile;
-    encoderHeapDesc.EncodeLevel.pHEVCLevelSetting = nullptr;
-    encoderHeapDesc.EncodeLevel = maxLevel;
-    encoderHeapDesc.ResolutionsListCount = _countof(resolutionDescList);
-    encoderHeapDesc.pResolutionList = resolutionDescList;
+bool EncoderH264DX12::IsProfileSupported(D3D12_VIDEO_ENCODER_PROFILE_H264 profile)
+{
+    D3D12_FEATURE_DATA_VIDEO_ENCODER_PROFILE_LEVEL profileLevel = {};
+    profileLevel.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
+    profileLevel.Profile.pH264Profile = &profile;
+    profileLevel.Profile.DataSize = sizeof(profile);
+    D3D12_VIDEO_ENCODER_LEVELS_H264 minLevelH264 = {};
+    D3D12_VIDEO_ENCODER_LEVELS_H264 maxLevelH264 = {};
+    profileLevel.MinSupportedLevel.pH264LevelSetting = &minLevelH264;
+    profileLevel.MinSupportedLevel.DataSize = sizeof(minLevelH264);
+    profileLevel.MaxSupportedLevel.pH264LevelSetting = &maxLevelH264;
+    profileLevel.MaxSupportedLevel.DataSize = sizeof(maxLevelH264);
+    if (FAILED(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_PROFILE_LEVEL,
+        &profileLevel, sizeof(profileLevel))) || !profileLevel.IsSupported)
+    {
+        return false;
+    }
 
-    ThrowIfFailed(m_videoDevice->CreateVideoEncoderHeap(&encoderHeapDesc, IID_PPV_ARGS(&m_videoEncoderHeap)));
+    D3D12_FEATURE_DATA_VIDEO_ENCODER_INPUT_FORMAT inputFormat = {};
+    inputFormat.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
+    inputFormat.Profile = profileLevel.Profile;
+    inputFormat.Format = m_inputFormat;
+    if (FAILED(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_INPUT_FORMAT,
+        &inputFormat, sizeof(inputFormat))) || !inputFormat.IsSupported)
+    {
+        return false;
+    }
 
-    bool gopHasInterFrames =
-        (m_h264GopStructure.PPicturePeriod > 0) &&
-        ((m_h264GopStructure.GOPLength == 0) || (m_h264GopStructure.PPicturePeriod < m_h264GopStructure.GOPLength));
+    return true;
+}
 
-    m_referenceFramesManager = std::make_unique<ReferenceFramesManager>(
-        m_device, m_resolutionDesc, m_inputFormat, m_maxReferenceFrameCount, gopHasInterFrames);
+D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264 EncoderH264DX12::ConfigureCodecH264(const EncoderConfiguration& config)
+{
+    D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_SUPPORT_H264 h264CodecSupport = {};
+    D3D12_FEATURE_DATA_VIDEO_ENCODER_CODEC_CONFIGURATION_SUPPORT codecSupport = {};
+    codecSupport.Codec = D3D12_VIDEO_ENCODER_CODEC_H264;
+    codecSupport.Profile = m_profileDesc;
+    codecSupport.CodecSupportLimits.pH264Support = &h264CodecSupport;
+    codecSupport.CodecSupportLimits.DataSize = sizeof(h264CodecSupport);
+    ThrowIfFailed(m_videoDevice->CheckFeatureSupport(D3D12_FEATURE_VIDEO_ENCODER_CODEC_CONFIGURATION_SUPPORT,
+        &codecSupport, sizeof(codecSupport)));
+
+    ThrowIfFalse(codecSupport.IsSupported == TRUE);
+
+    const auto supportFlags = h264CodecSupport.SupportFlags;
+    const bool isHighProfile = (m_h264Profile == D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH)
+        || (m_h264Profile == D3D12_VIDEO_ENCODER_PROFILE_H264_HIGH_10);
+
+    D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264 codecH264Config = {};
+    codecH264Config.DisableDeblockingFilterConfig =
+        D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264_SLICES_DEBLOCKING_MODE_0_ALL_LUMA_CHROMA_SLICE_BLOCK_EDGES_ALWAYS_FILTERED;
+
+    if (config.enableCabac
+        && (supportFlags & D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_SUPPORT_H264_FLAG_CABAC_ENCODING_SUPPORT))
+    {
+        codecH264Config.ConfigurationFlags |= D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264_FLAG_ENABLE_CABAC_ENCODING;
+    }
 
-    CreateOutputBufferResource();
-    CreateEncodeCommand();
-    CreateOutputCommand();
+    if (config.enableAdaptive8x8Transform && isHighProfile
+        && (supportFlags & D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_SUPPORT_H264_FLAG_ADAPTIVE_8x8_TRANSFORM_ENCODING_SUPPORT))
+    {
+        codecH264Config.ConfigurationFlags |= D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264_FLAG_USE_ADAPTIVE_8x8_TRANSFORM;
+    }
+
+    // Direct modes are used only by B-frames.
+    if (config.enableDirectModes && config.bFramesCount > 0)
+    {
+        if (supportFlags & D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_SUPPORT_H264_FLAG_DIRECT_SPATIAL_ENCODING_SUPPORT)
+            codecH264Config.DirectModeConfig = D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264_DIRECT_MODES_SPATIAL;
+        else if (supportFlags & D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_SUPPORT_H264_FLAG_DIRECT_TEMPORAL_ENCODING_SUPPORT)
+            codecH264Config.DirectModeConfig = D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264_DIRECT_MODES_TEMPORAL;
+    }
+
+    LogMessage(LogLevel::E_INFO, std::string("H264 coding tools: CABAC ")
+        + ((codecH264Config.ConfigurationFlags & D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264_FLAG_ENABLE_CABAC_ENCODING) ? "on" : "off")
+        + ", 8x8 transform "
+        + ((codecH264Config.ConfigurationFlags & D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264_FLAG_USE_ADAPTIVE_8x8_TRANSFORM) ? "on" : "off")
+        + ", direct mode " + std::to_string(codecH264Config.DirectModeConfig));
+
+    return codecH264Config;
 }
 
 D3D12_VIDEO_ENCODER_SEQUENCE_GOP_STRUCTURE_H264
-EncoderH264DX12::ConfigureGOPStructure(UINT gopLengthInFrames, UINT bFramesCount)
+EncoderH264DX12::ConfigureGOPStructure(UINT gopLengthInFrames, UINT bFramesCount, bool openGop)
 {
     D3D12_VIDEO_ENCODER_SEQUENCE_GOP_STRUCTURE_H264 h264GopStructure = {};
     h264GopStructure.GOPLength = gopLengthInFrames;
     h264GopStructure.PPicturePeriod = gopLengthInFrames == 1 /*Key frames only*/ ? 0 : bFramesCount + 1;
     h264GopStructure.pic_order_cnt_type = 0;
 
-    // @todo: This is temp fix for infinite GOP.
-    auto GOPLength = h264GopStructure.GOPLength == 0 ? (1 << 15) : h264GopStructure.GOPLength;
+    // frame_num and POC of infinite and open GOPs are counted from the IDR frame across I-frames and wrap:
+    // MaxFrameNum 2^15 and the POC lsb 2^16, so frames up to 2^15 apart in display order are told apart.
+    // The decoder unwraps both, POC grows until PicturePlanner restarts it with MMCO 5
+    // every PictureNumberingRestartInterval frames.
+    auto GOPLength = h264GopStructure.GOPLength == 0 || openGop ? (1 << 15) : h264GopStructure.GOPLength;
 
     const uint32_t max_pic_order_cnt_lsb = 2 * GOPLength;
     const uint32_t max_max_frame_num = GOPLength;
@@ -292,14 +738,20 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
     ThrowIfFalse((inputFrameResources.GetHeight() == m_resolutionDesc.Height)
         && (inputFrameResources.GetWidth() == m_resolutionDesc.Width));
 
-    m_currentFrame = inputFrame;
+    // Encoded data of all sent frames should be read before reusing their output buffers.
+    ThrowIfFalse(m_sentFrames.size() < m_outputSlots.size());
+    const size_t slotIndex = m_nextOutputSlot;
+    m_nextOutputSlot = (m_nextOutputSlot + 1) % m_outputSlots.size();
+    auto& slot = m_outputSlots[slotIndex];
 
-    // Wait on GPU for completion of copying the frame to input texture.
-    inputFrameResources.WaitForUploadingGPU(m_encodeCommandQueue.Get());
+    BeginRecording();
+
+    m_currentFrame = inputFrame;
 
     UpdateCurrentFrameInfo(m_currentFrame);
     bool isCurrentFrameUsedAsReference = m_currentFrame.useAsReference;
-    m_referenceFramesManager->PrepareForEncodingFrame(m_curPicParamsData, isCurrentFrameUsedAsReference);
+    m_referenceFramesManager->PrepareForEncodingFrame(m_curPicParamsData, isCurrentFrameUsedAsReference,
+        m_currentFrame.longTermReference, m_currentFrame.restartPictureNumbering);
     m_referenceFramesManager->GetPictureControlCodecData(m_curPicParamsData);
 
 
@@ -307,10 +759,10 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
         CD3DX12_RESOURCE_BARRIER::Transition(inputFrameResources.GetInputTextureRawPtr(),
             D3D12_RESOURCE_STATE_COMMON,
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_READ),
-        CD3DX12_RESOURCE_BARRIER::Transition(m_outputBitrstreamBuffer.Get(),
+        CD3DX12_RESOURCE_BARRIER::Transition(slot.outputBitstreamBuffer.Get(),
             D3D12_RESOURCE_STATE_COMMON,
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_WRITE),
-        CD3DX12_RESOURCE_BARRIER::Transition(m_metadataOutputBuffer.Get(),
+        CD3DX12_RESOURCE_BARRIER::Transition(slot.metadataOutputBuffer.Get(),
             D3D12_RESOURCE_STATE_COMMON,
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_WRITE)
     };
@@ -346,14 +798,17 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
         m_encodeCommandList->ResourceBarrier(refFramesTransitions.size(), refFramesTransitions.data());
     }
 
-    uint32_t prefixGeneratedHeadersByteSize = BuildCodecHeadersH264();
+    uint32_t prefixGeneratedHeadersByteSize = BuildCodecHeadersH264(slot.bitstreamHeadersBuffer);
+    slot.temporalLayerIndex = m_temporalLayerCount > 1
+        ? std::optional<UINT>(m_currentFrame.temporalLayerIndex)
+        : std::nullopt;
     if ((m_resourceRequirements.CompressedBitstreamBufferAccessAlignment > 1)
         && ((prefixGeneratedHeadersByteSize % m_resourceRequirements.CompressedBitstreamBufferAccessAlignment) != 0))
     {
         prefixGeneratedHeadersByteSize = D3DX12Align(prefixGeneratedHeadersByteSize,
             m_resourceRequirements.CompressedBitstreamBufferAccessAlignment);
 
-        m_bitstreamHeadersBuffer.resize(prefixGeneratedHeadersByteSize, 0);
+        slot.bitstreamHeadersBuffer.resize(prefixGeneratedHeadersByteSize, 0);
     }
 
     D3D12_VIDEO_ENCODER_PICTURE_CONTROL_FLAGS pictureControlFlags = D3D12_VIDEO_ENCODER_PICTURE_CONTROL_FLAG_NONE;
@@ -363,25 +818,52 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
         pictureControlFlags |= D3D12_VIDEO_ENCODER_PICTURE_CONTROL_FLAG_USED_AS_REFERENCE_PICTURE;
     }
 
+    D3D12_VIDEO_ENCODER_PICTURE_CONTROL_SUBREGIONS_LAYOUT_DATA subregionsLayoutData = {};
+    if (m_subregionMode != D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME)
+    {
+        subregionsLayoutData.DataSize = sizeof(m_sliceLayout);
+        subregionsLayoutData.pSlicesPartition_H264 = &m_sliceLayout;
+    }
+
+    D3D12_VIDEO_ENCODER_SEQUENCE_CONTROL_FLAGS sequenceControlFlags = D3D12_VIDEO_ENCODER_SEQUENCE_CONTROL_FLAG_NONE;
+    if (m_isRateControlReconfigurationSupported && UpdateFrameQP(inputFrame.frameType, inputFrame.qp))
+    {
+        sequenceControlFlags |= D3D12_VIDEO_ENCODER_SEQUENCE_CONTROL_FLAG_RATE_CONTROL_CHANGE;
+    }
+
+    // The first frame of each wave requests the refresh, the following ones pass their index in it.
+    D3D12_VIDEO_ENCODER_INTRA_REFRESH intraRefresh = {
+        .Mode = D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_NONE,
+        .IntraRefreshDuration = 0,
+    };
+    if (inputFrame.intraRefreshFrameIndex.has_value())
+    {
+        assert(m_intraRefreshPeriod > 0 && *inputFrame.intraRefreshFrameIndex < m_intraRefreshPeriod);
+        intraRefresh = {
+            .Mode = m_intraRefreshMode,
+            .IntraRefreshDuration = m_intraRefreshPeriod,
+        };
+        if (*inputFrame.intraRefreshFrameIndex == 0)
+        {
+            sequenceControlFlags |= D3D12_VIDEO_ENCODER_SEQUENCE_CONTROL_FLAG_REQUEST_INTRA_REFRESH;
+        }
+    }
+
     const D3D12_VIDEO_ENCODER_ENCODEFRAME_INPUT_ARGUMENTS inputArguments = {
         .SequenceControlDesc = D3D12_VIDEO_ENCODER_SEQUENCE_CONTROL_DESC
         {
-            .Flags = D3D12_VIDEO_ENCODER_SEQUENCE_CONTROL_FLAG_NONE,
-            .IntraRefreshConfig = D3D12_VIDEO_ENCODER_INTRA_REFRESH
-            {
-                .Mode = D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_NONE,
-                .IntraRefreshDuration = 0,
-            },
+            .Flags = sequenceControlFlags,
+            .IntraRefreshConfig = intraRefresh,
             .RateControl = m_rateControl,
             .PictureTargetResolution = m_resolutionDesc,
-            .SelectedLayoutMode = D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME,
-            .FrameSubregionsLayoutData = {},
+            .SelectedLayoutMode = m_subregionMode,
+            .FrameSubregionsLayoutData = subregionsLayoutData,
             .CodecGopSequence = m_gopStructure,
         },
 
         .PictureControlDesc = D3D12_VIDEO_ENCODER_PICTURE_CONTROL_DESC
         {
-            .IntraRefreshFrameIndex = 0,
+            .IntraRefreshFrameIndex = inputFrame.intraRefreshFrameIndex.value_or(0),
             .Flags = pictureControlFlags,
             .PictureControlCodecData = m_curPicParamsData,
             .ReferenceFrames = referenceFrames,
@@ -396,21 +878,21 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
     {
         .Bitstream = D3D12_VIDEO_ENCODER_COMPRESSED_BITSTREAM
         {
-            .pBuffer = m_outputBitrstreamBuffer.Get(),
+            .pBuffer = slot.outputBitstreamBuffer.Get(),
             .FrameStartOffset = prefixGeneratedHeadersByteSize // Bitstream headers in the beginning
         },
         .ReconstructedPicture = reconstructedPicture,
         .EncoderOutputMetadata = D3D12_VIDEO_ENCODER_ENCODE_OPERATION_METADATA_BUFFER
         {
-            .pBuffer = m_metadataOutputBuffer.Get(),
+            .pBuffer = slot.metadataOutputBuffer.Get(),
             .Offset = 0
         }
     };
 
-    assert(prefixGeneratedHeadersByteSize == m_bitstreamHeadersBuffer.size());
+    assert(prefixGeneratedHeadersByteSize == slot.bitstreamHeadersBuffer.size());
 
     // Upload bitstream headers to GPU (see description of CurrentFrameBitstreamMetadataSize in the doc).
-    UploadBitstreamHeaders();
+    UploadBitstreamHeaders(slot);
 
 
     m_encodeCommandList->EncodeFrame(m_videoEncoder.Get(),
@@ -418,16 +900,16 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
 
 
     const D3D12_RESOURCE_BARRIER resolveMetadataStateTransitions[] = {
-        CD3DX12_RESOURCE_BARRIER::Transition(m_resolvedMetadataBuffer.Get(),
+        CD3DX12_RESOURCE_BARRIER::Transition(slot.resolvedMetadataBuffer.Get(),
             D3D12_RESOURCE_STATE_COMMON,
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_WRITE),
-        CD3DX12_RESOURCE_BARRIER::Transition(m_metadataOutputBuffer.Get(),
+        CD3DX12_RESOURCE_BARRIER::Transition(slot.metadataOutputBuffer.Get(),
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_WRITE,
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_READ),
         CD3DX12_RESOURCE_BARRIER::Transition(inputFrameResources.GetInputTextureRawPtr(),
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_READ,
             D3D12_RESOURCE_STATE_COMMON),
-        CD3DX12_RESOURCE_BARRIER::Transition(m_outputBitrstreamBuffer.Get(),
+        CD3DX12_RESOURCE_BARRIER::Transition(slot.outputBitstreamBuffer.Get(),
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_WRITE,
             D3D12_RESOURCE_STATE_COMMON)
     };
@@ -444,13 +926,13 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
         .EncodedPictureEffectiveResolution = m_resolutionDesc,
         .HWLayoutMetadata = D3D12_VIDEO_ENCODER_ENCODE_OPERATION_METADATA_BUFFER
         {
-            .pBuffer = m_metadataOutputBuffer.Get(),
+            .pBuffer = slot.metadataOutputBuffer.Get(),
             .Offset = 0
         }
     };
 
     const D3D12_VIDEO_ENCODER_RESOLVE_METADATA_OUTPUT_ARGUMENTS outputMetadataArgs = {
-        { m_resolvedMetadataBuffer.Get(), 0 }
+        { slot.resolvedMetadataBuffer.Get(), 0 }
     };
     m_encodeCommandList->ResolveEncoderOutputMetadata(&inputMetadataArgs, &outputMetadataArgs);
 
@@ -465,10 +947,10 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
     }
 
     const D3D12_RESOURCE_BARRIER rgRevertResolveMetadataStateTransitions[] = {
-        CD3DX12_RESOURCE_BARRIER::Transition(m_resolvedMetadataBuffer.Get(),
+        CD3DX12_RESOURCE_BARRIER::Transition(slot.resolvedMetadataBuffer.Get(),
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_WRITE,
             D3D12_RESOURCE_STATE_COMMON),
-        CD3DX12_RESOURCE_BARRIER::Transition(m_metadataOutputBuffer.Get(),
+        CD3DX12_RESOURCE_BARRIER::Transition(slot.metadataOutputBuffer.Get(),
             D3D12_RESOURCE_STATE_VIDEO_ENCODE_READ,
             D3D12_RESOURCE_STATE_COMMON),
     };
@@ -477,22 +959,83 @@ void EncoderH264DX12::SendFrame(const InputFrame& inputFrame, const InputFrameRe
         rgRevertResolveMetadataStateTransitions);
 
 
+    // Following frames of the batch refer to this one, the commands are executed in the recorded order.
+    m_referenceFramesManager->UpdateReferenceFrames();
+    m_isFirstFrame = false;
+
+    m_sentFrames.push_back(SentFrame{ slotIndex, nullptr });
+    // Wait on GPU for completion of copying the frame to input texture.
+    m_recordedDependencies.push_back(inputFrameResources.GetUploadSubmission());
+    if (m_recordedDependencies.size() == m_framesPerSubmission)
+    {
+        SubmitRecordedFrames();
+    }
+}
+
+void EncoderH264DX12::BeginRecording()
+{
+    if (!m_isCommandListClosed)
+        return;
+
+    // The allocator can be reset only after GPU completes its previous submission, the other batch may still
+    // be encoded.
+    auto& allocatorSubmission = m_allocatorSubmissions[m_currentAllocator];
+    if (allocatorSubmission)
+    {
+        m_encodeSubmitter->WaitForCompletion(allocatorSubmission);
+        allocatorSubmission = nullptr;
+    }
+    const auto& allocator = m_encodeCommandAllocators[m_currentAllocator];
+    ThrowIfFailed(allocator->Reset());
+    ThrowIfFailed(m_encodeCommandList->Reset(allocator.Get()));
+    m_isCommandListClosed = false;
+}
+
+void EncoderH264DX12::WaitForSubmissions()
+{
+    for (auto& allocatorSubmission : m_allocatorSubmissions)
+    {
+        if (allocatorSubmission)
+        {
+            m_encodeSubmitter->WaitForCompletion(allocatorSubmission);
+            allocatorSubmission = nullptr;
+        }
+    }
+}
+
+void EncoderH264DX12::SubmitRecordedFrames()
+{
+    assert(!m_isCommandListClosed && !m_recordedDependencies.empty());
+
     ThrowIfFailed(m_encodeCommandList->Close());
-    ID3D12CommandList* commandLists[] = { m_encodeCommandList.Get() };
-    m_encodeCommandQueue->ExecuteCommandLists(_countof(commandLists), commandLists);
+    m_isCommandListClosed = true;
 
-    ThrowIfFailed(m_encodeCommandQueue->Signal(m_encoderFence.Get(), m_encoderFenceValue));
+    const SubmissionHandle submission = m_encodeSubmitter->Submit({ m_encodeCommandList.Get() }, m_recordedDependencies);
+    m_recordedDependencies.clear();
+    m_allocatorSubmissions[m_currentAllocator] = submission;
+    m_currentAllocator = (m_currentAllocator + 1) % m_encodeCommandAllocators.size();
+
+    for (auto it = m_sentFrames.rbegin(); (it != m_sentFrames.rend()) && !it->submission; ++it)
+    {
+        it->submission = submission;
+    }
 }
 
-D3D12_VIDEO_ENCODER_OUTPUT_METADATA EncoderH264DX12::ReadResolvedMetadata()
+D3D12_VIDEO_ENCODER_OUTPUT_METADATA EncoderH264DX12::ReadResolvedMetadata(const OutputSlot& slot,
+    std::vector<D3D12_VIDEO_ENCODER_FRAME_SUBREGION_METADATA>& slicesMetadata)
 {
     D3D12_VIDEO_ENCODER_OUTPUT_METADATA metadata;
     const auto metadataBufferSize = sizeof(metadata);
     void* resolvedMetadata = nullptr;
     D3D12_RANGE readRange = { 0, m_resolvedMetadataBufferSize };
-    ThrowIfFailed(m_resolvedMetadataBuffer->Map(0, &readRange, &resolvedMetadata));
+    ThrowIfFailed(slot.resolvedMetadataBuffer->Map(0, &readRange, &resolvedMetadata));
     memcpy(&metadata, resolvedMetadata, metadataBufferSize);
-    m_resolvedMetadataBuffer->Unmap(0, nullptr);
+
+    const size_t sliceCount = (std::min)(static_cast<size_t>(metadata.WrittenSubregionsCount), size_t(m_maxSliceCount));
+    slicesMetadata.resize(sliceCount);
+    memcpy(slicesMetadata.data(), static_cast<const uint8_t*>(resolvedMetadata) + metadataBufferSize,
+        sliceCount * sizeof(D3D12_VIDEO_ENCODER_FRAME_SUBREGION_METADATA));
+    slot.resolvedMetadataBuffer->Unmap(0, nullptr);
 
     if (metadata.EncodeErrorFlags != D3D12_VIDEO_ENCODER_ENCODE_ERROR_FLAG_NO_ERROR)
     {
@@ -502,47 +1045,123 @@ D3D12_VIDEO_ENCODER_OUTPUT_METADATA EncoderH264DX12::ReadResolvedMetadata()
     return metadata;
 }
 
-void EncoderH264DX12::ReadEncodedData(std::vector<uint8_t>& encodedData)
+void EncoderH264DX12::ReadEncodedData(const OutputSlot& slot, std::vector<uint8_t>& encodedData,
+    std::vector<EncodedSlice>& slices)
 {
-    const D3D12_VIDEO_ENCODER_OUTPUT_METADATA metadata = ReadResolvedMetadata();
-    auto encodedFrameSize = metadata.EncodedBitstreamWrittenBytesCount + m_bitstreamHeadersBuffer.size();
+    const D3D12_VIDEO_ENCODER_OUTPUT_METADATA metadata = ReadResolvedMetadata(slot, m_slicesMetadata);
+    const size_t headersSize = slot.bitstreamHeadersBuffer.size();
+    auto encodedFrameSize = metadata.EncodedBitstreamWrittenBytesCount + headersSize;
     assert(encodedFrameSize);
 
-    encodedData.resize(encodedFrameSize);
-
     void* encodedFrameData = nullptr;
     D3D12_RANGE readRange = { 0, encodedFrameSize };
-    ThrowIfFailed(m_outputBitrstreamBuffer->Map(0, &readRange, &encodedFrameData));
-    memcpy(encodedData.data(), encodedFrameData, encodedFrameSize);
-    m_outputBitrstreamBuffer->Unmap(0, nullptr);
+    ThrowIfFailed(slot.outputBitstreamBuffer->Map(0, &readRange, &encodedFrameData));
+    const uint8_t* bitstream = static_cast<const uint8_t*>(encodedFrameData);
+
+    slices.clear();
+    encodedData.assign(bitstream, bitstream + headersSize);
+    if (m_slicesMetadata.empty())
+    {
+        AppendSlice(slot, bitstream + headersSize, encodedFrameSize - headersSize, encodedData, slices);
+    }
+    else
+    {
+        // Each slice may be preceded by padding, the slices are packed one after another without it.
+        size_t sliceStart = headersSize;
+        for (const auto& sliceMetadata : m_slicesMetadata)
+        {
+            const size_t dataStart = sliceStart + static_cast<size_t>(sliceMetadata.bStartOffset);
+            const size_t dataSize = static_cast<size_t>(sliceMetadata.bSize - sliceMetadata.bStartOffset);
+            ThrowIfFalse(sliceMetadata.bStartOffset <= sliceMetadata.bSize
+                && dataStart + dataSize <= encodedFrameSize);
+
+            AppendSlice(slot, bitstream + dataStart, dataSize, encodedData, slices);
+            sliceStart += static_cast<size_t>(sliceMetadata.bSize);
+        }
+    }
+    slot.outputBitstreamBuffer->Unmap(0, nullptr);
 }
 
-uint32_t EncoderH264DX12::BuildCodecHeadersH264()
+void EncoderH264DX12::AppendSlice(const OutputSlot& slot, const uint8_t* slice, size_t sliceSize,
+    std::vector<uint8_t>& encodedData, std::vector<EncodedSlice>& slices)
 {
-    size_t writtenSPSBytesCount = 0;
-    bool isFirstFrame = (m_encoderFenceValue == 1);
-    bool writeNewSPS = isFirstFrame;
+    const size_t sliceOffset = encodedData.size();
+    if (slot.temporalLayerIndex.has_value())
+    {
+        // The prefix repeats nal_ref_idc and the IDR flag of the slice written by the driver.
+        const uint8_t nalUnitHeader = GetNalUnitHeader(slice, sliceSize);
+        const H264_PREFIX_NALU prefix = {
+            .nal_ref_idc = static_cast<uint32_t>((nalUnitHeader >> 5) & 0x3),
+            .idr_flag = (nalUnitHeader & 0x1f) == NAL_TYPE_IDR ? 1u : 0u,
+            .temporal_id = *slot.temporalLayerIndex,
+        };
+        size_t writtenPrefixBytesCount = 0;
+        m_bitstreamBuilder->write_prefix_nalu(prefix, encodedData, encodedData.end(), writtenPrefixBytesCount);
+    }
+    encodedData.insert(encodedData.end(), slice, slice + sliceSize);
+    slices.push_back(EncodedSlice{ sliceOffset, encodedData.size() - sliceOffset });
+}
 
-    uint32_t activeSeqParameterSetId = m_bitstreamBuilder->get_active_sps_id();
+uint32_t EncoderH264DX12::BuildCodecHeadersH264(std::vector<uint8_t>& headersBuffer)
+{
+    const bool isIDRFrame = m_curPicParamsData.pH264PicData->FrameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+    if (m_lowLatency && !isIDRFrame)
+    {
+        // Parameter sets don't change within the sequence, a decoder joining the stream waits for the next IDR frame.
+        headersBuffer.clear();
+        return AppendSEIMessages(headersBuffer);
+    }
 
-    if (writeNewSPS)
+    // The same SPS is repeated on IDR frames in the low-latency mode.
+    const bool writeSPS = m_isFirstFrame || m_lowLatency;
+    const uint32_t activeSeqParameterSetId = m_bitstreamBuilder->get_active_sps_id();
+
+    size_t writtenSPSBytesCount = 0;
+    if (writeSPS)
     {
-        if (!isFirstFrame)
-        {
-            ++activeSeqParameterSetId;
-            m_bitstreamBuilder->set_active_sps_id(activeSeqParameterSetId);
-        }
+        // B-frames are not used as reference, only the following P-frame is decoded before them. Without
+        // the restriction a decoder may hold the whole DPB of the level before output.
+        const uint32_t maxNumReorderFrames = m_h264GopStructure.PPicturePeriod > 1 ? 1 : 0;
+        const bool hasColorDescription = m_colorDescription.primaries != 2
+            || m_colorDescription.transferCharacteristics != 2 || m_colorDescription.matrixCoefficients != 2;
+        const bool hasFrameRate = m_targetFramerate.Numerator != 0 && m_targetFramerate.Denominator != 0;
+        // Ticks of field duration, the clock timestamps of progressive frames count frames of 2 ticks.
+        // The rate is not fixed, the frame timestamps may have gaps.
+        const H264_VUI vui = {
+            .aspect_ratio_info_present_flag = m_sampleAspectRatio.Numerator != 0 ? 1u : 0u,
+            .aspect_ratio_idc = GetAspectRatioIdc(m_sampleAspectRatio),
+            .sar_width = m_sampleAspectRatio.Numerator,
+            .sar_height = m_sampleAspectRatio.Denominator,
+            .video_signal_type_present_flag = hasColorDescription || m_colorDescription.fullRange ? 1u : 0u,
+            .video_format = 5, // unspecified
+            .video_full_range_flag = m_colorDescription.fullRange ? 1u : 0u,
+            .colour_description_present_flag = hasColorDescription ? 1u : 0u,
+            .colour_primaries = m_colorDescription.primaries,
+            .transfer_characteristics = m_colorDescription.transferCharacteristics,
+            .matrix_coefficients = m_colorDescription.matrixCoefficients,
+            .timing_info_present_flag = hasFrameRate ? 1u : 0u,
+            .num_units_in_tick = m_targetFramerate.Denominator,
+            .time_scale = 2 * m_targetFramerate.Numerator,
+            .fixed_frame_rate_flag = 0,
+            .pic_struct_present_flag = m_timingSEI ? 1u : 0u,
+            .bitstream_restriction_flag = 1,
+            .max_num_reorder_frames = maxNumReorderFrames,
+            .max_dec_frame_buffering =
+                (std::max)(m_maxReferenceFrameCount + m_maxLongTermReferenceFrameCount, maxNumReorderFrames),
+        };
+
         m_bitstreamBuilder->build_sps(*m_profileDesc.pH264Profile,
             m_selectedLevel,
             m_inputFormat,
             *m_codecConfiguration.pH264Config,
             *m_gopStructure.pH264GroupOfPictures,
             activeSeqParameterSetId,
-            m_maxReferenceFrameCount,
+            m_maxReferenceFrameCount + m_maxLongTermReferenceFrameCount,
             m_resolutionDesc,
             m_frameCropping,
-            m_bitstreamHeadersBuffer,
-            m_bitstreamHeadersBuffer.begin(),
+            vui,
+            headersBuffer,
+            headersBuffer.begin(),
             writtenSPSBytesCount);
     }
 
@@ -552,25 +1171,70 @@ uint32_t EncoderH264DX12::BuildCodecHeadersH264()
         *m_curPicParamsData.pH264PicData,
         m_curPicParamsData.pH264PicData->pic_parameter_set_id,
         activeSeqParameterSetId,
-        m_bitstreamHeadersBuffer,
-        m_bitstreamHeadersBuffer.begin() + writtenSPSBytesCount,
+        headersBuffer,
+        headersBuffer.begin() + writtenSPSBytesCount,
         writtenPPSBytesCount);
 
-    if (m_bitstreamHeadersBuffer.size() > (writtenPPSBytesCount + writtenSPSBytesCount))
+    if (headersBuffer.size() > (writtenPPSBytesCount + writtenSPSBytesCount))
     {
-        m_bitstreamHeadersBuffer.resize(writtenPPSBytesCount + writtenSPSBytesCount);
+        headersBuffer.resize(writtenPPSBytesCount + writtenSPSBytesCount);
     }
 
-    return m_bitstreamHeadersBuffer.size();
+    return AppendSEIMessages(headersBuffer);
 }
 
-void EncoderH264DX12::PrepareForNextFrame()
+// SEI messages of the current frame follow the parameter sets, returns the size of all headers.
+uint32_t EncoderH264DX12::AppendSEIMessages(std::vector<uint8_t>& headersBuffer)
 {
-    ThrowIfFailed(m_encodeCommandAllocator->Reset());
-    ThrowIfFailed(m_encodeCommandList->Reset(m_encodeCommandAllocator.Get()));
-    ++m_encoderFenceValue;
+    if (m_currentFrame.recoveryFrameCount.has_value())
+    {
+        const H264_SEI_RECOVERY_POINT recoveryPoint = {
+            .recovery_frame_cnt = *m_currentFrame.recoveryFrameCount,
+            .exact_match_flag = 1,
+            .broken_link_flag = 0,
+        };
+        size_t writtenSEIBytesCount = 0;
+        m_bitstreamBuilder->write_recovery_point_sei(recoveryPoint, headersBuffer, headersBuffer.end(),
+            writtenSEIBytesCount);
+    }
 
-    m_referenceFramesManager->UpdateReferenceFrames();
+    if (m_currentFrame.timing.has_value())
+    {
+        const FrameTiming& timing = *m_currentFrame.timing;
+
+        // Clock timestamp in the VUI ticks: whole seconds, frames of the target frame rate and the rest of
+        // the presentation time in time_offset.
+        const uint64_t seconds = timing.presentationTime / 1000000;
+        const uint64_t secondTicks = (timing.presentationTime % 1000000) * (2 * m_targetFramerate.Numerator) / 1000000;
+        const uint64_t frameTicks = 2 * m_targetFramerate.Denominator;
+        const H264_SEI_PIC_TIMING picTiming = {
+            .pic_struct = 0, // frame
+            .ct_type = 0, // progressive
+            .nuit_field_based_flag = 1,
+            .counting_type = 1, // no dropped n_frames, time_offset used
+            .n_frames = static_cast<uint32_t>(secondTicks / frameTicks),
+            .seconds_value = static_cast<uint32_t>(seconds % 60),
+            .minutes_value = static_cast<uint32_t>(seconds / 60 % 60),
+            .hours_value = static_cast<uint32_t>(seconds / 3600 % 24),
+            .time_offset = static_cast<int32_t>(secondTicks % frameTicks),
+        };
+        size_t writtenSEIBytesCount = 0;
+        m_bitstreamBuilder->write_pic_timing_sei(picTiming, headersBuffer, headersBuffer.end(), writtenSEIBytesCount);
+
+        H264_SEI_USER_DATA_UNREGISTERED userData = {};
+        std::copy(std::begin(TimingSEIUuid), std::end(TimingSEIUuid), userData.uuid_iso_iec_11578);
+        for (uint64_t value : { timing.frameNumber, timing.captureTime, timing.encodingStartTime })
+        {
+            for (int shift = 56; shift >= 0; shift -= 8)
+            {
+                userData.user_data_payload_byte.push_back(static_cast<uint8_t>(value >> shift));
+            }
+        }
+        m_bitstreamBuilder->write_user_data_unregistered_sei(userData, headersBuffer, headersBuffer.end(),
+            writtenSEIBytesCount);
+    }
+
+    return headersBuffer.size();
 }
 
 void EncoderH264DX12::UpdateCurrentFrameInfo(InputFrame& inputFrame)
@@ -580,149 +1244,152 @@ void EncoderH264DX12::UpdateCurrentFrameInfo(InputFrame& inputFrame)
     m_h264PicData.idr_pic_id = inputFrame.idrPicId;
 
     m_h264PicData.PictureOrderCountNumber = inputFrame.pictureOrderCountNumber;
-    m_h264PicData.FrameDecodingOrderNumber = inputFrame.decodingOrderNumber;
+    // Infinite and open GOPs run past MaxFrameNum, the references keep their wrapped frame_num.
+    m_h264PicData.FrameDecodingOrderNumber = inputFrame.decodingOrderNumber % GetMaxFrameNum();
+    m_h264PicData.TemporalLayerIndex = inputFrame.temporalLayerIndex;
 
     m_h264PicData.List0ReferenceFramesCount = inputFrame.l0List.empty() ? 0 : inputFrame.l0List.size();
     m_h264PicData.pList0ReferenceFrames = inputFrame.l0List.data();
     m_h264PicData.List1ReferenceFramesCount = inputFrame.l1List.empty() ? 0 : inputFrame.l1List.size();
     m_h264PicData.pList1ReferenceFrames = inputFrame.l1List.data();
 
+    m_h264PicData.QPMapValuesCount = static_cast<UINT>(inputFrame.deltaQPMap.size());
+    m_h264PicData.pRateControlQPMap = inputFrame.deltaQPMap.empty() ? nullptr : inputFrame.deltaQPMap.data();
+
     m_curPicParamsData.pH264PicData = &m_h264PicData;
     m_curPicParamsData.DataSize = sizeof(m_h264PicData);
 }
 
-void EncoderH264DX12::UploadBitstreamHeaders()
+// Returns true if QP of the frame type differs from the current rate control, which then takes the new QP.
+bool EncoderH264DX12::UpdateFrameQP(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType, UINT qp)
 {
-    auto prefixGeneratedHeadersByteSize = m_bitstreamHeadersBuffer.size();
+    UINT* typeQP = nullptr;
+    switch (frameType)
+    {
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME:
+        typeQP = &m_rateControlCQP.ConstantQP_InterPredictedFrame_PrevRefOnly;
+        break;
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME:
+        typeQP = &m_rateControlCQP.ConstantQP_InterPredictedFrame_BiDirectionalRef;
+        break;
+    default:
+        typeQP = &m_rateControlCQP.ConstantQP_FullIntracodedFrame;
+        break;
+    }
+
+    if (*typeQP == qp)
+        return false;
+
+    *typeQP = qp;
+    return true;
+}
+
+void EncoderH264DX12::UploadBitstreamHeaders(const OutputSlot& slot)
+{
+    auto prefixGeneratedHeadersByteSize = slot.bitstreamHeadersBuffer.size();
     void* outputBitrstreamData = nullptr;
     D3D12_RANGE readRange = { 0, prefixGeneratedHeadersByteSize };
-    ThrowIfFailed(m_outputBitrstreamBuffer->Map(0, &readRange, &outputBitrstreamData));
-    memcpy(outputBitrstreamData, m_bitstreamHeadersBuffer.data(), prefixGeneratedHeadersByteSize);
-    m_outputBitrstreamBuffer->Unmap(0, nullptr);
+    ThrowIfFailed(slot.outputBitstreamBuffer->Map(0, &readRange, &outputBitrstreamData));
+    memcpy(outputBitrstreamData, slot.bitstreamHeadersBuffer.data(), prefixGeneratedHeadersByteSize);
+    slot.outputBitstreamBuffer->Unmap(0, nullptr);
 }
 
 void EncoderH264DX12::CreateEncodeCommand()
 {
-    m_encodeCommandQueue.Reset();
-    m_encodeCommandAllocator.Reset();
     m_encodeCommandList.Reset();
-    m_encoderFence.Reset();
-
-    D3D12_COMMAND_QUEUE_DESC commandQueueDesc = { D3D12_COMMAND_LIST_TYPE_VIDEO_ENCODE };
-    ThrowIfFailed(m_device->CreateCommandQueue(
-        &commandQueueDesc,
-        IID_PPV_ARGS(&m_encodeCommandQueue)));
-
-    ThrowIfFailed(m_device->CreateCommandAllocator(
-        D3D12_COMMAND_LIST_TYPE_VIDEO_ENCODE,
-        IID_PPV_ARGS(&m_encodeCommandAllocator)));
+    for (auto& allocator : m_encodeCommandAllocators)
+    {
+        allocator.Reset();
+        ThrowIfFailed(m_device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_VIDEO_ENCODE,
+            IID_PPV_ARGS(&allocator)));
+    }
+    m_currentAllocator = 0;
 
     ThrowIfFailed(m_device->CreateCommandList(0,
         D3D12_COMMAND_LIST_TYPE_VIDEO_ENCODE,
-        m_encodeCommandAllocator.Get(),
+        m_encodeCommandAllocators[m_currentAllocator].Get(),
         nullptr,
         IID_PPV_ARGS(&m_encodeCommandList)));
-
-    ThrowIfFailed(m_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_encoderFence)));
-}
-
-void EncoderH264DX12::CreateOutputCommand()
-{
-    m_outputEncodedCommandQueue.Reset();
-    m_outputEncodedCommandAllocator.Reset();
-    m_outputEncodedCommandList.Reset();
-
-    D3D12_COMMAND_QUEUE_DESC queueDesc = { D3D12_COMMAND_LIST_TYPE_COPY };
-    ThrowIfFailed(m_device->CreateCommandQueue(
-        &queueDesc,
-        IID_PPV_ARGS(&m_outputEncodedCommandQueue)));
-
-    ThrowIfFailed(m_device->CreateCommandAllocator(
-        queueDesc.Type,
-        IID_PPV_ARGS(&m_outputEncodedCommandAllocator)));
-
-    ThrowIfFailed(m_device->CreateCommandList(0,
-        queueDesc.Type,
-        m_outputEncodedCommandAllocator.Get(),
-        nullptr,
-        IID_PPV_ARGS(&m_outputEncodedCommandList)));
 }
 
 void EncoderH264DX12::CreateOutputBufferResource()
 {
-    const CD3DX12_RESOURCE_DESC resolvedMetadataBufferDesc =
-        CD3DX12_RESOURCE_DESC::Buffer(m_resolvedMetadataBufferSize);
+    // Each frame of the batches in flight writes to own buffers.
+    m_outputSlots.resize(SubmissionsInFlight * m_framesPerSubmission);
+    for (auto& slot : m_outputSlots)
+    {
+        const CD3DX12_RESOURCE_DESC resolvedMetadataBufferDesc =
+            CD3DX12_RESOURCE_DESC::Buffer(m_resolvedMetadataBufferSize);
 
-    const D3D12_HEAP_PROPERTIES resolvedMetadataHeapProps = CD3DX12_HEAP_PROPERTIES(
-        D3D12_CPU_PAGE_PROPERTY_WRITE_COMBINE, D3D12_MEMORY_POOL_L0);
+        const D3D12_HEAP_PROPERTIES resolvedMetadataHeapProps = CD3DX12_HEAP_PROPERTIES(
+            D3D12_CPU_PAGE_PROPERTY_WRITE_COMBINE, D3D12_MEMORY_POOL_L0);
 
-    m_resolvedMetadataBuffer.Reset();
-    ThrowIfFailed(m_device->CreateCommittedResource(
-        &resolvedMetadataHeapProps,
-        D3D12_HEAP_FLAG_NONE,
-        &resolvedMetadataBufferDesc,
-        D3D12_RESOURCE_STATE_COMMON,
-        nullptr,
-        IID_PPV_ARGS(&m_resolvedMetadataBuffer)));
+        slot.resolvedMetadataBuffer.Reset();
+        ThrowIfFailed(m_device->CreateCommittedResource(
+            &resolvedMetadataHeapProps,
+            D3D12_HEAP_FLAG_NONE,
+            &resolvedMetadataBufferDesc,
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(&slot.resolvedMetadataBuffer)));
 
-    assert(m_resolvedMetadataBuffer->GetDesc().Width == m_resolvedMetadataBufferSize);
+        assert(slot.resolvedMetadataBuffer->GetDesc().Width == m_resolvedMetadataBufferSize);
 
 
-    const CD3DX12_RESOURCE_DESC metadataBufferDesc =
-        CD3DX12_RESOURCE_DESC::Buffer(m_resourceRequirements.MaxEncoderOutputMetadataBufferSize);
+        const CD3DX12_RESOURCE_DESC metadataBufferDesc =
+            CD3DX12_RESOURCE_DESC::Buffer(m_resourceRequirements.MaxEncoderOutputMetadataBufferSize);
 
-    const D3D12_HEAP_PROPERTIES metadataHeapProps = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+        const D3D12_HEAP_PROPERTIES metadataHeapProps = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
 
-    m_metadataOutputBuffer.Reset();
-    ThrowIfFailed(m_device->CreateCommittedResource(
-        &metadataHeapProps,
-        D3D12_HEAP_FLAG_NONE,
-        &metadataBufferDesc,
-        D3D12_RESOURCE_STATE_COMMON,
-        nullptr,
-        IID_PPV_ARGS(&m_metadataOutputBuffer)));
+        slot.metadataOutputBuffer.Reset();
+        ThrowIfFailed(m_device->CreateCommittedResource(
+            &metadataHeapProps,
+            D3D12_HEAP_FLAG_NONE,
+            &metadataBufferDesc,
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(&slot.metadataOutputBuffer)));
 
 
-    const D3D12_HEAP_PROPERTIES outputBitstreamHeapProps = CD3DX12_HEAP_PROPERTIES(
-        D3D12_CPU_PAGE_PROPERTY_WRITE_COMBINE, D3D12_MEMORY_POOL_L0);
+        const D3D12_HEAP_PROPERTIES outputBitstreamHeapProps = CD3DX12_HEAP_PROPERTIES(
+            D3D12_CPU_PAGE_PROPERTY_WRITE_COMBINE, D3D12_MEMORY_POOL_L0);
 
-    // Roughly estimated size of the output bitstream buffer, that should be improved.
-    const UINT64 outputBitstreamBufferSize = 4 * m_resolutionDesc.Width * m_resolutionDesc.Height;
-    CD3DX12_RESOURCE_DESC outputBitstreamBufferDesc = CD3DX12_RESOURCE_DESC::Buffer(outputBitstreamBufferSize);
+        // Roughly estimated size of the output bitstream buffer, that should be improved.
+        const UINT64 outputBitstreamBufferSize = 4 * m_resolutionDesc.Width * m_resolutionDesc.Height;
+        CD3DX12_RESOURCE_DESC outputBitstreamBufferDesc = CD3DX12_RESOURCE_DESC::Buffer(outputBitstreamBufferSize);
 
-    m_outputBitrstreamBuffer.Reset();
-    ThrowIfFailed(m_device->CreateCommittedResource(
-        &outputBitstreamHeapProps,
-        D3D12_HEAP_FLAG_NONE,
-        &outputBitstreamBufferDesc,
-        D3D12_RESOURCE_STATE_COMMON,
-        nullptr,
-        IID_PPV_ARGS(&m_outputBitrstreamBuffer)));
+        slot.outputBitstreamBuffer.Reset();
+        ThrowIfFailed(m_device->CreateCommittedResource(
+            &outputBitstreamHeapProps,
+            D3D12_HEAP_FLAG_NONE,
+            &outputBitstreamBufferDesc,
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(&slot.outputBitstreamBuffer)));
+    }
 }
 
 bool EncoderH264DX12::WaitForEncodedData(Microsoft::WRL::Wrappers::Event& termintateEvent,
-    std::vector<uint8_t>& encodedData)
+    std::vector<uint8_t>& encodedData, std::vector<EncodedSlice>& slices)
 {
-    if (m_encoderFence->GetCompletedValue() < m_encoderFenceValue)
+    assert(!m_sentFrames.empty());
+    const SentFrame& sentFrame = m_sentFrames.front();
+
+    // Don't wait for the whole batch to be recorded when the caller needs the frame.
+    if (!sentFrame.submission)
     {
-        // Wait for the fence to be set from GPU.
-        ThrowIfFailed(m_encoderFence->SetEventOnCompletion(m_encoderFenceValue, m_encodeCompletedEvent.Get()));
-        HANDLE events[] = { m_encodeCompletedEvent.Get(), termintateEvent.Get() };
-        DWORD result = WaitForMultipleObjects(_countof(events), events, FALSE, INFINITE);
-        if (result == WAIT_OBJECT_0)
-        {
-        }
-        else if (result == WAIT_OBJECT_0 + 1)
-        {
-            // Terminated
-            return false;
-        }
-        else
-            throw std::runtime_error("WaitForSingleObject() failed: " + GetLastError());
+        SubmitRecordedFrames();
+    }
+
+    if (!m_encodeSubmitter->WaitForCompletion(sentFrame.submission, termintateEvent.Get()))
+    {
+        // Terminated
+        return false;
     }
 
-    ReadEncodedData(encodedData);
-    PrepareForNextFrame();
+    ReadEncodedData(m_outputSlots[sentFrame.slotIndex], encodedData, slices);
+    m_sentFrames.pop_front();
 
     return true;
 }
@@ -3,6 +3,8 @@
 #include "EncoderAPI.h"
 #include "ReferenceFramesManager.h"
 #include "InputFrameResources.h"
+#include "CapabilityCache.h"
+#include "CommandSubmitter.h"
 
 class d3d12_video_bitstream_builder_h264;
 
@@ -14,43 +16,114 @@ class EncoderH264DX12
 {
 public:
 
-    EncoderH264DX12(const ComPtr<ID3D12Device>& device, const EncoderConfiguration& config,
-        DXGI_FORMAT inputFormat);
+    EncoderH264DX12(const ComPtr<ID3D12Device>& device, std::unique_ptr<ICommandSubmitter> encodeSubmitter,
+        const EncoderConfiguration& config, DXGI_FORMAT inputFormat);
     ~EncoderH264DX12();
 
+    // One batch is recorded while the previous one is encoded, so frames of two batches can be sent unread.
+    static constexpr uint32_t SubmissionsInFlight = 2;
+
+    // Times in microseconds since the Unix epoch, except the presentation one counted from the zero timestamp.
+    struct FrameTiming
+    {
+        uint64_t frameNumber{};
+        uint64_t captureTime{};
+        uint64_t encodingStartTime{};
+        uint64_t presentationTime{};
+    };
+
     struct InputFrame
     {
         D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType{ D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME };
         UINT pictureOrderCountNumber{};
-        UINT decodingOrderNumber{};
+        UINT decodingOrderNumber{}; // frame_num before the wrap, counts the reference frames
         UINT idrPicId{};
         std::vector<UINT> l0List;
         std::vector<UINT> l1List;
         bool useAsReference{ false };
+        UINT qp{};
+        UINT temporalLayerIndex{};
+        std::vector<INT8> deltaQPMap; // Empty if QP maps are disabled
+        std::optional<UINT> intraRefreshFrameIndex; // Position in the refresh wave, none outside of waves
+        std::optional<UINT> recoveryFrameCount; // Recovery point SEI is written before the frame if set
+        std::optional<LongTermReferenceMarking> longTermReference;
+        bool restartPictureNumbering{ false }; // MMCO 5, POC and frame_num of the next frames count from this frame
+        std::optional<FrameTiming> timing; // Timing SEI is written before the frame if set
     };
 
+    // Records encoding of the frame, recorded frames are submitted to GPU by batches of framesPerSubmission.
+    // Up to SubmissionsInFlight * framesPerSubmission frames can be sent before reading their encoded data.
     void SendFrame(const InputFrame& inputFrame, const InputFrameResources& inputFrameResources);
+    // Reads encoded data of the oldest sent frame, incomplete batch is submitted immediately.
     bool WaitForEncodedData(Microsoft::WRL::Wrappers::Event& termintateEvent,
-        std::vector<uint8_t>& encodedData);
+        std::vector<uint8_t>& encodedData, std::vector<EncodedSlice>& slices);
+
+    // Starts a new sequence with another GOP structure and frame rate, keeping the encoder objects and resources.
+    void Reset(const EncoderConfiguration& config);
+    // Side of the delta QP map regions in pixels, 0 if QP maps are not requested or not supported.
+    uint32_t GetQPMapRegionSize() const { return m_qpMapRegionSize; }
+    // Long-term reference frames in the DPB on top of the short-term ones, 0 if not supported.
+    uint32_t GetMaxLongTermReferenceFrameCount() const { return m_maxLongTermReferenceFrameCount; }
+    // Frames of an intra refresh wave, 0 if intra refresh is not requested or not supported.
+    uint32_t GetIntraRefreshPeriod() const { return m_intraRefreshPeriod; }
+    uint64_t GetMemoryUsage() const;
 
 private:
+    struct OutputSlot
+    {
+        ComPtr<ID3D12Resource> resolvedMetadataBuffer;
+        ComPtr<ID3D12Resource> metadataOutputBuffer;
+        ComPtr<ID3D12Resource> outputBitstreamBuffer;
+        std::vector<uint8_t> bitstreamHeadersBuffer;
+        std::optional<UINT> temporalLayerIndex; // Prefix NAL units are written before the slices if set
+    };
+
+    struct SentFrame
+    {
+        size_t slotIndex{};
+        SubmissionHandle submission; // Empty until the batch is submitted
+    };
+
     void Configure(const EncoderConfiguration& config);
-    D3D12_VIDEO_ENCODER_SEQUENCE_GOP_STRUCTURE_H264 ConfigureGOPStructure(UINT gopLengthInFrames, UINT bFramesCount);
-    D3D12_VIDEO_ENCODER_OUTPUT_METADATA ReadResolvedMetadata();
-    void ReadEncodedData(std::vector<uint8_t>& encodedData);
-    uint32_t BuildCodecHeadersH264();
-    void PrepareForNextFrame();
+    void ConfigureSequence(const EncoderConfiguration& config);
+    void ConfigureSlices(const EncoderConfiguration& config, const EncoderCapabilities& capabilities);
+    void CreateVideoEncoder();
+    bool HasInterFrames() const;
+    // frame_num wraps at this value, while POC is passed unwrapped.
+    UINT GetMaxFrameNum() const { return 1u << (m_h264GopStructure.log2_max_frame_num_minus4 + 4); }
+    EncoderCapabilities GetCapabilities(const EncoderConfiguration& config);
+    EncoderCapabilities QueryCapabilities(const EncoderConfiguration& config);
+    D3D12_VIDEO_ENCODER_PROFILE_H264 NegotiateProfile(H264Profile requestedProfile);
+    bool IsProfileSupported(D3D12_VIDEO_ENCODER_PROFILE_H264 profile);
+    D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264 ConfigureCodecH264(const EncoderConfiguration& config);
+    D3D12_VIDEO_ENCODER_SEQUENCE_GOP_STRUCTURE_H264 ConfigureGOPStructure(UINT gopLengthInFrames, UINT bFramesCount,
+        bool openGop);
+    D3D12_VIDEO_ENCODER_OUTPUT_METADATA ReadResolvedMetadata(const OutputSlot& slot,
+        std::vector<D3D12_VIDEO_ENCODER_FRAME_SUBREGION_METADATA>& slicesMetadata);
+    void ReadEncodedData(const OutputSlot& slot, std::vector<uint8_t>& encodedData, std::vector<EncodedSlice>& slices);
+    void AppendSlice(const OutputSlot& slot, const uint8_t* slice, size_t sliceSize, std::vector<uint8_t>& encodedData,
+        std::vector<EncodedSlice>& slices);
+    uint32_t BuildCodecHeadersH264(std::vector<uint8_t>& headersBuffer);
+    uint32_t AppendSEIMessages(std::vector<uint8_t>& headersBuffer);
+    void BeginRecording();
+    void WaitForSubmissions();
+    void SubmitRecordedFrames();
     void UpdateCurrentFrameInfo(InputFrame& inputFrame);
-    void UploadBitstreamHeaders();
+    bool UpdateFrameQP(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType, UINT qp);
+    void UploadBitstreamHeaders(const OutputSlot& slot);
     void CreateEncodeCommand();
-    void CreateOutputCommand();
     void CreateOutputBufferResource();
 
 
 private:
     const uint32_t m_maxReferenceFrameCount;
+    const uint32_t m_requestedLongTermReferenceFrameCount;
+    uint32_t m_maxLongTermReferenceFrameCount = 0;
+    const uint32_t m_framesPerSubmission;
     D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC m_resolutionDesc = {};
     DXGI_RATIONAL m_targetFramerate = {};
+    DXGI_RATIONAL m_sampleAspectRatio = {}; // Fits 16 bits of VUI, 0:0 - unspecified
+    ColorDescription m_colorDescription;
     D3D12_BOX m_frameCropping = {};
     const DXGI_FORMAT m_inputFormat;
 
@@ -62,25 +135,23 @@ private:
     ComPtr<ID3D12VideoEncoderHeap> m_videoEncoderHeap;
 
 
-    // Resources for reading encoded data.
-
-    ComPtr<ID3D12CommandQueue> m_outputEncodedCommandQueue;
-    ComPtr<ID3D12CommandAllocator> m_outputEncodedCommandAllocator;
-    ComPtr<ID3D12GraphicsCommandList> m_outputEncodedCommandList;
-
-
     // Resources for encoding.
 
-    ComPtr<ID3D12CommandQueue> m_encodeCommandQueue;
-    ComPtr<ID3D12CommandAllocator> m_encodeCommandAllocator;
+    // Allocators alternate between submissions, each is reset after GPU completes its own previous one.
+    std::array<ComPtr<ID3D12CommandAllocator>, SubmissionsInFlight> m_encodeCommandAllocators;
+    std::array<SubmissionHandle, SubmissionsInFlight> m_allocatorSubmissions;
+    size_t m_currentAllocator = 0;
     ComPtr<ID3D12VideoEncodeCommandList2> m_encodeCommandList;
-    ComPtr<ID3D12Fence> m_encoderFence;
-    UINT64 m_encoderFenceValue = 1;
-
-    ComPtr<ID3D12Resource> m_resolvedMetadataBuffer;
-    ComPtr<ID3D12Resource> m_metadataOutputBuffer;
-    ComPtr<ID3D12Resource> m_outputBitrstreamBuffer;
+    bool m_isCommandListClosed = false;
+    std::vector<SubmissionHandle> m_recordedDependencies; // Uploads of the frames recorded since the last submission
+    bool m_isFirstFrame = true;
+    bool m_lowLatency = false; // Parameter sets are written only before IDR frames
+    bool m_timingSEI = false; // Timing info in VUI, picture timing SEI before each frame
+    uint32_t m_temporalLayerCount = 1;
 
+    std::vector<OutputSlot> m_outputSlots;
+    size_t m_nextOutputSlot = 0;
+    std::deque<SentFrame> m_sentFrames; // In the decoding order
 
 
     D3D12_FEATURE_DATA_VIDEO_ENCODER_RESOURCE_REQUIREMENTS m_resourceRequirements = {};
@@ -89,11 +160,21 @@ private:
 
     D3D12_VIDEO_ENCODER_RATE_CONTROL_CQP m_rateControlCQP = {};
     D3D12_VIDEO_ENCODER_RATE_CONTROL m_rateControl = {};
+    bool m_isRateControlReconfigurationSupported = false; // QP of the frame type can change between frames
+    uint32_t m_qpMapRegionSize = 0;
+    D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE m_intraRefreshMode = D3D12_VIDEO_ENCODER_INTRA_REFRESH_MODE_NONE;
+    uint32_t m_intraRefreshPeriod = 0;
+
+    D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE m_subregionMode = D3D12_VIDEO_ENCODER_FRAME_SUBREGION_LAYOUT_MODE_FULL_FRAME;
+    D3D12_VIDEO_ENCODER_PICTURE_CONTROL_SUBREGIONS_LAYOUT_DATA_SLICES m_sliceLayout = {};
+    UINT m_maxSliceCount = 1;
+    std::vector<D3D12_VIDEO_ENCODER_FRAME_SUBREGION_METADATA> m_slicesMetadata;
 
     D3D12_VIDEO_ENCODER_SEQUENCE_GOP_STRUCTURE_H264 m_h264GopStructure = {};
     D3D12_VIDEO_ENCODER_SEQUENCE_GOP_STRUCTURE m_gopStructure = {};
 
     D3D12_VIDEO_ENCODER_LEVELS_H264 m_selectedLevel = D3D12_VIDEO_ENCODER_LEVELS_H264_42;
+    D3D12_VIDEO_ENCODER_LEVELS_H264 m_maxSupportedLevel = D3D12_VIDEO_ENCODER_LEVELS_H264_42;
     D3D12_VIDEO_ENCODER_PROFILE_H264 m_h264Profile = D3D12_VIDEO_ENCODER_PROFILE_H264_MAIN;
     D3D12_VIDEO_ENCODER_PROFILE_DESC m_profileDesc = {};
 
@@ -101,14 +182,14 @@ private:
     D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA m_curPicParamsData = {};
 
     InputFrame m_currentFrame;
-    std::vector<uint8_t> m_bitstreamHeadersBuffer;
     std::unique_ptr<d3d12_video_bitstream_builder_h264> m_bitstreamBuilder;
 
     UINT64 m_resolvedMetadataBufferSize = 0;
 
     std::unique_ptr<ReferenceFramesManager> m_referenceFramesManager;
 
-    Microsoft::WRL::Wrappers::Event m_encodeCompletedEvent;
+    // Declared last to wait for the GPU work before the resources are released.
+    std::unique_ptr<ICommandSubmitter> m_encodeSubmitter;
 };
 
 }
@@ -0,0 +1,205 @@
+#include "pch.h"
+#include "EncoderPool.h"
+#include "EncoderH264.h"
+
+
+namespace DX12VideoEncoding {
+
+namespace {
+
+class EncoderH264PoolBackend : public EncoderPool::IBackend
+{
+public:
+    explicit EncoderH264PoolBackend(const ComPtr<ID3D12Device>& device)
+        : m_device(device)
+    {
+    }
+
+    std::unique_ptr<IEncoder> CreateEncoder(const EncoderConfiguration& config) override
+    {
+        return CreateH264Encoder(m_device, config);
+    }
+
+    void ResetEncoder(IEncoder& encoder, const EncoderConfiguration& config) override
+    {
+        static_cast<EncoderH264&>(encoder).Reset(config);
+    }
+
+    uint64_t GetMemoryUsage(const IEncoder& encoder) const override
+    {
+        return static_cast<const EncoderH264&>(encoder).GetMemoryUsage();
+    }
+
+private:
+    ComPtr<ID3D12Device> m_device;
+};
+
+}
+
+EncoderPool::Key EncoderPool::Key::FromConfiguration(const EncoderConfiguration& config)
+{
+    Key key;
+    key.width = config.width;
+    key.height = config.height;
+    key.format = config.inputFormat;
+    key.profile = config.profile;
+    key.maxReferenceFrameCount = config.maxReferenceFrameCount;
+    key.maxLongTermReferenceFrameCount = config.maxLongTermReferenceFrameCount;
+    key.framesPerSubmission = config.framesPerSubmission;
+    key.enableCabac = config.enableCabac;
+    key.enableAdaptive8x8Transform = config.enableAdaptive8x8Transform;
+    // Direct prediction mode is a part of the encoder object configuration and is used only with B-frames.
+    key.useDirectModes = config.enableDirectModes && config.bFramesCount > 0;
+    // Command submitters of the session are bound to the scheduler queues.
+    key.scheduler = config.scheduler.get();
+    return key;
+}
+
+EncoderPool::Releaser::Releaser(EncoderPool* pool, const Key& key, uint64_t memoryUsage)
+    : m_pool(pool)
+    , m_key(key)
+    , m_memoryUsage(memoryUsage)
+{
+}
+
+void EncoderPool::Releaser::operator()(IEncoder* encoder) const
+{
+    std::unique_ptr<IEncoder> ownedEncoder(encoder);
+    if (m_pool != nullptr)
+    {
+        m_pool->Release(m_key, std::move(ownedEncoder), m_memoryUsage);
+    }
+}
+
+EncoderPool::EncoderPool(std::unique_ptr<IBackend> backend, uint64_t memoryBudget)
+    : m_backend(std::move(backend))
+    , m_memoryBudget(memoryBudget)
+{
+    ThrowIfFalse(m_backend != nullptr);
+}
+
+EncoderPool::~EncoderPool()
+{
+    assert(m_activeMemoryUsage == 0 && "All acquired encoders should be released before the pool");
+    Clear();
+}
+
+EncoderPool::PooledEncoder EncoderPool::Acquire(const EncoderConfiguration& config)
+{
+    const Key key = Key::FromConfiguration(config);
+
+    std::unique_ptr<IEncoder> encoder;
+    uint64_t memoryUsage = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = std::find_if(m_idleSessions.begin(), m_idleSessions.end(),
+            [&key](const IdleSession& session) { return session.key == key; });
+        if (it != m_idleSessions.end())
+        {
+            encoder = std::move(it->encoder);
+            memoryUsage = it->memoryUsage;
+            m_idleMemoryUsage -= memoryUsage;
+            m_activeMemoryUsage += memoryUsage;
+            m_idleSessions.erase(it);
+            ++m_statistics.reusedSessions;
+        }
+    }
+
+    if (encoder != nullptr)
+    {
+        try
+        {
+            m_backend->ResetEncoder(*encoder, config);
+        }
+        catch (const std::exception& e)
+        {
+            LogMessage(LogLevel::E_WARNING, std::string("Failed to reset pooled encoder, creating new one: ") + e.what());
+            encoder.reset();
+            std::lock_guard lock(m_mutex);
+            m_activeMemoryUsage -= memoryUsage;
+        }
+    }
+
+    if (encoder == nullptr)
+    {
+        // Free memory for the new session in advance.
+        std::list<std::unique_ptr<IEncoder>> evicted;
+        {
+            std::lock_guard lock(m_mutex);
+            EvictOverBudget(evicted);
+        }
+        evicted.clear();
+
+        encoder = m_backend->CreateEncoder(config);
+        memoryUsage = m_backend->GetMemoryUsage(*encoder);
+
+        std::lock_guard lock(m_mutex);
+        m_activeMemoryUsage += memoryUsage;
+        ++m_statistics.createdSessions;
+    }
+
+    return PooledEncoder(encoder.release(), Releaser(this, key, memoryUsage));
+}
+
+void EncoderPool::Clear()
+{
+    std::list<IdleSession> idleSessions;
+    {
+        std::lock_guard lock(m_mutex);
+        idleSessions.swap(m_idleSessions);
+        m_idleMemoryUsage = 0;
+    }
+    // Sessions are destroyed out of the lock as it waits for GPU.
+}
+
+size_t EncoderPool::GetIdleSessionCount() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_idleSessions.size();
+}
+
+uint64_t EncoderPool::GetMemoryUsage() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_idleMemoryUsage + m_activeMemoryUsage;
+}
+
+EncoderPool::Statistics EncoderPool::GetStatistics() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_statistics;
+}
+
+void EncoderPool::Release(const Key& key, std::unique_ptr<IEncoder> encoder, uint64_t memoryUsage)
+{
+    // Stop waiting in the released session, it's reset on the next acquiring.
+    encoder->Terminate();
+
+    std::list<std::unique_ptr<IEncoder>> evicted;
+    {
+        std::lock_guard lock(m_mutex);
+        m_activeMemoryUsage -= memoryUsage;
+        m_idleMemoryUsage += memoryUsage;
+        m_idleSessions.push_front(IdleSession{ key, std::move(encoder), memoryUsage });
+        EvictOverBudget(evicted);
+    }
+}
+
+void EncoderPool::EvictOverBudget(std::list<std::unique_ptr<IEncoder>>& evicted)
+{
+    while (!m_idleSessions.empty() && (m_idleMemoryUsage + m_activeMemoryUsage > m_memoryBudget))
+    {
+        auto& session = m_idleSessions.back();
+        m_idleMemoryUsage -= session.memoryUsage;
+        evicted.push_back(std::move(session.encoder));
+        m_idleSessions.pop_back();
+        ++m_statistics.evictedSessions;
+    }
+}
+
+std::unique_ptr<EncoderPool::IBackend> CreateH264EncoderPoolBackend(const ComPtr<ID3D12Device>& device)
+{
+    return std::make_unique<EncoderH264PoolBackend>(device);
+}
+
+}
@@ -0,0 +1,436 @@
+#include "pch.h"
+#include "FrameAnalyzer.h"
+#include "CpuFeatures.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define FRAME_ANALYZER_AVX2
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#define FRAME_ANALYZER_NEON
+#endif
+
+
+namespace DX12VideoEncoding {
+
+namespace {
+
+// Luma is reduced to averages of 8x8 blocks, every other row of a block is sampled.
+constexpr uint32_t BlockSize = 8;
+constexpr uint32_t RowStep = 2;
+constexpr uint32_t SamplesPerBlock = BlockSize * BlockSize / RowStep;
+
+// Scene cut thresholds, see FrameAnalyzer::IsSceneCut().
+constexpr float SceneCutHistogramDistance = 0.25f;
+constexpr float SceneCutDifference = 16.0f;
+constexpr float SceneCutDifferenceOnly = 40.0f;
+
+// Motion search on the downscaled luma: 8x8 samples blocks, +-2 samples (16 luma pixels) around the same position.
+constexpr uint32_t MotionBlockSize = 8;
+constexpr int MotionSearchRange = 2;
+constexpr float HighMotionDifference = 5.0f;
+
+struct AnalysisKernels
+{
+    // Adds sums of consecutive 8 samples of the row to sums[0] ... sums[blockCount - 1].
+    void (*sumBlocks8)(const uint8_t* row, uint32_t* sums, uint32_t blockCount);
+    // Same for 16-bit samples narrowed to 8 bits by the shift.
+    void (*sumBlocks16)(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t blockCount);
+    uint64_t (*sumAbsoluteDifferences)(const uint8_t* a, const uint8_t* b, size_t count);
+    // SAD of 8x8 blocks with the same pitch.
+    uint32_t (*blockSad8x8)(const uint8_t* a, const uint8_t* b, size_t pitch);
+};
+
+void SumBlocks8Scalar(const uint8_t* row, uint32_t* sums, uint32_t blockCount)
+{
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        uint32_t sum = 0;
+        for (uint32_t x = 0; x < BlockSize; ++x)
+        {
+            sum += row[block * BlockSize + x];
+        }
+        sums[block] += sum;
+    }
+}
+
+void SumBlocks16Scalar(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t blockCount)
+{
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        uint32_t sum = 0;
+        for (uint32_t x = 0; x < BlockSize; ++x)
+        {
+            sum += row[block * BlockSize + x] >> shift;
+        }
+        sums[block] += sum;
+    }
+}
+
+uint64_t SumAbsoluteDifferencesScalar(const uint8_t* a, const uint8_t* b, size_t count)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        sum += static_cast<uint64_t>(std::abs(int(a[i]) - int(b[i])));
+    }
+    return sum;
+}
+
+uint32_t BlockSad8x8Scalar(const uint8_t* a, const uint8_t* b, size_t pitch)
+{
+    uint32_t sum = 0;
+    for (uint32_t y = 0; y < MotionBlockSize; ++y)
+    {
+        sum += static_cast<uint32_t>(SumAbsoluteDifferencesScalar(a + y * pitch, b + y * pitch, MotionBlockSize));
+    }
+    return sum;
+}
+
+constexpr AnalysisKernels ScalarKernels = {
+    SumBlocks8Scalar,
+    SumBlocks16Scalar,
+    SumAbsoluteDifferencesScalar,
+    BlockSad8x8Scalar,
+};
+
+#if defined(FRAME_ANALYZER_AVX2)
+
+// Adds 4 sums of 8 bytes each to the sums.
+inline void AddBlockSums(__m256i samples, uint32_t* sums)
+{
+    // SAD against zero sums each 8 bytes into a 64-bit element, low halves of them are gathered.
+    const __m256i blockSums = _mm256_sad_epu8(samples, _mm256_setzero_si256());
+    const __m128i packed = _mm256_castsi256_si128(
+        _mm256_permutevar8x32_epi32(blockSums, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0)));
+    __m128i* destination = reinterpret_cast<__m128i*>(sums);
+    _mm_storeu_si128(destination, _mm_add_epi32(_mm_loadu_si128(destination), packed));
+}
+
+void SumBlocks8Avx2(const uint8_t* row, uint32_t* sums, uint32_t blockCount)
+{
+    uint32_t block = 0;
+    for (; block + 4 <= blockCount; block += 4)
+    {
+        AddBlockSums(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + block * BlockSize)), sums + block);
+    }
+    SumBlocks8Scalar(row + block * BlockSize, sums + block, blockCount - block);
+}
+
+void SumBlocks16Avx2(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t blockCount)
+{
+    const __m128i shiftCount = _mm_cvtsi32_si128(static_cast<int>(shift));
+    uint32_t block = 0;
+    for (; block + 4 <= blockCount; block += 4)
+    {
+        const uint16_t* samples = row + block * BlockSize;
+        const __m256i lo = _mm256_srl_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples)), shiftCount);
+        const __m256i hi = _mm256_srl_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + 16)), shiftCount);
+        // Packing works within 128-bit lanes, 64-bit quarters are reordered to get the linear order.
+        AddBlockSums(_mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8), sums + block);
+    }
+    SumBlocks16Scalar(row + block * BlockSize, shift, sums + block, blockCount - block);
+}
+
+uint64_t SumAbsoluteDifferencesAvx2(const uint8_t* a, const uint8_t* b, size_t count)
+{
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))));
+    }
+    const __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    const uint64_t vectorSum = static_cast<uint64_t>(_mm_cvtsi128_si64(halves))
+        + static_cast<uint64_t>(_mm_extract_epi64(halves, 1));
+    return vectorSum + SumAbsoluteDifferencesScalar(a + i, b + i, count - i);
+}
+
+// Gathers 4 rows of 8 bytes into one register.
+inline __m256i LoadRows8x4(const uint8_t* rows, size_t pitch)
+{
+    return _mm256_setr_epi64x(
+        *reinterpret_cast<const int64_t*>(rows),
+        *reinterpret_cast<const int64_t*>(rows + pitch),
+        *reinterpret_cast<const int64_t*>(rows + 2 * pitch),
+        *reinterpret_cast<const int64_t*>(rows + 3 * pitch));
+}
+
+uint32_t BlockSad8x8Avx2(const uint8_t* a, const uint8_t* b, size_t pitch)
+{
+    const __m256i top = _mm256_sad_epu8(LoadRows8x4(a, pitch), LoadRows8x4(b, pitch));
+    const __m256i bottom = _mm256_sad_epu8(LoadRows8x4(a + 4 * pitch, pitch), LoadRows8x4(b + 4 * pitch, pitch));
+    const __m256i sum = _mm256_add_epi64(top, bottom);
+    const __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(halves) + _mm_extract_epi32(halves, 2));
+}
+
+constexpr AnalysisKernels Avx2Kernels = {
+    SumBlocks8Avx2,
+    SumBlocks16Avx2,
+    SumAbsoluteDifferencesAvx2,
+    BlockSad8x8Avx2,
+};
+
+#elif defined(FRAME_ANALYZER_NEON)
+
+// Adds 2 sums of 8 bytes each to the sums.
+inline void AddBlockSums(uint8x16_t samples, uint32_t* sums)
+{
+    const uint32x4_t quads = vpaddlq_u16(vpaddlq_u8(samples));
+    const uint32x2_t blockSums = vpadd_u32(vget_low_u32(quads), vget_high_u32(quads));
+    vst1_u32(sums, vadd_u32(vld1_u32(sums), blockSums));
+}
+
+void SumBlocks8Neon(const uint8_t* row, uint32_t* sums, uint32_t blockCount)
+{
+    uint32_t block = 0;
+    for (; block + 2 <= blockCount; block += 2)
+    {
+        AddBlockSums(vld1q_u8(row + block * BlockSize), sums + block);
+    }
+    SumBlocks8Scalar(row + block * BlockSize, sums + block, blockCount - block);
+}
+
+void SumBlocks16Neon(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t blockCount)
+{
+    const int16x8_t shiftCount = vdupq_n_s16(-static_cast<int16_t>(shift));
+    uint32_t block = 0;
+    for (; block + 2 <= blockCount; block += 2)
+    {
+        const uint16_t* samples = row + block * BlockSize;
+        const uint8x16_t narrowed = vcombine_u8(
+            vmovn_u16(vshlq_u16(vld1q_u16(samples), shiftCount)),
+            vmovn_u16(vshlq_u16(vld1q_u16(samples + 8), shiftCount)));
+        AddBlockSums(narrowed, sums + block);
+    }
+    SumBlocks16Scalar(row + block * BlockSize, shift, sums + block, blockCount - block);
+}
+
+uint64_t SumAbsoluteDifferencesNeon(const uint8_t* a, const uint8_t* b, size_t count)
+{
+    uint32x4_t sum = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        sum = vpadalq_u16(sum, vpaddlq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i))));
+    }
+    return vaddlvq_u32(sum) + SumAbsoluteDifferencesScalar(a + i, b + i, count - i);
+}
+
+uint32_t BlockSad8x8Neon(const uint8_t* a, const uint8_t* b, size_t pitch)
+{
+    uint16x8_t sum = vdupq_n_u16(0);
+    for (uint32_t y = 0; y < MotionBlockSize; y += 2)
+    {
+        const uint8x16_t rowsA = vcombine_u8(vld1_u8(a + y * pitch), vld1_u8(a + (y + 1) * pitch));
+        const uint8x16_t rowsB = vcombine_u8(vld1_u8(b + y * pitch), vld1_u8(b + (y + 1) * pitch));
+        sum = vpadalq_u8(sum, vabdq_u8(rowsA, rowsB));
+    }
+    return vaddlvq_u16(sum);
+}
+
+constexpr AnalysisKernels NeonKernels = {
+    SumBlocks8Neon,
+    SumBlocks16Neon,
+    SumAbsoluteDifferencesNeon,
+    BlockSad8x8Neon,
+};
+
+#endif
+
+const AnalysisKernels& GetAnalysisKernels()
+{
+#if defined(FRAME_ANALYZER_AVX2)
+    static const AnalysisKernels& kernels = IsAvx2Supported() ? Avx2Kernels : ScalarKernels;
+    return kernels;
+#elif defined(FRAME_ANALYZER_NEON)
+    return NeonKernels;
+#else
+    return ScalarKernels;
+#endif
+}
+
+}
+
+std::optional<uint32_t> GetLumaShift(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::NV12:
+    case PixelFormat::YUV420P:
+    case PixelFormat::YUVJ420P:
+    case PixelFormat::YUV422P:
+        return 0;
+    case PixelFormat::P010:
+        return 8;
+    case PixelFormat::YUV420P10:
+        return 2;
+    default:
+        return std::nullopt;
+    }
+}
+
+FrameStatistics FrameAnalyzer::Analyze(const FrameDescriptor& frame)
+{
+    if (!Downscale(frame))
+    {
+        m_hasPreviousFrame = false;
+        return {};
+    }
+
+    m_histogram.fill(0);
+    for (uint8_t sample : m_thumbnail)
+    {
+        ++m_histogram[sample * HistogramBinCount / 256];
+    }
+
+    const AnalysisKernels& kernels = GetAnalysisKernels();
+    FrameStatistics statistics;
+    statistics.isAnalyzed = true;
+
+    // Horizontal neighbours are compared row by row, vertical ones in one pass over shifted thumbnail.
+    uint64_t gradientSum = kernels.sumAbsoluteDifferences(
+        m_thumbnail.data(), m_thumbnail.data() + m_thumbnailWidth, size_t(m_thumbnailWidth) * (m_thumbnailHeight - 1));
+    for (uint32_t y = 0; y < m_thumbnailHeight; ++y)
+    {
+        const uint8_t* row = m_thumbnail.data() + size_t(y) * m_thumbnailWidth;
+        gradientSum += kernels.sumAbsoluteDifferences(row, row + 1, m_thumbnailWidth - 1);
+    }
+    statistics.spatialActivity = static_cast<float>(double(gradientSum) / m_thumbnail.size());
+
+    if (m_hasPreviousFrame)
+    {
+        const size_t sampleCount = m_thumbnail.size();
+        const uint64_t difference = kernels.sumAbsoluteDifferences(
+            m_thumbnail.data(), m_previousThumbnail.data(), sampleCount);
+
+        uint64_t histogramDifference = 0;
+        for (uint32_t bin = 0; bin < HistogramBinCount; ++bin)
+        {
+            histogramDifference += static_cast<uint64_t>(
+                std::abs(int64_t(m_histogram[bin]) - int64_t(m_previousHistogram[bin])));
+        }
+
+        statistics.hasPreviousFrame = true;
+        statistics.meanAbsoluteDifference = static_cast<float>(double(difference) / sampleCount);
+        // Each moved sample is counted in two bins.
+        statistics.histogramDistance = static_cast<float>(double(histogramDifference) / (2.0 * sampleCount));
+        statistics.motionCompensatedDifference = EstimateMotion().value_or(statistics.meanAbsoluteDifference);
+    }
+
+    std::swap(m_thumbnail, m_previousThumbnail);
+    std::swap(m_histogram, m_previousHistogram);
+    m_hasPreviousFrame = true;
+    return statistics;
+}
+
+void FrameAnalyzer::Reset()
+{
+    m_hasPreviousFrame = false;
+}
+
+bool FrameAnalyzer::IsSceneCut(const FrameStatistics& statistics)
+{
+    if (!statistics.hasPreviousFrame)
+        return false;
+
+    return statistics.meanAbsoluteDifference >= SceneCutDifferenceOnly
+        || (statistics.meanAbsoluteDifference >= SceneCutDifference
+            && statistics.histogramDistance >= SceneCutHistogramDistance);
+}
+
+bool FrameAnalyzer::IsHighMotion(const FrameStatistics& statistics)
+{
+    return statistics.hasPreviousFrame && statistics.motionCompensatedDifference >= HighMotionDifference;
+}
+
+std::optional<float> FrameAnalyzer::EstimateMotion() const
+{
+    const uint32_t blocksX = m_thumbnailWidth / MotionBlockSize;
+    const uint32_t blocksY = m_thumbnailHeight / MotionBlockSize;
+    if (blocksX == 0 || blocksY == 0)
+        return std::nullopt;
+
+    const AnalysisKernels& kernels = GetAnalysisKernels();
+    const int width = static_cast<int>(m_thumbnailWidth);
+    const int height = static_cast<int>(m_thumbnailHeight);
+    const int blockSize = static_cast<int>(MotionBlockSize);
+
+    uint64_t difference = 0;
+    for (int blockY = 0; blockY < static_cast<int>(blocksY); ++blockY)
+    {
+        for (int blockX = 0; blockX < static_cast<int>(blocksX); ++blockX)
+        {
+            const int x0 = blockX * blockSize;
+            const int y0 = blockY * blockSize;
+            const uint8_t* block = m_thumbnail.data() + size_t(y0) * width + x0;
+
+            uint32_t bestSad = UINT32_MAX;
+            for (int dy = -MotionSearchRange; dy <= MotionSearchRange; ++dy)
+            {
+                for (int dx = -MotionSearchRange; dx <= MotionSearchRange; ++dx)
+                {
+                    const int x = x0 + dx;
+                    const int y = y0 + dy;
+                    if (x < 0 || y < 0 || x + blockSize > width || y + blockSize > height)
+                        continue;
+
+                    const uint8_t* candidate = m_previousThumbnail.data() + size_t(y) * width + x;
+                    bestSad = (std::min)(bestSad, kernels.blockSad8x8(block, candidate, size_t(width)));
+                }
+            }
+            difference += bestSad;
+        }
+    }
+    return static_cast<float>(double(difference) / (size_t(blocksX) * blocksY * MotionBlockSize * MotionBlockSize));
+}
+
+bool FrameAnalyzer::Downscale(const FrameDescriptor& frame)
+{
+    const std::optional<uint32_t> shift = GetLumaShift(frame.format);
+    const FramePlane& luma = frame.planes[0];
+    if (!shift.has_value() || frame.planeCount == 0 || luma.data == nullptr)
+        return false;
+
+    const uint32_t width = frame.width / BlockSize;
+    const uint32_t height = (std::min)(frame.height, luma.height) / BlockSize;
+    if (width == 0 || height == 0)
+        return false;
+
+    if (width != m_thumbnailWidth || height != m_thumbnailHeight)
+    {
+        // Frames of different sizes are not compared.
+        m_hasPreviousFrame = false;
+        m_thumbnailWidth = width;
+        m_thumbnailHeight = height;
+        m_blockSums.resize(width);
+        m_thumbnail.resize(size_t(width) * height);
+        m_previousThumbnail.resize(size_t(width) * height);
+    }
+
+    const AnalysisKernels& kernels = GetAnalysisKernels();
+    for (uint32_t blockRow = 0; blockRow < height; ++blockRow)
+    {
+        std::fill(m_blockSums.begin(), m_blockSums.end(), 0u);
+        for (uint32_t y = 0; y < BlockSize; y += RowStep)
+        {
+            const uint8_t* row = luma.data + (size_t(blockRow) * BlockSize + y) * luma.pitch;
+            if (*shift == 0)
+                kernels.sumBlocks8(row, m_blockSums.data(), width);
+            else
+                kernels.sumBlocks16(reinterpret_cast<const uint16_t*>(row), *shift, m_blockSums.data(), width);
+        }
+
+        uint8_t* thumbnailRow = m_thumbnail.data() + size_t(blockRow) * width;
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            thumbnailRow[x] = static_cast<uint8_t>((m_blockSums[x] + SamplesPerBlock / 2) / SamplesPerBlock);
+        }
+    }
+    return true;
+}
+
+}
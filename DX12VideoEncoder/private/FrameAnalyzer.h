@@ -0,0 +1,56 @@
+#pragma once
+#include "EncoderAPI.h"
+
+namespace DX12VideoEncoding
+{
+
+// Shift narrowing luma samples to 8 bits, nullopt for formats without a luma plane.
+std::optional<uint32_t> GetLumaShift(PixelFormat format);
+
+// Luma detail of a frame and its difference from the previous analyzed one.
+struct FrameStatistics
+{
+    bool isAnalyzed{};
+    // Mean absolute difference of neighbour downscaled luma samples, estimates intra prediction cost.
+    float spatialActivity{};
+
+    bool hasPreviousFrame{};
+    float meanAbsoluteDifference{}; // per downscaled luma sample, 0 - 255
+    float histogramDistance{};      // 0 - same luma distribution, 1 - disjoint ones
+    // Mean absolute difference after motion compensation of 64x64 luma blocks, estimates inter prediction cost.
+    float motionCompensatedDifference{};
+};
+
+// Compares consecutive frames by their luma downscaled to 8x8 block averages, with AVX2 or NEON if available.
+class FrameAnalyzer
+{
+public:
+    // Frames should be passed in display order. Frames without a luma plane (BGRA) are not analyzed
+    // and break the sequence.
+    FrameStatistics Analyze(const FrameDescriptor& frame);
+    void Reset();
+
+    // Large change of both the picture and its brightness distribution, motion keeps the distribution.
+    static bool IsSceneCut(const FrameStatistics& statistics);
+    // Motion which isn't compensated well, frames around it are poor candidates for B-frames.
+    static bool IsHighMotion(const FrameStatistics& statistics);
+
+private:
+    static constexpr uint32_t HistogramBinCount = 32;
+
+    bool Downscale(const FrameDescriptor& frame);
+    // Nullopt if the frame is smaller than a motion block.
+    std::optional<float> EstimateMotion() const;
+
+private:
+    uint32_t m_thumbnailWidth = 0;
+    uint32_t m_thumbnailHeight = 0;
+    std::vector<uint32_t> m_blockSums;
+    std::vector<uint8_t> m_thumbnail;
+    std::vector<uint8_t> m_previousThumbnail;
+    std::array<uint32_t, HistogramBinCount> m_histogram{};
+    std::array<uint32_t, HistogramBinCount> m_previousHistogram{};
+    bool m_hasPreviousFrame = false;
+};
+
+}
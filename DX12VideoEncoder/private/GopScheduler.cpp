@@ -0,0 +1,300 @@
+#include "pch.h"
+#include "GopScheduler.h"
+#include "Utils.h"
+
+namespace DX12VideoEncoding
+{
+
+std::string GetFrameTypeName(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType)
+{
+    switch (frameType)
+    {
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME:
+        return "IDR";
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME:
+        return "I";
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME:
+        return "P";
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME:
+        return "B";
+    default:
+        return "Unknown";
+    }
+}
+
+GopScheduler::GopScheduler(const EncoderConfiguration& config)
+    : m_keyFrameInterval(config.keyFrameInterval)
+    , m_bFramesCount(config.bFramesCount)
+    , m_openGop(config.enableOpenGop)
+    , m_adaptiveBFrames(config.enableAdaptiveBFrames && config.bFramesCount > 0)
+    , m_lookaheadDepth(config.lookaheadDepth)
+{
+}
+
+void GopScheduler::Push(Frame frame, bool sceneCut, bool highMotion)
+{
+    // Requested key frames start a new GOP the same way as scene cuts.
+    frame.frameType = sceneCut || m_keyFrameRequested
+        ? D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME
+        : GetFrameType(frame.frameOrderNumber);
+    if (frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME
+        || frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME)
+    {
+        if (sceneCut)
+        {
+            LogMessage(LogLevel::E_DEBUG, "Scene cut at frame " + std::to_string(frame.frameOrderNumber)
+                + ", starting new GOP\n");
+        }
+        else if (m_keyFrameRequested)
+        {
+            LogMessage(LogLevel::E_DEBUG, "Key frame requested at frame " + std::to_string(frame.frameOrderNumber)
+                + ", starting new GOP\n");
+        }
+        m_gopStartFrameNumber = frame.frameOrderNumber;
+        m_keyFrameRequested = false;
+    }
+    frame.gopStartFrameNumber = m_gopStartFrameNumber;
+
+    if (frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
+    {
+        auto futureRefFrameNumber = GetNextReferenceFrameNumber(frame);
+        auto nextKeyFrameNumber = GetNextKeyFrameNumber(frame);
+        if (m_openGop && futureRefFrameNumber >= nextKeyFrameNumber)
+        {
+            // The I-frame starting the next open GOP is the future reference of the leading B-frames.
+            futureRefFrameNumber = nextKeyFrameNumber;
+        }
+        else if (futureRefFrameNumber >= nextKeyFrameNumber)
+        {
+            // No P frame in the end of GOP, treat this frame as P frame.
+            LogMessage(LogLevel::E_DEBUG, "Queue P frame " + std::to_string(frame.frameOrderNumber)
+                + " instead of B frame because of GOP end\n");
+            frame.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+        }
+        frame.futureReferenceFrameOrderNumber = futureRefFrameNumber;
+    }
+
+    m_heldFrames.push_back(LookaheadFrame{ std::move(frame), highMotion });
+    if (m_heldFrames.size() > m_lookaheadDepth)
+        ReleaseHeldFrame();
+}
+
+void GopScheduler::RequestKeyFrame()
+{
+    m_keyFrameRequested = true;
+}
+
+void GopScheduler::RestartGop(uint64_t frameOrderNumber)
+{
+    // A GOP pushed after the frame is kept.
+    m_gopStartFrameNumber = (std::max)(m_gopStartFrameNumber, frameOrderNumber);
+}
+
+void GopScheduler::Flush()
+{
+    while (!m_heldFrames.empty())
+    {
+        ReleaseHeldFrame();
+    }
+    while (QueueNextMiniGop(true))
+    {
+    }
+    QueueBFramesAsPFrames();
+}
+
+std::optional<GopScheduler::Frame> GopScheduler::Pop()
+{
+    if (m_queuedFrames.empty())
+        return {};
+
+    Frame frame = std::move(m_queuedFrames.front());
+    m_queuedFrames.pop_front();
+    m_lastPoppedFrameOrderNumber = frame.frameOrderNumber;
+    return frame;
+}
+
+bool GopScheduler::HasReorderedFrames() const
+{
+    if (!m_lastPoppedFrameOrderNumber.has_value())
+        return false;
+
+    const auto precedesPopped = [this](const Frame& frame)
+        {
+            return frame.frameOrderNumber < *m_lastPoppedFrameOrderNumber;
+        };
+    return std::any_of(m_queuedFrames.begin(), m_queuedFrames.end(), precedesPopped)
+        || std::any_of(m_bFrames.begin(), m_bFrames.end(), precedesPopped);
+}
+
+bool GopScheduler::IsPictureNumberingRestartDue(uint64_t frameOrderNumber) const
+{
+    return frameOrderNumber - m_pictureNumberingStart >= PictureNumberingRestartInterval;
+}
+
+D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 GopScheduler::GetFrameType(uint64_t frameOrderNumber) const
+{
+    // GOP phase is counted from the last IDR or I-frame, as scene cuts can start GOPs at any frame.
+    bool firstFrame = frameOrderNumber == 0;
+    const auto gopFrameNumber = frameOrderNumber - m_gopStartFrameNumber;
+    if (firstFrame)
+        return D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+
+    if (m_keyFrameInterval > 0 && (gopFrameNumber % m_keyFrameInterval == 0))
+    {
+        return m_openGop ? D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME : D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+    }
+
+    if ((gopFrameNumber % (m_bFramesCount + 1)) == 0)
+        return D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+
+    return D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME;
+}
+
+uint64_t GopScheduler::GetNextReferenceFrameNumber(const Frame& frame) const
+{
+    const auto gopStart = frame.gopStartFrameNumber;
+
+    const auto pFrameInterval = m_bFramesCount + 1;
+    return ((frame.frameOrderNumber - gopStart) / pFrameInterval) * pFrameInterval + pFrameInterval + gopStart;
+}
+
+uint64_t GopScheduler::GetNextKeyFrameNumber(const Frame& frame) const
+{
+    if (m_keyFrameInterval == 0)
+        return (std::numeric_limits<uint64_t>::max)();
+
+    // A scene cut can come earlier.
+    return frame.gopStartFrameNumber + m_keyFrameInterval;
+}
+
+void GopScheduler::ReleaseHeldFrame()
+{
+    LookaheadFrame heldFrame = std::move(m_heldFrames.front());
+    m_heldFrames.pop_front();
+
+    if (m_adaptiveBFrames)
+    {
+        m_lookaheadFrames.push_back(std::move(heldFrame));
+        QueueNextMiniGop(false);
+    }
+    else
+    {
+        QueueFrame(std::move(heldFrame.frame));
+    }
+}
+
+void GopScheduler::QueueFrame(Frame frame)
+{
+    if (frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME
+        && IsPictureNumberingRestartDue(frame.futureReferenceFrameOrderNumber))
+    {
+        // No P frame before the POC restart.
+        LogMessage(LogLevel::E_DEBUG, "Queue P frame " + std::to_string(frame.frameOrderNumber)
+            + " instead of B frame because of POC restart\n");
+        frame.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+    }
+
+    if (frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
+    {
+        LogMessage(LogLevel::E_DEBUG, "Queue B frame " + std::to_string(frame.frameOrderNumber) + "\n");
+
+        // Don't use referenced B frames.
+        frame.useAsReference = false;
+        m_bFrames.push_back(std::move(frame));
+        return;
+    }
+
+    frame.useAsReference = true;
+    if (frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
+    {
+        // A scene cut came before the future reference of the waiting B-frames,
+        // they are encoded as P-frames of the previous GOP before the IDR frame.
+        QueueBFramesAsPFrames();
+        m_queuedFrames.push_back(std::move(frame));
+        return;
+    }
+
+    // The waiting B-frames reference this P or I-frame, so they follow it.
+    const uint64_t referenceFrameOrderNumber = frame.frameOrderNumber;
+    m_queuedFrames.push_back(std::move(frame));
+    for (Frame& bFrame : m_bFrames)
+    {
+        bFrame.futureReferenceFrameOrderNumber = referenceFrameOrderNumber;
+        m_queuedFrames.push_back(std::move(bFrame));
+    }
+    m_bFrames.clear();
+}
+
+bool GopScheduler::QueueNextMiniGop(bool flushing)
+{
+    // Queues the next IDR frame or B-frames with the P-frame they reference in encoding order,
+    // returns false if more frames are needed for the decision.
+    if (m_lookaheadFrames.empty())
+        return false;
+
+    if (m_lookaheadFrames.front().frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
+    {
+        Frame idrFrame = std::move(m_lookaheadFrames.front().frame);
+        m_lookaheadFrames.pop_front();
+        idrFrame.useAsReference = true;
+        m_queuedFrames.push_back(std::move(idrFrame));
+        return true;
+    }
+
+    // B-frames are not used across IDR frames and high motion, so the P-frame is the last frame before them.
+    // The I-frame of an open GOP takes the place of the P-frame.
+    size_t referenceIndex = 0;
+    for (; referenceIndex < m_bFramesCount; ++referenceIndex)
+    {
+        if (m_lookaheadFrames[referenceIndex].frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME
+            || IsPictureNumberingRestartDue(m_lookaheadFrames[referenceIndex].frame.frameOrderNumber))
+            break;
+
+        if (referenceIndex + 1 == m_lookaheadFrames.size())
+        {
+            if (!flushing)
+                return false;
+            break;
+        }
+
+        const LookaheadFrame& nextFrame = m_lookaheadFrames[referenceIndex + 1];
+        if (nextFrame.frame.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME || nextFrame.highMotion)
+            break;
+    }
+
+    Frame referenceFrame = std::move(m_lookaheadFrames[referenceIndex].frame);
+    if (referenceFrame.frameType != D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME)
+        referenceFrame.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+    referenceFrame.useAsReference = true;
+    const uint64_t referenceFrameOrderNumber = referenceFrame.frameOrderNumber;
+    const auto referenceFrameType = referenceFrame.frameType;
+    m_queuedFrames.push_back(std::move(referenceFrame));
+
+    for (size_t i = 0; i < referenceIndex; ++i)
+    {
+        Frame bFrame = std::move(m_lookaheadFrames[i].frame);
+        bFrame.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME;
+        bFrame.useAsReference = false;
+        bFrame.futureReferenceFrameOrderNumber = referenceFrameOrderNumber;
+        m_queuedFrames.push_back(std::move(bFrame));
+    }
+    m_lookaheadFrames.erase(m_lookaheadFrames.begin(), m_lookaheadFrames.begin() + referenceIndex + 1);
+
+    LogMessage(LogLevel::E_DEBUG, "Queue " + GetFrameTypeName(referenceFrameType) + " frame "
+        + std::to_string(referenceFrameOrderNumber)
+        + " after " + std::to_string(referenceIndex) + " B frames\n");
+    return true;
+}
+
+void GopScheduler::QueueBFramesAsPFrames()
+{
+    for (Frame& frame : m_bFrames)
+    {
+        frame.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+        frame.useAsReference = true;
+        m_queuedFrames.push_back(std::move(frame));
+    }
+    m_bFrames.clear();
+}
+
+}
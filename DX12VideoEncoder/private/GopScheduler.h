@@ -0,0 +1,90 @@
+#pragma once
+#include "EncoderAPI.h"
+
+namespace DX12VideoEncoding
+{
+
+// POC of infinite and open GOPs is restarted with MMCO 5 once it reaches this value, far below the 32-bit range
+// of POC in the decoder, so they don't need IDR frames to run for years.
+constexpr uint64_t PictureNumberingRestartInterval = uint64_t{ 1 } << 30;
+
+std::string GetFrameTypeName(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType);
+
+// Gives the pushed frames their types by the GOP structure, scene cuts and key frame requests, and returns them
+// in the encoding order, B-frames after the frame they reference. Pushed frames can be held back for the lookahead
+// before the B-frames decision, each one keeps the GOP it was pushed to, whatever GOPs the later frames start.
+class GopScheduler
+{
+public:
+    struct Frame
+    {
+        RawFrameData frameData;
+        int64_t timestamp{};
+        std::chrono::steady_clock::time_point captureTime{};
+        D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType{ D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME };
+        uint64_t frameOrderNumber{};
+        uint64_t gopStartFrameNumber{}; // IDR or I-frame of the GOP the frame was pushed to
+        uint32_t idrPicId{};
+        uint64_t futureReferenceFrameOrderNumber{}; // Only valid for B-frames
+        bool useAsReference{ false };
+        uint32_t temporalLayerIndex{};
+    };
+
+    GopScheduler() = default;
+    explicit GopScheduler(const EncoderConfiguration& config);
+
+    // Frames are pushed in display order with frame order numbers counted from 0, the type is set here.
+    // sceneCut and highMotion come from the analysis of the frame.
+    void Push(Frame frame, bool sceneCut = false, bool highMotion = false);
+    // The next pushed frame starts a new GOP with an IDR frame.
+    void RequestKeyFrame();
+    // The started frame became an IDR frame, GOPs of the next pushed frames are counted from it.
+    void RestartGop(uint64_t frameOrderNumber);
+    // Queues all pushed frames, B-frames without their future reference become P-frames.
+    void Flush();
+
+    // The next frame in the encoding order, none if more frames should be pushed first.
+    std::optional<Frame> Pop();
+    // Queued frames follow the last popped one in the encoding order but precede it in the display order,
+    // as B-frames referencing it.
+    bool HasReorderedFrames() const;
+
+    // B-frames don't span the restart of POC counting, which is due on the frames that far from this one.
+    void SetPictureNumberingStart(uint64_t frameOrderNumber) { m_pictureNumberingStart = frameOrderNumber; }
+    bool IsPictureNumberingRestartDue(uint64_t frameOrderNumber) const;
+
+private:
+    // Pushed frame held for the lookahead or waiting for the B-frames decision.
+    struct LookaheadFrame
+    {
+        Frame frame;
+        bool highMotion{ false };
+    };
+
+    D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 GetFrameType(uint64_t frameOrderNumber) const;
+    uint64_t GetNextReferenceFrameNumber(const Frame& frame) const;
+    uint64_t GetNextKeyFrameNumber(const Frame& frame) const;
+    void ReleaseHeldFrame();
+    void QueueFrame(Frame frame);
+    bool QueueNextMiniGop(bool flushing);
+    void QueueBFramesAsPFrames();
+
+private:
+    uint32_t m_keyFrameInterval = 0; // 0 - inifinite GOP
+    uint32_t m_bFramesCount = 0;
+    bool m_openGop = false; // GOPs start with I-frames, only scene cuts and key frame requests start with IDR frames
+    bool m_adaptiveBFrames = false;
+    uint32_t m_lookaheadDepth = 0;
+
+    uint64_t m_gopStartFrameNumber = 0; // Of the last pushed GOP
+    bool m_keyFrameRequested = false;
+    uint64_t m_pictureNumberingStart = 0;
+
+    std::deque<LookaheadFrame> m_heldFrames; // Analyzed frames not queued yet, the future of the started frames
+    std::deque<LookaheadFrame> m_lookaheadFrames; // Of the B-frames decision
+    std::vector<Frame> m_bFrames; // Waiting for the P or I-frame they reference
+    std::deque<Frame> m_queuedFrames; // In the encoding order
+    std::optional<uint64_t> m_lastPoppedFrameOrderNumber;
+};
+
+}
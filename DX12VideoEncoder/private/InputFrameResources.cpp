@@ -1,14 +1,19 @@
 #include "pch.h"
 #include "InputFrameResources.h"
+#include "PixelFormatConverter.h"
 #include "Utils.h"
 
 namespace DX12VideoEncoding
 {
 
 InputFrameResources::InputFrameResources(const ComPtr<ID3D12Device>& device,
+    std::shared_ptr<ICommandSubmitter> copySubmitter,
+    std::shared_ptr<WorkerPool> workerPool,
     DXGI_FORMAT dxgiFormat, UINT width, UINT height)
     : m_device(device)
     , m_dxgiFormat(dxgiFormat)
+    , m_workerPool(std::move(workerPool))
+    , m_copySubmitter(std::move(copySubmitter))
 {
     CreateCommandResources();
     CreateTextureResources(width, height);
@@ -19,6 +24,7 @@ void InputFrameResources::SetFrameData(const RawFrameData& rawFrameData)
     // Ensure previous frame is uploaded.
     assert(m_rawFrameData == nullptr);
     m_rawFrameData = rawFrameData;
+    m_frameDescriptor = rawFrameData->GetDescriptor();
 }
 
 void InputFrameResources::UploadTexture()
@@ -26,33 +32,28 @@ void InputFrameResources::UploadTexture()
     // Starts copying the frame to input texture.
 
     D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint[2];
-    UINT numRows[2];
-    UINT64 rowBytes[2];
-    UINT64 totalBytes;
     auto inputTextureDesc = m_inputTexture->GetDesc();
-    m_device->GetCopyableFootprints(&inputTextureDesc, 0, 2, 0, footprint, numRows, rowBytes, &totalBytes);
-
-    D3D12_SUBRESOURCE_DATA frameData[2] = {};
-    frameData[0].pData = m_rawFrameData->GetY();
-    frameData[0].RowPitch = m_rawFrameData->GetLinesizeY();
-    frameData[0].SlicePitch = m_rawFrameData->GetLinesizeY() * m_rawFrameData->GetHeight();
-
-    frameData[1].pData = m_rawFrameData->GetUV();
-    frameData[1].RowPitch = m_rawFrameData->GetLinesizeUV();
-    frameData[1].SlicePitch = m_rawFrameData->GetLinesizeUV() * m_rawFrameData->GetHeight() / 2;
+    m_device->GetCopyableFootprints(&inputTextureDesc, 0, 2, 0, footprint, nullptr, nullptr, nullptr);
+
+    const FrameUploadBuffer uploadBuffer{
+        .format = m_dxgiFormat,
+        .y = m_uploadBufferData + footprint[0].Offset,
+        .linesizeY = footprint[0].Footprint.RowPitch,
+        .uv = m_uploadBufferData + footprint[1].Offset,
+        .linesizeUV = footprint[1].Footprint.RowPitch,
+    };
+    if (!m_rawFrameData->WriteTo(uploadBuffer))
+    {
+        // Planes in the input format are copied, other layouts are converted on the way.
+        ConvertImage(m_frameDescriptor, uploadBuffer, m_workerPool.get());
+    }
 
-    auto requiredSize = UpdateSubresources(m_inputTextureCommandList.Get(),
-        m_inputTexture.Get(),
-        m_frameUploadBuffer.Get(),
-        0, // FirstSubresource
-        2, // NumSubresources
-        totalBytes, // UINT64 RequiredSize
-        footprint,
-        numRows,
-        rowBytes,
-        frameData
-    );
-    assert(requiredSize == totalBytes);
+    for (UINT plane = 0; plane < 2; ++plane)
+    {
+        const CD3DX12_TEXTURE_COPY_LOCATION destination(m_inputTexture.Get(), plane);
+        const CD3DX12_TEXTURE_COPY_LOCATION source(m_frameUploadBuffer.Get(), footprint[plane]);
+        m_inputTextureCommandList->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+    }
 
     const CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
         m_inputTexture.Get(),
@@ -61,53 +62,58 @@ void InputFrameResources::UploadTexture()
     m_inputTextureCommandList->ResourceBarrier(1, &barrier);
 
     ThrowIfFailed(m_inputTextureCommandList->Close());
-    ID3D12CommandList* commandLists[] = { m_inputTextureCommandList.Get() };
-    m_inputTextureCommandQueue->ExecuteCommandLists(_countof(commandLists), commandLists);
-
-    ThrowIfFailed(m_inputTextureCommandQueue->Signal(m_inputTextureFence.Get(), m_inputTextureFenceValue));
+    m_uploadSubmission = m_copySubmitter->Submit({ m_inputTextureCommandList.Get() }, {});
 }
 
 void InputFrameResources::WaitForUploadingCPU()
 {
-    if (m_inputTextureFence->GetCompletedValue() < m_inputTextureFenceValue)
+    if (m_uploadSubmission)
     {
-        ThrowIfFailed(m_inputTextureFence->SetEventOnCompletion(m_inputTextureFenceValue, nullptr));
+        m_copySubmitter->WaitForCompletion(m_uploadSubmission);
     }
 }
 
-void InputFrameResources::WaitForUploadingGPU(ID3D12CommandQueue* commandQueue) const
-{
-    ThrowIfFailed(commandQueue->Wait(m_inputTextureFence.Get(), m_inputTextureFenceValue));
-}
-
 void InputFrameResources::ResetCommands()
 {
     ThrowIfFailed(m_inputTextureCommandAllocator->Reset());
     ThrowIfFailed(m_inputTextureCommandList->Reset(m_inputTextureCommandAllocator.Get(), nullptr));
-    ++m_inputTextureFenceValue;
+    m_uploadSubmission.reset();
 
     m_rawFrameData.reset();
+    m_frameDescriptor = {};
 }
 
-void InputFrameResources::CreateCommandResources()
+void InputFrameResources::Reset()
 {
-    D3D12_COMMAND_QUEUE_DESC queueDesc = { D3D12_COMMAND_LIST_TYPE_COPY };
-    ThrowIfFailed(m_device->CreateCommandQueue(
-        &queueDesc,
-        IID_PPV_ARGS(&m_inputTextureCommandQueue)));
+    if (m_rawFrameData != nullptr)
+    {
+        WaitForUploadingCPU();
+        ResetCommands();
+    }
+}
 
+void InputFrameResources::SetWorkerPool(std::shared_ptr<WorkerPool> workerPool)
+{
+    m_workerPool = std::move(workerPool);
+}
+
+uint64_t InputFrameResources::GetMemoryUsage() const
+{
+    return GetAllocationSize(m_device.Get(), m_inputTexture.Get())
+        + GetAllocationSize(m_device.Get(), m_frameUploadBuffer.Get());
+}
+
+void InputFrameResources::CreateCommandResources()
+{
     ThrowIfFailed(m_device->CreateCommandAllocator(
-        queueDesc.Type,
+        D3D12_COMMAND_LIST_TYPE_COPY,
         IID_PPV_ARGS(&m_inputTextureCommandAllocator)));
 
     ThrowIfFailed(m_device->CreateCommandList(0,
-        queueDesc.Type,
+        D3D12_COMMAND_LIST_TYPE_COPY,
         m_inputTextureCommandAllocator.Get(),
         nullptr,
         IID_PPV_ARGS(&m_inputTextureCommandList)));
-
-    ThrowIfFailed(m_device->CreateFence(0, D3D12_FENCE_FLAG_NONE,
-        IID_PPV_ARGS(&m_inputTextureFence)));
 }
 
 
@@ -152,6 +158,12 @@ void InputFrameResources::CreateTextureResources(UINT width, UINT height)
         D3D12_RESOURCE_STATE_GENERIC_READ,
         nullptr,
         IID_PPV_ARGS(&m_frameUploadBuffer)));
+
+    // Upload heap stays mapped for the whole lifetime of the buffer.
+    const D3D12_RANGE readRange = {};
+    void* uploadBufferData = nullptr;
+    ThrowIfFailed(m_frameUploadBuffer->Map(0, &readRange, &uploadBufferData));
+    m_uploadBufferData = static_cast<uint8_t*>(uploadBufferData);
 }
 
 } // namespace DX12VideoEncoding
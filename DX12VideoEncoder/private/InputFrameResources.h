@@ -1,5 +1,6 @@
 #pragma once
 #include "EncoderAPI.h"
+#include "CommandSubmitter.h"
 
 namespace DX12VideoEncoding
 {
@@ -10,19 +11,27 @@ class InputFrameResources
 {
 public:
     InputFrameResources(const ComPtr<ID3D12Device>& device,
+        std::shared_ptr<ICommandSubmitter> copySubmitter,
+        std::shared_ptr<WorkerPool> workerPool,
         DXGI_FORMAT dxgiFormat, UINT width, UINT height);
 
     InputFrameResources(const InputFrameResources&) = delete;
 
-    UINT GetWidth() const { return m_rawFrameData->GetWidth(); }
-    UINT GetHeight() const { return m_rawFrameData->GetHeight(); }
+    UINT GetWidth() const { return m_frameDescriptor.width; }
+    UINT GetHeight() const { return m_frameDescriptor.height; }
 
     void SetFrameData(const RawFrameData& rawFrameData);
     void UploadTexture();
     ID3D12Resource* GetInputTextureRawPtr() const { return m_inputTexture.Get(); }
     void WaitForUploadingCPU();
-    void WaitForUploadingGPU(ID3D12CommandQueue* commandQueue) const;
+    // Encoding of the frame should wait for this submission on GPU.
+    const SubmissionHandle& GetUploadSubmission() const { return m_uploadSubmission; }
     void ResetCommands();
+    // Drops the frame of an interrupted encoding.
+    void Reset();
+    // Threads copying the frame planes, nullptr - copy on the calling thread.
+    void SetWorkerPool(std::shared_ptr<WorkerPool> workerPool);
+    uint64_t GetMemoryUsage() const;
 
 private:
 
@@ -32,16 +41,20 @@ private:
 private:
     ComPtr<ID3D12Device> m_device;
     const DXGI_FORMAT m_dxgiFormat;
+    std::shared_ptr<WorkerPool> m_workerPool;
 
     RawFrameData m_rawFrameData;
+    FrameDescriptor m_frameDescriptor;
     ComPtr<ID3D12Resource> m_frameUploadBuffer;
+    uint8_t* m_uploadBufferData = nullptr;
     ComPtr<ID3D12Resource> m_inputTexture;
 
-    ComPtr<ID3D12CommandQueue> m_inputTextureCommandQueue;
     ComPtr<ID3D12CommandAllocator> m_inputTextureCommandAllocator;
     ComPtr<ID3D12GraphicsCommandList> m_inputTextureCommandList;
-    ComPtr<ID3D12Fence> m_inputTextureFence;
-    UINT64 m_inputTextureFenceValue = 1;
+    SubmissionHandle m_uploadSubmission;
+
+    // Declared last to wait for the GPU work before the resources are released.
+    std::shared_ptr<ICommandSubmitter> m_copySubmitter;
 };
 
 }
@@ -0,0 +1,193 @@
+#include "pch.h"
+#include "PicturePlanner.h"
+#include "Utils.h"
+
+namespace DX12VideoEncoding
+{
+
+namespace {
+
+// idr_pic_id is coded in 16 bits, only consecutive IDR frames need different ones.
+constexpr uint32_t MaxIdrPicId = 1 << 16;
+
+}
+
+PicturePlanner::PicturePlanner(uint32_t maxReferenceFrameCount, uint32_t maxLongTermReferenceFrameCount,
+    uint64_t pictureNumberingRestartInterval)
+    : m_maxLongTermReferenceFrameCount(maxLongTermReferenceFrameCount)
+    , m_pictureNumberingRestartInterval(pictureNumberingRestartInterval)
+    , m_referenceFrames(maxReferenceFrameCount, maxLongTermReferenceFrameCount)
+{
+}
+
+PicturePlanner::Picture PicturePlanner::Start(const GopScheduler::Frame& frame, bool reorderedFrames)
+{
+    Picture picture{
+        .frameType = frame.frameType,
+        .useAsReference = frame.useAsReference,
+        .temporalLayerIndex = frame.temporalLayerIndex,
+    };
+
+    if (picture.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME
+        && !m_referenceFrames.GetLastValid(picture.temporalLayerIndex))
+    {
+        if (!reorderedFrames)
+        {
+            // All references are lost, the frame starts a new GOP.
+            LogMessage(LogLevel::E_DEBUG, "No intact reference for frame "
+                + std::to_string(frame.frameOrderNumber) + ", encoding it as IDR frame\n");
+            picture.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+            picture.useAsReference = true;
+            picture.temporalLayerIndex = 0;
+        }
+        else
+        {
+            // B-frames started after it reference it as their future frame, so the DPB is kept for them.
+            LogMessage(LogLevel::E_DEBUG, "No intact reference for frame "
+                + std::to_string(frame.frameOrderNumber) + ", encoding it as I frame\n");
+            picture.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME;
+        }
+    }
+
+    if (picture.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
+    {
+        // All frames of the previous GOP are started before its IDR frame.
+        m_referenceFrames.Clear();
+        if (m_startedFrameCount != 0)
+            m_idrPicId = (m_idrPicId + 1) % MaxIdrPicId;
+        m_lastIdrNumber = frame.frameOrderNumber;
+        m_pictureNumberingStart = frame.frameOrderNumber;
+        m_frameNum = 0;
+        picture.idrPicId = m_idrPicId;
+    }
+
+    std::vector<uint64_t> l0References;
+    std::vector<uint64_t> l1References;
+    if (picture.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME)
+    {
+        // Using only 1 past reference frame, the previous encoded frame of the same or a lower temporal layer
+        // unless it's lost on the receiver side.
+        l0References.push_back(*m_referenceFrames.GetLastValid(picture.temporalLayerIndex));
+    }
+    else if (picture.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
+    {
+        // Using only 1 past and 1 future reference frame, the future one is the last started reference frame.
+        // The past one is the newest intact frame before it.
+        assert(m_referenceFrames.GetCount() >= 2);
+        const size_t lastIdx = m_referenceFrames.GetCount() - 1;
+        const uint64_t futureFrameOrderNumber = m_referenceFrames.GetFrameOrderNumber(lastIdx);
+        std::optional<uint64_t> pastFrameOrderNumber;
+        for (size_t i = lastIdx; i-- > 0 && !pastFrameOrderNumber.has_value();)
+        {
+            if (m_referenceFrames.IsValid(m_referenceFrames.GetFrameOrderNumber(i)))
+                pastFrameOrderNumber = m_referenceFrames.GetFrameOrderNumber(i);
+        }
+
+        // B-frames are not referenced, so a lost reference is replaced without breaking the next frames:
+        // by a P-frame from the other reference or by an intra frame if both are lost.
+        const bool futureFrameValid = m_referenceFrames.IsValid(futureFrameOrderNumber);
+        if (pastFrameOrderNumber.has_value() && futureFrameValid)
+        {
+            l0References.push_back(*pastFrameOrderNumber);
+            l1References.push_back(futureFrameOrderNumber);
+        }
+        else if (pastFrameOrderNumber.has_value() || futureFrameValid)
+        {
+            picture.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+            l0References.push_back(futureFrameValid ? futureFrameOrderNumber : *pastFrameOrderNumber);
+        }
+        else
+        {
+            picture.frameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME;
+        }
+        if (picture.frameType != D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
+        {
+            LogMessage(LogLevel::E_DEBUG, "Lost reference of B frame " + std::to_string(frame.frameOrderNumber)
+                + ", encoding it as " + GetFrameTypeName(picture.frameType) + " frame\n");
+        }
+    }
+    for (uint64_t reference : l0References)
+    {
+        picture.l0List.push_back(GetPictureOrderCountNumber(reference));
+    }
+    for (uint64_t reference : l1References)
+    {
+        picture.l1List.push_back(GetPictureOrderCountNumber(reference));
+    }
+
+    // POC and frame_num restart on a P-frame which no frame precedes in display order and follows in decoding order,
+    // so the frame numbers of both orders are equal and the next frames count from it. The restart waits for
+    // the pending long-term marking, as MMCO 5 drops all other references. The frame left alone in the DPB is
+    // of the base temporal layer, so the frames of all layers can reference it.
+    picture.restartPictureNumbering = picture.frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME
+        && picture.useAsReference && picture.temporalLayerIndex == 0
+        && !reorderedFrames && !m_pendingLongTermReference.has_value()
+        && frame.frameOrderNumber - m_pictureNumberingStart >= m_pictureNumberingRestartInterval;
+
+    // The marking is written by the next reference frame, the frame to mark is gone if an IDR frame cleared the DPB
+    // or the sliding window evicted it meanwhile.
+    if (m_pendingLongTermReference.has_value() && picture.useAsReference)
+    {
+        if (m_referenceFrames.IsShortTerm(*m_pendingLongTermReference))
+        {
+            picture.longTermReference = LongTermReferenceMarking{
+                .pictureOrderCountNumber = GetPictureOrderCountNumber(*m_pendingLongTermReference),
+                .longTermFrameIndex = m_referenceFrames.MarkLongTerm(*m_pendingLongTermReference),
+            };
+            LogMessage(LogLevel::E_DEBUG, "Frame " + std::to_string(*m_pendingLongTermReference)
+                + " marked as long-term reference " + std::to_string(picture.longTermReference->longTermFrameIndex) + "\n");
+        }
+        m_pendingLongTermReference.reset();
+    }
+
+    picture.pictureOrderCountNumber = GetPictureOrderCountNumber(frame.frameOrderNumber);
+    picture.decodingOrderNumber = static_cast<UINT>(m_frameNum);
+
+    // The frame can be referenced by the next started frames even if it is not encoded yet,
+    // as GPU executes the frames in the order they are sent.
+    if (picture.useAsReference)
+    {
+        // The tracker keeps the same sliding window of the last reference frames as the DPB.
+        m_referenceFrames.Add(frame.frameOrderNumber, l0References, picture.temporalLayerIndex);
+        ++m_frameNum;
+    }
+
+    if (picture.restartPictureNumbering)
+    {
+        m_referenceFrames.KeepLast();
+        m_pictureNumberingStart = frame.frameOrderNumber;
+        // The restarting frame is inferred to have frame_num 0 after decoding.
+        m_frameNum = 1;
+        LogMessage(LogLevel::E_DEBUG, "POC and frame_num restarted at frame "
+            + std::to_string(frame.frameOrderNumber) + "\n");
+    }
+
+    ++m_startedFrameCount;
+    return picture;
+}
+
+void PicturePlanner::InvalidateReferences(uint64_t firstFrameOrderNumber, uint64_t lastFrameOrderNumber)
+{
+    m_referenceFrames.Invalidate(firstFrameOrderNumber, lastFrameOrderNumber);
+}
+
+bool PicturePlanner::MarkLongTermReference(uint64_t frameOrderNumber)
+{
+    if (m_maxLongTermReferenceFrameCount == 0)
+        return false;
+    if (m_referenceFrames.IsLongTerm(frameOrderNumber))
+        return true;
+    if (!m_referenceFrames.IsShortTerm(frameOrderNumber))
+        return false;
+
+    m_pendingLongTermReference = frameOrderNumber;
+    return true;
+}
+
+UINT PicturePlanner::GetPictureOrderCountNumber(uint64_t frameOrderNumber) const
+{
+    // Below the restart interval, far from the 32-bit range.
+    return static_cast<UINT>(frameOrderNumber - m_pictureNumberingStart);
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "GopScheduler.h"
+#include "ReferenceFrameTracker.h"
+#include "ReferenceFramesManager.h"
+
+namespace DX12VideoEncoding
+{
+
+// Numbers the started frames for the slice headers: POC and frame_num counted from the last IDR frame or the last
+// restart with MMCO 5, idr_pic_id and the long-term marking. Keeps the DPB of the started frames to choose
+// their references, only intact ones: frames which references are lost are encoded as intra or P-frames instead.
+class PicturePlanner
+{
+public:
+    struct Picture
+    {
+        D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType{ D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME };
+        bool useAsReference{ false };
+        uint32_t temporalLayerIndex{};
+        uint32_t idrPicId{};
+        UINT pictureOrderCountNumber{};
+        UINT decodingOrderNumber{}; // frame_num before the wrap by MaxFrameNum
+        std::vector<UINT> l0List; // POC of the references
+        std::vector<UINT> l1List;
+        std::optional<LongTermReferenceMarking> longTermReference;
+        bool restartPictureNumbering{ false };
+    };
+
+    PicturePlanner() = default;
+    PicturePlanner(uint32_t maxReferenceFrameCount, uint32_t maxLongTermReferenceFrameCount,
+        uint64_t pictureNumberingRestartInterval = PictureNumberingRestartInterval);
+
+    // frame - the next frame in the encoding order, typed by GopScheduler.
+    // reorderedFrames - the frames started after it precede it in display order, see GopScheduler::HasReorderedFrames.
+    // Frames which references are lost change the type: P-frames become IDR frames, or reference I-frames
+    // if reordered B-frames wait for them, B-frames become non-reference P-frames or I-frames.
+    Picture Start(const GopScheduler::Frame& frame, bool reorderedFrames);
+
+    void InvalidateReferences(uint64_t firstFrameOrderNumber, uint64_t lastFrameOrderNumber);
+    // The frame is marked by the next started reference frame. Returns false if the DPB doesn't hold it.
+    bool MarkLongTermReference(uint64_t frameOrderNumber);
+
+    const ReferenceFrameTracker& GetReferenceFrames() const { return m_referenceFrames; }
+    uint64_t GetLastIdrNumber() const { return m_lastIdrNumber; }
+    uint64_t GetPictureNumberingStart() const { return m_pictureNumberingStart; }
+
+private:
+    UINT GetPictureOrderCountNumber(uint64_t frameOrderNumber) const;
+
+private:
+    uint32_t m_maxLongTermReferenceFrameCount = 0;
+    uint64_t m_pictureNumberingRestartInterval = PictureNumberingRestartInterval;
+    uint64_t m_startedFrameCount = 0;
+    uint64_t m_lastIdrNumber = 0; // IDR frame of the last started GOP
+    // POC and frame_num are counted from the last IDR frame or a later P-frame restarting them with MMCO 5.
+    uint64_t m_pictureNumberingStart = 0;
+    // frame_num of the next started frame. Gaps are not allowed, so it advances only after reference frames (7.4.3):
+    // non-reference B-frames and top temporal layer frames share it with the next frame.
+    uint64_t m_frameNum = 0;
+    uint32_t m_idrPicId = 0;
+    ReferenceFrameTracker m_referenceFrames; // Of the started frames
+    std::optional<uint64_t> m_pendingLongTermReference; // Marked by the next started reference frame
+};
+
+}
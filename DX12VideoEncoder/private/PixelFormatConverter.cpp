@@ -0,0 +1,773 @@
+#include "pch.h"
+#include "PixelFormatConverter.h"
+#include "CpuFeatures.h"
+#include "PlaneCopy.h"
+#include "WorkerPool.h"
+#include "Utils.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define PIXEL_CONVERTER_AVX2
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#define PIXEL_CONVERTER_NEON
+#endif
+
+
+namespace DX12VideoEncoding {
+
+namespace {
+
+// Full to limited range scales of luma and chroma.
+constexpr uint32_t LumaRangeScale = 219;
+constexpr uint32_t ChromaRangeScale = 224;
+
+// Rows of one task, it's enough to amortize the task overhead and keep rows of the task in cache.
+constexpr uint32_t MinChromaRowsPerTask = 16;
+
+// Row kernels, widths are in samples of the destination row.
+// Scalar versions produce exactly the same result as SIMD ones and handle the row tails.
+struct RowKernels
+{
+    void (*interleave)(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width);
+    void (*averageInterleave)(const uint8_t* u0, const uint8_t* u1, const uint8_t* v0, const uint8_t* v1,
+        uint8_t* uv, uint32_t width);
+    void (*compressRange)(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t scale);
+    void (*compressInterleave)(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width);
+    void (*narrow16To8)(const uint16_t* src, uint8_t* dst, uint32_t width);
+    void (*bgraToLuma)(const uint8_t* bgra, uint8_t* y, uint32_t width);
+    // Width is in luma samples, the chroma is taken from 2x2 blocks of two rows.
+    void (*bgraToChroma)(const uint8_t* bgra0, const uint8_t* bgra1, uint8_t* uv, uint32_t width);
+    // Moves 10-bit values from the low bits to the high ones.
+    void (*widen10)(const uint16_t* src, uint16_t* dst, uint32_t width);
+    void (*widenInterleave10)(const uint16_t* u, const uint16_t* v, uint16_t* uv, uint32_t width);
+};
+
+// round(x / 255) for x < 2^16 - 256
+inline uint32_t DivideBy255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+inline uint8_t CompressRange(uint8_t value, uint32_t scale)
+{
+    return static_cast<uint8_t>(DivideBy255(value * scale) + 16);
+}
+
+inline uint8_t BgraToY(const uint8_t* bgra)
+{
+    return static_cast<uint8_t>(((66 * bgra[2] + 129 * bgra[1] + 25 * bgra[0] + 128) >> 8) + 16);
+}
+
+// b, g, r are sums of two pixels.
+inline void BgraSumToUV(int b, int g, int r, uint8_t* uv)
+{
+    uv[0] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 256) >> 9) + 128);
+    uv[1] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 256) >> 9) + 128);
+}
+
+void InterleaveScalar(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        uv[2 * x] = u[x];
+        uv[2 * x + 1] = v[x];
+    }
+}
+
+void AverageInterleaveScalar(const uint8_t* u0, const uint8_t* u1, const uint8_t* v0, const uint8_t* v1,
+    uint8_t* uv, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        uv[2 * x] = static_cast<uint8_t>((u0[x] + u1[x] + 1) >> 1);
+        uv[2 * x + 1] = static_cast<uint8_t>((v0[x] + v1[x] + 1) >> 1);
+    }
+}
+
+void CompressRangeScalar(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t scale)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        dst[x] = CompressRange(src[x], scale);
+    }
+}
+
+void CompressInterleaveScalar(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        uv[2 * x] = CompressRange(u[x], ChromaRangeScale);
+        uv[2 * x + 1] = CompressRange(v[x], ChromaRangeScale);
+    }
+}
+
+void Narrow16To8Scalar(const uint16_t* src, uint8_t* dst, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        dst[x] = static_cast<uint8_t>((std::min)(src[x] + 128u, 0xFFFFu) >> 8);
+    }
+}
+
+void BgraToLumaScalar(const uint8_t* bgra, uint8_t* y, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        y[x] = BgraToY(bgra + 4 * x);
+    }
+}
+
+void BgraToChromaScalar(const uint8_t* bgra0, const uint8_t* bgra1, uint8_t* uv, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x += 2)
+    {
+        // The last column of odd width is duplicated.
+        const uint32_t x1 = (std::min)(x + 1, width - 1);
+        int sum[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            sum[c] = ((bgra0[4 * x + c] + bgra1[4 * x + c] + 1) >> 1)
+                + ((bgra0[4 * x1 + c] + bgra1[4 * x1 + c] + 1) >> 1);
+        }
+        BgraSumToUV(sum[0], sum[1], sum[2], uv + x);
+    }
+}
+
+void Widen10Scalar(const uint16_t* src, uint16_t* dst, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        dst[x] = static_cast<uint16_t>(src[x] << 6);
+    }
+}
+
+void WidenInterleave10Scalar(const uint16_t* u, const uint16_t* v, uint16_t* uv, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        uv[2 * x] = static_cast<uint16_t>(u[x] << 6);
+        uv[2 * x + 1] = static_cast<uint16_t>(v[x] << 6);
+    }
+}
+
+constexpr RowKernels ScalarKernels = {
+    InterleaveScalar,
+    AverageInterleaveScalar,
+    CompressRangeScalar,
+    CompressInterleaveScalar,
+    Narrow16To8Scalar,
+    BgraToLumaScalar,
+    BgraToChromaScalar,
+    Widen10Scalar,
+    WidenInterleave10Scalar,
+};
+
+#if defined(PIXEL_CONVERTER_AVX2)
+
+// Interleaves 32 samples of u and v into 64 bytes.
+inline void StoreInterleaved(__m256i u, __m256i v, uint8_t* uv)
+{
+    // Unpacking works within 128-bit lanes, so 64-bit quarters are reordered to get the linear order.
+    u = _mm256_permute4x64_epi64(u, 0xD8);
+    v = _mm256_permute4x64_epi64(v, 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv), _mm256_unpacklo_epi8(u, v));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv + 32), _mm256_unpackhi_epi8(u, v));
+}
+
+inline __m256i Load256(const void* src)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+}
+
+inline __m256i CompressRange16(__m256i value, __m256i scale)
+{
+    const __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(value, scale), _mm256_set1_epi16(128));
+    const __m256i divided = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    return _mm256_add_epi16(divided, _mm256_set1_epi16(16));
+}
+
+inline __m256i CompressRange8(__m256i value, uint32_t scale)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i scale16 = _mm256_set1_epi16(static_cast<short>(scale));
+    // Unpacking and packing within lanes keep the order.
+    return _mm256_packus_epi16(
+        CompressRange16(_mm256_unpacklo_epi8(value, zero), scale16),
+        CompressRange16(_mm256_unpackhi_epi8(value, zero), scale16));
+}
+
+// Packs 16 values of two registers with 32-bit elements in order, stores 16 bytes.
+inline void StorePacked32(__m256i a, __m256i b, __m256i offset, uint8_t* dst)
+{
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+    packed = _mm256_add_epi16(packed, offset);
+    packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(packed, packed), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed));
+}
+
+void InterleaveAvx2(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        StoreInterleaved(Load256(u + x), Load256(v + x), uv + 2 * x);
+    }
+    InterleaveScalar(u + x, v + x, uv + 2 * x, width - x);
+}
+
+void AverageInterleaveAvx2(const uint8_t* u0, const uint8_t* u1, const uint8_t* v0, const uint8_t* v1,
+    uint8_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        StoreInterleaved(
+            _mm256_avg_epu8(Load256(u0 + x), Load256(u1 + x)),
+            _mm256_avg_epu8(Load256(v0 + x), Load256(v1 + x)),
+            uv + 2 * x);
+    }
+    AverageInterleaveScalar(u0 + x, u1 + x, v0 + x, v1 + x, uv + 2 * x, width - x);
+}
+
+void CompressRangeAvx2(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t scale)
+{
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), CompressRange8(Load256(src + x), scale));
+    }
+    CompressRangeScalar(src + x, dst + x, width - x, scale);
+}
+
+void CompressInterleaveAvx2(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        StoreInterleaved(
+            CompressRange8(Load256(u + x), ChromaRangeScale),
+            CompressRange8(Load256(v + x), ChromaRangeScale),
+            uv + 2 * x);
+    }
+    CompressInterleaveScalar(u + x, v + x, uv + 2 * x, width - x);
+}
+
+void Narrow16To8Avx2(const uint16_t* src, uint8_t* dst, uint32_t width)
+{
+    const __m256i rounding = _mm256_set1_epi16(128);
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        const __m256i a = _mm256_srli_epi16(_mm256_adds_epu16(Load256(src + x), rounding), 8);
+        const __m256i b = _mm256_srli_epi16(_mm256_adds_epu16(Load256(src + x + 16), rounding), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+    Narrow16To8Scalar(src + x, dst + x, width - x);
+}
+
+// Weighted sums of channels of 8 BGRA pixels (32 bytes), 32-bit results in the pixel order.
+inline __m256i WeightedSum8(__m256i bgra, __m256i coefficients)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(bgra, zero), coefficients);
+    const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(bgra, zero), coefficients);
+    return _mm256_hadd_epi32(lo, hi);
+}
+
+void BgraToLumaAvx2(const uint8_t* bgra, uint8_t* y, uint32_t width)
+{
+    const __m256i coefficients = _mm256_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0, 25, 129, 66, 0, 25, 129, 66, 0);
+    const __m256i rounding = _mm256_set1_epi32(128);
+    const __m256i offset = _mm256_set1_epi16(16);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m256i a = _mm256_srai_epi32(_mm256_add_epi32(
+            WeightedSum8(Load256(bgra + 4 * x), coefficients), rounding), 8);
+        const __m256i b = _mm256_srai_epi32(_mm256_add_epi32(
+            WeightedSum8(Load256(bgra + 4 * x + 32), coefficients), rounding), 8);
+        StorePacked32(a, b, offset, y + x);
+    }
+    BgraToLumaScalar(bgra + 4 * x, y + x, width - x);
+}
+
+// U and V of 4 chroma samples from 8 BGRA pixels of vertically averaged rows, in the U V U V order.
+inline __m256i BgraToUV8(__m256i bgra, __m256i coefficientsU, __m256i coefficientsV)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_unpacklo_epi8(bgra, zero);
+    const __m256i hi = _mm256_unpackhi_epi8(bgra, zero);
+    // Sums of horizontal pairs: pixels 0+1, 2+3 in the low lane and 4+5, 6+7 in the high one.
+    const __m256i pairs = _mm256_unpacklo_epi64(
+        _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8)),
+        _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8)));
+
+    __m256i uv = _mm256_hadd_epi32(
+        _mm256_madd_epi16(pairs, coefficientsU),
+        _mm256_madd_epi16(pairs, coefficientsV));
+    uv = _mm256_srai_epi32(_mm256_add_epi32(uv, _mm256_set1_epi32(256)), 9);
+    return _mm256_shuffle_epi32(uv, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+void BgraToChromaAvx2(const uint8_t* bgra0, const uint8_t* bgra1, uint8_t* uv, uint32_t width)
+{
+    const __m256i coefficientsU = _mm256_setr_epi16(
+        112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0);
+    const __m256i coefficientsV = _mm256_setr_epi16(
+        -18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0);
+    const __m256i offset = _mm256_set1_epi16(128);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m256i a = BgraToUV8(_mm256_avg_epu8(Load256(bgra0 + 4 * x), Load256(bgra1 + 4 * x)),
+            coefficientsU, coefficientsV);
+        const __m256i b = BgraToUV8(_mm256_avg_epu8(Load256(bgra0 + 4 * x + 32), Load256(bgra1 + 4 * x + 32)),
+            coefficientsU, coefficientsV);
+        StorePacked32(a, b, offset, uv + x);
+    }
+    BgraToChromaScalar(bgra0 + 4 * x, bgra1 + 4 * x, uv + x, width - x);
+}
+
+void Widen10Avx2(const uint16_t* src, uint16_t* dst, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_slli_epi16(Load256(src + x), 6));
+    }
+    Widen10Scalar(src + x, dst + x, width - x);
+}
+
+void WidenInterleave10Avx2(const uint16_t* u, const uint16_t* v, uint16_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m256i u16 = _mm256_permute4x64_epi64(_mm256_slli_epi16(Load256(u + x), 6), 0xD8);
+        const __m256i v16 = _mm256_permute4x64_epi64(_mm256_slli_epi16(Load256(v + x), 6), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv + 2 * x), _mm256_unpacklo_epi16(u16, v16));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv + 2 * x + 16), _mm256_unpackhi_epi16(u16, v16));
+    }
+    WidenInterleave10Scalar(u + x, v + x, uv + 2 * x, width - x);
+}
+
+constexpr RowKernels Avx2Kernels = {
+    InterleaveAvx2,
+    AverageInterleaveAvx2,
+    CompressRangeAvx2,
+    CompressInterleaveAvx2,
+    Narrow16To8Avx2,
+    BgraToLumaAvx2,
+    BgraToChromaAvx2,
+    Widen10Avx2,
+    WidenInterleave10Avx2,
+};
+
+#elif defined(PIXEL_CONVERTER_NEON)
+
+inline uint8x16_t CompressRange8(uint8x16_t value, uint32_t scale)
+{
+    const uint8x8_t scale8 = vdup_n_u8(static_cast<uint8_t>(scale));
+    const uint16x8_t rounding = vdupq_n_u16(128);
+    uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(value), scale8), rounding);
+    uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(value), scale8), rounding);
+    lo = vshrq_n_u16(vaddq_u16(lo, vshrq_n_u16(lo, 8)), 8);
+    hi = vshrq_n_u16(vaddq_u16(hi, vshrq_n_u16(hi, 8)), 8);
+    return vaddq_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)), vdupq_n_u8(16));
+}
+
+void InterleaveNeon(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x2_t interleaved = { { vld1q_u8(u + x), vld1q_u8(v + x) } };
+        vst2q_u8(uv + 2 * x, interleaved);
+    }
+    InterleaveScalar(u + x, v + x, uv + 2 * x, width - x);
+}
+
+void AverageInterleaveNeon(const uint8_t* u0, const uint8_t* u1, const uint8_t* v0, const uint8_t* v1,
+    uint8_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x2_t interleaved = { {
+            vrhaddq_u8(vld1q_u8(u0 + x), vld1q_u8(u1 + x)),
+            vrhaddq_u8(vld1q_u8(v0 + x), vld1q_u8(v1 + x)) } };
+        vst2q_u8(uv + 2 * x, interleaved);
+    }
+    AverageInterleaveScalar(u0 + x, u1 + x, v0 + x, v1 + x, uv + 2 * x, width - x);
+}
+
+void CompressRangeNeon(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t scale)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        vst1q_u8(dst + x, CompressRange8(vld1q_u8(src + x), scale));
+    }
+    CompressRangeScalar(src + x, dst + x, width - x, scale);
+}
+
+void CompressInterleaveNeon(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x2_t interleaved = { {
+            CompressRange8(vld1q_u8(u + x), ChromaRangeScale),
+            CompressRange8(vld1q_u8(v + x), ChromaRangeScale) } };
+        vst2q_u8(uv + 2 * x, interleaved);
+    }
+    CompressInterleaveScalar(u + x, v + x, uv + 2 * x, width - x);
+}
+
+void Narrow16To8Neon(const uint16_t* src, uint8_t* dst, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        vst1q_u8(dst + x, vcombine_u8(
+            vqrshrn_n_u16(vld1q_u16(src + x), 8),
+            vqrshrn_n_u16(vld1q_u16(src + x + 8), 8)));
+    }
+    Narrow16To8Scalar(src + x, dst + x, width - x);
+}
+
+inline uint8x8_t BgraToLuma8(uint8x8_t b, uint8x8_t g, uint8x8_t r)
+{
+    uint16x8_t sum = vmull_u8(r, vdup_n_u8(66));
+    sum = vmlal_u8(sum, g, vdup_n_u8(129));
+    sum = vmlal_u8(sum, b, vdup_n_u8(25));
+    return vadd_u8(vrshrn_n_u16(sum, 8), vdup_n_u8(16));
+}
+
+void BgraToLumaNeon(const uint8_t* bgra, uint8_t* y, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16x4_t pixels = vld4q_u8(bgra + 4 * x);
+        vst1q_u8(y + x, vcombine_u8(
+            BgraToLuma8(vget_low_u8(pixels.val[0]), vget_low_u8(pixels.val[1]), vget_low_u8(pixels.val[2])),
+            BgraToLuma8(vget_high_u8(pixels.val[0]), vget_high_u8(pixels.val[1]), vget_high_u8(pixels.val[2]))));
+    }
+    BgraToLumaScalar(bgra + 4 * x, y + x, width - x);
+}
+
+// One of U or V from sums of horizontal pixel pairs.
+inline uint8x8_t BgraSumToChroma8(int16x8_t b, int16x8_t g, int16x8_t r, int16_t cb, int16_t cg, int16_t cr)
+{
+    int32x4_t lo = vmull_n_s16(vget_low_s16(b), cb);
+    lo = vmlal_n_s16(lo, vget_low_s16(g), cg);
+    lo = vmlal_n_s16(lo, vget_low_s16(r), cr);
+    int32x4_t hi = vmull_n_s16(vget_high_s16(b), cb);
+    hi = vmlal_n_s16(hi, vget_high_s16(g), cg);
+    hi = vmlal_n_s16(hi, vget_high_s16(r), cr);
+    const int16x8_t chroma = vcombine_s16(vmovn_s32(vrshrq_n_s32(lo, 9)), vmovn_s32(vrshrq_n_s32(hi, 9)));
+    return vqmovun_s16(vaddq_s16(chroma, vdupq_n_s16(128)));
+}
+
+void BgraToChromaNeon(const uint8_t* bgra0, const uint8_t* bgra1, uint8_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16x4_t row0 = vld4q_u8(bgra0 + 4 * x);
+        const uint8x16x4_t row1 = vld4q_u8(bgra1 + 4 * x);
+        const int16x8_t b = vreinterpretq_s16_u16(vpaddlq_u8(vrhaddq_u8(row0.val[0], row1.val[0])));
+        const int16x8_t g = vreinterpretq_s16_u16(vpaddlq_u8(vrhaddq_u8(row0.val[1], row1.val[1])));
+        const int16x8_t r = vreinterpretq_s16_u16(vpaddlq_u8(vrhaddq_u8(row0.val[2], row1.val[2])));
+        uint8x8x2_t interleaved = { {
+            BgraSumToChroma8(b, g, r, 112, -74, -38),
+            BgraSumToChroma8(b, g, r, -18, -94, 112) } };
+        vst2_u8(uv + x, interleaved);
+    }
+    BgraToChromaScalar(bgra0 + 4 * x, bgra1 + 4 * x, uv + x, width - x);
+}
+
+void Widen10Neon(const uint16_t* src, uint16_t* dst, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        vst1q_u16(dst + x, vshlq_n_u16(vld1q_u16(src + x), 6));
+    }
+    Widen10Scalar(src + x, dst + x, width - x);
+}
+
+void WidenInterleave10Neon(const uint16_t* u, const uint16_t* v, uint16_t* uv, uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        uint16x8x2_t interleaved = { {
+            vshlq_n_u16(vld1q_u16(u + x), 6),
+            vshlq_n_u16(vld1q_u16(v + x), 6) } };
+        vst2q_u16(uv + 2 * x, interleaved);
+    }
+    WidenInterleave10Scalar(u + x, v + x, uv + 2 * x, width - x);
+}
+
+constexpr RowKernels NeonKernels = {
+    InterleaveNeon,
+    AverageInterleaveNeon,
+    CompressRangeNeon,
+    CompressInterleaveNeon,
+    Narrow16To8Neon,
+    BgraToLumaNeon,
+    BgraToChromaNeon,
+    Widen10Neon,
+    WidenInterleave10Neon,
+};
+
+#endif
+
+const RowKernels& GetRowKernels(ConversionKernels kernelSet)
+{
+    if (kernelSet == ConversionKernels::Scalar)
+        return ScalarKernels;
+
+#if defined(PIXEL_CONVERTER_AVX2)
+    static const RowKernels& kernels = IsAvx2Supported() ? Avx2Kernels : ScalarKernels;
+    return kernels;
+#elif defined(PIXEL_CONVERTER_NEON)
+    return NeonKernels;
+#else
+    return ScalarKernels;
+#endif
+}
+
+template<typename T>
+const T* RowOf(const FrameDescriptor& source, uint32_t plane, uint32_t row)
+{
+    return reinterpret_cast<const T*>(source.planes[plane].data + row * source.planes[plane].pitch);
+}
+
+// 10-bit sources to P010, rows of P010 source are copied as is.
+void ConvertLumaRowsP010(const FrameDescriptor& source, const FrameUploadBuffer& destination, const RowKernels& kernels,
+    uint32_t rowBegin, uint32_t rowEnd)
+{
+    if (source.format == PixelFormat::P010)
+    {
+        CopyPlane(RowOf<uint8_t>(source, 0, rowBegin), source.planes[0].pitch,
+            destination.y + rowBegin * destination.linesizeY, destination.linesizeY,
+            source.width * sizeof(uint16_t), rowEnd - rowBegin);
+        return;
+    }
+
+    assert(source.format == PixelFormat::YUV420P10);
+    for (uint32_t row = rowBegin; row < rowEnd; ++row)
+    {
+        kernels.widen10(RowOf<uint16_t>(source, 0, row),
+            reinterpret_cast<uint16_t*>(destination.y + row * destination.linesizeY), source.width);
+    }
+}
+
+void ConvertChromaRowsP010(const FrameDescriptor& source, const FrameUploadBuffer& destination, const RowKernels& kernels,
+    uint32_t rowBegin, uint32_t rowEnd)
+{
+    const uint32_t chromaWidth = (source.width + 1) / 2;
+    if (source.format == PixelFormat::P010)
+    {
+        CopyPlane(RowOf<uint8_t>(source, 1, rowBegin), source.planes[1].pitch,
+            destination.uv + rowBegin * destination.linesizeUV, destination.linesizeUV,
+            2 * chromaWidth * sizeof(uint16_t), rowEnd - rowBegin);
+        return;
+    }
+
+    assert(source.format == PixelFormat::YUV420P10);
+    for (uint32_t row = rowBegin; row < rowEnd; ++row)
+    {
+        kernels.widenInterleave10(RowOf<uint16_t>(source, 1, row), RowOf<uint16_t>(source, 2, row),
+            reinterpret_cast<uint16_t*>(destination.uv + row * destination.linesizeUV), chromaWidth);
+    }
+}
+
+void ConvertLumaRows(const FrameDescriptor& source, const FrameUploadBuffer& destination, const RowKernels& kernels,
+    uint32_t rowBegin, uint32_t rowEnd)
+{
+    if (destination.format == DXGI_FORMAT_P010)
+    {
+        ConvertLumaRowsP010(source, destination, kernels, rowBegin, rowEnd);
+        return;
+    }
+
+    if (source.format == PixelFormat::NV12 || source.format == PixelFormat::YUV420P
+        || source.format == PixelFormat::YUV422P)
+    {
+        CopyPlane(RowOf<uint8_t>(source, 0, rowBegin), source.planes[0].pitch,
+            destination.y + rowBegin * destination.linesizeY, destination.linesizeY, source.width, rowEnd - rowBegin);
+        return;
+    }
+
+    for (uint32_t row = rowBegin; row < rowEnd; ++row)
+    {
+        uint8_t* dst = destination.y + row * destination.linesizeY;
+        switch (source.format)
+        {
+        case PixelFormat::YUVJ420P:
+            kernels.compressRange(RowOf<uint8_t>(source, 0, row), dst, source.width, LumaRangeScale);
+            break;
+        case PixelFormat::P010:
+            kernels.narrow16To8(RowOf<uint16_t>(source, 0, row), dst, source.width);
+            break;
+        case PixelFormat::BGRA:
+            kernels.bgraToLuma(RowOf<uint8_t>(source, 0, row), dst, source.width);
+            break;
+        default:
+            assert(false);
+        }
+    }
+}
+
+void ConvertChromaRows(const FrameDescriptor& source, const FrameUploadBuffer& destination, const RowKernels& kernels,
+    uint32_t rowBegin, uint32_t rowEnd)
+{
+    if (destination.format == DXGI_FORMAT_P010)
+    {
+        ConvertChromaRowsP010(source, destination, kernels, rowBegin, rowEnd);
+        return;
+    }
+
+    const uint32_t chromaWidth = (source.width + 1) / 2;
+    if (source.format == PixelFormat::NV12)
+    {
+        CopyPlane(RowOf<uint8_t>(source, 1, rowBegin), source.planes[1].pitch,
+            destination.uv + rowBegin * destination.linesizeUV, destination.linesizeUV, 2 * chromaWidth, rowEnd - rowBegin);
+        return;
+    }
+
+    for (uint32_t row = rowBegin; row < rowEnd; ++row)
+    {
+        // Rows of 4:2:2 and RGB sources averaged to the chroma row, the last one is duplicated for odd height.
+        const uint32_t row0 = 2 * row;
+        const uint32_t row1 = (std::min)(row0 + 1, source.height - 1);
+
+        uint8_t* dst = destination.uv + row * destination.linesizeUV;
+        switch (source.format)
+        {
+        case PixelFormat::YUV420P:
+            kernels.interleave(RowOf<uint8_t>(source, 1, row), RowOf<uint8_t>(source, 2, row), dst, chromaWidth);
+            break;
+        case PixelFormat::YUVJ420P:
+            kernels.compressInterleave(RowOf<uint8_t>(source, 1, row), RowOf<uint8_t>(source, 2, row),
+                dst, chromaWidth);
+            break;
+        case PixelFormat::YUV422P:
+            kernels.averageInterleave(RowOf<uint8_t>(source, 1, row0), RowOf<uint8_t>(source, 1, row1),
+                RowOf<uint8_t>(source, 2, row0), RowOf<uint8_t>(source, 2, row1), dst, chromaWidth);
+            break;
+        case PixelFormat::P010:
+            kernels.narrow16To8(RowOf<uint16_t>(source, 1, row), dst, 2 * chromaWidth);
+            break;
+        case PixelFormat::BGRA:
+            kernels.bgraToChroma(RowOf<uint8_t>(source, 0, row0), RowOf<uint8_t>(source, 0, row1),
+                dst, source.width);
+            break;
+        default:
+            assert(false);
+        }
+    }
+}
+
+}
+
+uint32_t GetPlaneCount(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::NV12:
+    case PixelFormat::P010:
+        return 2;
+    case PixelFormat::BGRA:
+        return 1;
+    default:
+        return 3;
+    }
+}
+
+size_t GetPlaneRowSize(PixelFormat format, uint32_t plane, uint32_t width)
+{
+    const size_t chromaWidth = (width + 1) / 2;
+    switch (format)
+    {
+    case PixelFormat::NV12:
+        return plane == 0 ? width : 2 * chromaWidth;
+    case PixelFormat::P010:
+        return plane == 0 ? 2 * width : 4 * chromaWidth;
+    case PixelFormat::BGRA:
+        return 4 * width;
+    case PixelFormat::YUV420P10:
+        return plane == 0 ? 2 * width : 2 * chromaWidth;
+    default:
+        return plane == 0 ? width : chromaWidth;
+    }
+}
+
+uint32_t GetPlaneHeight(PixelFormat format, uint32_t plane, uint32_t height)
+{
+    if (plane == 0 || format == PixelFormat::YUV422P)
+        return height;
+    return (height + 1) / 2;
+}
+
+bool IsConversionSupported(PixelFormat sourceFormat, DXGI_FORMAT destinationFormat)
+{
+    switch (destinationFormat)
+    {
+    case DXGI_FORMAT_NV12:
+        return sourceFormat != PixelFormat::YUV420P10;
+    case DXGI_FORMAT_P010:
+        return sourceFormat == PixelFormat::P010 || sourceFormat == PixelFormat::YUV420P10;
+    default:
+        return false;
+    }
+}
+
+void ConvertImage(const FrameDescriptor& source, const FrameUploadBuffer& destination, WorkerPool* workerPool,
+    ConversionKernels kernelSet)
+{
+    ThrowIfFalse(source.width > 0 && source.height > 0);
+    ThrowIfFalse(IsConversionSupported(source.format, destination.format));
+    ThrowIfFalse(source.planeCount >= GetPlaneCount(source.format));
+
+    const RowKernels& kernels = GetRowKernels(kernelSet);
+    const uint32_t chromaHeight = (source.height + 1) / 2;
+
+    // Tasks take bands of whole chroma rows and corresponding luma rows.
+    uint32_t taskCount = 1;
+    if (workerPool != nullptr)
+    {
+        taskCount = (std::min)(workerPool->GetThreadCount() + 1,
+            (std::max)(chromaHeight / MinChromaRowsPerTask, 1u));
+    }
+    const uint32_t rowsPerTask = (chromaHeight + taskCount - 1) / taskCount;
+
+    auto convertBand = [&](uint32_t taskIndex)
+    {
+        const uint32_t chromaRowBegin = taskIndex * rowsPerTask;
+        const uint32_t chromaRowEnd = (std::min)(chromaRowBegin + rowsPerTask, chromaHeight);
+        if (chromaRowBegin >= chromaRowEnd)
+            return;
+
+        ConvertLumaRows(source, destination, kernels, 2 * chromaRowBegin, (std::min)(2 * chromaRowEnd, source.height));
+        ConvertChromaRows(source, destination, kernels, chromaRowBegin, chromaRowEnd);
+    };
+
+    if (taskCount > 1)
+    {
+        workerPool->ParallelFor(taskCount, convertBand);
+    }
+    else
+    {
+        convertBand(0);
+    }
+}
+
+}
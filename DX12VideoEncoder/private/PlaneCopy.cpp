@@ -0,0 +1,110 @@
+#include "pch.h"
+#include "PlaneCopy.h"
+#include "WorkerPool.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define PLANE_COPY_STREAMING_STORES
+#endif
+
+
+namespace DX12VideoEncoding {
+
+namespace {
+
+// Smaller copies are not worth waking the pool threads.
+constexpr size_t MinBytesPerTask = 256 * 1024;
+
+void StreamCopy(const uint8_t* source, uint8_t* destination, size_t size)
+{
+#if defined(PLANE_COPY_STREAMING_STORES)
+    // Streaming stores need aligned destination, the source is read unaligned.
+    const size_t head = (std::min)((16 - (reinterpret_cast<uintptr_t>(destination) & 15)) & 15, size);
+    memcpy(destination, source, head);
+    source += head;
+    destination += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, source += 64, destination += 64)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 32));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination + 48), d);
+    }
+    for (; size >= 16; size -= 16, source += 16, destination += 16)
+    {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+    }
+#endif
+    memcpy(destination, source, size);
+}
+
+void CopyRows(const uint8_t* source, size_t sourcePitch, uint8_t* destination, size_t destinationPitch,
+    size_t rowSize, uint32_t rowBegin, uint32_t rowEnd)
+{
+    source += rowBegin * sourcePitch;
+    destination += rowBegin * destinationPitch;
+
+    if (sourcePitch == destinationPitch)
+    {
+        // Padding between rows is copied too, it's cheaper than a loop over short rows.
+        StreamCopy(source, destination, (rowEnd - rowBegin - 1) * sourcePitch + rowSize);
+    }
+    else
+    {
+        for (uint32_t row = rowBegin; row < rowEnd; ++row)
+        {
+            StreamCopy(source, destination, rowSize);
+            source += sourcePitch;
+            destination += destinationPitch;
+        }
+    }
+
+#if defined(PLANE_COPY_STREAMING_STORES)
+    // Makes the streaming stores visible before the copy is reported finished.
+    _mm_sfence();
+#endif
+}
+
+}
+
+void CopyPlane(const uint8_t* source, size_t sourcePitch,
+    uint8_t* destination, size_t destinationPitch,
+    size_t rowSize, uint32_t rowCount, WorkerPool* workerPool)
+{
+    if (rowCount == 0 || rowSize == 0)
+        return;
+
+    uint32_t taskCount = 1;
+    if (workerPool != nullptr)
+    {
+        const size_t bytesTaskCount = (std::max)(rowSize * rowCount / MinBytesPerTask, size_t{ 1 });
+        taskCount = static_cast<uint32_t>((std::min)(
+            { size_t{ workerPool->GetThreadCount() } + 1, bytesTaskCount, size_t{ rowCount } }));
+    }
+
+    if (taskCount == 1)
+    {
+        CopyRows(source, sourcePitch, destination, destinationPitch, rowSize, 0, rowCount);
+        return;
+    }
+
+    const uint32_t rowsPerTask = (rowCount + taskCount - 1) / taskCount;
+    workerPool->ParallelFor(taskCount, [&](uint32_t taskIndex)
+    {
+        const uint32_t rowBegin = taskIndex * rowsPerTask;
+        const uint32_t rowEnd = (std::min)(rowBegin + rowsPerTask, rowCount);
+        if (rowBegin < rowEnd)
+        {
+            CopyRows(source, sourcePitch, destination, destinationPitch, rowSize, rowBegin, rowEnd);
+        }
+    });
+}
+
+}
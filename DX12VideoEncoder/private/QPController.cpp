@@ -0,0 +1,222 @@
+#include "pch.h"
+#include "QPController.h"
+#include "Utils.h"
+
+
+namespace DX12VideoEncoding {
+
+namespace {
+
+constexpr uint32_t MaxQP = 51;
+
+// Share of the complexity change compensated by QP, the rest is left to the bitrate as in qcomp = 0.6 of x264.
+constexpr double AdaptationStrength = 0.4;
+constexpr double MaxAdaptiveOffset = 4.0;
+// Neighbour frames on each side the frame complexity is compared with.
+constexpr uint64_t ComplexityWindow = 12;
+// Costs are mean differences of 8-bit samples, the bias keeps static frames from getting extreme offsets.
+constexpr double CostBias = 1.0;
+
+constexpr char PassStatisticsMagic[4] = { 'D', 'X', 'Q', 'P' };
+constexpr uint32_t PassStatisticsVersion = 1;
+constexpr uint8_t MissingFrameClass = 0xFF;
+
+size_t GetFrameClass(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType)
+{
+    switch (frameType)
+    {
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME:
+        return 1;
+    case D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+// H.264 QP step doubles every 6 QP.
+double QPToLog2Scale(uint32_t qp)
+{
+    return qp / 6.0;
+}
+
+}
+
+QPController::QPController(const EncoderConfiguration& config)
+    : m_isAdaptive(config.enableAdaptiveQP || config.encodingPass == EncodingPass::Second)
+{
+    m_frameClassQP = {
+        GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME),
+        GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME),
+        GetFrameTypeQP(config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME),
+    };
+
+    if (config.encodingPass == EncodingPass::First)
+    {
+        m_passStatisticsOutput.open(std::filesystem::path(config.passStatisticsFile), std::ios::binary | std::ios::trunc);
+        if (!m_passStatisticsOutput)
+            throw std::runtime_error("Cannot create pass statistics file");
+
+        m_passStatisticsOutput.write(PassStatisticsMagic, sizeof(PassStatisticsMagic));
+        m_passStatisticsOutput.write(reinterpret_cast<const char*>(&PassStatisticsVersion), sizeof(PassStatisticsVersion));
+    }
+    else if (config.encodingPass == EncodingPass::Second)
+    {
+        LoadPassStatistics(config.passStatisticsFile);
+    }
+}
+
+uint32_t QPController::GetFrameTypeQP(const EncoderConfiguration& config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType)
+{
+    int64_t qp = config.qp;
+    if (frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME)
+        qp += config.pFrameQPOffset;
+    else if (frameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME)
+        qp += config.bFrameQPOffset;
+    return static_cast<uint32_t>(std::clamp<int64_t>(qp, 0, MaxQP));
+}
+
+void QPController::AddFrame(uint64_t frameOrderNumber, const FrameStatistics& statistics)
+{
+    if (!m_isAdaptive)
+        return;
+
+    // Inter prediction can always fall back to intra one.
+    const float interCost = statistics.hasPreviousFrame
+        ? (std::min)(statistics.motionCompensatedDifference, statistics.spatialActivity)
+        : statistics.spatialActivity;
+
+    assert(m_frames.empty() || m_frames.back().frameOrderNumber + 1 == frameOrderNumber);
+    m_frames.push_back(FrameComplexity{
+        .frameOrderNumber = frameOrderNumber,
+        .isAnalyzed = statistics.isAnalyzed,
+        .intraCost = statistics.spatialActivity,
+        .interCost = interCost,
+    });
+}
+
+uint32_t QPController::GetFrameQP(uint64_t frameOrderNumber, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType)
+{
+    const size_t frameClass = GetFrameClass(frameType);
+    const uint32_t frameClassQP = m_frameClassQP[frameClass];
+    if (!m_isAdaptive)
+        return frameClassQP;
+
+    // B-frames are encoded after the following P-frame, so a margin of frames before the window is kept.
+    while (!m_frames.empty() && m_frames.front().frameOrderNumber + 2 * ComplexityWindow < frameOrderNumber)
+    {
+        m_frames.pop_front();
+    }
+
+    std::optional<double> offset = GetPassOffset(frameOrderNumber, frameClass);
+    if (!offset.has_value())
+        offset = GetLookaheadOffset(frameOrderNumber, frameClass);
+    if (!offset.has_value())
+        return frameClassQP;
+
+    const double qp = frameClassQP + std::clamp(*offset, -MaxAdaptiveOffset, MaxAdaptiveOffset);
+    return static_cast<uint32_t>(std::clamp(std::lround(qp), 0l, static_cast<long>(MaxQP)));
+}
+
+void QPController::OnFrameEncoded(uint64_t frameOrderNumber, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType,
+    uint32_t qp, size_t encodedSize)
+{
+    if (!m_passStatisticsOutput.is_open())
+        return;
+
+    const PassRecord record{
+        .frameOrderNumber = static_cast<uint32_t>(frameOrderNumber),
+        .encodedSize = static_cast<uint32_t>((std::min)(encodedSize, size_t(UINT32_MAX))),
+        .frameClass = static_cast<uint8_t>(GetFrameClass(frameType)),
+        .qp = static_cast<uint8_t>(qp),
+    };
+    m_passStatisticsOutput.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    if (!m_passStatisticsOutput)
+        throw std::runtime_error("Cannot write pass statistics file");
+}
+
+void QPController::LoadPassStatistics(const std::wstring& path)
+{
+    std::ifstream input(std::filesystem::path(path), std::ios::binary);
+    char magic[sizeof(PassStatisticsMagic)]{};
+    uint32_t version = 0;
+    input.read(magic, sizeof(magic));
+    input.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!input || !std::equal(std::begin(magic), std::end(magic), PassStatisticsMagic)
+        || version != PassStatisticsVersion)
+    {
+        throw std::runtime_error("Invalid pass statistics file");
+    }
+
+    // Frame sizes are brought to QP 0, their geometric mean per frame class is the reference complexity.
+    std::array<double, FrameClassCount> log2ComplexitySum{};
+    std::array<size_t, FrameClassCount> frameCount{};
+    PassRecord record{};
+    while (input.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    {
+        if (record.frameClass >= FrameClassCount || record.encodedSize == 0)
+            continue;
+
+        if (record.frameOrderNumber >= m_passRecords.size())
+        {
+            m_passRecords.resize(size_t(record.frameOrderNumber) + 1, PassRecord{ .frameClass = MissingFrameClass });
+        }
+        m_passRecords[record.frameOrderNumber] = record;
+
+        log2ComplexitySum[record.frameClass] += std::log2(double(record.encodedSize)) + QPToLog2Scale(record.qp);
+        ++frameCount[record.frameClass];
+    }
+
+    for (size_t frameClass = 0; frameClass < FrameClassCount; ++frameClass)
+    {
+        if (frameCount[frameClass] > 0)
+            m_passMeanLog2Complexity[frameClass] = log2ComplexitySum[frameClass] / frameCount[frameClass];
+    }
+    LogMessage(LogLevel::E_INFO, "Loaded pass statistics of " + std::to_string(m_passRecords.size()) + " frames");
+}
+
+std::optional<double> QPController::GetPassOffset(uint64_t frameOrderNumber, size_t frameClass) const
+{
+    // Frame types of the passes differ if the configuration or the input changed, then the lookahead is used.
+    if (frameOrderNumber >= m_passRecords.size() || m_passRecords[frameOrderNumber].frameClass != frameClass)
+        return std::nullopt;
+
+    const PassRecord& record = m_passRecords[frameOrderNumber];
+    const double log2Complexity = std::log2(double(record.encodedSize)) + QPToLog2Scale(record.qp);
+    return AdaptationStrength * 6.0 * (log2Complexity - m_passMeanLog2Complexity[frameClass]);
+}
+
+std::optional<double> QPController::GetLookaheadOffset(uint64_t frameOrderNumber, size_t frameClass) const
+{
+    if (m_frames.empty() || frameOrderNumber < m_frames.front().frameOrderNumber
+        || frameOrderNumber > m_frames.back().frameOrderNumber)
+    {
+        return std::nullopt;
+    }
+
+    const FrameComplexity& frame = m_frames[frameOrderNumber - m_frames.front().frameOrderNumber];
+    if (!frame.isAnalyzed)
+        return std::nullopt;
+
+    // Intra frames are compared by intra cost, inter frames by inter cost of the neighbours.
+    const bool isIntra = frameClass == 0;
+    const auto getLog2Cost = [isIntra](const FrameComplexity& complexity)
+    {
+        return std::log2((isIntra ? complexity.intraCost : complexity.interCost) + CostBias);
+    };
+
+    double log2CostSum = 0.0;
+    size_t frameCount = 0;
+    for (const FrameComplexity& neighbour : m_frames)
+    {
+        if (neighbour.isAnalyzed && neighbour.frameOrderNumber + ComplexityWindow >= frameOrderNumber
+            && neighbour.frameOrderNumber <= frameOrderNumber + ComplexityWindow)
+        {
+            log2CostSum += getLog2Cost(neighbour);
+            ++frameCount;
+        }
+    }
+    return AdaptationStrength * 6.0 * (getLog2Cost(frame) - log2CostSum / frameCount);
+}
+
+}
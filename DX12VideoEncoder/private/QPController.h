@@ -0,0 +1,64 @@
+#pragma once
+#include "EncoderAPI.h"
+#include "FrameAnalyzer.h"
+
+namespace DX12VideoEncoding
+{
+
+// Chooses QP of each frame in constant QP mode: the configured QP of the frame type, adjusted by the frame
+// complexity relative to the neighbour frames when adaptive QP or the second pass is enabled.
+class QPController
+{
+public:
+    explicit QPController(const EncoderConfiguration& config);
+
+    static uint32_t GetFrameTypeQP(const EncoderConfiguration& config, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType);
+
+    bool IsAdaptive() const { return m_isAdaptive; }
+
+    // Frames are added in display order when pushed, so the frames held by lookaheadDepth of the configuration and
+    // the B-frames waiting for their reference serve as the lookahead.
+    void AddFrame(uint64_t frameOrderNumber, const FrameStatistics& statistics);
+    uint32_t GetFrameQP(uint64_t frameOrderNumber, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType);
+    // Records the frame to the statistics file in the first pass.
+    void OnFrameEncoded(uint64_t frameOrderNumber, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType, uint32_t qp,
+        size_t encodedSize);
+
+private:
+    // Intra, P and B frames are adapted separately.
+    static constexpr size_t FrameClassCount = 3;
+
+    struct FrameComplexity
+    {
+        uint64_t frameOrderNumber{};
+        bool isAnalyzed{};
+        float intraCost{};
+        float interCost{};
+    };
+
+    // Record of the statistics file, the file starts with a header of the magic and the version.
+    struct PassRecord
+    {
+        uint32_t frameOrderNumber;
+        uint32_t encodedSize;
+        uint8_t frameClass;
+        uint8_t qp;
+        uint16_t reserved;
+    };
+    static_assert(sizeof(PassRecord) == 12);
+
+    void LoadPassStatistics(const std::wstring& path);
+    std::optional<double> GetPassOffset(uint64_t frameOrderNumber, size_t frameClass) const;
+    std::optional<double> GetLookaheadOffset(uint64_t frameOrderNumber, size_t frameClass) const;
+
+private:
+    std::array<uint32_t, FrameClassCount> m_frameClassQP{};
+    const bool m_isAdaptive;
+    std::deque<FrameComplexity> m_frames;
+
+    std::ofstream m_passStatisticsOutput; // First pass only
+    std::vector<PassRecord> m_passRecords; // Second pass only, indexed by frame order number
+    std::array<double, FrameClassCount> m_passMeanLog2Complexity{};
+};
+
+}
@@ -0,0 +1,311 @@
+#include "pch.h"
+#include "QPMapBuilder.h"
+#include "FrameAnalyzer.h"
+#include "CpuFeatures.h"
+#include "Utils.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define QP_MAP_BUILDER_AVX2
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#define QP_MAP_BUILDER_NEON
+#endif
+
+
+namespace DX12VideoEncoding {
+
+namespace {
+
+constexpr uint32_t BlockWidth = 16;
+constexpr int32_t MaxDeltaQP = 51;
+
+// QP offset per doubling of the region variance relative to the frame mean, as the x264 auto-variance mode.
+constexpr float AdaptiveQuantizationStrength = 1.0f;
+constexpr float MaxAdaptiveDeltaQP = 6.0f;
+
+struct VarianceKernels
+{
+    // Adds sums and square sums of consecutive 16 samples of the row to the block sums.
+    void (*accumulateBlocks8)(const uint8_t* row, uint32_t* sums, uint32_t* squareSums, uint32_t blockCount);
+    // Same for 16-bit samples narrowed to 8 bits by the shift.
+    void (*accumulateBlocks16)(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t* squareSums,
+        uint32_t blockCount);
+};
+
+void AccumulateBlocks8Scalar(const uint8_t* row, uint32_t* sums, uint32_t* squareSums, uint32_t blockCount)
+{
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        uint32_t sum = 0;
+        uint32_t squareSum = 0;
+        for (uint32_t x = 0; x < BlockWidth; ++x)
+        {
+            const uint32_t sample = row[block * BlockWidth + x];
+            sum += sample;
+            squareSum += sample * sample;
+        }
+        sums[block] += sum;
+        squareSums[block] += squareSum;
+    }
+}
+
+void AccumulateBlocks16Scalar(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t* squareSums,
+    uint32_t blockCount)
+{
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        uint32_t sum = 0;
+        uint32_t squareSum = 0;
+        for (uint32_t x = 0; x < BlockWidth; ++x)
+        {
+            const uint32_t sample = (std::min)(row[block * BlockWidth + x] >> shift, 255);
+            sum += sample;
+            squareSum += sample * sample;
+        }
+        sums[block] += sum;
+        squareSums[block] += squareSum;
+    }
+}
+
+constexpr VarianceKernels ScalarKernels = {
+    AccumulateBlocks8Scalar,
+    AccumulateBlocks16Scalar,
+};
+
+#if defined(QP_MAP_BUILDER_AVX2)
+
+// Adds the sum and the square sum of 16 samples widened to 16 bits.
+inline void AccumulateBlock(__m256i samples, uint32_t& sum, uint32_t& squareSum)
+{
+    const __m256i pairSums = _mm256_madd_epi16(samples, _mm256_set1_epi16(1));
+    const __m256i pairSquares = _mm256_madd_epi16(samples, samples);
+    // Horizontal adds within the lanes give sums in the low and squares in the high halves of each lane.
+    const __m256i quads = _mm256_hadd_epi32(pairSums, pairSquares);
+    __m128i totals = _mm_add_epi32(_mm256_castsi256_si128(quads), _mm256_extracti128_si256(quads, 1));
+    totals = _mm_hadd_epi32(totals, totals);
+    sum += static_cast<uint32_t>(_mm_cvtsi128_si32(totals));
+    squareSum += static_cast<uint32_t>(_mm_extract_epi32(totals, 1));
+}
+
+void AccumulateBlocks8Avx2(const uint8_t* row, uint32_t* sums, uint32_t* squareSums, uint32_t blockCount)
+{
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + block * BlockWidth));
+        AccumulateBlock(_mm256_cvtepu8_epi16(samples), sums[block], squareSums[block]);
+    }
+}
+
+void AccumulateBlocks16Avx2(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t* squareSums,
+    uint32_t blockCount)
+{
+    const __m128i shiftCount = _mm_cvtsi32_si128(static_cast<int>(shift));
+    const __m256i maxSample = _mm256_set1_epi16(255);
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        const __m256i samples = _mm256_srl_epi16(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + block * BlockWidth)), shiftCount);
+        AccumulateBlock(_mm256_min_epu16(samples, maxSample), sums[block], squareSums[block]);
+    }
+}
+
+constexpr VarianceKernels Avx2Kernels = {
+    AccumulateBlocks8Avx2,
+    AccumulateBlocks16Avx2,
+};
+
+#elif defined(QP_MAP_BUILDER_NEON)
+
+void AccumulateBlocks8Neon(const uint8_t* row, uint32_t* sums, uint32_t* squareSums, uint32_t blockCount)
+{
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        const uint8x16_t samples = vld1q_u8(row + block * BlockWidth);
+        const uint16x8_t lowSquares = vmull_u8(vget_low_u8(samples), vget_low_u8(samples));
+        const uint16x8_t highSquares = vmull_high_u8(samples, samples);
+        sums[block] += vaddlvq_u8(samples);
+        squareSums[block] += vaddlvq_u16(lowSquares) + vaddlvq_u16(highSquares);
+    }
+}
+
+void AccumulateBlocks16Neon(const uint16_t* row, uint32_t shift, uint32_t* sums, uint32_t* squareSums,
+    uint32_t blockCount)
+{
+    const int16x8_t shiftCount = vdupq_n_s16(-static_cast<int16_t>(shift));
+    const uint16x8_t maxSample = vdupq_n_u16(255);
+    for (uint32_t block = 0; block < blockCount; ++block)
+    {
+        const uint16_t* samples = row + block * BlockWidth;
+        const uint16x8_t low = vminq_u16(vshlq_u16(vld1q_u16(samples), shiftCount), maxSample);
+        const uint16x8_t high = vminq_u16(vshlq_u16(vld1q_u16(samples + 8), shiftCount), maxSample);
+        sums[block] += vaddlvq_u16(low) + vaddlvq_u16(high);
+        squareSums[block] += vaddvq_u32(vmull_u16(vget_low_u16(low), vget_low_u16(low)))
+            + vaddvq_u32(vmull_high_u16(low, low))
+            + vaddvq_u32(vmull_u16(vget_low_u16(high), vget_low_u16(high)))
+            + vaddvq_u32(vmull_high_u16(high, high));
+    }
+}
+
+constexpr VarianceKernels NeonKernels = {
+    AccumulateBlocks8Neon,
+    AccumulateBlocks16Neon,
+};
+
+#endif
+
+const VarianceKernels& GetVarianceKernels()
+{
+#if defined(QP_MAP_BUILDER_AVX2)
+    static const VarianceKernels& kernels = IsAvx2Supported() ? Avx2Kernels : ScalarKernels;
+    return kernels;
+#elif defined(QP_MAP_BUILDER_NEON)
+    return NeonKernels;
+#else
+    return ScalarKernels;
+#endif
+}
+
+}
+
+QPMapBuilder::QPMapBuilder(uint32_t width, uint32_t height, uint32_t regionSize, bool adaptiveQuantization,
+    bool regionsOfInterest)
+    : m_width(width)
+    , m_height(height)
+    , m_regionSize(regionSize)
+    , m_regionsX((width + regionSize - 1) / regionSize)
+    , m_regionsY((height + regionSize - 1) / regionSize)
+    , m_adaptiveQuantization(adaptiveQuantization)
+    , m_regionsOfInterest(regionsOfInterest)
+{
+    ThrowIfFalse(regionSize > 0 && regionSize % BlockWidth == 0);
+
+    m_map.resize(size_t(m_regionsX) * m_regionsY);
+    m_regionOfInterestMap.resize(m_map.size());
+    m_blockSums.resize(width / BlockWidth);
+    m_blockSquareSums.resize(width / BlockWidth);
+    m_log2Variances.resize(m_map.size());
+}
+
+const std::vector<int8_t>& QPMapBuilder::Build(const FrameDescriptor& frame)
+{
+    std::fill(m_map.begin(), m_map.end(), int8_t(0));
+    if (m_adaptiveQuantization)
+        AddAdaptiveQuantization(frame);
+    if (m_regionsOfInterest)
+        AddRegionsOfInterest(frame);
+    return m_map;
+}
+
+void QPMapBuilder::AddAdaptiveQuantization(const FrameDescriptor& frame)
+{
+    const std::optional<uint32_t> shift = GetLumaShift(frame.format);
+    const FramePlane& luma = frame.planes[0];
+    if (!shift.has_value() || frame.planeCount == 0 || luma.data == nullptr || frame.width != m_width)
+        return;
+
+    // Partial blocks on the right and bottom edges are skipped.
+    const uint32_t blocksX = static_cast<uint32_t>(m_blockSums.size());
+    const uint32_t rows = (std::min)(frame.height, luma.height);
+    const uint32_t blocksPerRegion = m_regionSize / BlockWidth;
+    const VarianceKernels& kernels = GetVarianceKernels();
+
+    double log2VarianceSum = 0.0;
+    size_t varianceCount = 0;
+    for (uint32_t regionY = 0; regionY < m_regionsY; ++regionY)
+    {
+        std::fill(m_blockSums.begin(), m_blockSums.end(), 0u);
+        std::fill(m_blockSquareSums.begin(), m_blockSquareSums.end(), 0u);
+
+        const uint32_t firstRow = regionY * m_regionSize;
+        const uint32_t endRow = (std::min)(firstRow + m_regionSize, rows / BlockWidth * BlockWidth);
+        for (uint32_t y = firstRow; y < endRow; ++y)
+        {
+            const uint8_t* row = luma.data + size_t(y) * luma.pitch;
+            if (*shift == 0)
+            {
+                kernels.accumulateBlocks8(row, m_blockSums.data(), m_blockSquareSums.data(), blocksX);
+            }
+            else
+            {
+                kernels.accumulateBlocks16(reinterpret_cast<const uint16_t*>(row), *shift,
+                    m_blockSums.data(), m_blockSquareSums.data(), blocksX);
+            }
+        }
+
+        for (uint32_t regionX = 0; regionX < m_regionsX; ++regionX)
+        {
+            const uint32_t firstBlock = regionX * blocksPerRegion;
+            const uint32_t endBlock = (std::min)(firstBlock + blocksPerRegion, blocksX);
+            float& log2Variance = m_log2Variances[size_t(regionY) * m_regionsX + regionX];
+            if (endRow <= firstRow || endBlock <= firstBlock)
+            {
+                log2Variance = -1.0f;
+                continue;
+            }
+
+            uint64_t sum = 0;
+            uint64_t squareSum = 0;
+            for (uint32_t block = firstBlock; block < endBlock; ++block)
+            {
+                sum += m_blockSums[block];
+                squareSum += m_blockSquareSums[block];
+            }
+            const double sampleCount = double(endRow - firstRow) * (endBlock - firstBlock) * BlockWidth;
+            const double mean = sum / sampleCount;
+            const double variance = (std::max)(squareSum / sampleCount - mean * mean, 0.0);
+
+            log2Variance = static_cast<float>(std::log2(variance + 1.0));
+            log2VarianceSum += log2Variance;
+            ++varianceCount;
+        }
+    }
+
+    if (varianceCount == 0)
+        return;
+
+    // Offsets are relative to the frame mean, so the frame keeps roughly the QP chosen for it.
+    const float meanLog2Variance = static_cast<float>(log2VarianceSum / varianceCount);
+    for (size_t region = 0; region < m_map.size(); ++region)
+    {
+        if (m_log2Variances[region] < 0.0f)
+            continue;
+
+        const float delta = AdaptiveQuantizationStrength * (m_log2Variances[region] - meanLog2Variance);
+        m_map[region] = static_cast<int8_t>(std::lround(std::clamp(delta, -MaxAdaptiveDeltaQP, MaxAdaptiveDeltaQP)));
+    }
+}
+
+void QPMapBuilder::AddRegionsOfInterest(const FrameDescriptor& frame)
+{
+    if (frame.regionOfInterestCount == 0 || frame.regionsOfInterest == nullptr)
+        return;
+
+    std::fill(m_regionOfInterestMap.begin(), m_regionOfInterestMap.end(), int8_t(0));
+    for (uint32_t index = 0; index < frame.regionOfInterestCount; ++index)
+    {
+        const RegionOfInterest& region = frame.regionsOfInterest[index];
+        if (region.width == 0 || region.height == 0 || region.left >= m_width || region.top >= m_height)
+            continue;
+
+        // Map regions touched by the rectangle get its delta.
+        const uint32_t right = region.left + (std::min)(region.width, m_width - region.left);
+        const uint32_t bottom = region.top + (std::min)(region.height, m_height - region.top);
+        const int8_t delta = static_cast<int8_t>(std::clamp(region.deltaQP, -MaxDeltaQP, MaxDeltaQP));
+        for (uint32_t regionY = region.top / m_regionSize; regionY <= (bottom - 1) / m_regionSize; ++regionY)
+        {
+            for (uint32_t regionX = region.left / m_regionSize; regionX <= (right - 1) / m_regionSize; ++regionX)
+            {
+                m_regionOfInterestMap[size_t(regionY) * m_regionsX + regionX] = delta;
+            }
+        }
+    }
+
+    for (size_t region = 0; region < m_map.size(); ++region)
+    {
+        const int32_t delta = m_map[region] + m_regionOfInterestMap[region];
+        m_map[region] = static_cast<int8_t>(std::clamp(delta, -MaxDeltaQP, MaxDeltaQP));
+    }
+}
+
+}
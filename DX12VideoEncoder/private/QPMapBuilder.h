@@ -0,0 +1,40 @@
+#pragma once
+#include "EncoderAPI.h"
+
+namespace DX12VideoEncoding
+{
+
+// Builds delta QP maps of frames from luma variance of the map regions and regions of interest of the frames,
+// with AVX2 or NEON if available.
+class QPMapBuilder
+{
+public:
+    // regionSize - side of a square map region in pixels, a multiple of 16.
+    QPMapBuilder(uint32_t width, uint32_t height, uint32_t regionSize, bool adaptiveQuantization,
+        bool regionsOfInterest);
+
+    // Delta QP of the map regions in raster order, valid until the next call.
+    const std::vector<int8_t>& Build(const FrameDescriptor& frame);
+
+private:
+    void AddAdaptiveQuantization(const FrameDescriptor& frame);
+    void AddRegionsOfInterest(const FrameDescriptor& frame);
+
+private:
+    const uint32_t m_width;
+    const uint32_t m_height;
+    const uint32_t m_regionSize;
+    const uint32_t m_regionsX;
+    const uint32_t m_regionsY;
+    const bool m_adaptiveQuantization;
+    const bool m_regionsOfInterest;
+
+    std::vector<int8_t> m_map;
+    std::vector<int8_t> m_regionOfInterestMap;
+    // Sums of the 16 pixels wide blocks of a region row.
+    std::vector<uint32_t> m_blockSums;
+    std::vector<uint32_t> m_blockSquareSums;
+    std::vector<float> m_log2Variances; // Negative for regions without full blocks
+};
+
+}
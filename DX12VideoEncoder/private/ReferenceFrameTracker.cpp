@@ -0,0 +1,160 @@
+#include "pch.h"
+#include "ReferenceFrameTracker.h"
+
+namespace DX12VideoEncoding
+{
+
+ReferenceFrameTracker::ReferenceFrameTracker(uint32_t maxReferenceFrameCount, uint32_t maxLongTermReferenceFrameCount)
+    : m_maxReferenceFrameCount(maxReferenceFrameCount)
+    , m_maxLongTermReferenceFrameCount(maxLongTermReferenceFrameCount)
+{
+}
+
+void ReferenceFrameTracker::Clear()
+{
+    m_frames.clear();
+}
+
+void ReferenceFrameTracker::KeepLast()
+{
+    assert(!m_frames.empty());
+    m_frames.erase(m_frames.begin(), m_frames.end() - 1);
+}
+
+void ReferenceFrameTracker::Add(uint64_t frameOrderNumber, const std::vector<uint64_t>& references,
+    uint32_t temporalLayerIndex)
+{
+    // References come from the DPB, so a frame predicted from a lost one is lost as well.
+    bool valid = true;
+    for (uint64_t reference : references)
+    {
+        const Frame* referenceFrame = Find(reference);
+        if (referenceFrame != nullptr && !referenceFrame->valid)
+            valid = false;
+    }
+
+    // Sliding window of the decoder: the DPB is full when it holds the sum of both counts.
+    if (m_frames.size() >= m_maxReferenceFrameCount + m_maxLongTermReferenceFrameCount)
+    {
+        auto oldestShortTerm = std::find_if(m_frames.begin(), m_frames.end(),
+            [](const Frame& frame) { return !frame.longTermFrameIndex.has_value(); });
+        assert(oldestShortTerm != m_frames.end());
+        m_frames.erase(oldestShortTerm);
+    }
+    m_frames.push_back(Frame{ frameOrderNumber, references, valid, std::nullopt, temporalLayerIndex });
+}
+
+bool ReferenceFrameTracker::IsShortTerm(uint64_t frameOrderNumber) const
+{
+    const Frame* frame = Find(frameOrderNumber);
+    return frame != nullptr && !frame->longTermFrameIndex.has_value();
+}
+
+bool ReferenceFrameTracker::IsValid(uint64_t frameOrderNumber) const
+{
+    const Frame* frame = Find(frameOrderNumber);
+    return frame != nullptr && frame->valid;
+}
+
+bool ReferenceFrameTracker::IsLongTerm(uint64_t frameOrderNumber) const
+{
+    const Frame* frame = Find(frameOrderNumber);
+    return frame != nullptr && frame->longTermFrameIndex.has_value();
+}
+
+uint32_t ReferenceFrameTracker::MarkLongTerm(uint64_t frameOrderNumber)
+{
+    assert(IsShortTerm(frameOrderNumber) && m_maxLongTermReferenceFrameCount > 0);
+
+    // A free index if any, otherwise the one of the oldest long-term frame, which is unmarked by the decoder.
+    std::vector<bool> usedIndices(m_maxLongTermReferenceFrameCount);
+    auto oldestLongTerm = m_frames.end();
+    for (auto it = m_frames.begin(); it != m_frames.end(); ++it)
+    {
+        if (!it->longTermFrameIndex.has_value())
+            continue;
+
+        usedIndices[*it->longTermFrameIndex] = true;
+        if (oldestLongTerm == m_frames.end())
+            oldestLongTerm = it;
+    }
+
+    uint32_t longTermFrameIndex = 0;
+    auto freeIndex = std::find(usedIndices.begin(), usedIndices.end(), false);
+    if (freeIndex != usedIndices.end())
+    {
+        longTermFrameIndex = static_cast<uint32_t>(std::distance(usedIndices.begin(), freeIndex));
+    }
+    else
+    {
+        longTermFrameIndex = *oldestLongTerm->longTermFrameIndex;
+        m_frames.erase(oldestLongTerm);
+    }
+
+    auto frame = std::find_if(m_frames.begin(), m_frames.end(),
+        [frameOrderNumber](const Frame& frame) { return frame.frameOrderNumber == frameOrderNumber; });
+    frame->longTermFrameIndex = longTermFrameIndex;
+    return longTermFrameIndex;
+}
+
+void ReferenceFrameTracker::Invalidate(uint64_t firstFrameOrderNumber, uint64_t lastFrameOrderNumber)
+{
+    assert(firstFrameOrderNumber <= lastFrameOrderNumber);
+
+    // Frames are predicted only from earlier encoded ones, so a single pass in the encoding order
+    // propagates the loss. Frames older than the range can't be predicted from it.
+    for (Frame& frame : m_frames)
+    {
+        if (!frame.valid || frame.frameOrderNumber < firstFrameOrderNumber)
+            continue;
+
+        if (frame.frameOrderNumber <= lastFrameOrderNumber)
+        {
+            frame.valid = false;
+            continue;
+        }
+
+        for (uint64_t reference : frame.references)
+        {
+            if (reference < firstFrameOrderNumber)
+                continue;
+
+            // A reference evicted from the DPB could be predicted from the range, it's assumed to be lost.
+            const Frame* referenceFrame = Find(reference);
+            if (reference <= lastFrameOrderNumber || referenceFrame == nullptr || !referenceFrame->valid)
+            {
+                frame.valid = false;
+                break;
+            }
+        }
+    }
+}
+
+std::vector<uint64_t> ReferenceFrameTracker::GetFrameOrderNumbers() const
+{
+    std::vector<uint64_t> frameOrderNumbers;
+    for (const Frame& frame : m_frames)
+    {
+        frameOrderNumbers.push_back(frame.frameOrderNumber);
+    }
+    return frameOrderNumbers;
+}
+
+std::optional<uint64_t> ReferenceFrameTracker::GetLastValid(uint32_t maxTemporalLayerIndex) const
+{
+    for (auto it = m_frames.rbegin(); it != m_frames.rend(); ++it)
+    {
+        if (it->valid && it->temporalLayerIndex <= maxTemporalLayerIndex)
+            return it->frameOrderNumber;
+    }
+    return {};
+}
+
+const ReferenceFrameTracker::Frame* ReferenceFrameTracker::Find(uint64_t frameOrderNumber) const
+{
+    auto it = std::find_if(m_frames.begin(), m_frames.end(),
+        [frameOrderNumber](const Frame& frame) { return frame.frameOrderNumber == frameOrderNumber; });
+    return it != m_frames.end() ? &*it : nullptr;
+}
+
+}
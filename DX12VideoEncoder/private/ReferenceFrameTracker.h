@@ -0,0 +1,64 @@
+#pragma once
+
+namespace DX12VideoEncoding
+{
+
+// Reference frames the decoder holds in the DPB, in the encoding order, and whether they are intact after
+// the losses reported by the receiver. Only frame order numbers are tracked, the textures are kept by
+// ReferenceFramesManager with the same sliding window and long-term marking.
+class ReferenceFrameTracker
+{
+public:
+    ReferenceFrameTracker() = default;
+    // The DPB holds up to maxReferenceFrameCount + maxLongTermReferenceFrameCount frames,
+    // the sliding window evicts short-term frames only.
+    ReferenceFrameTracker(uint32_t maxReferenceFrameCount, uint32_t maxLongTermReferenceFrameCount);
+
+    // Drops all frames, an IDR frame starts a new DPB.
+    void Clear();
+    // Drops all frames except the last added one, which marks the others as unused with MMCO 5.
+    void KeepLast();
+
+    // references - frames the added one is predicted from, the oldest short-term frame is evicted if the DPB is full.
+    void Add(uint64_t frameOrderNumber, const std::vector<uint64_t>& references, uint32_t temporalLayerIndex = 0);
+
+    bool IsShortTerm(uint64_t frameOrderNumber) const;
+    // The frame is in the DPB and intact.
+    bool IsValid(uint64_t frameOrderNumber) const;
+    bool IsLongTerm(uint64_t frameOrderNumber) const;
+    // Converts a short-term frame to long-term one, replacing the oldest long-term frame if all indices are used.
+    // Returns the long-term frame index, the marking is done by the next added frame before it's added.
+    uint32_t MarkLongTerm(uint64_t frameOrderNumber);
+
+    // Frames of the range are lost, frames predicted from them directly or through other frames are lost too.
+    void Invalidate(uint64_t firstFrameOrderNumber, uint64_t lastFrameOrderNumber);
+
+    bool IsEmpty() const { return m_frames.empty(); }
+    size_t GetCount() const { return m_frames.size(); }
+    // index 0 - the oldest frame.
+    uint64_t GetFrameOrderNumber(size_t index) const { return m_frames[index].frameOrderNumber; }
+    uint64_t GetLast() const { return m_frames.back().frameOrderNumber; }
+    std::vector<uint64_t> GetFrameOrderNumbers() const;
+
+    // The newest intact frame of the temporal layer or a lower one, none if all such frames of the DPB are lost.
+    std::optional<uint64_t> GetLastValid(uint32_t maxTemporalLayerIndex = UINT32_MAX) const;
+
+private:
+    struct Frame
+    {
+        uint64_t frameOrderNumber{};
+        std::vector<uint64_t> references;
+        bool valid{ true };
+        std::optional<uint32_t> longTermFrameIndex;
+        uint32_t temporalLayerIndex{};
+    };
+
+    const Frame* Find(uint64_t frameOrderNumber) const;
+
+private:
+    uint32_t m_maxReferenceFrameCount = 0;
+    uint32_t m_maxLongTermReferenceFrameCount = 0;
+    std::vector<Frame> m_frames;
+};
+
+}
@@ -10,15 +10,17 @@ ReferenceFramesManager::ReferenceFramesManager(
     const D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC& resolutionDesc,
     DXGI_FORMAT inputFormat,
     uint32_t maxReferenceFrameCount,
+    uint32_t maxLongTermReferenceFrameCount,
     bool gopHasInterFrames)
     : m_device(device)
     , m_resolutionDesc(resolutionDesc)
     , m_inputFormat(inputFormat)
     , m_maxReferenceFrameCount(maxReferenceFrameCount)
+    , m_maxLongTermReferenceFrameCount(maxLongTermReferenceFrameCount)
     , m_gopHasInterFrames(gopHasInterFrames)
 {
     if (m_gopHasInterFrames)
-        AllocateTextures(maxReferenceFrameCount);
+        AllocateTextures(GetDPBCapacity());
 }
 
 D3D12_VIDEO_ENCODER_RECONSTRUCTED_PICTURE ReferenceFramesManager::GetReconstructedPicture()
@@ -48,10 +50,14 @@ D3D12_VIDEO_ENCODE_REFERENCE_FRAMES ReferenceFramesManager::GetReferenceFrames()
 }
 
 void ReferenceFramesManager::PrepareForEncodingFrame(
-    D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA currentPicParamsData, bool useFrameAsReference)
+    D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA currentPicParamsData, bool useFrameAsReference,
+    std::optional<LongTermReferenceMarking> longTermReference, bool restartPictureNumbering)
 {
     m_currentH264PicData = *currentPicParamsData.pH264PicData;
     m_isCurrentFrameReference = useFrameAsReference;
+    m_longTermReference = useFrameAsReference ? longTermReference : std::nullopt;
+    m_restartPictureNumbering = useFrameAsReference && restartPictureNumbering;
+    assert(!m_restartPictureNumbering || !m_longTermReference.has_value());
 
     if (m_currentH264PicData.FrameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME)
     {
@@ -105,6 +111,30 @@ void ReferenceFramesManager::GetPictureControlCodecData(
         MapDecodingOrderToReferenceFrameIndex(m_referenceFrameDescriptors,
             m_currentH264PicData.pList0ReferenceFrames, m_currentH264PicData.List0ReferenceFramesCount);
     }
+
+    m_list0Modifications.clear();
+    if (m_currentH264PicData.FrameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME)
+    {
+        AddList0Modifications();
+    }
+    m_currentH264PicData.List0RefPicModificationsCount = static_cast<UINT>(m_list0Modifications.size());
+    m_currentH264PicData.pList0RefPicModifications = m_list0Modifications.empty() ? nullptr : m_list0Modifications.data();
+
+    m_markingOperations.clear();
+    if (m_longTermReference.has_value())
+    {
+        AddLongTermMarkingOperations();
+    }
+    if (m_restartPictureNumbering)
+    {
+        m_markingOperations.push_back(D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_MARKING_OPERATION{
+            .memory_management_control_operation = 5, // Mark all frames as unused and restart POC and frame_num
+        });
+    }
+    m_currentH264PicData.adaptive_ref_pic_marking_mode_flag = m_markingOperations.empty() ? 0 : 1;
+    m_currentH264PicData.RefPicMarkingOperationsCommandsCount = static_cast<UINT>(m_markingOperations.size());
+    m_currentH264PicData.pRefPicMarkingOperationsCommands = m_markingOperations.empty() ? nullptr : m_markingOperations.data();
+
     if (usesL1RefFrames && (m_currentH264PicData.List1ReferenceFramesCount > 0))
     {
         MapDecodingOrderToReferenceFrameIndex(m_referenceFrameDescriptors,
@@ -132,14 +162,152 @@ void ReferenceFramesManager::GetPictureControlCodecData(
     *pictureControlCodecData.pH264PicData = m_currentH264PicData;
 }
 
+void ReferenceFramesManager::AddList0Modifications()
+{
+    // The default list of P-frames orders short-term references from the last decoded one, followed by long-term
+    // references by index, as the descriptors are.
+    bool isDefaultOrder = true;
+    for (UINT i = 0; i < m_currentH264PicData.List0ReferenceFramesCount; ++i)
+    {
+        isDefaultOrder = isDefaultOrder && m_currentH264PicData.pList0ReferenceFrames[i] == i;
+    }
+    if (isDefaultOrder)
+        return;
+
+    // Short-term entries are coded as a difference from the previous one, starting from the current frame.
+    int64_t predictedPicNum = m_currentH264PicData.FrameDecodingOrderNumber;
+    for (UINT i = 0; i < m_currentH264PicData.List0ReferenceFramesCount; ++i)
+    {
+        const auto& descriptor = m_referenceFrameDescriptors[m_currentH264PicData.pList0ReferenceFrames[i]];
+        if (descriptor.IsLongTermReference)
+        {
+            m_list0Modifications.push_back(D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_LIST_MODIFICATION_OPERATION{
+                .modification_of_pic_nums_idc = 2, // Long-term picture number
+                .abs_diff_pic_num_minus1 = 0,
+                .long_term_pic_num = descriptor.LongTermPictureIdx,
+            });
+            continue;
+        }
+
+        const int64_t picNum = GetPicNum(descriptor);
+        const int64_t difference = predictedPicNum - picNum;
+        assert(difference != 0);
+
+        m_list0Modifications.push_back(D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_LIST_MODIFICATION_OPERATION{
+            .modification_of_pic_nums_idc = static_cast<UCHAR>(difference > 0 ? 0 : 1), // Subtract or add
+            .abs_diff_pic_num_minus1 = static_cast<UINT>((difference > 0 ? difference : -difference) - 1),
+            .long_term_pic_num = 0,
+        });
+        predictedPicNum = picNum;
+    }
+}
+
+void ReferenceFramesManager::AddLongTermMarkingOperations()
+{
+    const auto markedFrame = std::find_if(m_referenceFrameDescriptors.begin(), m_referenceFrameDescriptors.end(),
+        [this](const D3D12_VIDEO_ENCODER_REFERENCE_PICTURE_DESCRIPTOR_H264& descriptor)
+        {
+            return !descriptor.IsLongTermReference
+                && descriptor.PictureOrderCountNumber == m_longTermReference->pictureOrderCountNumber;
+        });
+    assert(markedFrame != m_referenceFrameDescriptors.end());
+    const size_t replacedLongTermCount = std::count_if(m_referenceFrameDescriptors.begin(), m_referenceFrameDescriptors.end(),
+        [this](const D3D12_VIDEO_ENCODER_REFERENCE_PICTURE_DESCRIPTOR_H264& descriptor)
+        {
+            return descriptor.IsLongTermReference && descriptor.LongTermPictureIdx == m_longTermReference->longTermFrameIndex;
+        });
+
+    const int64_t currentPicNum = m_currentH264PicData.FrameDecodingOrderNumber;
+
+    // Adaptive marking replaces the sliding window for this frame, so the oldest short-term frame is removed
+    // explicitly if the current frame doesn't fit otherwise.
+    if (m_referenceFrameDescriptors.size() - replacedLongTermCount >= GetDPBCapacity())
+    {
+        const size_t oldestShortTerm = GetOldestShortTermIndex(markedFrame->PictureOrderCountNumber);
+        m_markingOperations.push_back(D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_MARKING_OPERATION{
+            .memory_management_control_operation = 1, // Mark short-term frame as unused
+            .difference_of_pic_nums_minus1 =
+                static_cast<UINT>(currentPicNum - GetPicNum(m_referenceFrameDescriptors[oldestShortTerm]) - 1),
+        });
+    }
+
+    // Long-term indices are not available after an IDR frame until their maximum is set.
+    m_markingOperations.push_back(D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_MARKING_OPERATION{
+        .memory_management_control_operation = 4, // Set maximum long-term frame index
+        .max_long_term_frame_idx_plus1 = m_maxLongTermReferenceFrameCount,
+    });
+
+    // A long-term frame with the same index is marked as unused by the decoder.
+    m_markingOperations.push_back(D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_MARKING_OPERATION{
+        .memory_management_control_operation = 3, // Convert short-term frame to long-term one
+        .difference_of_pic_nums_minus1 = static_cast<UINT>(currentPicNum - GetPicNum(*markedFrame) - 1),
+        .long_term_frame_idx = m_longTermReference->longTermFrameIndex,
+    });
+}
+
+void ReferenceFramesManager::ApplyLongTermMarking()
+{
+    const UINT longTermFrameIndex = m_longTermReference->longTermFrameIndex;
+    for (size_t i = 0; i < m_referenceFrameDescriptors.size(); ++i)
+    {
+        if (m_referenceFrameDescriptors[i].IsLongTermReference
+            && m_referenceFrameDescriptors[i].LongTermPictureIdx == longTermFrameIndex)
+        {
+            RemoveReferenceFrame(i);
+            break;
+        }
+    }
+
+    auto markedFrame = std::find_if(m_referenceFrameDescriptors.begin(), m_referenceFrameDescriptors.end(),
+        [this](const D3D12_VIDEO_ENCODER_REFERENCE_PICTURE_DESCRIPTOR_H264& descriptor)
+        {
+            return !descriptor.IsLongTermReference
+                && descriptor.PictureOrderCountNumber == m_longTermReference->pictureOrderCountNumber;
+        });
+    assert(markedFrame != m_referenceFrameDescriptors.end());
+    const size_t markedIndex = std::distance(m_referenceFrameDescriptors.begin(), markedFrame);
+
+    auto descriptor = *markedFrame;
+    descriptor.IsLongTermReference = TRUE;
+    descriptor.LongTermPictureIdx = longTermFrameIndex;
+    ID3D12Resource* resource = m_referenceFramesResources[markedIndex];
+    m_referenceFrameDescriptors.erase(markedFrame);
+    m_referenceFramesResources.erase(m_referenceFramesResources.begin() + markedIndex);
+
+    // Long-term frames follow the short-term ones by index.
+    size_t position = 0;
+    while (position < m_referenceFrameDescriptors.size()
+        && (!m_referenceFrameDescriptors[position].IsLongTermReference
+            || m_referenceFrameDescriptors[position].LongTermPictureIdx < longTermFrameIndex))
+    {
+        ++position;
+    }
+    m_referenceFrameDescriptors.insert(m_referenceFrameDescriptors.begin() + position, descriptor);
+    m_referenceFramesResources.insert(m_referenceFramesResources.begin() + position, resource);
+}
+
 void ReferenceFramesManager::UpdateReferenceFrames()
 {
     if (!IsCurrentFrameUsedAsReference())
         return;
 
-    if (m_referenceFramesResources.size() >= m_maxReferenceFrameCount)
+    if (m_longTermReference.has_value())
+    {
+        ApplyLongTermMarking();
+    }
+
+    // The reconstructed picture of the current frame stays in use.
+    if (m_restartPictureNumbering)
     {
-        RemoveOldestReferenceFrame();
+        while (!m_referenceFrameDescriptors.empty())
+        {
+            RemoveReferenceFrame(0);
+        }
+    }
+
+    if (m_referenceFramesResources.size() >= GetDPBCapacity())
+    {
+        RemoveReferenceFrame(GetOldestShortTermIndex());
     }
 
     // Add reconstructed pic to the ref frames.
@@ -150,9 +318,9 @@ void ReferenceFramesManager::UpdateReferenceFrames()
         .ReconstructedPictureResourceIndex = 0,
         .IsLongTermReference = FALSE,
         .LongTermPictureIdx = 0,
-        .PictureOrderCountNumber = m_currentH264PicData.PictureOrderCountNumber,
-        .FrameDecodingOrderNumber = m_currentH264PicData.FrameDecodingOrderNumber,
-        .TemporalLayerIndex = 0
+        .PictureOrderCountNumber = m_restartPictureNumbering ? 0 : m_currentH264PicData.PictureOrderCountNumber,
+        .FrameDecodingOrderNumber = m_restartPictureNumbering ? 0 : m_currentH264PicData.FrameDecodingOrderNumber,
+        .TemporalLayerIndex = m_currentH264PicData.TemporalLayerIndex
     };
 
     m_referenceFrameDescriptors.insert(m_referenceFrameDescriptors.begin(), descriptorH264);
@@ -171,6 +339,20 @@ void ReferenceFramesManager::Reset()
     m_freeTextures.merge(m_usedTextures);
 }
 
+uint64_t ReferenceFramesManager::GetMemoryUsage() const
+{
+    uint64_t memoryUsage = 0;
+    for (const auto& texture : m_freeTextures)
+    {
+        memoryUsage += GetAllocationSize(m_device.Get(), texture.Get());
+    }
+    for (const auto& texture : m_usedTextures)
+    {
+        memoryUsage += GetAllocationSize(m_device.Get(), texture.Get());
+    }
+    return memoryUsage;
+}
+
 void ReferenceFramesManager::AllocateTextures(int size)
 {
     for (int i = 0; i < size; ++i)
@@ -201,7 +383,7 @@ void ReferenceFramesManager::CreateReconstructedPictureResource()
     }
 
     assert((m_freeTextures.size() + m_usedTextures.size())
-        <= (m_maxReferenceFrameCount + 1 /* One additional is allowed for reconstructed pic */));
+        <= (GetDPBCapacity() + 1 /* One additional is allowed for reconstructed pic */));
 
     m_reconstructedPicture.pReconstructedPicture = m_reconstructedPictureResource.Get();
     m_reconstructedPicture.ReconstructedPictureSubresource = 0;
@@ -232,21 +414,41 @@ ComPtr<ID3D12Resource> ReferenceFramesManager::CreateTexture()
     return result;
 }
 
-void ReferenceFramesManager::RemoveOldestReferenceFrame()
+size_t ReferenceFramesManager::GetOldestShortTermIndex(std::optional<UINT> exceptPictureOrderCountNumber) const
+{
+    // Short-term frames are first, from the last decoded one.
+    size_t oldestIndex = m_referenceFrameDescriptors.size();
+    for (size_t i = 0; i < m_referenceFrameDescriptors.size(); ++i)
+    {
+        const auto& descriptor = m_referenceFrameDescriptors[i];
+        if (!descriptor.IsLongTermReference && descriptor.PictureOrderCountNumber != exceptPictureOrderCountNumber)
+            oldestIndex = i;
+    }
+    assert(oldestIndex < m_referenceFrameDescriptors.size());
+    return oldestIndex;
+}
+
+int64_t ReferenceFramesManager::GetPicNum(const D3D12_VIDEO_ENCODER_REFERENCE_PICTURE_DESCRIPTOR_H264& descriptor) const
+{
+    const int64_t frameNum = descriptor.FrameDecodingOrderNumber;
+    return frameNum > m_currentH264PicData.FrameDecodingOrderNumber ? frameNum - m_maxFrameNum : frameNum;
+}
+
+void ReferenceFramesManager::RemoveReferenceFrame(size_t index)
 {
-    assert(!(m_referenceFrameDescriptors.empty() || m_referenceFramesResources.empty()));
-    if (m_referenceFrameDescriptors.empty() || m_referenceFramesResources.empty())
+    assert(index < m_referenceFrameDescriptors.size() && index < m_referenceFramesResources.size());
+    if (index >= m_referenceFrameDescriptors.size() || index >= m_referenceFramesResources.size())
         return;
 
-    auto oldestResource = m_referenceFramesResources.rbegin();
-    if (auto usedTextureIter = m_usedTextures.find(*oldestResource); usedTextureIter != m_usedTextures.end())
+    auto resource = m_referenceFramesResources[index];
+    if (auto usedTextureIter = m_usedTextures.find(resource); usedTextureIter != m_usedTextures.end())
     {
         m_freeTextures.insert(*usedTextureIter);
         m_usedTextures.erase(usedTextureIter);
     }
 
-    m_referenceFramesResources.pop_back();
-    m_referenceFrameDescriptors.pop_back();
+    m_referenceFramesResources.erase(m_referenceFramesResources.begin() + index);
+    m_referenceFrameDescriptors.erase(m_referenceFrameDescriptors.begin() + index);
 }
 
 }
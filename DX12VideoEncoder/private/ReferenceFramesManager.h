@@ -4,6 +4,13 @@ namespace DX12VideoEncoding {
 
 using Microsoft::WRL::ComPtr;
 
+// Short-term reference frame converted to a long-term one by the marking of the current frame.
+struct LongTermReferenceMarking
+{
+    UINT pictureOrderCountNumber{};
+    UINT longTermFrameIndex{};
+};
+
 class ReferenceFramesManager
 {
 public:
@@ -12,6 +19,7 @@ public:
         const D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC& resolutionDesc,
         DXGI_FORMAT inputFormat,
         uint32_t maxReferenceFrameCount,
+        uint32_t maxLongTermReferenceFrameCount,
         bool gopHasInterFrames
     );
 
@@ -21,8 +29,11 @@ public:
 
     D3D12_VIDEO_ENCODE_REFERENCE_FRAMES GetReferenceFrames();
 
+    // restartPictureNumbering - MMCO 5 of the current frame drops all other references, then the frame
+    // has POC and frame_num 0.
     void PrepareForEncodingFrame(D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA currentPicParamsData,
-        bool useFrameAsReference);
+        bool useFrameAsReference, std::optional<LongTermReferenceMarking> longTermReference = std::nullopt,
+        bool restartPictureNumbering = false);
 
     bool IsCurrentFrameUsedAsReference() const;
 
@@ -30,12 +41,27 @@ public:
 
     void UpdateReferenceFrames();
 
-private:
+    // Releases all reference frames, keeping allocated textures.
     void Reset();
+    uint64_t GetMemoryUsage() const;
+    bool HasInterFrames() const { return m_gopHasInterFrames; }
+    uint32_t GetMaxLongTermReferenceFrameCount() const { return m_maxLongTermReferenceFrameCount; }
+    // frame_num of the frames wraps at this value.
+    void SetMaxFrameNum(UINT maxFrameNum) { m_maxFrameNum = maxFrameNum; }
+
+private:
     void AllocateTextures(int size);
     void CreateReconstructedPictureResource();
     ComPtr<ID3D12Resource> CreateTexture();
-    void RemoveOldestReferenceFrame();
+    uint32_t GetDPBCapacity() const { return m_maxReferenceFrameCount + m_maxLongTermReferenceFrameCount; }
+    size_t GetOldestShortTermIndex(std::optional<UINT> exceptPictureOrderCountNumber = std::nullopt) const;
+    void RemoveReferenceFrame(size_t index);
+    // FrameNumWrap of the short-term frame, negative if its frame_num is before the wrap of the current one.
+    int64_t GetPicNum(const D3D12_VIDEO_ENCODER_REFERENCE_PICTURE_DESCRIPTOR_H264& descriptor) const;
+    // Reorders the list of a P-frame referencing other frames than the last decoded ones.
+    void AddList0Modifications();
+    void AddLongTermMarkingOperations();
+    void ApplyLongTermMarking();
 
 private:
     D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264 m_currentH264PicData = {};
@@ -44,6 +70,11 @@ private:
 
     std::vector<D3D12_VIDEO_ENCODER_REFERENCE_PICTURE_DESCRIPTOR_H264> m_referenceFrameDescriptors;
     std::vector<ID3D12Resource*> m_referenceFramesResources;
+    std::vector<D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_LIST_MODIFICATION_OPERATION> m_list0Modifications;
+    std::vector<D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_MARKING_OPERATION> m_markingOperations;
+    std::optional<LongTermReferenceMarking> m_longTermReference; // Of the current frame
+    bool m_restartPictureNumbering = false; // Of the current frame
+    UINT m_maxFrameNum = 1u << 16;
 
     std::set<ComPtr<ID3D12Resource>> m_freeTextures;
     std::set<ComPtr<ID3D12Resource>> m_usedTextures;
@@ -53,6 +84,7 @@ private:
     const D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC m_resolutionDesc;
     const DXGI_FORMAT m_inputFormat;
     const uint32_t m_maxReferenceFrameCount;
+    const uint32_t m_maxLongTermReferenceFrameCount;
     const bool m_gopHasInterFrames;
     bool m_isCurrentFrameReference = false;
 };
@@ -0,0 +1,386 @@
+#include "pch.h"
+#include "SharedQueuesScheduler.h"
+#include "Utils.h"
+
+
+namespace DX12VideoEncoding {
+
+class SharedQueuesScheduler::ScheduledCommandSubmitter : public ICommandSubmitter
+{
+public:
+    ScheduledCommandSubmitter(std::shared_ptr<SharedQueuesScheduler> scheduler, Queue& queue,
+        std::shared_ptr<Client> client)
+        : m_scheduler(std::move(scheduler))
+        , m_queue(queue)
+        , m_client(std::move(client))
+    {
+    }
+
+    ~ScheduledCommandSubmitter()
+    {
+        // Command lists and resources are released by the owner right after this.
+        if (m_lastSubmission)
+        {
+            try
+            {
+                WaitForCompletion(m_lastSubmission, nullptr);
+            }
+            catch (const std::exception& e)
+            {
+                LogMessage(LogLevel::E_ERROR, e.what());
+            }
+        }
+    }
+
+    SubmissionHandle Submit(const std::vector<ID3D12CommandList*>& commandLists,
+        const std::vector<SubmissionHandle>& dependencies) override
+    {
+        m_lastSubmission = m_scheduler->Enqueue(m_queue, m_client, commandLists, dependencies);
+        return m_lastSubmission;
+    }
+
+    bool WaitForCompletion(const SubmissionHandle& submission, HANDLE terminateEvent) override
+    {
+        // The completed event is shared by all submissions of the client, so the state is checked on each wake up.
+        while (!submission->IsCompleted())
+        {
+            m_scheduler->RethrowFailure();
+            if (!WaitForEventOrTermination(m_client->completedEvent.Get(), terminateEvent))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    const std::shared_ptr<SharedQueuesScheduler> m_scheduler;
+    Queue& m_queue;
+    const std::shared_ptr<Client> m_client;
+    SubmissionHandle m_lastSubmission;
+};
+
+SharedQueuesScheduler::SharedQueuesScheduler(const ComPtr<ID3D12Device>& device,
+    const DeviceSchedulerConfiguration& config)
+    : m_device(device)
+    , m_config(config)
+{
+    ThrowIfFalse(m_config.encodeQueueCount > 0 && m_config.copyQueueCount > 0
+        && m_config.maxCommandListsPerSubmission > 0);
+    // The scheduler thread waits for the wake event and the fences of all queues at once.
+    ThrowIfFalse(m_config.encodeQueueCount + m_config.copyQueueCount < MAXIMUM_WAIT_OBJECTS);
+
+    CreateQueues(D3D12_COMMAND_LIST_TYPE_COPY, m_config.copyQueueCount);
+    CreateQueues(D3D12_COMMAND_LIST_TYPE_VIDEO_ENCODE, m_config.encodeQueueCount);
+
+    m_wakeEvent.Attach(CreateEvent(NULL, FALSE, FALSE, nullptr));
+    m_thread = std::thread(&SharedQueuesScheduler::ThreadProc, this);
+}
+
+SharedQueuesScheduler::~SharedQueuesScheduler()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    SetEvent(m_wakeEvent.Get());
+    m_thread.join();
+}
+
+IDeviceScheduler::Statistics SharedQueuesScheduler::GetStatistics() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_statistics;
+}
+
+std::unique_ptr<ICommandSubmitter> SharedQueuesScheduler::CreateSubmitter(D3D12_COMMAND_LIST_TYPE type,
+    uint32_t priority)
+{
+    std::lock_guard lock(m_mutex);
+
+    Queue* selectedQueue = nullptr;
+    for (auto& queue : m_queues)
+    {
+        if (queue->type != type)
+            continue;
+
+        std::erase_if(queue->clients, [](const auto& client) { return client.expired(); });
+        if (selectedQueue == nullptr || queue->clients.size() < selectedQueue->clients.size())
+        {
+            selectedQueue = queue.get();
+        }
+    }
+    ThrowIfFalse(selectedQueue != nullptr);
+
+    auto client = std::make_shared<Client>();
+    client->weight = static_cast<uint64_t>(priority) + 1;
+    client->completedEvent.Attach(CreateEvent(NULL, FALSE, FALSE, nullptr));
+
+    // Start from the current share of the queue, otherwise the new client would outrun existing ones.
+    std::optional<double> minVirtualTime;
+    for (const auto& weakClient : selectedQueue->clients)
+    {
+        if (auto existingClient = weakClient.lock())
+        {
+            const double virtualTime = double(existingClient->executedCommandLists) / existingClient->weight;
+            minVirtualTime = minVirtualTime ? (std::min)(*minVirtualTime, virtualTime) : virtualTime;
+        }
+    }
+    client->executedCommandLists = static_cast<uint64_t>(minVirtualTime.value_or(0.0) * client->weight);
+    selectedQueue->clients.push_back(client);
+
+    return std::make_unique<ScheduledCommandSubmitter>(shared_from_this(), *selectedQueue, std::move(client));
+}
+
+void SharedQueuesScheduler::CreateQueues(D3D12_COMMAND_LIST_TYPE type, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        auto queue = std::make_unique<Queue>();
+        queue->type = type;
+
+        D3D12_COMMAND_QUEUE_DESC commandQueueDesc = { type };
+        ThrowIfFailed(m_device->CreateCommandQueue(
+            &commandQueueDesc,
+            IID_PPV_ARGS(&queue->commandQueue)));
+
+        ThrowIfFailed(m_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&queue->fence)));
+        queue->fenceEvent.Attach(CreateEvent(NULL, FALSE, FALSE, nullptr));
+
+        m_queues.push_back(std::move(queue));
+    }
+}
+
+SubmissionHandle SharedQueuesScheduler::Enqueue(Queue& queue, const std::shared_ptr<Client>& client,
+    const std::vector<ID3D12CommandList*>& commandLists, const std::vector<SubmissionHandle>& dependencies)
+{
+    auto submission = std::make_shared<Submission>();
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_error)
+        {
+            std::rethrow_exception(m_error);
+        }
+
+        queue.pending.push_back(PendingSubmission{ client, commandLists, dependencies, submission });
+        if (!m_firstPendingTime)
+        {
+            m_firstPendingTime = std::chrono::steady_clock::now();
+        }
+    }
+    SetEvent(m_wakeEvent.Get());
+    return submission;
+}
+
+void SharedQueuesScheduler::ThreadProc()
+{
+    std::vector<HANDLE> events{ m_wakeEvent.Get() };
+    for (const auto& queue : m_queues)
+    {
+        events.push_back(queue->fenceEvent.Get());
+    }
+
+    try
+    {
+        while (true)
+        {
+            DWORD result = WaitForMultipleObjects(static_cast<DWORD>(events.size()), events.data(), FALSE,
+                GetWaitTimeout());
+            if (result == WAIT_FAILED)
+            {
+                throw std::runtime_error("WaitForMultipleObjects() failed: " + std::to_string(GetLastError()));
+            }
+
+            std::lock_guard lock(m_mutex);
+            if (m_stopping)
+            {
+                break;
+            }
+
+            for (auto& queue : m_queues)
+            {
+                NotifyCompleted(*queue);
+            }
+
+            size_t pendingCommandLists = 0;
+            for (const auto& queue : m_queues)
+            {
+                for (const auto& pending : queue->pending)
+                    pendingCommandLists += pending.commandLists.size();
+            }
+
+            const bool isBatchCollected = m_firstPendingTime
+                && ((std::chrono::steady_clock::now() - *m_firstPendingTime >= m_config.batchingInterval)
+                    || (pendingCommandLists >= m_config.maxCommandListsPerSubmission));
+            if (isBatchCollected)
+            {
+                bool hasPending = false;
+                for (auto& queue : m_queues)
+                {
+                    ExecutePending(*queue);
+                    hasPending = hasPending || !queue->pending.empty();
+                }
+                // Remaining submissions go with the next batch without waiting.
+                if (!hasPending)
+                {
+                    m_firstPendingTime.reset();
+                }
+            }
+
+            for (auto& queue : m_queues)
+            {
+                if (!queue->inFlight.empty())
+                {
+                    ThrowIfFailed(queue->fence->SetEventOnCompletion(queue->inFlight.front().fenceValue,
+                        queue->fenceEvent.Get()));
+                }
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LogMessage(LogLevel::E_ERROR, std::string("Device scheduler failed: ") + e.what());
+        NotifyFailure(std::current_exception());
+    }
+}
+
+DWORD SharedQueuesScheduler::GetWaitTimeout() const
+{
+    std::lock_guard lock(m_mutex);
+    if (!m_firstPendingTime)
+    {
+        return INFINITE;
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - *m_firstPendingTime;
+    if (elapsed >= m_config.batchingInterval)
+    {
+        return 0;
+    }
+    return static_cast<DWORD>(std::chrono::ceil<std::chrono::milliseconds>(m_config.batchingInterval - elapsed).count());
+}
+
+void SharedQueuesScheduler::ExecutePending(Queue& queue)
+{
+    std::vector<ID3D12CommandList*> commandLists;
+    std::vector<PendingSubmission> batch;
+    while (true)
+    {
+        auto index = SelectNextPending(queue);
+        if (!index)
+            break;
+
+        auto& pending = queue.pending[*index];
+        if (!commandLists.empty()
+            && (commandLists.size() + pending.commandLists.size() > m_config.maxCommandListsPerSubmission))
+            break;
+
+        commandLists.insert(commandLists.end(), pending.commandLists.begin(), pending.commandLists.end());
+        batch.push_back(std::move(pending));
+        queue.pending.erase(queue.pending.begin() + *index);
+    }
+
+    if (batch.empty())
+        return;
+
+    // Dependencies of the whole batch are merged, one wait per fence.
+    std::map<ID3D12Fence*, UINT64> fenceWaits;
+    for (const auto& pending : batch)
+    {
+        for (const auto& dependency : pending.dependencies)
+        {
+            if (dependency->fence == queue.fence.Get())
+                continue;
+            auto& value = fenceWaits[dependency->fence];
+            value = (std::max)(value, dependency->fenceValue);
+        }
+    }
+    for (const auto& [fence, value] : fenceWaits)
+    {
+        ThrowIfFailed(queue.commandQueue->Wait(fence, value));
+    }
+
+    queue.commandQueue->ExecuteCommandLists(static_cast<UINT>(commandLists.size()), commandLists.data());
+    ThrowIfFailed(queue.commandQueue->Signal(queue.fence.Get(), ++queue.fenceValue));
+
+    for (auto& pending : batch)
+    {
+        pending.submission->fence = queue.fence.Get();
+        pending.submission->fenceValue = queue.fenceValue;
+        pending.submission->isSubmitted.store(true, std::memory_order_release);
+        pending.client->executedCommandLists += pending.commandLists.size();
+        queue.inFlight.push_back(InFlightSubmission{ pending.client, queue.fenceValue });
+    }
+
+    m_statistics.submittedCommandLists += commandLists.size();
+    ++m_statistics.executeCalls;
+}
+
+std::optional<size_t> SharedQueuesScheduler::SelectNextPending(const Queue& queue) const
+{
+    // Weighted fair share: the client with the smallest amount of executed work relative to its weight goes first.
+    // Submissions of one client keep their order.
+    std::optional<size_t> selected;
+    double selectedVirtualTime = 0.0;
+    std::set<const Client*> visitedClients;
+    for (size_t i = 0; i < queue.pending.size(); ++i)
+    {
+        const auto& pending = queue.pending[i];
+        if (!visitedClients.insert(pending.client.get()).second)
+            continue;
+
+        const bool isReady = std::all_of(pending.dependencies.begin(), pending.dependencies.end(),
+            [](const SubmissionHandle& dependency) { return dependency->IsSubmitted(); });
+        if (!isReady)
+            continue;
+
+        const double virtualTime = double(pending.client->executedCommandLists) / pending.client->weight;
+        if (!selected || virtualTime < selectedVirtualTime)
+        {
+            selected = i;
+            selectedVirtualTime = virtualTime;
+        }
+    }
+    return selected;
+}
+
+void SharedQueuesScheduler::NotifyCompleted(Queue& queue)
+{
+    const UINT64 completedValue = queue.fence->GetCompletedValue();
+    while (!queue.inFlight.empty() && queue.inFlight.front().fenceValue <= completedValue)
+    {
+        SetEvent(queue.inFlight.front().client->completedEvent.Get());
+        queue.inFlight.pop_front();
+    }
+}
+
+void SharedQueuesScheduler::NotifyFailure(std::exception_ptr error)
+{
+    std::lock_guard lock(m_mutex);
+    m_error = error;
+    for (const auto& queue : m_queues)
+    {
+        for (const auto& weakClient : queue->clients)
+        {
+            if (auto client = weakClient.lock())
+                SetEvent(client->completedEvent.Get());
+        }
+    }
+}
+
+void SharedQueuesScheduler::RethrowFailure() const
+{
+    std::lock_guard lock(m_mutex);
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+std::shared_ptr<IDeviceScheduler> CreateDeviceScheduler(const ComPtr<ID3D12Device>& device,
+    const DeviceSchedulerConfiguration& config)
+{
+    return std::make_shared<SharedQueuesScheduler>(device, config);
+}
+
+}
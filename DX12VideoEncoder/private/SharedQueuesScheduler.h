@@ -0,0 +1,86 @@
+#pragma once
+#include "DeviceScheduler.h"
+#include "CommandSubmitter.h"
+
+namespace DX12VideoEncoding
+{
+
+class SharedQueuesScheduler : public IDeviceScheduler, public std::enable_shared_from_this<SharedQueuesScheduler>
+{
+public:
+    SharedQueuesScheduler(const ComPtr<ID3D12Device>& device, const DeviceSchedulerConfiguration& config);
+    ~SharedQueuesScheduler();
+
+    Statistics GetStatistics() const override;
+
+    ID3D12Device* GetDevice() const { return m_device.Get(); }
+
+    // Submitter of a session, it is bound to the least loaded queue of the given type.
+    std::unique_ptr<ICommandSubmitter> CreateSubmitter(D3D12_COMMAND_LIST_TYPE type, uint32_t priority);
+
+private:
+    class ScheduledCommandSubmitter;
+
+    struct Client
+    {
+        uint64_t weight{ 1 };
+        uint64_t executedCommandLists{};
+        Microsoft::WRL::Wrappers::Event completedEvent;
+    };
+
+    struct PendingSubmission
+    {
+        std::shared_ptr<Client> client;
+        std::vector<ID3D12CommandList*> commandLists;
+        std::vector<SubmissionHandle> dependencies;
+        SubmissionHandle submission;
+    };
+
+    struct InFlightSubmission
+    {
+        std::shared_ptr<Client> client;
+        UINT64 fenceValue{};
+    };
+
+    struct Queue
+    {
+        D3D12_COMMAND_LIST_TYPE type{};
+        ComPtr<ID3D12CommandQueue> commandQueue;
+        ComPtr<ID3D12Fence> fence;
+        UINT64 fenceValue = 0;
+        Microsoft::WRL::Wrappers::Event fenceEvent;
+        std::vector<std::weak_ptr<Client>> clients;
+        std::deque<PendingSubmission> pending;
+        std::deque<InFlightSubmission> inFlight;
+    };
+
+    void CreateQueues(D3D12_COMMAND_LIST_TYPE type, uint32_t count);
+    SubmissionHandle Enqueue(Queue& queue, const std::shared_ptr<Client>& client,
+        const std::vector<ID3D12CommandList*>& commandLists, const std::vector<SubmissionHandle>& dependencies);
+
+    void ThreadProc();
+    DWORD GetWaitTimeout() const;
+    void ExecutePending(Queue& queue);
+    std::optional<size_t> SelectNextPending(const Queue& queue) const;
+    void NotifyCompleted(Queue& queue);
+    void NotifyFailure(std::exception_ptr error);
+    void RethrowFailure() const;
+
+private:
+    const ComPtr<ID3D12Device> m_device;
+    const DeviceSchedulerConfiguration m_config;
+
+    // Copy queues go first so uploads are submitted before the encoding waiting for them.
+    std::vector<std::unique_ptr<Queue>> m_queues;
+
+    mutable std::mutex m_mutex;
+    std::optional<std::chrono::steady_clock::time_point> m_firstPendingTime;
+    Statistics m_statistics;
+    bool m_stopping = false;
+    std::exception_ptr m_error;
+
+    Microsoft::WRL::Wrappers::Event m_wakeEvent;
+    std::thread m_thread;
+};
+
+}
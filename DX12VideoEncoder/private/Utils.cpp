@@ -22,6 +22,16 @@ void ThrowIfFalse(bool condition)
     }
 }
 
+UINT64 GetAllocationSize(ID3D12Device* device, ID3D12Resource* resource)
+{
+    if (resource == nullptr)
+    {
+        return 0;
+    }
+    const D3D12_RESOURCE_DESC desc = resource->GetDesc();
+    return device->GetResourceAllocationInfo(0, 1, &desc).SizeInBytes;
+}
+
 namespace {
 std::mutex g_logMutex;
 LogLevel g_currentLogLevel = LogLevel::E_DEBUG;
@@ -0,0 +1,124 @@
+#include "pch.h"
+#include "WorkerPool.h"
+#include "Utils.h"
+
+
+namespace DX12VideoEncoding {
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = (std::max)(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    for (uint32_t i = 0; i < threadCount; ++i)
+    {
+        m_threads.emplace_back(&WorkerPool::ThreadProc, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_jobAdded.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkerPool::ParallelFor(uint32_t taskCount, const TTask& task)
+{
+    if (taskCount == 0)
+        return;
+
+    if (taskCount == 1 || m_threads.empty())
+    {
+        for (uint32_t i = 0; i < taskCount; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->task = &task;
+    job->taskCount = taskCount;
+    {
+        std::lock_guard lock(m_mutex);
+        m_jobs.push_back(job);
+    }
+    m_jobAdded.notify_all();
+
+    // The calling thread takes part in its own job, so the job is finished even if all threads are busy.
+    while (RunNextTask(*job))
+    {
+    }
+
+    {
+        std::unique_lock lock(m_mutex);
+        m_jobFinished.wait(lock, [&job] { return job->finishedTasks.load() == job->taskCount; });
+    }
+
+    if (job->error)
+        std::rethrow_exception(job->error);
+}
+
+void WorkerPool::ThreadProc()
+{
+    while (true)
+    {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock lock(m_mutex);
+            m_jobAdded.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping)
+                return;
+
+            job = m_jobs.front();
+        }
+
+        if (!RunNextTask(*job))
+        {
+            // All tasks of the job are taken, go to the next job.
+            std::lock_guard lock(m_mutex);
+            if (!m_jobs.empty() && m_jobs.front() == job)
+            {
+                m_jobs.pop_front();
+            }
+        }
+    }
+}
+
+bool WorkerPool::RunNextTask(Job& job)
+{
+    const uint32_t taskIndex = job.nextTask.fetch_add(1);
+    if (taskIndex >= job.taskCount)
+        return false;
+
+    try
+    {
+        (*job.task)(taskIndex);
+    }
+    catch (...)
+    {
+        std::lock_guard lock(m_mutex);
+        if (!job.error)
+            job.error = std::current_exception();
+    }
+
+    if (job.finishedTasks.fetch_add(1) + 1 == job.taskCount)
+    {
+        // Lock to not miss the notification between the predicate check and waiting.
+        std::lock_guard lock(m_mutex);
+        m_jobFinished.notify_all();
+    }
+    return true;
+}
+
+}
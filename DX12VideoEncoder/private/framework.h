@@ -3,18 +3,28 @@
 #define WIN32_LEAN_AND_MEAN
 
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include <iostream>
 #include <exception>
 #include <cassert>
 #include <cmath>
+#include <numeric>
 #include <algorithm>
+#include <array>
 #include <cstdarg>
 #include <vector>
+#include <deque>
+#include <list>
 #include <set>
+#include <map>
 #include <string>
 #include <memory>
 #include <string_view>
 #include <optional>
+#include <fstream>
+#include <filesystem>
 
 #include <Windows.h>
 #include <wrl.h>
@@ -23,6 +33,7 @@
 #include <d3d12.h>
 #include <d3d12video.h>
 #include <dxgi.h>
+#include <dxgi1_4.h>
 
 
 void debug_printf(const char* format, ...);
@@ -156,6 +156,7 @@ d3d12_video_bitstream_builder_h264::build_sps(const D3D12_VIDEO_ENCODER_PROFILE_
                                               uint32_t                                    max_num_ref_frames,
                                               D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC sequenceTargetResolution,
                                               D3D12_BOX                                   frame_cropping_codec_config,
+                                              const H264_VUI &                            vui,
                                               std::vector<uint8_t> &                      headerBitstream,
                                               std::vector<uint8_t>::iterator              placingPositionStart,
                                               size_t &                                    writtenBytes)
@@ -223,7 +224,11 @@ d3d12_video_bitstream_builder_h264::build_sps(const D3D12_VIDEO_ENCODER_PROFILE_
                              frame_cropping_codec_config.left,
                              frame_cropping_codec_config.right,
                              frame_cropping_codec_config.top,
-                             frame_cropping_codec_config.bottom };
+                             frame_cropping_codec_config.bottom,
+                             vui.aspect_ratio_info_present_flag || vui.video_signal_type_present_flag
+                                || vui.timing_info_present_flag || vui.pic_struct_present_flag
+                                || vui.bitstream_restriction_flag,   // vui_parameters_present_flag
+                             vui };
 
    // Print built PPS structure
    debug_printf(
@@ -250,6 +255,47 @@ d3d12_video_bitstream_builder_h264::write_end_of_sequence_nalu(std::vector<uint8
    m_h264Encoder.write_end_of_sequence_nalu(headerBitstream, placingPositionStart, writtenBytes);
 }
 
+void
+d3d12_video_bitstream_builder_h264::write_recovery_point_sei(const H264_SEI_RECOVERY_POINT & recoveryPoint,
+                                                             std::vector<uint8_t> &          headerBitstream,
+                                                             std::vector<uint8_t>::iterator  placingPositionStart,
+                                                             size_t &                        writtenBytes)
+{
+   H264_SEI_RECOVERY_POINT recoveryPointSEI = recoveryPoint;
+   m_h264Encoder.recovery_point_sei_to_nalu_bytes(&recoveryPointSEI, headerBitstream, placingPositionStart, writtenBytes);
+}
+
+void
+d3d12_video_bitstream_builder_h264::write_pic_timing_sei(const H264_SEI_PIC_TIMING &    picTiming,
+                                                         std::vector<uint8_t> &         headerBitstream,
+                                                         std::vector<uint8_t>::iterator placingPositionStart,
+                                                         size_t &                       writtenBytes)
+{
+   H264_SEI_PIC_TIMING picTimingSEI = picTiming;
+   m_h264Encoder.pic_timing_sei_to_nalu_bytes(&picTimingSEI, headerBitstream, placingPositionStart, writtenBytes);
+}
+
+void
+d3d12_video_bitstream_builder_h264::write_user_data_unregistered_sei(const H264_SEI_USER_DATA_UNREGISTERED &userData,
+                                                                     std::vector<uint8_t> &                 headerBitstream,
+                                                                     std::vector<uint8_t>::iterator         placingPositionStart,
+                                                                     size_t &                               writtenBytes)
+{
+   H264_SEI_USER_DATA_UNREGISTERED userDataSEI = userData;
+   m_h264Encoder.user_data_unregistered_sei_to_nalu_bytes(&userDataSEI, headerBitstream, placingPositionStart,
+                                                          writtenBytes);
+}
+
+void
+d3d12_video_bitstream_builder_h264::write_prefix_nalu(const H264_PREFIX_NALU &       prefix,
+                                                      std::vector<uint8_t> &         headerBitstream,
+                                                      std::vector<uint8_t>::iterator placingPositionStart,
+                                                      size_t &                       writtenBytes)
+{
+   H264_PREFIX_NALU prefixNalu = prefix;
+   m_h264Encoder.prefix_to_nalu_bytes(&prefixNalu, headerBitstream, placingPositionStart, writtenBytes);
+}
+
 void
 d3d12_video_bitstream_builder_h264::build_pps(const D3D12_VIDEO_ENCODER_PROFILE_H264 &                   profile,
                                               const D3D12_VIDEO_ENCODER_CODEC_CONFIGURATION_H264 &       codecConfig,
@@ -328,7 +374,7 @@ d3d12_video_bitstream_builder_h264::print_sps(const H264_SPS &sps)
 
    static_assert(sizeof(H264_SPS) ==
                  (sizeof(uint32_t) *
-                  19), "Update the number of uint32_t in struct in assert and add case below if structure changes");
+                  39), "Update the number of uint32_t in struct in assert and add case below if structure changes");
 
    // Declared fields from definition in d3d12_video_encoder_bitstream_builder_h264.h
 
@@ -352,6 +398,26 @@ d3d12_video_bitstream_builder_h264::print_sps(const H264_SPS &sps)
    debug_printf("frame_cropping_rect_right_offset: %d\n", sps.frame_cropping_rect_right_offset);
    debug_printf("frame_cropping_rect_top_offset: %d\n", sps.frame_cropping_rect_top_offset);
    debug_printf("frame_cropping_rect_bottom_offset: %d\n", sps.frame_cropping_rect_bottom_offset);
+   debug_printf("vui_parameters_present_flag: %d\n", sps.vui_parameters_present_flag);
+   debug_printf("vui.aspect_ratio_info_present_flag: %d\n", sps.vui.aspect_ratio_info_present_flag);
+   debug_printf("vui.aspect_ratio_idc: %d\n", sps.vui.aspect_ratio_idc);
+   debug_printf("vui.sar_width: %d\n", sps.vui.sar_width);
+   debug_printf("vui.sar_height: %d\n", sps.vui.sar_height);
+   debug_printf("vui.video_signal_type_present_flag: %d\n", sps.vui.video_signal_type_present_flag);
+   debug_printf("vui.video_format: %d\n", sps.vui.video_format);
+   debug_printf("vui.video_full_range_flag: %d\n", sps.vui.video_full_range_flag);
+   debug_printf("vui.colour_description_present_flag: %d\n", sps.vui.colour_description_present_flag);
+   debug_printf("vui.colour_primaries: %d\n", sps.vui.colour_primaries);
+   debug_printf("vui.transfer_characteristics: %d\n", sps.vui.transfer_characteristics);
+   debug_printf("vui.matrix_coefficients: %d\n", sps.vui.matrix_coefficients);
+   debug_printf("vui.timing_info_present_flag: %d\n", sps.vui.timing_info_present_flag);
+   debug_printf("vui.num_units_in_tick: %d\n", sps.vui.num_units_in_tick);
+   debug_printf("vui.time_scale: %d\n", sps.vui.time_scale);
+   debug_printf("vui.fixed_frame_rate_flag: %d\n", sps.vui.fixed_frame_rate_flag);
+   debug_printf("vui.pic_struct_present_flag: %d\n", sps.vui.pic_struct_present_flag);
+   debug_printf("vui.bitstream_restriction_flag: %d\n", sps.vui.bitstream_restriction_flag);
+   debug_printf("vui.max_num_reorder_frames: %d\n", sps.vui.max_num_reorder_frames);
+   debug_printf("vui.max_dec_frame_buffering: %d\n", sps.vui.max_dec_frame_buffering);
    debug_printf(
       "[D3D12 d3d12_video_bitstream_builder_h264] H264_SPS values end\n--------------------------------------\n");
 }
@@ -43,6 +43,7 @@ class d3d12_video_bitstream_builder_h264 : public d3d12_video_bitstream_builder_
                   uint32_t                                               max_num_ref_frames,
                   D3D12_VIDEO_ENCODER_PICTURE_RESOLUTION_DESC            sequenceTargetResolution,
                   D3D12_BOX                                              frame_cropping_codec_config,
+                  const H264_VUI &                                       vui,
                   std::vector<uint8_t> &                                 headerBitstream,
                   std::vector<uint8_t>::iterator                         placingPositionStart,
                   size_t &                                               writtenBytes);
@@ -62,6 +63,22 @@ class d3d12_video_bitstream_builder_h264 : public d3d12_video_bitstream_builder_
    void write_end_of_sequence_nalu(std::vector<uint8_t> &         headerBitstream,
                                    std::vector<uint8_t>::iterator placingPositionStart,
                                    size_t &                       writtenBytes);
+   void write_recovery_point_sei(const H264_SEI_RECOVERY_POINT & recoveryPoint,
+                                 std::vector<uint8_t> &          headerBitstream,
+                                 std::vector<uint8_t>::iterator  placingPositionStart,
+                                 size_t &                        writtenBytes);
+   void write_pic_timing_sei(const H264_SEI_PIC_TIMING &    picTiming,
+                             std::vector<uint8_t> &         headerBitstream,
+                             std::vector<uint8_t>::iterator placingPositionStart,
+                             size_t &                       writtenBytes);
+   void write_user_data_unregistered_sei(const H264_SEI_USER_DATA_UNREGISTERED &userData,
+                                         std::vector<uint8_t> &                 headerBitstream,
+                                         std::vector<uint8_t>::iterator         placingPositionStart,
+                                         size_t &                               writtenBytes);
+   void write_prefix_nalu(const H264_PREFIX_NALU &       prefix,
+                          std::vector<uint8_t> &         headerBitstream,
+                          std::vector<uint8_t>::iterator placingPositionStart,
+                          size_t &                       writtenBytes);
 
    void print_pps(const H264_PPS &pps);
    void print_sps(const H264_SPS &sps);
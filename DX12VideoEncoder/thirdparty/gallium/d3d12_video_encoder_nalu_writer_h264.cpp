@@ -39,6 +39,18 @@ d3d12_video_nalu_writer_h264::rbsp_trailing(d3d12_video_encoder_bitstream *pBits
    assert(isAligned);
 }
 
+void
+d3d12_video_nalu_writer_h264::sei_payload_alignment(d3d12_video_encoder_bitstream *pBitstream)
+{
+   int32_t iLeft = pBitstream->get_num_bits_for_byte_align();
+   if (iLeft) {
+      pBitstream->put_bits(1, 1);   // bit_equal_to_one
+      if (iLeft > 1) {
+         pBitstream->put_bits(iLeft - 1, 0);   // bit_equal_to_zero
+      }
+   }
+}
+
 uint32_t
 d3d12_video_nalu_writer_h264::write_sps_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_SPS *pSPS)
 {
@@ -102,8 +114,10 @@ d3d12_video_nalu_writer_h264::write_sps_bytes(d3d12_video_encoder_bitstream *pBi
       pBitstream->exp_Golomb_ue(pSPS->frame_cropping_rect_bottom_offset);
    }
 
-   // We're not including the VUI so this better be zero.
-   pBitstream->put_bits(1, 0);   // vui_paramenters_present_flag
+   pBitstream->put_bits(1, pSPS->vui_parameters_present_flag);
+   if (pSPS->vui_parameters_present_flag) {
+      write_vui_bytes(pBitstream, &pSPS->vui);
+   }
 
    rbsp_trailing(pBitstream);
    pBitstream->flush();
@@ -112,6 +126,54 @@ d3d12_video_nalu_writer_h264::write_sps_bytes(d3d12_video_encoder_bitstream *pBi
    return (uint32_t) iBytesWritten;
 }
 
+void
+d3d12_video_nalu_writer_h264::write_vui_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_VUI *pVUI)
+{
+   pBitstream->put_bits(1, pVUI->aspect_ratio_info_present_flag);
+   if (pVUI->aspect_ratio_info_present_flag) {
+      pBitstream->put_bits(8, pVUI->aspect_ratio_idc);
+      if (pVUI->aspect_ratio_idc == 255) {   // Extended_SAR
+         assert(pVUI->sar_width < 65536 && pVUI->sar_height < 65536);
+         pBitstream->put_bits(16, pVUI->sar_width);
+         pBitstream->put_bits(16, pVUI->sar_height);
+      }
+   }
+   pBitstream->put_bits(1, 0);   // overscan_info_present_flag
+   pBitstream->put_bits(1, pVUI->video_signal_type_present_flag);
+   if (pVUI->video_signal_type_present_flag) {
+      pBitstream->put_bits(3, pVUI->video_format);
+      pBitstream->put_bits(1, pVUI->video_full_range_flag);
+      pBitstream->put_bits(1, pVUI->colour_description_present_flag);
+      if (pVUI->colour_description_present_flag) {
+         pBitstream->put_bits(8, pVUI->colour_primaries);
+         pBitstream->put_bits(8, pVUI->transfer_characteristics);
+         pBitstream->put_bits(8, pVUI->matrix_coefficients);
+      }
+   }
+   pBitstream->put_bits(1, 0);   // chroma_loc_info_present_flag
+   pBitstream->put_bits(1, pVUI->timing_info_present_flag);
+   if (pVUI->timing_info_present_flag) {
+      pBitstream->put_bits(32, pVUI->num_units_in_tick);
+      pBitstream->put_bits(32, pVUI->time_scale);
+      pBitstream->put_bits(1, pVUI->fixed_frame_rate_flag);
+   }
+   pBitstream->put_bits(1, 0);   // nal_hrd_parameters_present_flag
+   pBitstream->put_bits(1, 0);   // vcl_hrd_parameters_present_flag
+   pBitstream->put_bits(1, pVUI->pic_struct_present_flag);
+
+   pBitstream->put_bits(1, pVUI->bitstream_restriction_flag);
+   if (pVUI->bitstream_restriction_flag) {
+      // Values other than the reordering ones are the defaults inferred when the restriction is absent.
+      pBitstream->put_bits(1, 1);          // motion_vectors_over_pic_boundaries_flag
+      pBitstream->exp_Golomb_ue(2);        // max_bytes_per_pic_denom
+      pBitstream->exp_Golomb_ue(1);        // max_bits_per_mb_denom
+      pBitstream->exp_Golomb_ue(16);       // log2_max_mv_length_horizontal
+      pBitstream->exp_Golomb_ue(16);       // log2_max_mv_length_vertical
+      pBitstream->exp_Golomb_ue(pVUI->max_num_reorder_frames);
+      pBitstream->exp_Golomb_ue(pVUI->max_dec_frame_buffering);
+   }
+}
+
 uint32_t
 d3d12_video_nalu_writer_h264::write_pps_bytes(d3d12_video_encoder_bitstream *pBitstream,
                                               H264_PPS *                     pPPS,
@@ -158,6 +220,127 @@ d3d12_video_nalu_writer_h264::write_pps_bytes(d3d12_video_encoder_bitstream *pBi
    return (uint32_t) iBytesWritten;
 }
 
+uint32_t
+d3d12_video_nalu_writer_h264::write_prefix_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_PREFIX_NALU *pPrefix)
+{
+   int32_t iBytesWritten = pBitstream->get_byte_count();
+
+   assert(pPrefix->temporal_id < 8);
+
+   // nal_unit_header_svc_extension, the only layer is the base one
+   pBitstream->put_bits(1, 1);   // svc_extension_flag
+   pBitstream->put_bits(1, pPrefix->idr_flag);
+   pBitstream->put_bits(6, 0);   // priority_id
+   pBitstream->put_bits(1, 1);   // no_inter_layer_pred_flag
+   pBitstream->put_bits(3, 0);   // dependency_id
+   pBitstream->put_bits(4, 0);   // quality_id
+   pBitstream->put_bits(3, pPrefix->temporal_id);
+   pBitstream->put_bits(1, 0);   // use_ref_base_pic_flag
+   pBitstream->put_bits(1, 0);   // discardable_flag
+   pBitstream->put_bits(1, 1);   // output_flag
+   pBitstream->put_bits(2, 3);   // reserved_three_2bits
+
+   // prefix_nal_unit_svc, empty for non-reference slices
+   if (pPrefix->nal_ref_idc != 0) {
+      pBitstream->put_bits(1, 0);   // store_ref_base_pic_flag
+      pBitstream->put_bits(1, 0);   // additional_prefix_nal_unit_extension_flag
+      rbsp_trailing(pBitstream);
+   }
+   pBitstream->flush();
+
+   iBytesWritten = pBitstream->get_byte_count() - iBytesWritten;
+   return (uint32_t) iBytesWritten;
+}
+
+void
+d3d12_video_nalu_writer_h264::write_recovery_point_payload_bytes(d3d12_video_encoder_bitstream *pBitstream,
+                                                                 H264_SEI_RECOVERY_POINT *      pRecoveryPoint)
+{
+   pBitstream->exp_Golomb_ue(pRecoveryPoint->recovery_frame_cnt);
+   pBitstream->put_bits(1, pRecoveryPoint->exact_match_flag);
+   pBitstream->put_bits(1, pRecoveryPoint->broken_link_flag);
+   pBitstream->put_bits(2, 0);   // changing_slice_group_idc
+   sei_payload_alignment(pBitstream);
+   pBitstream->flush();
+}
+
+void
+d3d12_video_nalu_writer_h264::write_pic_timing_payload_bytes(d3d12_video_encoder_bitstream *pBitstream,
+                                                             H264_SEI_PIC_TIMING *          pPicTiming)
+{
+   // NumClockTS of each pic_struct, Table D-1
+   static const uint32_t numClockTS[] = { 1, 1, 1, 2, 2, 3, 3, 2, 3 };
+
+   assert(pPicTiming->pic_struct < 9);
+   assert(pPicTiming->ct_type < 4);
+   assert(pPicTiming->counting_type < 7);
+   assert(pPicTiming->n_frames < 256);
+   assert(pPicTiming->seconds_value < 60);
+   assert(pPicTiming->minutes_value < 60);
+   assert(pPicTiming->hours_value < 24);
+
+   // No cpb_removal_delay and dpb_output_delay without HRD parameters
+   pBitstream->put_bits(4, pPicTiming->pic_struct);
+   for (uint32_t i = 0; i < numClockTS[pPicTiming->pic_struct]; i++) {
+      pBitstream->put_bits(1, i == 0 ? 1 : 0);   // clock_timestamp_flag
+      if (i == 0) {
+         pBitstream->put_bits(2, pPicTiming->ct_type);
+         pBitstream->put_bits(1, pPicTiming->nuit_field_based_flag);
+         pBitstream->put_bits(5, pPicTiming->counting_type);
+         pBitstream->put_bits(1, 1);   // full_timestamp_flag
+         pBitstream->put_bits(1, 0);   // discontinuity_flag
+         pBitstream->put_bits(1, 0);   // cnt_dropped_flag
+         pBitstream->put_bits(8, pPicTiming->n_frames);
+         pBitstream->put_bits(6, pPicTiming->seconds_value);
+         pBitstream->put_bits(6, pPicTiming->minutes_value);
+         pBitstream->put_bits(5, pPicTiming->hours_value);
+         pBitstream->put_bits(24, static_cast<uint32_t>(pPicTiming->time_offset) & 0xffffff);
+      }
+   }
+   sei_payload_alignment(pBitstream);
+   pBitstream->flush();
+}
+
+void
+d3d12_video_nalu_writer_h264::write_user_data_unregistered_payload_bytes(d3d12_video_encoder_bitstream *   pBitstream,
+                                                                         H264_SEI_USER_DATA_UNREGISTERED *pUserData)
+{
+   assert(sizeof(pUserData->uuid_iso_iec_11578) + pUserData->user_data_payload_byte.size() <= MAX_COMPRESSED_SEI);
+
+   for (uint8_t byte : pUserData->uuid_iso_iec_11578) {
+      pBitstream->put_bits(8, byte);
+   }
+   for (uint8_t byte : pUserData->user_data_payload_byte) {
+      pBitstream->put_bits(8, byte);
+   }
+   pBitstream->flush();
+}
+
+void
+d3d12_video_nalu_writer_h264::write_sei_message_bytes(d3d12_video_encoder_bitstream *pBitstream,
+                                                      uint32_t                       payloadType,
+                                                      d3d12_video_encoder_bitstream *pPayload)
+{
+   bool isAligned = pPayload->is_byte_aligned();   // causes side-effects in object state, don't put inside assert()
+   assert(isAligned);
+   pPayload->flush();
+
+   uint32_t payloadSize = pPayload->get_byte_count();
+   for (; payloadType >= 255; payloadType -= 255) {
+      pBitstream->put_bits(8, 0xff);
+   }
+   pBitstream->put_bits(8, payloadType);
+   for (uint32_t size = payloadSize; size >= 255; size -= 255) {
+      pBitstream->put_bits(8, 0xff);
+   }
+   pBitstream->put_bits(8, payloadSize % 255);
+
+   uint8_t *pBuffer = pPayload->get_bitstream_buffer();
+   for (uint32_t i = 0; i < payloadSize; i++) {
+      pBitstream->put_bits(8, pBuffer[i]);
+   }
+}
+
 uint32_t
 d3d12_video_nalu_writer_h264::wrap_sps_nalu(d3d12_video_encoder_bitstream *pNALU, d3d12_video_encoder_bitstream *pRBSP)
 {
@@ -399,3 +582,137 @@ d3d12_video_nalu_writer_h264::write_end_of_sequence_nalu(std::vector<uint8_t> &
 
    writtenBytes = naluByteSize;
 }
+
+void
+d3d12_video_nalu_writer_h264::prefix_to_nalu_bytes(H264_PREFIX_NALU *             pPrefix,
+                                                   std::vector<uint8_t> &         headerBitstream,
+                                                   std::vector<uint8_t>::iterator placingPositionStart,
+                                                   size_t &                       writtenBytes)
+{
+   d3d12_video_encoder_bitstream rbsp, nalu;
+   if (!rbsp.create_bitstream(8)) {
+      debug_printf("rbsp.create_bitstream(8) failed.\n");
+      assert(false);
+   }
+
+   if (!nalu.create_bitstream(16)) {
+      debug_printf("nalu.create_bitstream(16) failed.\n");
+      assert(false);
+   }
+
+   rbsp.set_start_code_prevention(TRUE);
+   if (write_prefix_bytes(&rbsp, pPrefix) <= 0u) {
+      debug_printf("write_prefix_bytes(&rbsp, pPrefix) didn't write any bytes.\n");
+      assert(false);
+   }
+
+   if (wrap_rbsp_into_nalu(&nalu, &rbsp, pPrefix->nal_ref_idc, NAL_TYPE_PREFIX) <= 0u) {
+      debug_printf("wrap_rbsp_into_nalu(&nalu, &rbsp, pPrefix->nal_ref_idc, NAL_TYPE_PREFIX) didn't write any bytes.\n");
+      assert(false);
+   }
+
+   // Deep copy nalu into headerBitstream, nalu gets out of scope here and its destructor frees the nalu object buffer
+   // memory.
+   uint8_t *naluBytes    = nalu.get_bitstream_buffer();
+   size_t   naluByteSize = nalu.get_byte_count();
+
+   auto startDstIndex = std::distance(headerBitstream.begin(), placingPositionStart);
+   if (headerBitstream.size() < (startDstIndex + naluByteSize)) {
+      headerBitstream.resize(startDstIndex + naluByteSize);
+   }
+
+   std::copy_n(&naluBytes[0], naluByteSize, &headerBitstream.data()[startDstIndex]);
+
+   writtenBytes = naluByteSize;
+}
+
+void
+d3d12_video_nalu_writer_h264::recovery_point_sei_to_nalu_bytes(H264_SEI_RECOVERY_POINT *      pRecoveryPoint,
+                                                               std::vector<uint8_t> &         headerBitstream,
+                                                               std::vector<uint8_t>::iterator placingPositionStart,
+                                                               size_t &                       writtenBytes)
+{
+   d3d12_video_encoder_bitstream payload;
+   if (!payload.create_bitstream(MAX_COMPRESSED_SEI)) {
+      debug_printf("payload.create_bitstream(MAX_COMPRESSED_SEI) failed.\n");
+      assert(false);
+   }
+
+   write_recovery_point_payload_bytes(&payload, pRecoveryPoint);
+   sei_to_nalu_bytes(SEI_TYPE_RECOVERY_POINT, &payload, headerBitstream, placingPositionStart, writtenBytes);
+}
+
+void
+d3d12_video_nalu_writer_h264::pic_timing_sei_to_nalu_bytes(H264_SEI_PIC_TIMING *          pPicTiming,
+                                                           std::vector<uint8_t> &         headerBitstream,
+                                                           std::vector<uint8_t>::iterator placingPositionStart,
+                                                           size_t &                       writtenBytes)
+{
+   d3d12_video_encoder_bitstream payload;
+   if (!payload.create_bitstream(MAX_COMPRESSED_SEI)) {
+      debug_printf("payload.create_bitstream(MAX_COMPRESSED_SEI) failed.\n");
+      assert(false);
+   }
+
+   write_pic_timing_payload_bytes(&payload, pPicTiming);
+   sei_to_nalu_bytes(SEI_TYPE_PIC_TIMING, &payload, headerBitstream, placingPositionStart, writtenBytes);
+}
+
+void
+d3d12_video_nalu_writer_h264::user_data_unregistered_sei_to_nalu_bytes(H264_SEI_USER_DATA_UNREGISTERED *pUserData,
+                                                                       std::vector<uint8_t> &           headerBitstream,
+                                                                       std::vector<uint8_t>::iterator   placingPositionStart,
+                                                                       size_t &                         writtenBytes)
+{
+   d3d12_video_encoder_bitstream payload;
+   if (!payload.create_bitstream(MAX_COMPRESSED_SEI)) {
+      debug_printf("payload.create_bitstream(MAX_COMPRESSED_SEI) failed.\n");
+      assert(false);
+   }
+
+   write_user_data_unregistered_payload_bytes(&payload, pUserData);
+   sei_to_nalu_bytes(SEI_TYPE_USER_DATA_UNREGISTERED, &payload, headerBitstream, placingPositionStart, writtenBytes);
+}
+
+void
+d3d12_video_nalu_writer_h264::sei_to_nalu_bytes(uint32_t                       payloadType,
+                                                d3d12_video_encoder_bitstream *pPayload,
+                                                std::vector<uint8_t> &         headerBitstream,
+                                                std::vector<uint8_t>::iterator placingPositionStart,
+                                                size_t &                       writtenBytes)
+{
+   d3d12_video_encoder_bitstream rbsp, nalu;
+   if (!rbsp.create_bitstream(MAX_COMPRESSED_SEI)) {
+      debug_printf("rbsp.create_bitstream(MAX_COMPRESSED_SEI) failed.\n");
+      assert(false);
+   }
+
+   if (!nalu.create_bitstream(2 * MAX_COMPRESSED_SEI)) {
+      debug_printf("nalu.create_bitstream(2 * MAX_COMPRESSED_SEI) failed.\n");
+      assert(false);
+   }
+
+   rbsp.set_start_code_prevention(TRUE);
+   write_sei_message_bytes(&rbsp, payloadType, pPayload);
+   rbsp_trailing(&rbsp);
+   rbsp.flush();
+
+   if (wrap_rbsp_into_nalu(&nalu, &rbsp, NAL_REFIDC_NONREF, NAL_TYPE_SEI) <= 0u) {
+      debug_printf("wrap_rbsp_into_nalu(&nalu, &rbsp, NAL_REFIDC_NONREF, NAL_TYPE_SEI) didn't write any bytes.\n");
+      assert(false);
+   }
+
+   // Deep copy nalu into headerBitstream, nalu gets out of scope here and its destructor frees the nalu object buffer
+   // memory.
+   uint8_t *naluBytes    = nalu.get_bitstream_buffer();
+   size_t   naluByteSize = nalu.get_byte_count();
+
+   auto startDstIndex = std::distance(headerBitstream.begin(), placingPositionStart);
+   if (headerBitstream.size() < (startDstIndex + naluByteSize)) {
+      headerBitstream.resize(startDstIndex + naluByteSize);
+   }
+
+   std::copy_n(&naluBytes[0], naluByteSize, &headerBitstream.data()[startDstIndex]);
+
+   writtenBytes = naluByteSize;
+}
@@ -55,6 +55,29 @@ enum H264_NALU_TYPE
    /* 24...31 UNSPECIFIED */
 };
 
+struct H264_VUI
+{
+   uint32_t aspect_ratio_info_present_flag;
+   uint32_t aspect_ratio_idc;
+   uint32_t sar_width;
+   uint32_t sar_height;
+   uint32_t video_signal_type_present_flag;
+   uint32_t video_format;
+   uint32_t video_full_range_flag;
+   uint32_t colour_description_present_flag;
+   uint32_t colour_primaries;
+   uint32_t transfer_characteristics;
+   uint32_t matrix_coefficients;
+   uint32_t timing_info_present_flag;
+   uint32_t num_units_in_tick;
+   uint32_t time_scale;
+   uint32_t fixed_frame_rate_flag;
+   uint32_t pic_struct_present_flag;
+   uint32_t bitstream_restriction_flag;
+   uint32_t max_num_reorder_frames;
+   uint32_t max_dec_frame_buffering;
+};
+
 struct H264_SPS
 {
    uint32_t profile_idc;
@@ -76,6 +99,8 @@ struct H264_SPS
    uint32_t frame_cropping_rect_right_offset;
    uint32_t frame_cropping_rect_top_offset;
    uint32_t frame_cropping_rect_bottom_offset;
+   uint32_t vui_parameters_present_flag;
+   H264_VUI vui;
 };
 
 struct H264_PPS
@@ -90,6 +115,50 @@ struct H264_PPS
    uint32_t transform_8x8_mode_flag;
 };
 
+// SVC extension of the prefix NAL unit preceding each slice of the base layer (H.264 Annex G)
+struct H264_PREFIX_NALU
+{
+   uint32_t nal_ref_idc;   // Of the following slice
+   uint32_t idr_flag;
+   uint32_t temporal_id;
+};
+
+enum H264_SEI_PAYLOAD_TYPE
+{
+   SEI_TYPE_PIC_TIMING             = 1,
+   SEI_TYPE_USER_DATA_UNREGISTERED = 5,
+   SEI_TYPE_RECOVERY_POINT         = 6,
+};
+
+// Picture timing without HRD parameters, requires pic_struct_present_flag in VUI. The full clock timestamp is
+// given for the first field or frame of pic_struct only.
+struct H264_SEI_PIC_TIMING
+{
+   uint32_t pic_struct;
+   uint32_t ct_type;
+   uint32_t nuit_field_based_flag;
+   uint32_t counting_type;
+   uint32_t n_frames;
+   uint32_t seconds_value;
+   uint32_t minutes_value;
+   uint32_t hours_value;
+   int32_t  time_offset;   // time_offset_length is inferred to be 24 without HRD parameters
+};
+
+struct H264_SEI_USER_DATA_UNREGISTERED
+{
+   uint8_t              uuid_iso_iec_11578[16];
+   std::vector<uint8_t> user_data_payload_byte;
+};
+
+// Decoding starting at the frame gives correct pictures after recovery_frame_cnt more frames
+struct H264_SEI_RECOVERY_POINT
+{
+   uint32_t recovery_frame_cnt;
+   uint32_t exact_match_flag;
+   uint32_t broken_link_flag;
+};
+
 enum H264_SPEC_PROFILES
 {
    H264_PROFILE_MAIN   = 77,
@@ -99,6 +168,7 @@ enum H264_SPEC_PROFILES
 
 #define MAX_COMPRESSED_PPS 256
 #define MAX_COMPRESSED_SPS 256
+#define MAX_COMPRESSED_SEI 256
 
 class d3d12_video_nalu_writer_h264
 {
@@ -130,10 +200,51 @@ class d3d12_video_nalu_writer_h264
                                    std::vector<uint8_t>::iterator placingPositionStart,
                                    size_t &                       writtenBytes);
 
+   // Writes the recovery point SEI message in its own SEI NALU into a bitstream passed in headerBitstream
+   void recovery_point_sei_to_nalu_bytes(H264_SEI_RECOVERY_POINT *      pRecoveryPoint,
+                                         std::vector<uint8_t> &         headerBitstream,
+                                         std::vector<uint8_t>::iterator placingPositionStart,
+                                         size_t &                       writtenBytes);
+
+   // Writes the picture timing SEI message in its own SEI NALU into a bitstream passed in headerBitstream
+   void pic_timing_sei_to_nalu_bytes(H264_SEI_PIC_TIMING *          pPicTiming,
+                                     std::vector<uint8_t> &         headerBitstream,
+                                     std::vector<uint8_t>::iterator placingPositionStart,
+                                     size_t &                       writtenBytes);
+
+   // Writes the user data unregistered SEI message in its own SEI NALU into a bitstream passed in headerBitstream
+   void user_data_unregistered_sei_to_nalu_bytes(H264_SEI_USER_DATA_UNREGISTERED *pUserData,
+                                                 std::vector<uint8_t> &           headerBitstream,
+                                                 std::vector<uint8_t>::iterator   placingPositionStart,
+                                                 size_t &                         writtenBytes);
+
+   // Writes the prefix NAL unit of a slice into a bitstream passed in headerBitstream
+   void prefix_to_nalu_bytes(H264_PREFIX_NALU *             pPrefix,
+                             std::vector<uint8_t> &         headerBitstream,
+                             std::vector<uint8_t>::iterator placingPositionStart,
+                             size_t &                       writtenBytes);
+
  private:
    // Writes from structure into bitstream with RBSP trailing but WITHOUT NAL unit wrap (eg. nal_idc_type, etc)
    uint32_t write_sps_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_SPS *pSPS);
+   void     write_vui_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_VUI *pVUI);
    uint32_t write_pps_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_PPS *pPPS, BOOL bIsFREXTProfile);
+   uint32_t write_prefix_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_PREFIX_NALU *pPrefix);
+   void     write_recovery_point_payload_bytes(d3d12_video_encoder_bitstream *pBitstream,
+                                               H264_SEI_RECOVERY_POINT *      pRecoveryPoint);
+   void     write_pic_timing_payload_bytes(d3d12_video_encoder_bitstream *pBitstream, H264_SEI_PIC_TIMING *pPicTiming);
+   void     write_user_data_unregistered_payload_bytes(d3d12_video_encoder_bitstream *   pBitstream,
+                                                       H264_SEI_USER_DATA_UNREGISTERED *pUserData);
+   // Writes sei_message with the header and the byte aligned payload
+   void     write_sei_message_bytes(d3d12_video_encoder_bitstream *pBitstream,
+                                    uint32_t                       payloadType,
+                                    d3d12_video_encoder_bitstream *pPayload);
+   // Wraps the sei_message with the payload into an SEI NALU placed into headerBitstream
+   void     sei_to_nalu_bytes(uint32_t                       payloadType,
+                              d3d12_video_encoder_bitstream *pPayload,
+                              std::vector<uint8_t> &         headerBitstream,
+                              std::vector<uint8_t>::iterator placingPositionStart,
+                              size_t &                       writtenBytes);
 
    // Adds NALU wrapping into structures and ending NALU control bits
    uint32_t wrap_sps_nalu(d3d12_video_encoder_bitstream *pNALU, d3d12_video_encoder_bitstream *pRBSP);
@@ -142,6 +253,7 @@ class d3d12_video_nalu_writer_h264
    // Helpers
    void     write_nalu_end(d3d12_video_encoder_bitstream *pNALU);
    void     rbsp_trailing(d3d12_video_encoder_bitstream *pBitstream);
+   void     sei_payload_alignment(d3d12_video_encoder_bitstream *pBitstream);
    uint32_t wrap_rbsp_into_nalu(d3d12_video_encoder_bitstream *pNALU,
                                 d3d12_video_encoder_bitstream *pRBSP,
                                 uint32_t                       iNaluIdc,
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal self-registering benchmark runner. Benchmarks print the time of one run of their body, checks
+// of the measured code throw std::exception to fail the benchmark.
+namespace DX12VideoEncoding::Benchmarks
+{
+
+struct BenchmarkCase
+{
+    const char* name;
+    void (*function)();
+};
+
+std::vector<BenchmarkCase>& GetBenchmarkCases();
+
+struct BenchmarkRegistration
+{
+    BenchmarkRegistration(const char* name, void (*function)())
+    {
+        GetBenchmarkCases().push_back(BenchmarkCase{ name, function });
+    }
+};
+
+// Runs the body once to warm up caches and then the given number of times, prints the median and the best
+// time of one run.
+void Measure(const std::string& label, const std::function<void()>& body, uint32_t runCount = 30);
+
+}
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static const ::DX12VideoEncoding::Benchmarks::BenchmarkRegistration name##Registration(#name, &name); \
+    static void name()
@@ -0,0 +1,63 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+
+namespace DX12VideoEncoding::Benchmarks
+{
+
+std::vector<BenchmarkCase>& GetBenchmarkCases()
+{
+    static std::vector<BenchmarkCase> benchmarkCases;
+    return benchmarkCases;
+}
+
+void Measure(const std::string& label, const std::function<void()>& body, uint32_t runCount)
+{
+    body();
+
+    std::vector<double> runTimes;
+    runTimes.reserve(runCount);
+    for (uint32_t i = 0; i < runCount; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        runTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(runTimes.begin(), runTimes.end());
+
+    std::cout << "  " << std::left << std::setw(48) << label << std::right << std::fixed << std::setprecision(3)
+        << " median " << std::setw(9) << runTimes[runTimes.size() / 2] << " ms"
+        << ", best " << std::setw(9) << runTimes.front() << " ms" << std::endl;
+}
+
+}
+
+// Runs all benchmarks or the ones containing the first argument in the name, returns the number of failed ones.
+int main(int argc, char** argv)
+{
+    using namespace DX12VideoEncoding::Benchmarks;
+
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+    int failedCount = 0;
+    for (const BenchmarkCase& benchmarkCase : GetBenchmarkCases())
+    {
+        if (filter != nullptr && std::strstr(benchmarkCase.name, filter) == nullptr)
+            continue;
+
+        std::cout << benchmarkCase.name << std::endl;
+        try
+        {
+            benchmarkCase.function();
+        }
+        catch (const std::exception& e)
+        {
+            ++failedCount;
+            std::cout << "[  FAILED  ] " << benchmarkCase.name << ": " << e.what() << std::endl;
+        }
+    }
+    return failedCount;
+}
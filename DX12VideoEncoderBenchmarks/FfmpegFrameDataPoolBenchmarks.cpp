@@ -0,0 +1,188 @@
+#include "pch.h"
+#include "FfmpegFrameDataPool.h"
+#include "Utils.h"
+#include "Benchmark.h"
+#include <condition_variable>
+#include <iostream>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+using namespace DX12VideoEncoding;
+using namespace DX12VideoEncoding::Benchmarks;
+
+namespace {
+
+// Operator new calls of the whole process, av_malloc() of FFmpeg is not counted.
+std::atomic<uint64_t> g_allocationCount{};
+
+// Frames the encoder holds between PushFrame() and the encoded output.
+constexpr size_t FramesInFlight = 8;
+constexpr uint32_t WarmUpFrameCount = 1000;
+constexpr uint32_t MeasuredFrameCount = 100000;
+
+class AllocationCounter
+{
+public:
+    AllocationCounter() : m_start(g_allocationCount.load()) {}
+
+    uint64_t GetCount() const { return g_allocationCount.load() - m_start; }
+
+private:
+    uint64_t m_start;
+};
+
+AVFrame* AllocateFrame()
+{
+    AVFrame* frame = av_frame_alloc();
+    ThrowIfFalse(frame != nullptr);
+    frame->format = AV_PIX_FMT_NV12;
+    frame->width = 64;
+    frame->height = 64;
+    ThrowIfFalse(av_frame_get_buffer(frame, 0) >= 0);
+    return frame;
+}
+
+// Frames are released in the order they were created, a few of them are alive at any time.
+template<class TCreate>
+void RunFrames(uint32_t frameCount, const TCreate& create)
+{
+    std::array<std::shared_ptr<FfmpegFrameData>, FramesInFlight> framesInFlight;
+    for (uint32_t i = 0; i < frameCount; ++i)
+    {
+        framesInFlight[i % FramesInFlight] = create();
+    }
+}
+
+void CheckNoAllocations(uint64_t allocationCount, const char* description)
+{
+    std::cout << "  " << description << ": " << allocationCount << " allocations in "
+        << MeasuredFrameCount << " frames" << std::endl;
+    if (allocationCount != 0)
+    {
+        throw std::runtime_error(std::string(description) + " allocated memory in steady state");
+    }
+}
+
+}
+
+void* operator new(size_t size)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = _aligned_malloc(size == 0 ? 1 : size, static_cast<size_t>(alignment)))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+    _aligned_free(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept
+{
+    _aligned_free(pointer);
+}
+
+BENCHMARK(FfmpegFrameDataPoolSteadyState)
+{
+    AVFrame* frame = AllocateFrame();
+    {
+        FfmpegFrameDataPool pool;
+        RunFrames(WarmUpFrameCount, [&] { return pool.Create(*frame); });
+
+        const AllocationCounter counter;
+        RunFrames(MeasuredFrameCount, [&] { return pool.Create(*frame); });
+        CheckNoAllocations(counter.GetCount(), "Pool, released on the creating thread");
+
+        Measure("Pool, 1000 frames", [&] {
+            RunFrames(1000, [&] { return pool.Create(*frame); });
+        });
+        Measure("Without pool, 1000 frames", [&] {
+            RunFrames(1000, [&] { return FfmpegFrameData::Create(*frame); });
+        });
+    }
+    av_frame_free(&frame);
+}
+
+BENCHMARK(FfmpegFrameDataPoolCrossThreadRelease)
+{
+    // The encoder releases the frames on its own thread, they return to the decoder thread's pool.
+    AVFrame* frame = AllocateFrame();
+    {
+        FfmpegFrameDataPool pool;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::array<std::shared_ptr<FfmpegFrameData>, FramesInFlight> queue;
+        size_t head = 0;
+        size_t size = 0;
+        bool finished = false;
+
+        std::thread releasingThread([&] {
+            for (;;)
+            {
+                std::shared_ptr<FfmpegFrameData> frameData;
+                {
+                    std::unique_lock lock(mutex);
+                    condition.wait(lock, [&] { return finished || size > 0; });
+                    if (size == 0)
+                        return;
+                    frameData = std::move(queue[head]);
+                    head = (head + 1) % queue.size();
+                    --size;
+                }
+                condition.notify_all();
+            }
+        });
+
+        auto createFrames = [&](uint32_t frameCount) {
+            for (uint32_t i = 0; i < frameCount; ++i)
+            {
+                std::shared_ptr<FfmpegFrameData> frameData = pool.Create(*frame);
+                std::unique_lock lock(mutex);
+                condition.wait(lock, [&] { return size < queue.size(); });
+                queue[(head + size) % queue.size()] = std::move(frameData);
+                ++size;
+                lock.unlock();
+                condition.notify_all();
+            }
+        };
+
+        createFrames(WarmUpFrameCount);
+        const AllocationCounter counter;
+        createFrames(MeasuredFrameCount);
+        const uint64_t allocationCount = counter.GetCount();
+
+        {
+            std::lock_guard lock(mutex);
+            finished = true;
+        }
+        condition.notify_all();
+        releasingThread.join();
+
+        // Wrappers of the queued frames and the ones held by both threads are allocated during warm-up.
+        ThrowIfFalse(pool.GetAllocatedFrameCount() <= FramesInFlight + 2);
+        CheckNoAllocations(allocationCount, "Pool, released on another thread");
+    }
+    av_frame_free(&frame);
+}
@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "FrameAnalyzer.h"
+#include "Benchmark.h"
+
+using namespace DX12VideoEncoding;
+using namespace DX12VideoEncoding::Benchmarks;
+
+namespace {
+
+struct Resolution
+{
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+};
+
+constexpr Resolution Resolutions[] = {
+    { "1080p", 1920, 1080 },
+    { "4K", 3840, 2160 },
+};
+
+// Smooth texture with detail, the frames of a sequence show it panned by a few samples.
+class PanningFrame
+{
+public:
+    PanningFrame(PixelFormat format, uint32_t width, uint32_t height, int32_t offsetX, int32_t offsetY)
+    {
+        const bool is16Bit = format == PixelFormat::P010;
+        const size_t pitch = width * (is16Bit ? 2 : 1);
+        m_luma.resize(pitch * height);
+        m_chroma.assign(pitch * ((height + 1) / 2), 0x80);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                const double u = static_cast<double>(static_cast<int32_t>(x) + offsetX);
+                const double v = static_cast<double>(static_cast<int32_t>(y) + offsetY);
+                const auto sample = static_cast<uint8_t>(128 + 60 * std::sin(u * 0.02) * std::cos(v * 0.03)
+                    + 30 * std::sin(u * 0.005 + v * 0.007));
+                if (is16Bit)
+                {
+                    const uint16_t sample16 = static_cast<uint16_t>(sample << 8);
+                    memcpy(&m_luma[y * pitch + 2 * x], &sample16, sizeof(sample16));
+                }
+                else
+                {
+                    m_luma[y * pitch + x] = sample;
+                }
+            }
+        }
+
+        m_descriptor.format = format;
+        m_descriptor.width = width;
+        m_descriptor.height = height;
+        m_descriptor.planeCount = 2;
+        m_descriptor.planes[0] = { m_luma.data(), pitch, height };
+        m_descriptor.planes[1] = { m_chroma.data(), pitch, (height + 1) / 2 };
+    }
+
+    const FrameDescriptor& GetDescriptor() const { return m_descriptor; }
+
+private:
+    FrameDescriptor m_descriptor;
+    std::vector<uint8_t> m_luma;
+    std::vector<uint8_t> m_chroma;
+};
+
+void MeasureAnalysis(PixelFormat format, const char* formatName, const Resolution& resolution)
+{
+    const PanningFrame frames[2] = {
+        PanningFrame(format, resolution.width, resolution.height, 0, 0),
+        PanningFrame(format, resolution.width, resolution.height, 12, -5),
+    };
+
+    FrameAnalyzer analyzer;
+    analyzer.Analyze(frames[0].GetDescriptor());
+    const FrameStatistics statistics = analyzer.Analyze(frames[1].GetDescriptor());
+    // The pan is compensated, a regression in the estimation makes the numbers meaningless.
+    if (FrameAnalyzer::IsSceneCut(statistics) || FrameAnalyzer::IsHighMotion(statistics))
+    {
+        throw std::runtime_error(std::string("Pan of ") + formatName + " " + resolution.name
+            + " frames is detected as a scene cut or high motion");
+    }
+
+    size_t frameIndex = 0;
+    Measure(std::string(formatName) + " " + resolution.name + ", one frame", [&] {
+        analyzer.Analyze(frames[frameIndex++ % 2].GetDescriptor());
+    }, 100);
+}
+
+}
+
+BENCHMARK(FrameAnalyzerPerFrame)
+{
+    for (const Resolution& resolution : Resolutions)
+    {
+        MeasureAnalysis(PixelFormat::NV12, "NV12", resolution);
+        MeasureAnalysis(PixelFormat::P010, "P010", resolution);
+    }
+}
@@ -0,0 +1,150 @@
+#include "pch.h"
+#include "PixelFormatConverter.h"
+#include "Utils.h"
+#include "WorkerPool.h"
+#include "Benchmark.h"
+#include <random>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+using namespace DX12VideoEncoding;
+using namespace DX12VideoEncoding::Benchmarks;
+
+namespace {
+
+struct Resolution
+{
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+};
+
+constexpr Resolution Resolutions[] = {
+    { "1080p", 1920, 1080 },
+    { "4K", 3840, 2160 },
+};
+
+struct Conversion
+{
+    const char* name;
+    PixelFormat sourceFormat;
+    AVPixelFormat sourceAVFormat;
+    DXGI_FORMAT destinationFormat;
+    AVPixelFormat destinationAVFormat;
+};
+
+// Decoder outputs converted by the encoder library for the NV12 and P010 encoder inputs.
+constexpr Conversion Conversions[] = {
+    { "YUV420P to NV12", PixelFormat::YUV420P, AV_PIX_FMT_YUV420P, DXGI_FORMAT_NV12, AV_PIX_FMT_NV12 },
+    { "YUVJ420P to NV12", PixelFormat::YUVJ420P, AV_PIX_FMT_YUVJ420P, DXGI_FORMAT_NV12, AV_PIX_FMT_NV12 },
+    { "BGRA to NV12", PixelFormat::BGRA, AV_PIX_FMT_BGRA, DXGI_FORMAT_NV12, AV_PIX_FMT_NV12 },
+    { "P010 to NV12", PixelFormat::P010, AV_PIX_FMT_P010LE, DXGI_FORMAT_NV12, AV_PIX_FMT_NV12 },
+    { "YUV420P10 to P010", PixelFormat::YUV420P10, AV_PIX_FMT_YUV420P10LE, DXGI_FORMAT_P010, AV_PIX_FMT_P010LE },
+};
+
+AVFrame* AllocateFrame(AVPixelFormat format, uint32_t width, uint32_t height)
+{
+    AVFrame* frame = av_frame_alloc();
+    ThrowIfFalse(frame != nullptr);
+    frame->format = format;
+    frame->width = static_cast<int>(width);
+    frame->height = static_cast<int>(height);
+    if (av_frame_get_buffer(frame, 0) < 0)
+    {
+        av_frame_free(&frame);
+        throw std::runtime_error("av_frame_get_buffer() failed");
+    }
+    return frame;
+}
+
+// Random samples, 10-bit formats keep them in their own bits.
+void FillFrame(AVFrame* frame, PixelFormat format, std::mt19937& random)
+{
+    for (uint32_t plane = 0; plane < GetPlaneCount(format); ++plane)
+    {
+        const size_t rowSize = GetPlaneRowSize(format, plane, frame->width);
+        for (uint32_t row = 0; row < GetPlaneHeight(format, plane, frame->height); ++row)
+        {
+            uint8_t* samples = frame->data[plane] + row * frame->linesize[plane];
+            for (size_t i = 0; i + 1 < rowSize; i += 2)
+            {
+                uint16_t sample = static_cast<uint16_t>(random());
+                if (format == PixelFormat::P010)
+                    sample &= 0xFFC0;
+                else if (format == PixelFormat::YUV420P10)
+                    sample &= 0x03FF;
+                memcpy(samples + i, &sample, sizeof(sample));
+            }
+        }
+    }
+}
+
+FrameDescriptor GetDescriptor(const AVFrame* frame, PixelFormat format)
+{
+    FrameDescriptor descriptor;
+    descriptor.format = format;
+    descriptor.width = frame->width;
+    descriptor.height = frame->height;
+    descriptor.planeCount = GetPlaneCount(format);
+    for (uint32_t plane = 0; plane < descriptor.planeCount; ++plane)
+    {
+        descriptor.planes[plane] = { frame->data[plane], static_cast<size_t>(frame->linesize[plane]),
+            GetPlaneHeight(format, plane, frame->height) };
+    }
+    return descriptor;
+}
+
+void MeasureConversion(const Conversion& conversion, const Resolution& resolution, WorkerPool& workerPool)
+{
+    std::mt19937 random(1);
+    AVFrame* source = AllocateFrame(conversion.sourceAVFormat, resolution.width, resolution.height);
+    AVFrame* destination = AllocateFrame(conversion.destinationAVFormat, resolution.width, resolution.height);
+    FillFrame(source, conversion.sourceFormat, random);
+
+    const FrameDescriptor descriptor = GetDescriptor(source, conversion.sourceFormat);
+    const FrameUploadBuffer uploadBuffer = { conversion.destinationFormat,
+        destination->data[0], static_cast<size_t>(destination->linesize[0]),
+        destination->data[1], static_cast<size_t>(destination->linesize[1]) };
+
+    const std::string prefix = std::string(conversion.name) + " " + resolution.name;
+    Measure(prefix + ", scalar", [&] {
+        ConvertImage(descriptor, uploadBuffer, nullptr, ConversionKernels::Scalar);
+    });
+    Measure(prefix + ", SIMD", [&] {
+        ConvertImage(descriptor, uploadBuffer, nullptr, ConversionKernels::Best);
+    });
+    Measure(prefix + ", SIMD, " + std::to_string(workerPool.GetThreadCount() + 1) + " threads", [&] {
+        ConvertImage(descriptor, uploadBuffer, &workerPool, ConversionKernels::Best);
+    });
+
+    // Point sampling is the cheapest setting of swscale, the sizes are equal anyway.
+    SwsContext* swsContext = sws_getContext(resolution.width, resolution.height, conversion.sourceAVFormat,
+        resolution.width, resolution.height, conversion.destinationAVFormat, SWS_POINT, nullptr, nullptr, nullptr);
+    ThrowIfFalse(swsContext != nullptr);
+    Measure(prefix + ", sws_scale", [&] {
+        sws_scale(swsContext, source->data, source->linesize, 0, source->height,
+            destination->data, destination->linesize);
+    });
+    sws_freeContext(swsContext);
+
+    av_frame_free(&destination);
+    av_frame_free(&source);
+}
+
+}
+
+BENCHMARK(PixelFormatConverterVsSwscale)
+{
+    WorkerPool workerPool;
+    for (const Resolution& resolution : Resolutions)
+    {
+        for (const Conversion& conversion : Conversions)
+        {
+            MeasureConversion(conversion, resolution, workerPool);
+        }
+    }
+}
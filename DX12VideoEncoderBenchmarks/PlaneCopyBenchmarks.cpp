@@ -0,0 +1,70 @@
+#include "pch.h"
+#include "PlaneCopy.h"
+#include "Utils.h"
+#include "WorkerPool.h"
+#include "Benchmark.h"
+
+using namespace DX12VideoEncoding;
+using namespace DX12VideoEncoding::Benchmarks;
+
+namespace {
+
+struct Plane
+{
+    const char* name;
+    size_t rowSize;
+    uint32_t rowCount;
+};
+
+// Luma planes of NV12 and P010 frames, chroma ones are half of them.
+constexpr Plane Planes[] = {
+    { "NV12 1080p", 1920, 1080 },
+    { "P010 1080p", 2 * 1920, 1080 },
+    { "NV12 4K", 3840, 2160 },
+    { "P010 4K", 2 * 3840, 2160 },
+};
+
+// Host memory destination, so the numbers show the copy itself rather than the PCIe writes of an upload heap.
+void MeasureCopy(const Plane& plane, WorkerPool& workerPool)
+{
+    // Decoders pad rows to 64 bytes, upload heaps to 256 bytes of the D3D12 texture pitch alignment.
+    const size_t sourcePitch = (plane.rowSize + 63) & ~size_t{ 63 };
+    const size_t destinationPitch = (plane.rowSize + 255) & ~size_t{ 255 };
+    std::vector<uint8_t> source(sourcePitch * plane.rowCount, 0x5A);
+    std::vector<uint8_t> destination((std::max)(sourcePitch, destinationPitch) * plane.rowCount);
+
+    const std::string prefix = plane.name;
+    Measure(prefix + ", memcpy per row", [&] {
+        for (uint32_t row = 0; row < plane.rowCount; ++row)
+        {
+            memcpy(destination.data() + row * destinationPitch, source.data() + row * sourcePitch, plane.rowSize);
+        }
+    });
+    Measure(prefix + ", CopyPlane", [&] {
+        CopyPlane(source.data(), sourcePitch, destination.data(), destinationPitch, plane.rowSize, plane.rowCount);
+    });
+    Measure(prefix + ", CopyPlane, equal pitches", [&] {
+        CopyPlane(source.data(), sourcePitch, destination.data(), sourcePitch, plane.rowSize, plane.rowCount);
+    });
+    Measure(prefix + ", CopyPlane, " + std::to_string(workerPool.GetThreadCount() + 1) + " threads", [&] {
+        CopyPlane(source.data(), sourcePitch, destination.data(), destinationPitch, plane.rowSize, plane.rowCount,
+            &workerPool);
+    });
+
+    for (uint32_t row = 0; row < plane.rowCount; ++row)
+    {
+        ThrowIfFalse(memcmp(destination.data() + row * destinationPitch, source.data() + row * sourcePitch,
+            plane.rowSize) == 0);
+    }
+}
+
+}
+
+BENCHMARK(PlaneCopy)
+{
+    WorkerPool workerPool;
+    for (const Plane& plane : Planes)
+    {
+        MeasureCopy(plane, workerPool);
+    }
+}
@@ -0,0 +1,271 @@
+#include "pch.h"
+#include "EncoderPool.h"
+#include "TestFramework.h"
+
+using namespace DX12VideoEncoding;
+
+namespace {
+
+class FakeEncoder : public IEncoder
+{
+public:
+    explicit FakeEncoder(const EncoderConfiguration& config) : configuration(config) {}
+
+    void PushFrame(const RawFrameData&) override {}
+    bool StartEncodingPushedFrame() override { return false; }
+    bool WaitForEncodedFrame(EncodedFrame&) override { return false; }
+    void Flush() override {}
+    void Terminate() override { ++terminateCount; }
+    EncoderStatistics GetStatistics() const override { return {}; }
+    void RequestKeyFrame() override {}
+    void InvalidateReferences(uint64_t, uint64_t) override {}
+    bool MarkLongTermReference(uint64_t) override { return false; }
+
+    EncoderConfiguration configuration;
+    uint32_t resetCount = 0;
+    uint32_t terminateCount = 0;
+};
+
+// Sessions take as many bytes of memory as the frame has pixels.
+class FakeBackend : public EncoderPool::IBackend
+{
+public:
+    struct Counters
+    {
+        uint32_t created = 0;
+        uint32_t reset = 0;
+        uint32_t destroyed = 0;
+        bool failReset = false;
+    };
+
+    explicit FakeBackend(std::shared_ptr<Counters> counters) : m_counters(std::move(counters)) {}
+
+    std::unique_ptr<IEncoder> CreateEncoder(const EncoderConfiguration& config) override
+    {
+        ++m_counters->created;
+        struct CountedEncoder : FakeEncoder
+        {
+            CountedEncoder(const EncoderConfiguration& config, std::shared_ptr<Counters> counters)
+                : FakeEncoder(config), counters(std::move(counters)) {}
+            ~CountedEncoder() override { ++counters->destroyed; }
+            std::shared_ptr<Counters> counters;
+        };
+        return std::make_unique<CountedEncoder>(config, m_counters);
+    }
+
+    void ResetEncoder(IEncoder& encoder, const EncoderConfiguration& config) override
+    {
+        ++m_counters->reset;
+        if (m_counters->failReset)
+            throw std::runtime_error("Reset failed");
+
+        auto& fakeEncoder = static_cast<FakeEncoder&>(encoder);
+        fakeEncoder.configuration = config;
+        ++fakeEncoder.resetCount;
+    }
+
+    uint64_t GetMemoryUsage(const IEncoder& encoder) const override
+    {
+        const auto& configuration = static_cast<const FakeEncoder&>(encoder).configuration;
+        return uint64_t{ configuration.width } * configuration.height;
+    }
+
+private:
+    std::shared_ptr<Counters> m_counters;
+};
+
+EncoderConfiguration MakeConfiguration(uint32_t width, uint32_t height)
+{
+    EncoderConfiguration config{};
+    config.width = width;
+    config.height = height;
+    config.fps = { 30, 1 };
+    config.maxReferenceFrameCount = 2;
+    return config;
+}
+
+struct PoolFixture
+{
+    explicit PoolFixture(uint64_t memoryBudget)
+        : counters(std::make_shared<FakeBackend::Counters>())
+        , pool(std::make_unique<FakeBackend>(counters), memoryBudget)
+    {
+    }
+
+    std::shared_ptr<FakeBackend::Counters> counters;
+    EncoderPool pool;
+};
+
+}
+
+TEST(EncoderPoolKeyIgnoresSequenceSettings)
+{
+    EncoderConfiguration first = MakeConfiguration(1920, 1080);
+    EncoderConfiguration second = first;
+    second.keyFrameInterval = 60;
+    second.qp = 24;
+    second.fps = { 60, 1 };
+    second.lowLatency = true;
+    CHECK(EncoderPool::Key::FromConfiguration(first) == EncoderPool::Key::FromConfiguration(second));
+}
+
+TEST(EncoderPoolKeyDiffersByResources)
+{
+    const EncoderConfiguration base = MakeConfiguration(1920, 1080);
+    const EncoderPool::Key baseKey = EncoderPool::Key::FromConfiguration(base);
+
+    EncoderConfiguration other = base;
+    other.width = 1280;
+    CHECK(EncoderPool::Key::FromConfiguration(other) != baseKey);
+
+    other = base;
+    other.inputFormat = DXGI_FORMAT_P010;
+    CHECK(EncoderPool::Key::FromConfiguration(other) != baseKey);
+
+    other = base;
+    other.maxReferenceFrameCount = 3;
+    CHECK(EncoderPool::Key::FromConfiguration(other) != baseKey);
+
+    other = base;
+    other.framesPerSubmission = 4;
+    CHECK(EncoderPool::Key::FromConfiguration(other) != baseKey);
+
+    other = base;
+    other.enableCabac = !base.enableCabac;
+    CHECK(EncoderPool::Key::FromConfiguration(other) != baseKey);
+}
+
+TEST(EncoderPoolKeyDirectModesOnlyWithBFrames)
+{
+    // Without B-frames direct prediction is never used, so the flag doesn't split the sessions.
+    EncoderConfiguration withDirect = MakeConfiguration(1920, 1080);
+    withDirect.enableDirectModes = true;
+    EncoderConfiguration withoutDirect = withDirect;
+    withoutDirect.enableDirectModes = false;
+    CHECK(EncoderPool::Key::FromConfiguration(withDirect) == EncoderPool::Key::FromConfiguration(withoutDirect));
+    CHECK(!EncoderPool::Key::FromConfiguration(withDirect).useDirectModes);
+
+    withDirect.bFramesCount = 2;
+    withoutDirect.bFramesCount = 2;
+    CHECK(EncoderPool::Key::FromConfiguration(withDirect) != EncoderPool::Key::FromConfiguration(withoutDirect));
+    CHECK(EncoderPool::Key::FromConfiguration(withDirect).useDirectModes);
+
+    // B-frames alone don't change the key when direct modes are disabled.
+    EncoderConfiguration noBFrames = withoutDirect;
+    noBFrames.bFramesCount = 0;
+    CHECK(EncoderPool::Key::FromConfiguration(noBFrames) == EncoderPool::Key::FromConfiguration(withoutDirect));
+}
+
+TEST(EncoderPoolResetsSessionWithMatchingKey)
+{
+    PoolFixture fixture(UINT64_MAX);
+    EncoderConfiguration config = MakeConfiguration(1920, 1080);
+    IEncoder* firstSession = nullptr;
+    {
+        auto encoder = fixture.pool.Acquire(config);
+        firstSession = encoder.get();
+    }
+    CHECK_EQUAL(1u, static_cast<FakeEncoder*>(firstSession)->terminateCount);
+    CHECK_EQUAL(size_t{ 1 }, fixture.pool.GetIdleSessionCount());
+
+    config.keyFrameInterval = 120;
+    config.qp = 30;
+    auto encoder = fixture.pool.Acquire(config);
+    CHECK(encoder.get() == firstSession);
+    CHECK_EQUAL(1u, fixture.counters->created);
+    CHECK_EQUAL(1u, fixture.counters->reset);
+    CHECK_EQUAL(120u, static_cast<FakeEncoder&>(*encoder).configuration.keyFrameInterval);
+    CHECK_EQUAL(size_t{ 0 }, fixture.pool.GetIdleSessionCount());
+
+    const auto statistics = fixture.pool.GetStatistics();
+    CHECK_EQUAL(uint64_t{ 1 }, statistics.reusedSessions);
+    CHECK_EQUAL(uint64_t{ 1 }, statistics.createdSessions);
+}
+
+TEST(EncoderPoolCreatesSessionForOtherKey)
+{
+    PoolFixture fixture(UINT64_MAX);
+    fixture.pool.Acquire(MakeConfiguration(1920, 1080)).reset();
+
+    auto encoder = fixture.pool.Acquire(MakeConfiguration(1280, 720));
+    CHECK_EQUAL(2u, fixture.counters->created);
+    CHECK_EQUAL(0u, fixture.counters->reset);
+    // The other session stays idle for a later job.
+    CHECK_EQUAL(size_t{ 1 }, fixture.pool.GetIdleSessionCount());
+    CHECK_EQUAL(uint64_t{ 1920 * 1080 + 1280 * 720 }, fixture.pool.GetMemoryUsage());
+}
+
+TEST(EncoderPoolRecreatesSessionIfResetFails)
+{
+    PoolFixture fixture(UINT64_MAX);
+    const EncoderConfiguration config = MakeConfiguration(1920, 1080);
+    fixture.pool.Acquire(config).reset();
+
+    fixture.counters->failReset = true;
+    auto encoder = fixture.pool.Acquire(config);
+    CHECK(encoder != nullptr);
+    CHECK_EQUAL(1u, fixture.counters->reset);
+    CHECK_EQUAL(2u, fixture.counters->created);
+    CHECK_EQUAL(1u, fixture.counters->destroyed);
+    CHECK_EQUAL(size_t{ 0 }, fixture.pool.GetIdleSessionCount());
+    // Memory of the failed session is not counted anymore.
+    CHECK_EQUAL(uint64_t{ 1920 * 1080 }, fixture.pool.GetMemoryUsage());
+}
+
+TEST(EncoderPoolEvictsLeastRecentlyUsedOverBudget)
+{
+    // Room for 3 sessions of 100 bytes.
+    PoolFixture fixture(300);
+    {
+        auto a = fixture.pool.Acquire(MakeConfiguration(100, 1));
+        auto b = fixture.pool.Acquire(MakeConfiguration(50, 2));
+        auto c = fixture.pool.Acquire(MakeConfiguration(25, 4));
+        // Released in the order a, b, c, so a is the least recently used one.
+        a.reset();
+        b.reset();
+        c.reset();
+    }
+    CHECK_EQUAL(size_t{ 3 }, fixture.pool.GetIdleSessionCount());
+    CHECK_EQUAL(uint64_t{ 0 }, fixture.pool.GetStatistics().evictedSessions);
+
+    // The fourth session goes over the budget once it's released: a is evicted.
+    fixture.pool.Acquire(MakeConfiguration(20, 5)).reset();
+    CHECK_EQUAL(uint64_t{ 1 }, fixture.pool.GetStatistics().evictedSessions);
+    CHECK_EQUAL(1u, fixture.counters->destroyed);
+    CHECK_EQUAL(size_t{ 3 }, fixture.pool.GetIdleSessionCount());
+    CHECK_EQUAL(uint64_t{ 300 }, fixture.pool.GetMemoryUsage());
+
+    // b is still pooled and reusing it makes c the least recently used one.
+    fixture.pool.Acquire(MakeConfiguration(50, 2)).reset();
+    CHECK_EQUAL(4u, fixture.counters->created);
+    CHECK_EQUAL(1u, fixture.counters->reset);
+
+    fixture.pool.Acquire(MakeConfiguration(10, 10)).reset();
+    CHECK_EQUAL(uint64_t{ 2 }, fixture.pool.GetStatistics().evictedSessions);
+    CHECK_EQUAL(5u, fixture.counters->created);
+    fixture.pool.Acquire(MakeConfiguration(50, 2)).reset();
+    CHECK_EQUAL(2u, fixture.counters->reset); // b survived
+    fixture.pool.Acquire(MakeConfiguration(25, 4)).reset();
+    CHECK_EQUAL(6u, fixture.counters->created); // c was evicted
+}
+
+TEST(EncoderPoolKeepsActiveSessionsOverBudget)
+{
+    // Acquired sessions are never evicted, only idle ones are.
+    PoolFixture fixture(100);
+    auto a = fixture.pool.Acquire(MakeConfiguration(100, 1));
+    auto b = fixture.pool.Acquire(MakeConfiguration(50, 2));
+    CHECK_EQUAL(uint64_t{ 200 }, fixture.pool.GetMemoryUsage());
+    CHECK_EQUAL(0u, fixture.counters->destroyed);
+
+    // Released over the budget, b is evicted right away.
+    b.reset();
+    CHECK_EQUAL(1u, fixture.counters->destroyed);
+    CHECK_EQUAL(size_t{ 0 }, fixture.pool.GetIdleSessionCount());
+
+    a.reset();
+    CHECK_EQUAL(size_t{ 1 }, fixture.pool.GetIdleSessionCount());
+    fixture.pool.Clear();
+    CHECK_EQUAL(2u, fixture.counters->destroyed);
+    CHECK_EQUAL(uint64_t{ 0 }, fixture.pool.GetMemoryUsage());
+}
@@ -0,0 +1,147 @@
+#include "pch.h"
+#include "GopScheduler.h"
+#include "TestFramework.h"
+
+using namespace DX12VideoEncoding;
+
+namespace {
+
+constexpr auto IdrFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+constexpr auto IFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME;
+constexpr auto PFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+constexpr auto BFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME;
+
+struct ExpectedFrame
+{
+    uint64_t frameOrderNumber;
+    D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType;
+};
+
+// Pushes the frames and pops the queued ones after each push and after the flush, as the encoder starts them.
+void CheckEncodingOrder(const EncoderConfiguration& config, uint64_t frameCount, const std::set<uint64_t>& sceneCuts,
+    const std::vector<ExpectedFrame>& expectedFrames)
+{
+    GopScheduler scheduler(config);
+    std::vector<GopScheduler::Frame> frames;
+    std::vector<bool> reordered;
+    const auto popFrames = [&]
+        {
+            while (auto frame = scheduler.Pop())
+            {
+                frames.push_back(std::move(*frame));
+                reordered.push_back(scheduler.HasReorderedFrames());
+            }
+        };
+
+    for (uint64_t i = 0; i < frameCount; ++i)
+    {
+        scheduler.Push(GopScheduler::Frame{ .frameOrderNumber = i }, sceneCuts.contains(i));
+        popFrames();
+        // Frames are held back until the lookahead is full.
+        CHECK(frames.size() + config.lookaheadDepth + config.bFramesCount >= i + 1);
+    }
+    scheduler.Flush();
+    popFrames();
+
+    CHECK_EQUAL(expectedFrames.size(), frames.size());
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        CHECK_EQUAL(expectedFrames[i].frameOrderNumber, frames[i].frameOrderNumber);
+        CHECK_EQUAL(expectedFrames[i].frameType, frames[i].frameType);
+        CHECK_EQUAL(frames[i].frameType != BFrame, frames[i].useAsReference);
+        // Each frame is in the GOP of the last IDR or I-frame before it in the display order.
+        uint64_t gopStartFrameNumber = 0;
+        for (const ExpectedFrame& frame : expectedFrames)
+        {
+            if ((frame.frameType == IdrFrame || frame.frameType == IFrame) && frame.frameOrderNumber <= frames[i].frameOrderNumber)
+                gopStartFrameNumber = (std::max)(gopStartFrameNumber, frame.frameOrderNumber);
+        }
+        CHECK_EQUAL(gopStartFrameNumber, frames[i].gopStartFrameNumber);
+        // B-frames follow the frame they reference, which doesn't start a new closed GOP.
+        const bool bFramesFollow = frames[i].frameType != BFrame
+            && i + 1 < frames.size() && frames[i + 1].frameType == BFrame;
+        CHECK_EQUAL(bFramesFollow, static_cast<bool>(reordered[i]));
+        if (frames[i].frameType == BFrame)
+        {
+            auto reference = std::find_if(frames.begin(), frames.begin() + i, [&](const GopScheduler::Frame& frame)
+                {
+                    return frame.frameOrderNumber == frames[i].futureReferenceFrameOrderNumber;
+                });
+            CHECK(reference != frames.begin() + i);
+            CHECK(reference->frameOrderNumber > frames[i].frameOrderNumber);
+            CHECK(reference->gopStartFrameNumber == frames[i].gopStartFrameNumber || reference->frameType == IFrame);
+        }
+    }
+}
+
+EncoderConfiguration GetConfiguration(uint32_t keyFrameInterval, uint32_t bFramesCount, uint32_t lookaheadDepth)
+{
+    EncoderConfiguration config{};
+    config.keyFrameInterval = keyFrameInterval;
+    config.bFramesCount = bFramesCount;
+    config.lookaheadDepth = lookaheadDepth;
+    return config;
+}
+
+}
+
+TEST(GopSchedulerLookaheadKeepsGopsOfHeldFrames)
+{
+    // Periodic IDR frames at 8 and 21, a scene cut at 13 comes before the future reference of frame 12.
+    // Held frames keep the GOP they were pushed to, so the lookahead doesn't change the structure.
+    const std::vector<ExpectedFrame> expectedFrames = {
+        { 0, IdrFrame }, { 3, PFrame }, { 1, BFrame }, { 2, BFrame }, { 6, PFrame }, { 4, BFrame }, { 5, BFrame },
+        { 7, PFrame },
+        { 8, IdrFrame }, { 11, PFrame }, { 9, BFrame }, { 10, BFrame }, { 12, PFrame },
+        { 13, IdrFrame }, { 16, PFrame }, { 14, BFrame }, { 15, BFrame }, { 19, PFrame }, { 17, BFrame }, { 18, BFrame },
+        { 20, PFrame },
+        { 21, IdrFrame }, { 22, PFrame }, { 23, PFrame },
+    };
+    for (uint32_t lookaheadDepth : { 0u, 1u, 3u, 8u })
+    {
+        CheckEncodingOrder(GetConfiguration(8, 2, lookaheadDepth), 24, { 13 }, expectedFrames);
+    }
+}
+
+TEST(GopSchedulerLookaheadWithOpenGops)
+{
+    // Leading B-frames of each open GOP reference its I-frame.
+    EncoderConfiguration config = GetConfiguration(6, 2, 0);
+    config.enableOpenGop = true;
+    const std::vector<ExpectedFrame> expectedFrames = {
+        { 0, IdrFrame }, { 3, PFrame }, { 1, BFrame }, { 2, BFrame }, { 6, IFrame }, { 4, BFrame }, { 5, BFrame },
+        { 9, PFrame }, { 7, BFrame }, { 8, BFrame }, { 12, IFrame }, { 10, BFrame }, { 11, BFrame },
+        { 13, PFrame },
+    };
+    for (uint32_t lookaheadDepth : { 0u, 2u, 5u })
+    {
+        config.lookaheadDepth = lookaheadDepth;
+        CheckEncodingOrder(config, 14, {}, expectedFrames);
+    }
+}
+
+TEST(GopSchedulerKeyFrameRequestAppliesToNextPushedFrame)
+{
+    GopScheduler scheduler(GetConfiguration(0, 0, 2));
+    std::vector<GopScheduler::Frame> frames;
+    for (uint64_t i = 0; i < 6; ++i)
+    {
+        if (i == 3)
+            scheduler.RequestKeyFrame();
+        scheduler.Push(GopScheduler::Frame{ .frameOrderNumber = i });
+        while (auto frame = scheduler.Pop())
+            frames.push_back(std::move(*frame));
+    }
+    // Frames 0 - 3 are started by now, the held ones follow on flush.
+    CHECK_EQUAL(size_t{ 4 }, frames.size());
+    scheduler.Flush();
+    while (auto frame = scheduler.Pop())
+        frames.push_back(std::move(*frame));
+
+    CHECK_EQUAL(size_t{ 6 }, frames.size());
+    for (const auto& frame : frames)
+    {
+        CHECK_EQUAL(frame.frameOrderNumber == 0 || frame.frameOrderNumber == 3 ? IdrFrame : PFrame, frame.frameType);
+        CHECK_EQUAL(frame.frameOrderNumber >= 3 ? uint64_t{ 3 } : uint64_t{ 0 }, frame.gopStartFrameNumber);
+    }
+}
@@ -0,0 +1,423 @@
+#include "pch.h"
+#include "PicturePlanner.h"
+#include "ReferenceFramesManager.h"
+#include "TestFramework.h"
+
+using namespace DX12VideoEncoding;
+
+namespace {
+
+constexpr uint32_t MaxReferenceFrameCount = 2;
+constexpr uint32_t MaxLongTermReferenceFrameCount = 1;
+
+// Reference frame of the decoder model.
+struct DecodedFrame
+{
+    uint64_t frameOrderNumber{};
+    int64_t frameNum{};
+    int64_t picOrderCnt{};
+    bool isLongTerm{};
+    uint32_t longTermFrameIdx{};
+};
+
+// H.264 decoding process of P-frames with frame_num, POC type 0 (8.2.1.1), reference list initialization and
+// modification (8.2.4) and reference marking (8.2.5), checking the syntax elements the encoder produces.
+class DecoderModel
+{
+public:
+    DecoderModel(int64_t maxFrameNum, int64_t maxPicOrderCntLsb)
+        : m_maxFrameNum(maxFrameNum)
+        , m_maxPicOrderCntLsb(maxPicOrderCntLsb)
+    {
+    }
+
+    // Returns POC of the frame.
+    int64_t DecodeFrame(uint64_t frameOrderNumber, const D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264& picData,
+        bool isReference, std::optional<uint64_t> expectedReference)
+    {
+        const bool isIdr = picData.FrameType == D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+        m_frameNum = picData.FrameDecodingOrderNumber;
+        const int64_t picOrderCntLsb = picData.PictureOrderCountNumber % m_maxPicOrderCntLsb;
+
+        int64_t picOrderCntMsb = 0;
+        if (isIdr)
+        {
+            m_frames.clear();
+            m_maxLongTermFrameIdx = -1;
+            m_prevPicOrderCntMsb = 0;
+            m_prevPicOrderCntLsb = 0;
+            CHECK_EQUAL(int64_t{ 0 }, m_frameNum);
+        }
+        else
+        {
+            // Gaps are not allowed, each frame follows the previous reference frame.
+            CHECK_EQUAL((m_prevRefFrameNum + 1) % m_maxFrameNum, m_frameNum);
+            if (picOrderCntLsb < m_prevPicOrderCntLsb && m_prevPicOrderCntLsb - picOrderCntLsb >= m_maxPicOrderCntLsb / 2)
+                picOrderCntMsb = m_prevPicOrderCntMsb + m_maxPicOrderCntLsb;
+            else if (picOrderCntLsb > m_prevPicOrderCntLsb && picOrderCntLsb - m_prevPicOrderCntLsb > m_maxPicOrderCntLsb / 2)
+                picOrderCntMsb = m_prevPicOrderCntMsb - m_maxPicOrderCntLsb;
+            else
+                picOrderCntMsb = m_prevPicOrderCntMsb;
+
+            CHECK(expectedReference.has_value());
+            CHECK_EQUAL(*expectedReference, BuildList0(picData).at(0).frameOrderNumber);
+        }
+
+        if (!isReference)
+            return picOrderCntMsb + picOrderCntLsb;
+
+        bool hasMemoryManagementControlOperation5 = false;
+        if (picData.adaptive_ref_pic_marking_mode_flag)
+        {
+            for (UINT i = 0; i < picData.RefPicMarkingOperationsCommandsCount; ++i)
+            {
+                hasMemoryManagementControlOperation5 |= ApplyMarking(picData.pRefPicMarkingOperationsCommands[i]);
+            }
+        }
+        else if (!isIdr && m_frames.size() >= MaxReferenceFrameCount + MaxLongTermReferenceFrameCount)
+        {
+            // Sliding window
+            auto oldest = m_frames.end();
+            for (auto it = m_frames.begin(); it != m_frames.end(); ++it)
+            {
+                if (!it->isLongTerm && (oldest == m_frames.end() || GetPicNum(*it) < GetPicNum(*oldest)))
+                    oldest = it;
+            }
+            CHECK(oldest != m_frames.end());
+            m_frames.erase(oldest);
+        }
+
+        const int64_t picOrderCnt = picOrderCntMsb + picOrderCntLsb;
+        if (hasMemoryManagementControlOperation5)
+        {
+            // The frame is inferred to have frame_num 0 and POC 0 after decoding.
+            m_frames.push_back(DecodedFrame{ frameOrderNumber, 0, 0 });
+            m_prevPicOrderCntMsb = 0;
+            m_prevPicOrderCntLsb = 0;
+            m_prevRefFrameNum = 0;
+        }
+        else
+        {
+            m_frames.push_back(DecodedFrame{ frameOrderNumber, m_frameNum, picOrderCnt });
+            m_prevPicOrderCntMsb = picOrderCntMsb;
+            m_prevPicOrderCntLsb = picOrderCntLsb;
+            m_prevRefFrameNum = m_frameNum;
+        }
+        CHECK(m_frames.size() <= MaxReferenceFrameCount + MaxLongTermReferenceFrameCount);
+        return picOrderCnt;
+    }
+
+    const std::vector<DecodedFrame>& GetFrames() const { return m_frames; }
+
+    const DecodedFrame* FindLongTerm() const
+    {
+        auto it = std::find_if(m_frames.begin(), m_frames.end(), [](const DecodedFrame& frame) { return frame.isLongTerm; });
+        return it != m_frames.end() ? &*it : nullptr;
+    }
+
+private:
+    // FrameNumWrap, frames decoded before the wrap of the current frame_num are negative.
+    int64_t GetPicNum(const DecodedFrame& frame) const
+    {
+        return frame.frameNum > m_frameNum ? frame.frameNum - m_maxFrameNum : frame.frameNum;
+    }
+
+    std::vector<DecodedFrame> BuildList0(const D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264& picData) const
+    {
+        // Short-term frames by descending PicNum, then long-term ones by ascending LongTermPicNum.
+        std::vector<DecodedFrame> list;
+        std::copy_if(m_frames.begin(), m_frames.end(), std::back_inserter(list),
+            [](const DecodedFrame& frame) { return !frame.isLongTerm; });
+        std::sort(list.begin(), list.end(),
+            [this](const DecodedFrame& a, const DecodedFrame& b) { return GetPicNum(a) > GetPicNum(b); });
+        for (const DecodedFrame& frame : m_frames)
+        {
+            if (frame.isLongTerm)
+                list.push_back(frame);
+        }
+
+        int64_t picNumPred = m_frameNum;
+        for (UINT i = 0; i < picData.List0RefPicModificationsCount; ++i)
+        {
+            const auto& modification = picData.pList0RefPicModifications[i];
+            auto target = list.end();
+            if (modification.modification_of_pic_nums_idc == 2)
+            {
+                target = std::find_if(list.begin() + i, list.end(), [&](const DecodedFrame& frame)
+                    {
+                        return frame.isLongTerm && frame.longTermFrameIdx == modification.long_term_pic_num;
+                    });
+            }
+            else
+            {
+                CHECK(modification.modification_of_pic_nums_idc <= 1);
+                const int64_t absDiffPicNum = modification.abs_diff_pic_num_minus1 + 1;
+                int64_t picNumNoWrap = modification.modification_of_pic_nums_idc == 0
+                    ? picNumPred - absDiffPicNum
+                    : picNumPred + absDiffPicNum;
+                if (picNumNoWrap < 0)
+                    picNumNoWrap += m_maxFrameNum;
+                else if (picNumNoWrap >= m_maxFrameNum)
+                    picNumNoWrap -= m_maxFrameNum;
+                picNumPred = picNumNoWrap;
+
+                const int64_t picNum = picNumNoWrap > m_frameNum ? picNumNoWrap - m_maxFrameNum : picNumNoWrap;
+                target = std::find_if(list.begin() + i, list.end(), [&](const DecodedFrame& frame)
+                    {
+                        return !frame.isLongTerm && GetPicNum(frame) == picNum;
+                    });
+            }
+            CHECK(target != list.end());
+            std::rotate(list.begin() + i, target, target + 1);
+        }
+        return list;
+    }
+
+    // Returns true for MMCO 5.
+    bool ApplyMarking(const D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264_REFERENCE_PICTURE_MARKING_OPERATION& operation)
+    {
+        const int64_t picNumX = m_frameNum - (int64_t{ operation.difference_of_pic_nums_minus1 } + 1);
+        const auto findShortTerm = [&]
+        {
+            auto it = std::find_if(m_frames.begin(), m_frames.end(),
+                [&](const DecodedFrame& frame) { return !frame.isLongTerm && GetPicNum(frame) == picNumX; });
+            CHECK(it != m_frames.end());
+            return it;
+        };
+
+        switch (operation.memory_management_control_operation)
+        {
+        case 1:
+            m_frames.erase(findShortTerm());
+            return false;
+        case 3:
+        {
+            CHECK(static_cast<int64_t>(operation.long_term_frame_idx) <= m_maxLongTermFrameIdx);
+            std::erase_if(m_frames, [&](const DecodedFrame& frame)
+                {
+                    return frame.isLongTerm && frame.longTermFrameIdx == operation.long_term_frame_idx;
+                });
+            auto frame = findShortTerm();
+            frame->isLongTerm = true;
+            frame->longTermFrameIdx = operation.long_term_frame_idx;
+            return false;
+        }
+        case 4:
+            m_maxLongTermFrameIdx = static_cast<int64_t>(operation.max_long_term_frame_idx_plus1) - 1;
+            std::erase_if(m_frames, [this](const DecodedFrame& frame)
+                {
+                    return frame.isLongTerm && static_cast<int64_t>(frame.longTermFrameIdx) > m_maxLongTermFrameIdx;
+                });
+            return false;
+        case 5:
+            m_frames.clear();
+            m_maxLongTermFrameIdx = -1;
+            return true;
+        default:
+            Tests::Fail(__FILE__, __LINE__, "Unexpected memory_management_control_operation "
+                + std::to_string(operation.memory_management_control_operation));
+        }
+    }
+
+private:
+    const int64_t m_maxFrameNum;
+    const int64_t m_maxPicOrderCntLsb;
+    std::vector<DecodedFrame> m_frames;
+    int64_t m_frameNum = 0;
+    int64_t m_prevRefFrameNum = 0;
+    int64_t m_prevPicOrderCntMsb = 0;
+    int64_t m_prevPicOrderCntLsb = 0;
+    int64_t m_maxLongTermFrameIdx = -1;
+};
+
+// Constants of the syntax elements and the encoder, and the checks of a run.
+struct NumberingRun
+{
+    int64_t maxFrameNum{};
+    int64_t maxPicOrderCntLsb{};
+    uint64_t restartInterval{};
+    uint64_t frameCount{};
+    // Frame order numbers advance by the stride, so POC covers the range of a much longer stream.
+    uint64_t frameOrderNumberStride{ 1 };
+    uint32_t minFrameNumWrapCount{};
+    uint64_t minLongTermFrameNumWraps{};
+};
+
+// Starts P-frames of 3 temporal layers by PicturePlanner, as EncoderH264 does, and decodes them by the model:
+// the layers and the losses reported back make the frames reference older and long-term frames.
+void CheckPictureNumbering(const NumberingRun& run)
+{
+    // Without inter frames in the GOP the manager creates no textures, so it runs without a device.
+    ReferenceFramesManager manager(nullptr, {}, DXGI_FORMAT_NV12, MaxReferenceFrameCount,
+        MaxLongTermReferenceFrameCount, false);
+    manager.SetMaxFrameNum(static_cast<UINT>(run.maxFrameNum));
+    PicturePlanner planner(MaxReferenceFrameCount, MaxLongTermReferenceFrameCount, run.restartInterval);
+    DecoderModel decoder(run.maxFrameNum, run.maxPicOrderCntLsb);
+
+    // Frame order number of the last IDR frame or restart, kept apart from the planner.
+    uint64_t pictureNumberingStart = 0;
+    // Unwrapped frame_num of the reference frames, counted from the last IDR frame or restart.
+    std::vector<uint64_t> referenceFrameNums(run.frameCount);
+    uint32_t frameNumWrapCount = 0;
+    uint32_t restartCount = 0;
+    uint32_t longTermMarkingCount = 0;
+    uint32_t longTermReferenceCount = 0;
+    uint64_t maxLongTermFrameNumWraps = 0;
+    bool longTermMarkingPending = false;
+
+    for (uint64_t index = 0; index < run.frameCount; ++index)
+    {
+        const uint64_t frameOrderNumber = index * run.frameOrderNumberStride;
+        const bool isIdr = index == 0;
+        // L1T3 - 0 2 1 2..., the top layer is not referenced.
+        constexpr uint32_t TemporalLayers[] = { 0, 2, 1, 2 };
+        const uint32_t temporalLayerIndex = TemporalLayers[index % 4];
+        const bool isReference = temporalLayerIndex < 2;
+
+        // Losses of all frames after the long-term one, so the next frame references it. Not while the marking
+        // is pending, as the marked frame would replace it.
+        const DecodedFrame* longTermFrame = decoder.FindLongTerm();
+        if (index % 11 == 0 && longTermFrame != nullptr && !longTermMarkingPending
+            && planner.GetReferenceFrames().GetLast() > longTermFrame->frameOrderNumber)
+        {
+            planner.InvalidateReferences(longTermFrame->frameOrderNumber + 1, planner.GetReferenceFrames().GetLast());
+        }
+        std::optional<uint64_t> expectedReference;
+        if (!isIdr)
+            expectedReference = planner.GetReferenceFrames().GetLastValid(temporalLayerIndex);
+        if (expectedReference.has_value() && planner.GetReferenceFrames().IsLongTerm(*expectedReference))
+            ++longTermReferenceCount;
+
+        const GopScheduler::Frame frame{
+            .frameType = isIdr ? D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME : D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME,
+            .frameOrderNumber = frameOrderNumber,
+            .useAsReference = isReference,
+            .temporalLayerIndex = temporalLayerIndex,
+        };
+        PicturePlanner::Picture picture = planner.Start(frame, false);
+        CHECK_EQUAL(frame.frameType, picture.frameType);
+        if (isIdr)
+            pictureNumberingStart = frameOrderNumber;
+        CHECK_EQUAL(frameOrderNumber - pictureNumberingStart, uint64_t{ picture.pictureOrderCountNumber });
+        CHECK_EQUAL(expectedReference.has_value() ? size_t{ 1 } : size_t{ 0 }, picture.l0List.size());
+        if (expectedReference.has_value())
+            CHECK_EQUAL(*expectedReference - pictureNumberingStart, uint64_t{ picture.l0List.at(0) });
+        if (picture.longTermReference.has_value())
+            ++longTermMarkingCount;
+        if (isReference)
+            longTermMarkingPending = false;
+
+        D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264 picData = {};
+        picData.FrameType = picture.frameType;
+        picData.PictureOrderCountNumber = picture.pictureOrderCountNumber;
+        picData.FrameDecodingOrderNumber = static_cast<UINT>(picture.decodingOrderNumber % run.maxFrameNum);
+        picData.List0ReferenceFramesCount = static_cast<UINT>(picture.l0List.size());
+        picData.pList0ReferenceFrames = picture.l0List.empty() ? nullptr : picture.l0List.data();
+        D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA codecData = { sizeof(picData), {} };
+        codecData.pH264PicData = &picData;
+        manager.PrepareForEncodingFrame(codecData, isReference, picture.longTermReference,
+            picture.restartPictureNumbering);
+        manager.GetPictureControlCodecData(codecData);
+        if (!isIdr && picData.FrameDecodingOrderNumber == 0)
+            ++frameNumWrapCount;
+
+        const int64_t picOrderCnt = decoder.DecodeFrame(frameOrderNumber, picData, isReference, expectedReference);
+        CHECK_EQUAL(static_cast<int64_t>(picture.pictureOrderCountNumber), picOrderCnt);
+        manager.UpdateReferenceFrames();
+
+        // frame_num of the next frame
+        uint64_t frameNum = picture.decodingOrderNumber + (isReference ? 1 : 0);
+        if (isReference)
+            referenceFrameNums[index] = picture.decodingOrderNumber;
+        if (picture.restartPictureNumbering)
+        {
+            pictureNumberingStart = frameOrderNumber;
+            referenceFrameNums[index] = 0;
+            frameNum = 1;
+            ++restartCount;
+
+            // MMCO 5 leaves only the restarting frame, with POC and frame_num 0.
+            CHECK_EQUAL(size_t{ 1 }, decoder.GetFrames().size());
+            CHECK_EQUAL(int64_t{ 0 }, decoder.GetFrames()[0].frameNum);
+            CHECK_EQUAL(int64_t{ 0 }, decoder.GetFrames()[0].picOrderCnt);
+        }
+        if (isReference && index % 100 == 8)
+        {
+            CHECK(planner.MarkLongTermReference(frameOrderNumber));
+            longTermMarkingPending = true;
+        }
+
+        // The DPB of the encoder is the decoder one: same frames, frame_num, POC and long-term indices.
+        const ReferenceFrameTracker& referenceFrames = planner.GetReferenceFrames();
+        CHECK_EQUAL(decoder.GetFrames().size(), referenceFrames.GetCount());
+        CHECK_EQUAL(decoder.GetFrames().size(), manager.GetReferenceFrameCount());
+        for (const DecodedFrame& decodedFrame : decoder.GetFrames())
+        {
+            CHECK(decodedFrame.isLongTerm
+                ? referenceFrames.IsLongTerm(decodedFrame.frameOrderNumber)
+                : referenceFrames.IsShortTerm(decodedFrame.frameOrderNumber));
+        }
+
+        D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264 nextPicData = {};
+        nextPicData.FrameType = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+        nextPicData.FrameDecodingOrderNumber = static_cast<UINT>(frameNum % run.maxFrameNum);
+        D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA nextCodecData = { sizeof(nextPicData), {} };
+        nextCodecData.pH264PicData = &nextPicData;
+        manager.PrepareForEncodingFrame(nextCodecData, false);
+        manager.GetPictureControlCodecData(nextCodecData);
+        for (UINT i = 0; i < nextPicData.ReferenceFramesReconPictureDescriptorsCount; ++i)
+        {
+            const auto& descriptor = nextPicData.pReferenceFramesReconPictureDescriptors[i];
+            CHECK(std::any_of(decoder.GetFrames().begin(), decoder.GetFrames().end(), [&](const DecodedFrame& decodedFrame)
+                {
+                    return decodedFrame.picOrderCnt == descriptor.PictureOrderCountNumber
+                        && decodedFrame.frameNum == descriptor.FrameDecodingOrderNumber
+                        && decodedFrame.isLongTerm == (descriptor.IsLongTermReference != FALSE)
+                        && (!decodedFrame.isLongTerm || decodedFrame.longTermFrameIdx == descriptor.LongTermPictureIdx);
+                }));
+        }
+
+        // Long-term frames stay referenced while frame_num of the short-term ones wraps around them.
+        if (const DecodedFrame* decodedLongTermFrame = decoder.FindLongTerm())
+        {
+            const uint64_t longTermFrameNum = referenceFrameNums[decodedLongTermFrame->frameOrderNumber / run.frameOrderNumberStride];
+            CHECK_EQUAL(static_cast<int64_t>(longTermFrameNum % run.maxFrameNum), decodedLongTermFrame->frameNum);
+            maxLongTermFrameNumWraps = (std::max)(maxLongTermFrameNumWraps, (frameNum - longTermFrameNum) / run.maxFrameNum);
+        }
+    }
+
+    CHECK(frameNumWrapCount >= run.minFrameNumWrapCount);
+    CHECK_EQUAL(run.frameCount * run.frameOrderNumberStride / run.restartInterval - 1, uint64_t{ restartCount });
+    CHECK(longTermMarkingCount >= 5);
+    CHECK(longTermReferenceCount >= 5);
+    CHECK(maxLongTermFrameNumWraps >= run.minLongTermFrameNumWraps);
+}
+
+}
+
+TEST(PictureNumberingAcrossFrameNumWraps)
+{
+    // Small MaxFrameNum and restart interval, so a short stream wraps frame_num many times and restarts POC a few times.
+    CheckPictureNumbering(NumberingRun{
+        .maxFrameNum = 16,
+        .maxPicOrderCntLsb = 64,
+        .restartInterval = 300,
+        .frameCount = 1500,
+        .minFrameNumWrapCount = 20,
+        .minLongTermFrameNumWraps = 2,
+    });
+}
+
+TEST(PictureNumberingOfLongStreams)
+{
+    // MaxFrameNum, POC lsb and the restart interval of the encoder, POC advances by 2^14 per frame,
+    // so the frames reach 5 * 2^30 in display order through 4 restarts with MMCO 5.
+    CheckPictureNumbering(NumberingRun{
+        .maxFrameNum = 1 << 15,
+        .maxPicOrderCntLsb = 1 << 16,
+        .restartInterval = PictureNumberingRestartInterval,
+        .frameCount = uint64_t{ 5 } << 16,
+        .frameOrderNumberStride = 1 << 14,
+        .minFrameNumWrapCount = 8,
+    });
+}
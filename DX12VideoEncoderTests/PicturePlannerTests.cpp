@@ -0,0 +1,139 @@
+#include "pch.h"
+#include "PicturePlanner.h"
+#include "TestFramework.h"
+
+using namespace DX12VideoEncoding;
+
+namespace {
+
+constexpr auto IdrFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+constexpr auto IFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_I_FRAME;
+constexpr auto PFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+constexpr auto BFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME;
+
+// Starts the frame typed by GopScheduler, B-frames are not referenced. Frame order numbers are POC,
+// as no test reaches the restart interval.
+PicturePlanner::Picture Start(PicturePlanner& planner, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType,
+    uint64_t frameOrderNumber, bool reorderedFrames = false)
+{
+    const GopScheduler::Frame frame{
+        .frameType = frameType,
+        .frameOrderNumber = frameOrderNumber,
+        .useAsReference = frameType != BFrame,
+    };
+    // Lost frames are never referenced, the DPB is checked before the sliding window evicts the references.
+    const ReferenceFrameTracker referenceFrames = planner.GetReferenceFrames();
+    PicturePlanner::Picture picture = planner.Start(frame, reorderedFrames);
+    for (const auto* list : { &picture.l0List, &picture.l1List })
+    {
+        for (UINT reference : *list)
+        {
+            CHECK(referenceFrames.IsValid(reference + planner.GetPictureNumberingStart()));
+        }
+    }
+    return picture;
+}
+
+}
+
+TEST(PicturePlannerLostReferencesStartIdrFrame)
+{
+    PicturePlanner planner(2, 0);
+    Start(planner, IdrFrame, 0);
+    Start(planner, PFrame, 1);
+    Start(planner, PFrame, 2);
+
+    // The last frame is lost, the next one references the one before it.
+    planner.InvalidateReferences(2, 2);
+    PicturePlanner::Picture picture = Start(planner, PFrame, 3);
+    CHECK_EQUAL(PFrame, picture.frameType);
+    CHECK_EQUAL(std::vector<UINT>{ 1 }, picture.l0List);
+
+    // All frames are lost and no B-frames wait for the next one, so it starts a new GOP.
+    planner.InvalidateReferences(0, 3);
+    picture = Start(planner, PFrame, 4);
+    CHECK_EQUAL(IdrFrame, picture.frameType);
+    CHECK(picture.useAsReference);
+    CHECK(picture.l0List.empty());
+    CHECK_EQUAL(1u, picture.idrPicId);
+    CHECK_EQUAL(0u, picture.pictureOrderCountNumber);
+    CHECK_EQUAL(0u, picture.decodingOrderNumber);
+    CHECK_EQUAL(uint64_t{ 4 }, planner.GetLastIdrNumber());
+
+    // POC is counted from the IDR frame.
+    picture = Start(planner, PFrame, 5);
+    CHECK_EQUAL(PFrame, picture.frameType);
+    CHECK_EQUAL(std::vector<UINT>{ 0 }, picture.l0List);
+    CHECK_EQUAL(1u, picture.pictureOrderCountNumber);
+}
+
+TEST(PicturePlannerLostReferencesBeforeBFramesStartIFrame)
+{
+    // IDR 0, P 3, B 1, B 2, P 6, B 4, B 5, P 9 in the encoding order.
+    PicturePlanner planner(2, 0);
+    Start(planner, IdrFrame, 0);
+    Start(planner, PFrame, 3, true);
+    Start(planner, BFrame, 1);
+    Start(planner, BFrame, 2);
+
+    // B-frames 4 and 5 wait for frame 6 as their future reference, so it's an I-frame in the same GOP.
+    planner.InvalidateReferences(0, 3);
+    PicturePlanner::Picture picture = Start(planner, PFrame, 6, true);
+    CHECK_EQUAL(IFrame, picture.frameType);
+    CHECK(picture.useAsReference);
+    CHECK(picture.l0List.empty());
+    CHECK_EQUAL(6u, picture.pictureOrderCountNumber);
+    CHECK_EQUAL(uint64_t{ 0 }, planner.GetLastIdrNumber());
+
+    // The past references of the B-frames are lost, they are predicted from the I-frame only.
+    for (uint64_t frameOrderNumber : { 4, 5 })
+    {
+        picture = Start(planner, BFrame, frameOrderNumber);
+        CHECK_EQUAL(PFrame, picture.frameType);
+        CHECK(!picture.useAsReference);
+        CHECK_EQUAL(std::vector<UINT>{ 6 }, picture.l0List);
+        CHECK(picture.l1List.empty());
+    }
+
+    picture = Start(planner, PFrame, 9);
+    CHECK_EQUAL(PFrame, picture.frameType);
+    CHECK_EQUAL(std::vector<UINT>{ 6 }, picture.l0List);
+}
+
+TEST(PicturePlannerLostReferencesOfBFrames)
+{
+    PicturePlanner planner(3, 0);
+    Start(planner, IdrFrame, 0);
+    Start(planner, PFrame, 3, true);
+
+    // Both references are lost.
+    planner.InvalidateReferences(0, 3);
+    for (uint64_t frameOrderNumber : { 1, 2 })
+    {
+        PicturePlanner::Picture picture = Start(planner, BFrame, frameOrderNumber);
+        CHECK_EQUAL(IFrame, picture.frameType);
+        CHECK(!picture.useAsReference);
+        CHECK(picture.l0List.empty());
+        CHECK(picture.l1List.empty());
+    }
+    CHECK_EQUAL(IFrame, Start(planner, PFrame, 6, true).frameType);
+    Start(planner, BFrame, 4);
+    Start(planner, BFrame, 5);
+
+    // The future reference is lost, the past one is intact.
+    Start(planner, PFrame, 9, true);
+    planner.InvalidateReferences(9, 9);
+    PicturePlanner::Picture picture = Start(planner, BFrame, 7);
+    CHECK_EQUAL(PFrame, picture.frameType);
+    CHECK(!picture.useAsReference);
+    CHECK_EQUAL(std::vector<UINT>{ 6 }, picture.l0List);
+    Start(planner, BFrame, 8);
+
+    // Intact references, the frame lost between them is skipped.
+    picture = Start(planner, PFrame, 12, true);
+    CHECK_EQUAL(std::vector<UINT>{ 6 }, picture.l0List);
+    picture = Start(planner, BFrame, 10);
+    CHECK_EQUAL(BFrame, picture.frameType);
+    CHECK_EQUAL(std::vector<UINT>{ 6 }, picture.l0List);
+    CHECK_EQUAL(std::vector<UINT>{ 12 }, picture.l1List);
+}
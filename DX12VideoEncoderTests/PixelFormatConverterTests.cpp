@@ -0,0 +1,179 @@
+#include "pch.h"
+#include "PixelFormatConverter.h"
+#include "WorkerPool.h"
+#include "TestFramework.h"
+#include <random>
+
+using namespace DX12VideoEncoding;
+
+namespace {
+
+constexpr PixelFormat SourceFormats[] = {
+    PixelFormat::NV12,
+    PixelFormat::YUV420P,
+    PixelFormat::YUVJ420P,
+    PixelFormat::YUV422P,
+    PixelFormat::P010,
+    PixelFormat::BGRA,
+    PixelFormat::YUV420P10,
+};
+
+// Widths around the 16 and 32 samples of SIMD blocks check the row tails.
+constexpr uint32_t Widths[] = { 1, 2, 3, 15, 16, 17, 31, 32, 33, 63, 65, 130, 1921 };
+constexpr uint32_t Heights[] = { 1, 2, 3, 17 };
+
+// Planes with random samples, rows are padded and start at odd multiples of 2 bytes to be unaligned.
+class SourceFrame
+{
+public:
+    SourceFrame(PixelFormat format, uint32_t width, uint32_t height, std::mt19937& random)
+    {
+        m_descriptor.format = format;
+        m_descriptor.width = width;
+        m_descriptor.height = height;
+        m_descriptor.planeCount = GetPlaneCount(format);
+
+        for (uint32_t plane = 0; plane < m_descriptor.planeCount; ++plane)
+        {
+            const size_t pitch = GetPlaneRowSize(format, plane, width) + 18;
+            const uint32_t rows = GetPlaneHeight(format, plane, height);
+            auto& data = m_planes[plane];
+            data.resize(pitch * rows + 2);
+            for (size_t i = 0; i + 1 < data.size(); i += 2)
+            {
+                uint16_t sample = static_cast<uint16_t>(random());
+                // 10-bit samples are valid in their own bits only.
+                if (format == PixelFormat::P010)
+                    sample &= 0xFFC0;
+                else if (format == PixelFormat::YUV420P10)
+                    sample &= 0x03FF;
+                memcpy(&data[i], &sample, sizeof(sample));
+            }
+            m_descriptor.planes[plane] = { data.data() + 2, pitch, rows };
+        }
+    }
+
+    const FrameDescriptor& GetDescriptor() const { return m_descriptor; }
+
+private:
+    FrameDescriptor m_descriptor;
+    std::vector<uint8_t> m_planes[3];
+};
+
+// Destination padding is filled with a marker, so writes outside of the rows differ too.
+class DestinationFrame
+{
+public:
+    DestinationFrame(DXGI_FORMAT format, uint32_t width, uint32_t height)
+    {
+        const size_t bytesPerSample = format == DXGI_FORMAT_P010 ? 2 : 1;
+        const size_t linesize = bytesPerSample * ((width + 1) & ~1u) + 32;
+        m_y.assign(linesize * height, 0xCD);
+        m_uv.assign(linesize * ((height + 1) / 2), 0xCD);
+        m_buffer = { format, m_y.data(), linesize, m_uv.data(), linesize };
+    }
+
+    const FrameUploadBuffer& GetBuffer() const { return m_buffer; }
+
+    bool operator==(const DestinationFrame& other) const { return m_y == other.m_y && m_uv == other.m_uv; }
+
+private:
+    std::vector<uint8_t> m_y;
+    std::vector<uint8_t> m_uv;
+    FrameUploadBuffer m_buffer;
+};
+
+void CheckSimdMatchesScalar(DXGI_FORMAT destinationFormat, WorkerPool* workerPool)
+{
+    std::mt19937 random(1);
+    for (PixelFormat format : SourceFormats)
+    {
+        if (!IsConversionSupported(format, destinationFormat))
+            continue;
+
+        for (uint32_t width : Widths)
+        {
+            for (uint32_t height : Heights)
+            {
+                const SourceFrame source(format, width, height, random);
+                DestinationFrame scalar(destinationFormat, width, height);
+                DestinationFrame simd(destinationFormat, width, height);
+                ConvertImage(source.GetDescriptor(), scalar.GetBuffer(), nullptr, ConversionKernels::Scalar);
+                ConvertImage(source.GetDescriptor(), simd.GetBuffer(), workerPool, ConversionKernels::Best);
+                if (!(scalar == simd))
+                {
+                    Tests::Fail(__FILE__, __LINE__, "Format " + Tests::ToString(format) + " " + std::to_string(width)
+                        + "x" + std::to_string(height) + " differs from the scalar conversion");
+                }
+            }
+        }
+    }
+}
+
+}
+
+TEST(PixelFormatConverterSimdMatchesScalarNV12)
+{
+    CheckSimdMatchesScalar(DXGI_FORMAT_NV12, nullptr);
+}
+
+TEST(PixelFormatConverterSimdMatchesScalarP010)
+{
+    CheckSimdMatchesScalar(DXGI_FORMAT_P010, nullptr);
+}
+
+TEST(PixelFormatConverterPoolMatchesSingleThread)
+{
+    // Bands of the pool tasks join without seams, including the odd last chroma row.
+    WorkerPool workerPool(3);
+    CheckSimdMatchesScalar(DXGI_FORMAT_NV12, &workerPool);
+
+    std::mt19937 random(2);
+    const SourceFrame source(PixelFormat::YUV422P, 1283, 721, random);
+    DestinationFrame singleThread(DXGI_FORMAT_NV12, 1283, 721);
+    DestinationFrame pooled(DXGI_FORMAT_NV12, 1283, 721);
+    ConvertImage(source.GetDescriptor(), singleThread.GetBuffer());
+    ConvertImage(source.GetDescriptor(), pooled.GetBuffer(), &workerPool);
+    CHECK(singleThread == pooled);
+}
+
+TEST(PixelFormatConverterRangeAndMatrix)
+{
+    // Full range white and black are compressed to 235 and 16, BGRA white is Y 235 and neutral chroma.
+    const uint8_t fullRange[2] = { 255, 0 };
+    const uint8_t chroma[1] = { 255 };
+    FrameDescriptor source{};
+    source.format = PixelFormat::YUVJ420P;
+    source.width = 2;
+    source.height = 1;
+    source.planeCount = 3;
+    source.planes[0] = { fullRange, 2, 1 };
+    source.planes[1] = { chroma, 1, 1 };
+    source.planes[2] = { fullRange + 1, 1, 1 };
+
+    for (ConversionKernels kernelSet : { ConversionKernels::Scalar, ConversionKernels::Best })
+    {
+        uint8_t y[2]{};
+        uint8_t uv[2]{};
+        ConvertImage(source, { DXGI_FORMAT_NV12, y, 2, uv, 2 }, nullptr, kernelSet);
+        CHECK_EQUAL(235, y[0]);
+        CHECK_EQUAL(16, y[1]);
+        CHECK_EQUAL(240, uv[0]);
+        CHECK_EQUAL(16, uv[1]);
+    }
+
+    const uint8_t white[8] = { 255, 255, 255, 255, 255, 255, 255, 255 };
+    FrameDescriptor bgra{};
+    bgra.format = PixelFormat::BGRA;
+    bgra.width = 2;
+    bgra.height = 1;
+    bgra.planeCount = 1;
+    bgra.planes[0] = { white, 8, 1 };
+    uint8_t y[2]{};
+    uint8_t uv[2]{};
+    ConvertImage(bgra, { DXGI_FORMAT_NV12, y, 2, uv, 2 });
+    CHECK_EQUAL(235, y[0]);
+    CHECK_EQUAL(235, y[1]);
+    CHECK_EQUAL(128, uv[0]);
+    CHECK_EQUAL(128, uv[1]);
+}
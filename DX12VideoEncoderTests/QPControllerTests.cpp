@@ -0,0 +1,119 @@
+#include "pch.h"
+#include "QPController.h"
+#include "TestFramework.h"
+
+using namespace DX12VideoEncoding;
+
+namespace {
+
+constexpr auto PFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+
+FrameStatistics GetStatistics(float cost)
+{
+    return FrameStatistics{
+        .isAnalyzed = true,
+        .spatialActivity = 2 * cost,
+        .hasPreviousFrame = true,
+        .motionCompensatedDifference = cost,
+    };
+}
+
+EncoderConfiguration GetAdaptiveConfiguration()
+{
+    EncoderConfiguration config{};
+    config.qp = 30;
+    config.enableAdaptiveQP = true;
+    return config;
+}
+
+}
+
+TEST(QPControllerConstantWithoutAdaptation)
+{
+    EncoderConfiguration config = GetAdaptiveConfiguration();
+    config.enableAdaptiveQP = false;
+    config.pFrameQPOffset = 2;
+    QPController controller(config);
+    CHECK(!controller.IsAdaptive());
+
+    controller.AddFrame(0, GetStatistics(1.0f));
+    controller.AddFrame(1, GetStatistics(100.0f));
+    CHECK_EQUAL(32u, controller.GetFrameQP(0, PFrame));
+    CHECK_EQUAL(32u, controller.GetFrameQP(1, PFrame));
+}
+
+TEST(QPControllerFutureFramesFeedTheOffset)
+{
+    // Without future frames the frame is as complex as its past, held complex frames make it relatively simple.
+    constexpr uint64_t FrameOrderNumber = 12;
+    QPController withoutLookahead(GetAdaptiveConfiguration());
+    QPController withLookahead(GetAdaptiveConfiguration());
+    for (uint64_t i = 0; i <= FrameOrderNumber; ++i)
+    {
+        withoutLookahead.AddFrame(i, GetStatistics(8.0f));
+        withLookahead.AddFrame(i, GetStatistics(8.0f));
+    }
+    for (uint64_t i = FrameOrderNumber + 1; i <= FrameOrderNumber + 8; ++i)
+    {
+        withLookahead.AddFrame(i, GetStatistics(64.0f));
+    }
+
+    CHECK_EQUAL(30u, withoutLookahead.GetFrameQP(FrameOrderNumber, PFrame));
+    CHECK(withLookahead.GetFrameQP(FrameOrderNumber, PFrame) < 30u);
+}
+
+TEST(QPControllerOffsetIsLimited)
+{
+    QPController controller(GetAdaptiveConfiguration());
+    controller.AddFrame(0, GetStatistics(10000.0f));
+    for (uint64_t i = 1; i <= 12; ++i)
+    {
+        controller.AddFrame(i, GetStatistics(0.0f));
+    }
+
+    CHECK_EQUAL(34u, controller.GetFrameQP(0, PFrame));
+}
+
+TEST(QPControllerSecondPassUsesFirstPassStatistics)
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "QPControllerTwoPass.dxqp";
+    EncoderConfiguration config = GetAdaptiveConfiguration();
+    config.enableAdaptiveQP = false;
+    config.bFrameQPOffset = 2;
+    config.passStatisticsFile = path.wstring();
+
+    // The first pass records an IDR frame and P-frames, the last one four times larger than the others.
+    constexpr auto IdrFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+    const std::vector<size_t> pFrameSizes = { 1000, 1000, 1000, 4000 };
+    {
+        config.encodingPass = EncodingPass::First;
+        QPController firstPass(config);
+        CHECK(!firstPass.IsAdaptive());
+        firstPass.OnFrameEncoded(0, IdrFrame, 30, 5000);
+        for (size_t i = 0; i < pFrameSizes.size(); ++i)
+        {
+            firstPass.OnFrameEncoded(i + 1, PFrame, 30, pFrameSizes[i]);
+        }
+    }
+
+    config.encodingPass = EncodingPass::Second;
+    QPController secondPass(config);
+    CHECK(secondPass.IsAdaptive());
+    for (uint64_t i = 0; i <= 5; ++i)
+    {
+        secondPass.AddFrame(i, GetStatistics(8.0f));
+    }
+
+    // P-frames are compared with the mean log2 size of the P-frames: 0.4 * 6 * (0 - 0.5) and 0.4 * 6 * (2 - 0.5).
+    CHECK_EQUAL(30u, secondPass.GetFrameQP(0, IdrFrame));
+    CHECK_EQUAL(29u, secondPass.GetFrameQP(1, PFrame));
+    CHECK_EQUAL(29u, secondPass.GetFrameQP(3, PFrame));
+    CHECK_EQUAL(34u, secondPass.GetFrameQP(4, PFrame));
+    // Frames of another type in this pass or without a record fall back to the lookahead of uniform frames.
+    CHECK_EQUAL(32u, secondPass.GetFrameQP(2, D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_B_FRAME));
+    CHECK_EQUAL(30u, secondPass.GetFrameQP(5, PFrame));
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "DXQQ";
+    CHECK_THROWS(QPController{ config });
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,235 @@
+#include "pch.h"
+#include "ReferenceFrameTracker.h"
+#include "ReferenceFramesManager.h"
+#include "TestFramework.h"
+
+using namespace DX12VideoEncoding;
+
+namespace {
+
+constexpr uint32_t MaxReferenceFrameCount = 2;
+constexpr uint32_t MaxLongTermReferenceFrameCount = 1;
+
+// Drives the manager the way EncoderH264DX12 does for one frame. Without inter frames in the GOP the manager
+// creates no textures, so the reference bookkeeping runs without a device.
+class ReferenceFramesManagerDriver
+{
+public:
+    ReferenceFramesManagerDriver()
+        : m_manager(nullptr, {}, DXGI_FORMAT_NV12, MaxReferenceFrameCount, MaxLongTermReferenceFrameCount, false)
+    {
+    }
+
+    // l0List - POCs of the references, replaced by their DPB indices as in the encoder.
+    D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264 Prepare(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType,
+        UINT pictureOrderCountNumber, UINT frameNum, std::vector<UINT>& l0List,
+        std::optional<LongTermReferenceMarking> longTermReference = std::nullopt)
+    {
+        D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA_H264 picData = {};
+        picData.FrameType = frameType;
+        picData.PictureOrderCountNumber = pictureOrderCountNumber;
+        picData.FrameDecodingOrderNumber = frameNum;
+        picData.List0ReferenceFramesCount = static_cast<UINT>(l0List.size());
+        picData.pList0ReferenceFrames = l0List.empty() ? nullptr : l0List.data();
+
+        D3D12_VIDEO_ENCODER_PICTURE_CONTROL_CODEC_DATA codecData = { sizeof(picData), {} };
+        codecData.pH264PicData = &picData;
+        m_manager.PrepareForEncodingFrame(codecData, true, longTermReference);
+        m_manager.GetPictureControlCodecData(codecData);
+        return picData;
+    }
+
+    void Encode(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264 frameType, UINT pictureOrderCountNumber, UINT frameNum,
+        std::vector<UINT> l0List = {}, std::optional<LongTermReferenceMarking> longTermReference = std::nullopt)
+    {
+        Prepare(frameType, pictureOrderCountNumber, frameNum, l0List, longTermReference);
+        m_manager.UpdateReferenceFrames();
+    }
+
+    // Descriptors of the DPB as the next P-frame gets them.
+    std::vector<D3D12_VIDEO_ENCODER_REFERENCE_PICTURE_DESCRIPTOR_H264> GetDescriptors(UINT nextFrameNum)
+    {
+        std::vector<UINT> l0List;
+        const auto picData = Prepare(D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME, 0, nextFrameNum, l0List);
+        return { picData.pReferenceFramesReconPictureDescriptors,
+            picData.pReferenceFramesReconPictureDescriptors + picData.ReferenceFramesReconPictureDescriptorsCount };
+    }
+
+private:
+    ReferenceFramesManager m_manager;
+};
+
+constexpr auto IdrFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_IDR_FRAME;
+constexpr auto PFrame = D3D12_VIDEO_ENCODER_FRAME_TYPE_H264_P_FRAME;
+
+// IDR frame and P-frames 1 and 2 fill the DPB of 2 short-term and 1 long-term frames.
+void EncodeFullDPB(ReferenceFramesManagerDriver& driver)
+{
+    driver.Encode(IdrFrame, 0, 0);
+    driver.Encode(PFrame, 1, 1, { 0 });
+    driver.Encode(PFrame, 2, 2, { 1 });
+}
+
+}
+
+TEST(ReferenceFrameTrackerSlidingWindowKeepsLongTerm)
+{
+    ReferenceFrameTracker tracker(MaxReferenceFrameCount, MaxLongTermReferenceFrameCount);
+    tracker.Add(0, {});
+    CHECK_EQUAL(0u, tracker.MarkLongTerm(0));
+    for (uint64_t frame = 1; frame <= 4; ++frame)
+    {
+        tracker.Add(frame, { frame - 1 });
+    }
+
+    CHECK(tracker.GetFrameOrderNumbers() == (std::vector<uint64_t>{ 0, 3, 4 }));
+    CHECK(tracker.IsLongTerm(0));
+    CHECK(tracker.IsShortTerm(4));
+    CHECK(!tracker.IsShortTerm(2));
+}
+
+TEST(ReferenceFrameTrackerLongTermIndexReuse)
+{
+    // Free indices are taken first, then the oldest long-term frame gives up its index.
+    ReferenceFrameTracker tracker(2, 2);
+    tracker.Add(0, {});
+    tracker.Add(1, { 0 });
+    tracker.Add(2, { 1 });
+    CHECK_EQUAL(0u, tracker.MarkLongTerm(0));
+    CHECK_EQUAL(1u, tracker.MarkLongTerm(1));
+    CHECK_EQUAL(0u, tracker.MarkLongTerm(2));
+
+    CHECK(!tracker.IsLongTerm(0) && !tracker.IsShortTerm(0));
+    CHECK(tracker.IsLongTerm(1));
+    CHECK(tracker.IsLongTerm(2));
+}
+
+TEST(ReferenceFrameTrackerInvalidationFallsBackToLongTerm)
+{
+    ReferenceFrameTracker tracker(MaxReferenceFrameCount, MaxLongTermReferenceFrameCount);
+    tracker.Add(0, {});
+    tracker.Add(1, { 0 });
+    tracker.MarkLongTerm(0);
+    tracker.Add(2, { 1 });
+    tracker.Add(3, { 2 });
+
+    // Frame 3 is predicted from the lost frame 2, the long-term frame precedes the loss.
+    tracker.Invalidate(2, 2);
+    CHECK_EQUAL(uint64_t{ 0 }, tracker.GetLastValid().value_or(UINT64_MAX));
+
+    // The next frame predicted from the long-term one is intact again.
+    tracker.Add(4, { 0 });
+    CHECK_EQUAL(uint64_t{ 4 }, tracker.GetLastValid().value_or(UINT64_MAX));
+}
+
+TEST(ReferenceFrameTrackerInvalidationForcesIdr)
+{
+    // Without long-term frames a loss reaching back to the oldest frame leaves nothing to predict from,
+    // the encoder starts the next P-frame as an IDR frame.
+    ReferenceFrameTracker tracker(MaxReferenceFrameCount, 0);
+    tracker.Add(0, {});
+    tracker.Add(1, { 0 });
+    tracker.Add(2, { 1 });
+    tracker.Invalidate(2, 2);
+    CHECK_EQUAL(uint64_t{ 1 }, tracker.GetLastValid().value_or(UINT64_MAX));
+
+    // Frame 0 is evicted, so the loss of it is propagated through frame 1.
+    tracker.Invalidate(0, 0);
+    CHECK(!tracker.GetLastValid().has_value());
+}
+
+TEST(ReferenceFrameTrackerInvalidationByTemporalLayer)
+{
+    ReferenceFrameTracker tracker(3, 0);
+    tracker.Add(0, {}, 0);
+    tracker.Add(1, { 0 }, 1);
+    tracker.Add(2, { 0 }, 0);
+    CHECK_EQUAL(uint64_t{ 2 }, tracker.GetLastValid(1).value_or(UINT64_MAX));
+
+    // The base layer doesn't depend on the lost upper layer frame.
+    tracker.Invalidate(1, 1);
+    CHECK_EQUAL(uint64_t{ 2 }, tracker.GetLastValid().value_or(UINT64_MAX));
+    tracker.Invalidate(2, 2);
+    CHECK_EQUAL(uint64_t{ 0 }, tracker.GetLastValid(1).value_or(UINT64_MAX));
+}
+
+TEST(ReferenceFramesManagerLongTermMarkingInFullDPB)
+{
+    ReferenceFramesManagerDriver driver;
+    EncodeFullDPB(driver);
+
+    // Adaptive marking replaces the sliding window, so the oldest short-term frame is removed by MMCO 1.
+    std::vector<UINT> l0List = { 2 };
+    const auto picData = driver.Prepare(PFrame, 3, 3, l0List, LongTermReferenceMarking{ 1, 0 });
+    CHECK_EQUAL(1u, static_cast<uint32_t>(picData.adaptive_ref_pic_marking_mode_flag));
+    CHECK_EQUAL(3u, picData.RefPicMarkingOperationsCommandsCount);
+    const auto* operations = picData.pRefPicMarkingOperationsCommands;
+    CHECK_EQUAL(1u, static_cast<uint32_t>(operations[0].memory_management_control_operation));
+    CHECK_EQUAL(2u, operations[0].difference_of_pic_nums_minus1); // frame_num 0
+    CHECK_EQUAL(4u, static_cast<uint32_t>(operations[1].memory_management_control_operation));
+    CHECK_EQUAL(MaxLongTermReferenceFrameCount, operations[1].max_long_term_frame_idx_plus1);
+    CHECK_EQUAL(3u, static_cast<uint32_t>(operations[2].memory_management_control_operation));
+    CHECK_EQUAL(1u, operations[2].difference_of_pic_nums_minus1); // frame_num 1
+    CHECK_EQUAL(0u, operations[2].long_term_frame_idx);
+}
+
+TEST(ReferenceFramesManagerLongTermMarkingWithFreeSlot)
+{
+    ReferenceFramesManagerDriver driver;
+    driver.Encode(IdrFrame, 0, 0);
+    driver.Encode(PFrame, 1, 1, { 0 });
+
+    std::vector<UINT> l0List = { 1 };
+    const auto picData = driver.Prepare(PFrame, 2, 2, l0List, LongTermReferenceMarking{ 0, 0 });
+    CHECK_EQUAL(2u, picData.RefPicMarkingOperationsCommandsCount);
+    CHECK_EQUAL(4u, static_cast<uint32_t>(picData.pRefPicMarkingOperationsCommands[0].memory_management_control_operation));
+    CHECK_EQUAL(3u, static_cast<uint32_t>(picData.pRefPicMarkingOperationsCommands[1].memory_management_control_operation));
+    CHECK_EQUAL(1u, picData.pRefPicMarkingOperationsCommands[1].difference_of_pic_nums_minus1);
+}
+
+TEST(ReferenceFramesManagerLongTermFrameOrder)
+{
+    // Short-term frames from the last decoded one, then the long-term ones by index.
+    ReferenceFramesManagerDriver driver;
+    EncodeFullDPB(driver);
+    driver.Encode(PFrame, 3, 3, { 2 }, LongTermReferenceMarking{ 1, 0 });
+
+    const auto descriptors = driver.GetDescriptors(4);
+    CHECK_EQUAL(size_t{ 3 }, descriptors.size());
+    CHECK_EQUAL(3u, descriptors[0].PictureOrderCountNumber);
+    CHECK_EQUAL(2u, descriptors[1].PictureOrderCountNumber);
+    CHECK_EQUAL(1u, descriptors[2].PictureOrderCountNumber);
+    CHECK(!descriptors[0].IsLongTermReference && !descriptors[1].IsLongTermReference);
+    CHECK(descriptors[2].IsLongTermReference);
+    CHECK_EQUAL(0u, descriptors[2].LongTermPictureIdx);
+}
+
+TEST(ReferenceFramesManagerListModifications)
+{
+    ReferenceFramesManagerDriver driver;
+    EncodeFullDPB(driver);
+    driver.Encode(PFrame, 3, 3, { 2 }, LongTermReferenceMarking{ 1, 0 });
+
+    // The last decoded frame first is the default order.
+    std::vector<UINT> l0List = { 3 };
+    auto picData = driver.Prepare(PFrame, 4, 4, l0List);
+    CHECK_EQUAL(0u, picData.List0RefPicModificationsCount);
+
+    // Long-term references are moved by their index.
+    l0List = { 1 };
+    picData = driver.Prepare(PFrame, 4, 4, l0List);
+    CHECK_EQUAL(1u, picData.List0RefPicModificationsCount);
+    CHECK_EQUAL(2u, static_cast<uint32_t>(picData.pList0RefPicModifications[0].modification_of_pic_nums_idc));
+    CHECK_EQUAL(0u, picData.pList0RefPicModifications[0].long_term_pic_num);
+
+    // Short-term references are differences from the current frame_num, then from the previous entry.
+    l0List = { 2, 3, 1 };
+    picData = driver.Prepare(PFrame, 4, 4, l0List);
+    CHECK_EQUAL(3u, picData.List0RefPicModificationsCount);
+    const auto* modifications = picData.pList0RefPicModifications;
+    CHECK_EQUAL(0u, static_cast<uint32_t>(modifications[0].modification_of_pic_nums_idc)); // Subtract
+    CHECK_EQUAL(1u, modifications[0].abs_diff_pic_num_minus1);                            // 4 - 2
+    CHECK_EQUAL(1u, static_cast<uint32_t>(modifications[1].modification_of_pic_nums_idc)); // Add
+    CHECK_EQUAL(0u, modifications[1].abs_diff_pic_num_minus1);                            // 3 - 2
+    CHECK_EQUAL(2u, static_cast<uint32_t>(modifications[2].modification_of_pic_nums_idc));
+}
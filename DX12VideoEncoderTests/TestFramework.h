@@ -0,0 +1,78 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Minimal self-registering test runner. The tests cover the encoder logic which doesn't need a D3D12 device,
+// so they run on any machine building the solution.
+namespace DX12VideoEncoding::Tests
+{
+
+struct TestCase
+{
+    const char* name;
+    void (*function)();
+};
+
+std::vector<TestCase>& GetTestCases();
+
+struct TestRegistration
+{
+    TestRegistration(const char* name, void (*function)())
+    {
+        GetTestCases().push_back(TestCase{ name, function });
+    }
+};
+
+class TestFailure : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] void Fail(const char* file, int line, const std::string& message);
+
+template <typename T>
+std::string ToString(const T& value)
+{
+    if constexpr (std::is_enum_v<T>)
+        return std::to_string(static_cast<std::underlying_type_t<T>>(value));
+    else if constexpr (std::is_arithmetic_v<T>)
+        return std::to_string(value);
+    else
+        return "?";
+}
+
+template <typename TExpected, typename TActual>
+void CheckEqual(const TExpected& expected, const TActual& actual, const char* expression, const char* file, int line)
+{
+    if (!(expected == actual))
+    {
+        Fail(file, line, std::string(expression) + ": expected " + ToString(expected) + ", got " + ToString(actual));
+    }
+}
+
+}
+
+#define TEST(name) \
+    static void name(); \
+    static const ::DX12VideoEncoding::Tests::TestRegistration name##Registration(#name, &name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+            ::DX12VideoEncoding::Tests::Fail(__FILE__, __LINE__, #condition); \
+    } while (false)
+
+#define CHECK_EQUAL(expected, actual) \
+    ::DX12VideoEncoding::Tests::CheckEqual((expected), (actual), #actual, __FILE__, __LINE__)
+
+#define CHECK_THROWS(statement) \
+    do { \
+        bool thrown_ = false; \
+        try { statement; } catch (const std::exception&) { thrown_ = true; } \
+        if (!thrown_) \
+            ::DX12VideoEncoding::Tests::Fail(__FILE__, __LINE__, #statement " didn't throw"); \
+    } while (false)
@@ -0,0 +1,50 @@
+#include "TestFramework.h"
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+namespace DX12VideoEncoding::Tests
+{
+
+std::vector<TestCase>& GetTestCases()
+{
+    static std::vector<TestCase> testCases;
+    return testCases;
+}
+
+void Fail(const char* file, int line, const std::string& message)
+{
+    throw TestFailure(std::string(file) + "(" + std::to_string(line) + "): " + message);
+}
+
+}
+
+// Runs all tests or the ones containing the first argument in the name, returns the number of failed tests.
+int main(int argc, char** argv)
+{
+    using namespace DX12VideoEncoding::Tests;
+
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+    int passedCount = 0;
+    int failedCount = 0;
+    for (const TestCase& testCase : GetTestCases())
+    {
+        if (filter != nullptr && std::strstr(testCase.name, filter) == nullptr)
+            continue;
+
+        try
+        {
+            testCase.function();
+            ++passedCount;
+            std::cout << "[  PASSED  ] " << testCase.name << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            ++failedCount;
+            std::cout << "[  FAILED  ] " << testCase.name << ": " << e.what() << std::endl;
+        }
+    }
+
+    std::cout << passedCount << " passed, " << failedCount << " failed" << std::endl;
+    return failedCount;
+}
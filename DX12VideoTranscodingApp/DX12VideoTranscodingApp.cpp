@@ -1,9 +1,10 @@
 #include "EncoderAPI.h"
+#include "WorkerPool.h"
 #include "Utils.h"
 
 #include "StreamReader.h"
 #include "StreamWriter.h"
-#include "FfmpegFrameData.h"
+#include "FfmpegFrameDataPool.h"
 
 #include <d3d12.h>
 #include <dxgi1_6.h>
@@ -81,7 +82,7 @@ int main(int argc, char** argv)
 {
     if (argc < 3)
     {
-        std::cout << "Set input and output file paths" << std::endl;
+        std::cout << "Set input and output file paths, optionally followed by --low-latency" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -108,8 +109,7 @@ int main(int argc, char** argv)
         auto streamInfo = streamReader.OpenInputFile(inputFilename);
 
         StreamWriter streamWriter;
-        streamWriter.OpenOutputFile(outputFilename, streamInfo.width, streamInfo.height, streamInfo.frameRate);
-        const double frameDurationMs = 1000.0 * double(streamInfo.frameRate.den) / streamInfo.frameRate.num;
+        const int64_t frameDuration = av_rescale_q(1, av_inv_q(streamInfo.frameRate), streamInfo.timeBase);
 
         // I B B P I
         uint32_t keyFrameInterval = 4;
@@ -161,25 +161,79 @@ int main(int argc, char** argv)
         //uint32_t keyFrameInterval = 0;
         //uint32_t bFramesCount = 0;
 
-        auto encoder = CreateH264Encoder(dx12Device,
-            EncoderConfiguration{
+        // Converts decoded frames straight into the encoder input buffers.
+        auto workerPool = std::make_shared<WorkerPool>();
+
+        // Frames recorded to one command list and submitted at once.
+        const uint32_t framesPerSubmission = 4;
+
+        EncoderConfiguration encoderConfiguration{
             .width = static_cast<uint32_t>(streamInfo.width),
             .height = static_cast<uint32_t>(streamInfo.height),
+            // 10-bit sources are encoded without down-conversion if the device supports High10 profile.
+            .inputFormat = streamInfo.bitDepth > 8 ? DXGI_FORMAT_P010 : DXGI_FORMAT_NV12,
             .fps = {
                 .numerator = static_cast<uint32_t>(streamInfo.frameRate.num),
                 .denominator = static_cast<uint32_t>(streamInfo.frameRate.den)
             },
+            // Source timestamps are passed through.
+            .timeBase = {
+                .numerator = static_cast<uint32_t>(streamInfo.timeBase.num),
+                .denominator = static_cast<uint32_t>(streamInfo.timeBase.den)
+            },
+            .sampleAspectRatio = {
+                .width = static_cast<uint32_t>(streamInfo.sampleAspectRatio.num),
+                .height = static_cast<uint32_t>(streamInfo.sampleAspectRatio.den)
+            },
+            // Frames are converted to limited range NV12 or P010, other colour properties are kept.
+            .colorDescription = {
+                .primaries = static_cast<uint8_t>(streamInfo.colorPrimaries),
+                .transferCharacteristics = static_cast<uint8_t>(streamInfo.colorTransfer),
+                .matrixCoefficients = static_cast<uint8_t>(streamInfo.colorSpace),
+            },
             .keyFrameInterval = keyFrameInterval,
             .bFramesCount = bFramesCount,
             .maxReferenceFrameCount = 2,
-            });
+            .framesPerSubmission = framesPerSubmission,
+            .workerPool = workerPool,
+        };
 
-        // This is a fix for FFmpeg error "pts < dts" for B-frames.
-        const uint64_t ptsOffset = bFramesCount;
+        // Interactive streaming: no B-frames and batching, the GOP above keeps its key frame interval.
+        if (argc > 3 && std::string(argv[3]) == "--low-latency")
+        {
+            ApplyLowLatencyPreset(encoderConfiguration);
+        }
 
+        // Two batches are kept in flight, so GPU encodes one while the next is recorded. Low-latency mode waits
+        // for each frame right after starting it.
+        const uint32_t maxStartedFrameCount =
+            encoderConfiguration.lowLatency ? 1 : 2 * encoderConfiguration.framesPerSubmission;
+
+        std::unique_ptr<IEncoder> encoder;
+        try
+        {
+            encoder = CreateH264Encoder(dx12Device, encoderConfiguration);
+        }
+        catch (const std::exception& ex)
+        {
+            if (encoderConfiguration.inputFormat == DXGI_FORMAT_NV12)
+                throw;
+
+            LogMessage(LogLevel::E_WARNING, std::string("10-bit encoding is not available, using 8-bit: ") + ex.what());
+            encoderConfiguration.inputFormat = DXGI_FORMAT_NV12;
+            encoder = CreateH264Encoder(dx12Device, encoderConfiguration);
+        }
+        const AVPixelFormat encoderPixelFormat =
+            encoderConfiguration.inputFormat == DXGI_FORMAT_P010 ? AV_PIX_FMT_P010LE : AV_PIX_FMT_NV12;
+
+        streamWriter.OpenOutputFile(outputFilename, streamInfo.width, streamInfo.height, streamInfo.frameRate,
+            streamInfo.timeBase, encoderPixelFormat);
 
         EncodedFrame encodedFrame;
+        uint32_t startedFrameCount = 0;
         bool finishedReading = false;
+        // Wrappers of the decoded frames are reused once the encoder releases them.
+        FfmpegFrameDataPool frameDataPool;
         std::shared_ptr<FfmpegFrameData> frameData;
         std::exception_ptr exceptionPtr = nullptr;
 
@@ -191,9 +245,9 @@ int main(int argc, char** argv)
                 {
                     readingSemaphore.acquire();
                     assert(!frameData);
-                    frameData = FfmpegFrameData::Create(frame);
+                    frameData = frameDataPool.Create(frame);
                     writingSemaphore.release();
-                });
+                }, encoderPixelFormat);
 
                 readingSemaphore.acquire();
                 finishedReading = true;
@@ -227,23 +281,37 @@ int main(int argc, char** argv)
                 frameData.reset();
             }
 
-            while (!terminated && encoder->StartEncodingPushedFrame())
+            // Start up to two batches of frames before waiting for the first of them, all the rest on flush.
+            while (!terminated)
             {
+                if (encoder->StartEncodingPushedFrame())
+                {
+                    if (++startedFrameCount < maxStartedFrameCount)
+                        continue;
+                }
+                else if (!finishedReading || startedFrameCount == 0)
+                {
+                    break;
+                }
+
                 if (!encoder->WaitForEncodedFrame(encodedFrame))
                     break;
+                --startedFrameCount;
 
                 streamWriter.WriteVideoPacket(
                     encodedFrame.encodedData.data(),
                     encodedFrame.encodedData.size(),
                     encodedFrame.isKeyFrame,
-                    static_cast<int64_t>((encodedFrame.pictureOrderCountNumber + ptsOffset) * frameDurationMs),
-                    static_cast<int64_t>(encodedFrame.decodingOrderNumber * frameDurationMs),
-                    static_cast<int64_t>(frameDurationMs));
+                    encodedFrame.timestamp,
+                    encodedFrame.decodingTimestamp,
+                    frameDuration);
             
                 LogMessage(LogLevel::E_INFO, "Packet written: "
                     + std::string(encodedFrame.isKeyFrame ? "key" : "non-key")
                     + ", pic order " + std::to_string(encodedFrame.pictureOrderCountNumber)
-                    + ", dec order " + std::to_string(encodedFrame.decodingOrderNumber));
+                    + ", dec order " + std::to_string(encodedFrame.decodingOrderNumber)
+                    + ", slices " + std::to_string(encodedFrame.slices.size())
+                    + ", latency " + std::to_string(encodedFrame.latency.total.count()) + " us");
             }
             readingSemaphore.release();
 
@@ -256,6 +324,14 @@ int main(int argc, char** argv)
             std::rethrow_exception(exceptionPtr);
 
         streamWriter.Finalize();
+
+        const EncoderStatistics statistics = encoder->GetStatistics();
+        LogMessage(LogLevel::E_INFO, "Frames encoded: " + std::to_string(statistics.encodedFrameCount)
+            + ", bytes: " + std::to_string(statistics.encodedBytes)
+            + ", average latency: " + std::to_string(statistics.averageLatency.count()) + " us"
+            + ", max latency: " + std::to_string(statistics.maxLatency.count()) + " us");
+        LogMessage(LogLevel::E_INFO, "Frame wrappers allocated: " + std::to_string(frameDataPool.GetAllocatedFrameCount())
+            + ", control blocks allocated: " + std::to_string(frameDataPool.GetAllocatedBlockCount()));
         return EXIT_SUCCESS;
     }
     catch (const std::exception& ex)
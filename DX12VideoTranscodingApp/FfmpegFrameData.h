@@ -1,6 +1,8 @@
 #pragma once
 #include "EncoderAPI.h"
+#include "PixelFormatConverter.h"
 #include "FFmpegHelpers.h"
+#include <optional>
 #include <stdexcept>
 
 extern "C"
@@ -8,10 +10,42 @@ extern "C"
 #include <libavcodec/avcodec.h>
 }
 
+// Formats converted to NV12 by the encoder library, others are converted by libavfilter.
+inline std::optional<DX12VideoEncoding::PixelFormat> ToEncoderPixelFormat(int format)
+{
+    using DX12VideoEncoding::PixelFormat;
+    switch (format)
+    {
+    case AV_PIX_FMT_NV12: return PixelFormat::NV12;
+    case AV_PIX_FMT_YUV420P: return PixelFormat::YUV420P;
+    case AV_PIX_FMT_YUVJ420P: return PixelFormat::YUVJ420P;
+    case AV_PIX_FMT_YUV422P: return PixelFormat::YUV422P;
+    case AV_PIX_FMT_P010LE: return PixelFormat::P010;
+    case AV_PIX_FMT_BGRA: return PixelFormat::BGRA;
+    case AV_PIX_FMT_YUV420P10LE: return PixelFormat::YUV420P10;
+    default: return std::nullopt;
+    }
+}
+
+inline DXGI_FORMAT ToDxgiFormat(AVPixelFormat format)
+{
+    return format == AV_PIX_FMT_P010LE ? DXGI_FORMAT_P010 : DXGI_FORMAT_NV12;
+}
+
+// Frames converted by the encoder library don't need the libavfilter conversion to the encoder format.
+inline bool IsConvertedByEncoder(int format, AVPixelFormat encoderFormat)
+{
+    const auto pixelFormat = ToEncoderPixelFormat(format);
+    return pixelFormat.has_value()
+        && DX12VideoEncoding::IsConversionSupported(*pixelFormat, ToDxgiFormat(encoderFormat));
+}
+
 // This is a wrapper around AVFrame that increases ref counter
 // to keep the frame alive while before encoding starts.
 class FfmpegFrameData : public DX12VideoEncoding::IRawFrameData
 {
+    friend class FfmpegFrameDataPool;
+
 private:
     FfmpegFrameData()
         : m_frame(av_frame_alloc())
@@ -41,32 +75,35 @@ public:
         av_frame_free(&m_frame);
     }
 
-    void* GetY() const override
-    {
-        return m_frame->data[0];
-    }
-    void* GetUV() const override
+    // The planes are described as decoded, the encoder converts them to its input format.
+    DX12VideoEncoding::FrameDescriptor GetDescriptor() const override
     {
-        return m_frame->data[1];
-    }
-    size_t GetLinesizeY() const override
-    {
-        return static_cast<size_t>(m_frame->linesize[0]);
-    }
-    size_t GetLinesizeUV() const override
-    {
-        return static_cast<size_t>(m_frame->linesize[1]);
-    }
-    uint32_t GetWidth() const override
-    {
-        return m_frame->width;
-    }
-    uint32_t GetHeight() const override
-    {
-        return m_frame->height;
+        const auto format = ToEncoderPixelFormat(m_frame->format);
+        if (!format.has_value())
+        {
+            throw std::runtime_error("Unsupported frame format: " + std::to_string(m_frame->format));
+        }
+
+        DX12VideoEncoding::FrameDescriptor descriptor{
+            .format = *format,
+            .width = static_cast<uint32_t>(m_frame->width),
+            .height = static_cast<uint32_t>(m_frame->height),
+            .planeCount = DX12VideoEncoding::GetPlaneCount(*format),
+            .timestamp = m_frame->pts == AV_NOPTS_VALUE ? DX12VideoEncoding::NoTimestamp : m_frame->pts,
+        };
+        for (uint32_t plane = 0; plane < descriptor.planeCount; ++plane)
+        {
+            descriptor.planes[plane] = {
+                .data = m_frame->data[plane],
+                .pitch = static_cast<size_t>(m_frame->linesize[plane]),
+                .height = DX12VideoEncoding::GetPlaneHeight(*format, plane, descriptor.height),
+            };
+        }
+        return descriptor;
     }
 
 private:
     AVFrame* m_frame;
+    // Link in the free list of FfmpegFrameDataPool.
+    FfmpegFrameData* m_nextFree = nullptr;
 };
-
@@ -0,0 +1,171 @@
+#pragma once
+#include "FfmpegFrameData.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+// Lock-free stack linked through a member of the nodes. Push is allowed from any thread, pop from one
+// thread only: a node can't be popped and pushed back while the popping thread holds it, so there is no ABA.
+template<class TNode, TNode* TNode::*Next>
+class SingleConsumerStack
+{
+public:
+    void Push(TNode* node)
+    {
+        TNode* head = m_head.load(std::memory_order_relaxed);
+        do
+        {
+            node->*Next = head;
+        } while (!m_head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    TNode* Pop()
+    {
+        TNode* head = m_head.load(std::memory_order_acquire);
+        while (head != nullptr
+            && !m_head.compare_exchange_weak(head, head->*Next, std::memory_order_acquire, std::memory_order_acquire))
+        {
+        }
+        return head;
+    }
+
+private:
+    std::atomic<TNode*> m_head{};
+};
+
+// Recycles FfmpegFrameData wrappers with their AVFrame shells and the shared_ptr control blocks,
+// so a frame handed from the decoder to the encoder costs only av_frame_ref() once the pool is warm.
+// Frames are created on one thread and can be released on any thread, also after the pool is destroyed.
+class FfmpegFrameDataPool
+{
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // Large enough for a control block holding the deleter and the allocator below.
+    static constexpr size_t BlockSize = 128;
+
+    struct State
+    {
+        SingleConsumerStack<FfmpegFrameData, &FfmpegFrameData::m_nextFree> freeFrames;
+        SingleConsumerStack<FreeBlock, &FreeBlock::next> freeBlocks;
+        std::atomic<size_t> allocatedFrameCount{};
+        std::atomic<size_t> allocatedBlockCount{};
+
+        ~State()
+        {
+            while (FfmpegFrameData* frameData = freeFrames.Pop())
+            {
+                delete frameData;
+            }
+            while (FreeBlock* block = freeBlocks.Pop())
+            {
+                ::operator delete(block, std::align_val_t{ alignof(std::max_align_t) });
+            }
+        }
+    };
+
+    // Returns the wrapper to the pool instead of deleting it, the AVFrame shell is kept.
+    struct Recycler
+    {
+        State* state;
+
+        void operator()(FfmpegFrameData* frameData) const
+        {
+            av_frame_unref(frameData->m_frame);
+            state->freeFrames.Push(frameData);
+        }
+    };
+
+    // Allocates the control blocks, holds the pool state alive until the last control block is returned.
+    template<class T>
+    struct BlockAllocator
+    {
+        using value_type = T;
+
+        std::shared_ptr<State> state;
+
+        explicit BlockAllocator(std::shared_ptr<State> state)
+            : state(std::move(state))
+        {
+        }
+        template<class U>
+        BlockAllocator(const BlockAllocator<U>& other)
+            : state(other.state)
+        {
+        }
+
+        T* allocate(size_t count)
+        {
+            if (!IsPooled(count))
+                return std::allocator<T>().allocate(count);
+
+            FreeBlock* block = state->freeBlocks.Pop();
+            if (block == nullptr)
+            {
+                block = static_cast<FreeBlock*>(::operator new(BlockSize, std::align_val_t{ alignof(std::max_align_t) }));
+                state->allocatedBlockCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            return reinterpret_cast<T*>(block);
+        }
+
+        void deallocate(T* pointer, size_t count)
+        {
+            if (!IsPooled(count))
+            {
+                std::allocator<T>().deallocate(pointer, count);
+                return;
+            }
+            state->freeBlocks.Push(reinterpret_cast<FreeBlock*>(pointer));
+        }
+
+        static constexpr bool IsPooled(size_t count)
+        {
+            return count * sizeof(T) <= BlockSize && alignof(T) <= alignof(std::max_align_t);
+        }
+
+        template<class U>
+        bool operator==(const BlockAllocator<U>& other) const { return state == other.state; }
+    };
+
+public:
+    FfmpegFrameDataPool()
+        : m_state(std::make_shared<State>())
+    {
+    }
+
+    FfmpegFrameDataPool(const FfmpegFrameDataPool&) = delete;
+    FfmpegFrameDataPool& operator=(const FfmpegFrameDataPool&) = delete;
+
+    // Should be called from one thread at a time.
+    std::shared_ptr<FfmpegFrameData> Create(const AVFrame& frame)
+    {
+        FfmpegFrameData* frameData = m_state->freeFrames.Pop();
+        if (frameData == nullptr)
+        {
+            frameData = new FfmpegFrameData();
+            m_state->allocatedFrameCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        try
+        {
+            frameData->AddRef(frame);
+        }
+        catch (...)
+        {
+            m_state->freeFrames.Push(frameData);
+            throw;
+        }
+        return std::shared_ptr<FfmpegFrameData>(frameData, Recycler{ m_state.get() }, BlockAllocator<FfmpegFrameData>(m_state));
+    }
+
+    // Allocation counters, stay at the number of frames in flight when the frames are recycled.
+    size_t GetAllocatedFrameCount() const { return m_state->allocatedFrameCount.load(std::memory_order_relaxed); }
+    size_t GetAllocatedBlockCount() const { return m_state->allocatedBlockCount.load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<State> m_state;
+};
@@ -1,6 +1,8 @@
 #include "StreamReader.h"
 #include "FFmpegHelpers.h"
+#include "FfmpegFrameData.h"
 #include <stdexcept>
+#include <string>
 
 StreamReader::~StreamReader()
 {
@@ -15,7 +17,7 @@ StreamReader::~StreamReader()
     avfilter_inout_free(&outputs);
 }
 
-void StreamReader::ReadAllFrames(const TFrameCallback& frameCallback)
+void StreamReader::ReadAllFrames(const TFrameCallback& frameCallback, AVPixelFormat outputFormat)
 {
     if (!frame || !filt_frame || !packet)
     {
@@ -31,9 +33,6 @@ void StreamReader::ReadAllFrames(const TFrameCallback& frameCallback)
 
     int ret;
 
-    const char* filter_descr = "format=pix_fmts=nv12";
-    InitFilters(filter_descr);
-
     /* read all packets */
     while (1)
     {
@@ -62,6 +61,20 @@ void StreamReader::ReadAllFrames(const TFrameCallback& frameCallback)
 
                 frame->pts = frame->best_effort_timestamp;
 
+                /* frames of the formats converted by the encoder skip the filtergraph */
+                if (!buffersrc_ctx && IsConvertedByEncoder(frame->format, outputFormat))
+                {
+                    DisplayFrame(frame, fmt_ctx->streams[video_stream_index]->time_base);
+                    av_frame_unref(frame);
+                    continue;
+                }
+
+                if (!buffersrc_ctx)
+                {
+                    const std::string filter_descr = std::string("format=pix_fmts=") + av_get_pix_fmt_name(outputFormat);
+                    InitFilters(filter_descr.c_str());
+                }
+
                 /* push the decoded frame into the filtergraph */
                 if (av_buffersrc_add_frame_flags(buffersrc_ctx, frame, AV_BUFFERSRC_FLAG_KEEP_REF) < 0)
                 {
@@ -85,7 +98,7 @@ void StreamReader::ReadAllFrames(const TFrameCallback& frameCallback)
         }
         av_packet_unref(packet);
     }
-    if (ret == AVERROR_EOF)
+    if (ret == AVERROR_EOF && buffersrc_ctx)
     {
         /* signal EOF to the filtergraph */
         ret = av_buffersrc_add_frame_flags(buffersrc_ctx, nullptr, 0);
@@ -149,10 +162,18 @@ StreamReader::VideoStreamInfo StreamReader::OpenInputFile(const char* filename)
     if (frameRate.den == 0)
         throw std::runtime_error("Cannot guess framerate");
 
+    const AVPixFmtDescriptor* pixelFormatDesc = av_pix_fmt_desc_get(dec_ctx->pix_fmt);
+
     VideoStreamInfo result{
         .frameRate = frameRate,
+        .timeBase = fmt_ctx->streams[video_stream_index]->time_base,
         .width = dec_ctx->width,
         .height = dec_ctx->height,
+        .bitDepth = pixelFormatDesc ? pixelFormatDesc->comp[0].depth : 8,
+        .sampleAspectRatio = dec_ctx->sample_aspect_ratio,
+        .colorPrimaries = dec_ctx->color_primaries,
+        .colorTransfer = dec_ctx->color_trc,
+        .colorSpace = dec_ctx->colorspace,
     };
     return result;
 }
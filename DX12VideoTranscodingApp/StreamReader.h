@@ -10,6 +10,7 @@ extern "C"
 #include <libavfilter/buffersrc.h>
 #include <libavutil/mem.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 }
 
 
@@ -23,11 +24,18 @@ public:
     struct VideoStreamInfo
     {
         AVRational frameRate{};
+        AVRational timeBase{}; // of the frame timestamps
         int width{};
         int height{};
+        int bitDepth{};
+        AVRational sampleAspectRatio{}; // 0/1 - unknown
+        AVColorPrimaries colorPrimaries{ AVCOL_PRI_UNSPECIFIED };
+        AVColorTransferCharacteristic colorTransfer{ AVCOL_TRC_UNSPECIFIED };
+        AVColorSpace colorSpace{ AVCOL_SPC_UNSPECIFIED };
     };
     VideoStreamInfo OpenInputFile(const char* filename);
-    void ReadAllFrames(const TFrameCallback& frameCallback);
+    // Frames are passed in the output format, or in a format the encoder converts to it itself.
+    void ReadAllFrames(const TFrameCallback& frameCallback, AVPixelFormat outputFormat = AV_PIX_FMT_NV12);
 
 private:
     void DisplayFrame(const AVFrame* frame, AVRational time_base);
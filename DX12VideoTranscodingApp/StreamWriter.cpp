@@ -11,9 +11,11 @@ StreamWriter::~StreamWriter()
     avformat_free_context(ofmt_ctx);
 }
 
-void StreamWriter::OpenOutputFile(const char* outFilename, int width, int height, AVRational fps)
+void StreamWriter::OpenOutputFile(const char* outFilename, int width, int height, AVRational fps, AVRational timeBase,
+    AVPixelFormat pixelFormat)
 {
     m_targetFramerate = fps;
+    m_timeBase = timeBase;
 
     if (!pkt)
     {
@@ -42,11 +44,12 @@ void StreamWriter::OpenOutputFile(const char* outFilename, int width, int height
     out_stream->codecpar->codec_tag = 0;
     out_stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
     out_stream->codecpar->codec_id = AV_CODEC_ID_H264;
-    out_stream->codecpar->format = AV_PIX_FMT_NV12;
+    out_stream->codecpar->format = pixelFormat;
     out_stream->codecpar->width = width;
     out_stream->codecpar->height = height;
     out_stream->index = 0;
-    //out_stream->time_base = m_targetFramerate;
+    // A hint only, the muxer may choose another time base.
+    out_stream->time_base = m_timeBase;
 
     av_dump_format(ofmt_ctx, 0, outFilename, 1);
 
@@ -83,7 +86,7 @@ void StreamWriter::WriteVideoPacket(
     pkt->duration = duration;
 
     const AVRational &streamTimeBase = ofmt_ctx->streams[0]->time_base;
-    av_packet_rescale_ts(pkt, AVRational{ 1, 1000 }, streamTimeBase);
+    av_packet_rescale_ts(pkt, m_timeBase, streamTimeBase);
 
     pkt->flags = 0;
     if (isKeyFrame)
@@ -13,7 +13,9 @@ class StreamWriter
 public:
     ~StreamWriter();
 
-    void OpenOutputFile(const char* outFilename, int width, int height, AVRational fps);
+    // Packet timestamps are given in timeBase units.
+    void OpenOutputFile(const char* outFilename, int width, int height, AVRational fps, AVRational timeBase,
+        AVPixelFormat pixelFormat = AV_PIX_FMT_NV12);
     void WriteVideoPacket(
         const uint8_t* data,
         size_t size,
@@ -29,5 +31,6 @@ private:
     AVFormatContext* ofmt_ctx = nullptr;
     AVPacket* pkt = av_packet_alloc();
     AVRational m_targetFramerate = {};
+    AVRational m_timeBase = {};
 };
 